@@ -9,6 +9,10 @@ After=network.target
 [Service]
 ExecStart=$(pwd)/bin/studer232-to-mqtt
 WorkingDirectory=$(pwd)/bin
+ExecReload=/bin/kill -HUP \$MAINPID
+# the process started by upgrade-service.sh becomes the main process (MAINPID=, confirmed by
+# systemd before the old process exits; a failed handover hands it back)
+NotifyAccess=all
 Restart=always
 User=${SUDO_USER}
 StandardOutput=journal
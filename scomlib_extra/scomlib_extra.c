@@ -1,11 +1,12 @@
 #include "scomlib_extra.h"
 #include "../scomlib/scom_property.h"
 
+#include <stdio.h>
 #include <string.h>
 
 // allocate memory on the heap
 // normally only a single serial port is used so there is no need to use multiple buffers
-static char g_buffer[256];
+static char g_buffer[SCOMX_MAX_FRAME_SIZE];
 static scom_frame_t g_frame;
 static scom_property_t g_property;
 
@@ -58,6 +59,19 @@ static scomx_enc_result_t encode_request_frame()
     return res;
 }
 
+int scomx_is_multicast(scomx_dest_t dst_addr)
+{
+    switch (dst_addr) {
+    case SCOMX_DEST_XTM_ALL:
+    case SCOMX_DEST_MPPT_ALL:
+    case SCOMX_DEST_BSP_ALL:
+    case SCOMX_DEST_VS_ALL:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
 scomx_enc_result_t scomx_encode_read_property(uint32_t dst_addr, scom_object_type_t object_type, uint32_t object_id, uint16_t property_id)
 {
     reset_frame();
@@ -74,6 +88,52 @@ scomx_enc_result_t scomx_encode_read_property(uint32_t dst_addr, scom_object_typ
     return encode_request_frame();
 }
 
+scomx_enc_result_t scomx_encode_read_property_data(uint32_t dst_addr, scom_object_type_t object_type, uint32_t object_id, uint16_t property_id,
+                                                   const char *const data, size_t data_len)
+{
+    reset_frame();
+
+    g_frame.src_addr = 1; // our address
+    g_frame.dst_addr = dst_addr;
+
+    g_property.object_type = object_type;
+    g_property.object_id = object_id;
+    g_property.property_id = property_id;
+
+    scom_encode_read_property(&g_property);
+
+    // ensure data fits into the buffer
+    if (data_len > g_property.value_buffer_size - 2) {
+        scomx_enc_result_t res;
+        memset(&res, 0, sizeof(res));
+        res.error = SCOM_ERROR_STACK_BUFFER_TOO_SMALL;
+        return res;
+    }
+
+    // scom_encode_read_property() always encodes an empty value - append the data
+    memcpy(g_property.value_buffer, data, data_len);
+    g_property.value_length = data_len;
+    g_frame.data_length += data_len;
+
+    return encode_request_frame();
+}
+
+scomx_enc_result_t scomx_encode_datalog_transfer(uint32_t object_id, scomx_datalog_property_t property_id, const char *filename)
+{
+    char name[32];
+    size_t len = 0;
+
+    if (filename && property_id == SCOMX_PROP_SD_START) {
+        // the name is terminated by a line feed like in the directory listing (5.7.2)
+        len = (size_t)snprintf(name, sizeof(name), "%s\n", filename);
+        if (len >= sizeof(name)) {
+            len = sizeof(name) - 1;
+        }
+    }
+
+    return scomx_encode_read_property_data(SCOMX_DEST_232(0), SCOM_DATALOG_TRANSFER_OBJECT_TYPE, object_id, property_id, name, len);
+}
+
 scomx_enc_result_t scomx_encode_write_property(uint32_t dst_addr, scom_object_type_t object_type, uint32_t object_id, uint16_t property_id, const char *const data,
                                                size_t data_len)
 {
@@ -104,6 +164,11 @@ scomx_enc_result_t scomx_encode_write_property(uint32_t dst_addr, scom_object_ty
     return encode_request_frame();
 }
 
+scomx_enc_result_t scomx_encode_read_message(uint32_t index)
+{
+    return scomx_encode_read_property(SCOMX_DEST_232(0), SCOM_MESSAGE_OBJECT_TYPE, index, SCOMX_PROP_MESSAGE);
+}
+
 scomx_enc_result_t scomx_encode_read_user_info_value(scomx_dest_t dst_addr, scomx_user_info_object_t object_id)
 {
     return scomx_encode_read_property(dst_addr, SCOM_USER_INFO_OBJECT_TYPE, object_id, SCOMX_PROP_USER_INFO_VALUE);
@@ -212,6 +277,7 @@ scomx_header_dec_result_t scomx_decode_frame_header(const char *const data, size
 
     // request reading the data part
     res.length_to_read = scom_frame_length(&g_frame) - SCOM_FRAME_HEADER_SIZE;
+    res.frame_flags = g_frame.frame_flags;
 
     return res;
 }
@@ -237,6 +303,7 @@ scomx_dec_result_t scomx_decode_frame(const char *const data, size_t data_len)
     res.error = g_frame.last_error;
 
     res.src_addr = g_frame.src_addr;
+    res.frame_flags = g_frame.frame_flags;
     res.service_id = g_frame.service_id;
 
     // reuse the structure
@@ -292,4 +359,35 @@ float scomx_result_float(scomx_dec_result_t res)
         return scom_read_le_float(res.data);
     }
     return 0;
-}
\ No newline at end of file
+}
+
+float scomx_decode_value(scom_format_t format, const char *const data, size_t data_len)
+{
+    if (data_len >= 4) {
+        if (format == SCOM_FORMAT_INT32) {
+            return (float)(int32_t)scom_read_le32(data);
+        } else if (format == SCOMX_FORMAT_LONG_ENUM) {
+            return (float)scom_read_le32(data);
+        }
+        return scom_read_le_float(data);
+    } else if (data_len >= 2) {
+        return (float)scom_read_le16(data);
+    } else if (data_len >= 1) {
+        return (float)(data[0] != 0);
+    }
+    return 0;
+}
+
+int scomx_decode_message(const char *const data, size_t data_len, scomx_message_t *msg)
+{
+    if (data_len < SCOMX_MESSAGE_DATA_SIZE) {
+        return -1;
+    }
+
+    msg->total_number = scom_read_le32(&data[0]);
+    msg->type = scom_read_le16(&data[4]);
+    msg->src_addr = scom_read_le32(&data[6]);
+    msg->timestamp = scom_read_le32(&data[10]);
+    msg->value = scom_read_le32(&data[14]);
+    return 0;
+}
@@ -44,6 +44,9 @@ Example setup: XTM4000-48 inverter, VT-80 VarioTrack, BSP battery controller and
 
 #define SCOM_DATALOG_TRANSFER_OBJECT_TYPE ((scom_object_type_t)0x0101)
 
+// largest frame exchanged with the Xcom-232i: a 512 byte datalog block plus headers and checksums
+#define SCOMX_MAX_FRAME_SIZE 544
+
 // TYPES
 
 typedef struct {
@@ -64,6 +67,10 @@ typedef struct {
 
     /** \brief number of additional bytes which needs to be read and passed to scomx_decode_frame */
     size_t length_to_read;
+
+    /** \brief status flags of the Xcom-232i sent in every response (e.g. is_message_pending); only
+     * valid when no error is set */
+    scom_frame_flags_t frame_flags;
 } scomx_header_dec_result_t;
 
 typedef struct {
@@ -73,6 +80,9 @@ typedef struct {
     /** \brief source address of the sender */
     uint32_t src_addr;
 
+    /** \brief status flags of the Xcom-232i from the frame header */
+    scom_frame_flags_t frame_flags;
+
     /** \brief service_id of the property decoded from the frame; only valid when no error is set */
     uint8_t service_id;
 
@@ -109,8 +119,29 @@ typedef uint32_t scomx_dest_t;
 #define SCOMX_DEST_232(idx) ((scomx_dest_t)(501 + idx))
 // MSP battery controler
 #define SCOMX_DEST_BSP ((scomx_dest_t)(601))
+// VarioString solar controller
+#define SCOMX_DEST_VS(idx) ((scomx_dest_t)(701 + idx))
 #define SCOMX_DEST_GATEWAY ((scomx_dest_t)(1))
 
+// MULTICAST DESTINATIONS (3.6 Multicast addresses)
+
+// A WRITE_PROPERTY to a multicast address changes the property on all devices of the same kind
+// in a single frame. READ_PROPERTY of parameters is not supported (SCOM_ERROR_MULTICAST_READ_NOT_SUPPORTED),
+// values must be verified on the individual devices: SCOMX_DEST_MULTICAST_MEMBER(addr, idx).
+// User infos read at address 100 return the system totals.
+
+// all XTH/XTM/XTS inverters
+#define SCOMX_DEST_XTM_ALL ((scomx_dest_t)(100))
+// all VarioTrack MPPT solar controllers
+#define SCOMX_DEST_MPPT_ALL ((scomx_dest_t)(300))
+// all BSP battery controllers
+#define SCOMX_DEST_BSP_ALL ((scomx_dest_t)(600))
+// all VarioString solar controllers
+#define SCOMX_DEST_VS_ALL ((scomx_dest_t)(700))
+
+// unicast address of the idx-th (0-based) device behind a multicast address
+#define SCOMX_DEST_MULTICAST_MEMBER(multicast_addr, idx) ((scomx_dest_t)((multicast_addr) + 1 + (idx)))
+
 // USER INFO OBJECT_IDs
 
 // NOTE: These objects are nicely documented in the "Technical specification - Xtender serial
@@ -351,11 +382,68 @@ typedef enum {
     SCOMX_PROP_PARAMETER_UNSAVED_VALUE_QSP = 0xD,
 } scomx_property_t;
 
+// FILE TRANSFER OBJECT (4.8)
+
+// A transfer is started with SD_Start and every answer carries one block of the listing or file:
+// SD_Datablock when more blocks follow, SD_Finish for the last one. The next block is requested with
+// SD_Ack_Continue, the same block again with SD_Nack_Retry. All requests are READ_PROPERTY to
+// SCOMX_DEST_232(0) with object type SCOM_DATALOG_TRANSFER_OBJECT_TYPE.
+
+// object_id: list of the files in CSVFILES\LOG, one name per line
+#define SCOMX_DATALOG_DIRECTORY_LIST ((uint32_t)0x1)
+// object_id: content of the file named in the SD_Start request ("LGYYMMDD.CSV")
+#define SCOMX_DATALOG_FILE_ACCESS ((uint32_t)0x2)
+
+#define SCOMX_DATALOG_BLOCK_SIZE 512
+
+typedef enum {
+    SCOMX_PROP_SD_INVALID_ACTION = 0x0,
+    SCOMX_PROP_SD_START = 0x21,
+    SCOMX_PROP_SD_DATABLOCK = 0x22,
+    SCOMX_PROP_SD_ACK_CONTINUE = 0x23,
+    SCOMX_PROP_SD_NACK_RETRY = 0x24,
+    SCOMX_PROP_SD_ABORT = 0x25,
+    SCOMX_PROP_SD_FINISH = 0x26,
+} scomx_datalog_property_t;
+
+// MESSAGE OBJECTS (4.6)
+
+// Messages are read from the Xcom-232i (SCOMX_DEST_232(0)) with property_id 0. Index 0 returns the
+// most recent message, sets the read pointer (SCOM_MSG_IDX) and clears the is_message_pending flag;
+// index n > 0 returns the n-th older message relative to that pointer.
+#define SCOMX_PROP_MESSAGE ((uint16_t)0x0)
+
+// size of the property_data of a message (4.6.6)
+#define SCOMX_MESSAGE_DATA_SIZE 18
+
+/** \brief decoded message object */
+typedef struct {
+    uint32_t total_number; // number of messages stored in the Xcom-232i
+    uint16_t type;         // meaning of the message, see "RCC messages" in the appendix
+    uint32_t src_addr;     // address of the device that sent the message
+    uint32_t timestamp;    // seconds since January 1, 1970
+    uint32_t value;        // optional value, not used yet by the devices
+} scomx_message_t;
+
+// DATA FORMATS
+
+// The appendix distinguishes SHORT ENUM (2 bytes, SCOM_FORMAT_ENUM) and LONG ENUM (4 bytes) parameters,
+// scomlib only knows the former
+#define SCOMX_FORMAT_LONG_ENUM ((scom_format_t)10)
+
+// ERRORS
+
+// the request was cancelled by the caller before a response arrived (not a Scom error code)
+#define SCOMX_ERROR_CANCELLED ((scom_error_t)0x0100)
+
 // FUNCTIONS
 
 // Returns static string describing the error
 const char *scomx_err2str(scom_error_t err);
 
+// Returns 1 if dst_addr is a multicast (write-only) address, 0 otherwise
+int scomx_is_multicast(scomx_dest_t dst_addr);
+
 // FUNCTIONS - REQUEST ENCODING
 
 // Encodes a generic property read request
@@ -373,6 +461,15 @@ scomx_enc_result_t scomx_encode_read_parameter_max(scomx_dest_t dst_addr, scomx_
 // Encodes a request to read "level_qsp" property of a "parameter-type" (0x2) object
 scomx_enc_result_t scomx_encode_read_parameter_level(scomx_dest_t dst_addr, scomx_parameter_object_t object_id);
 
+// Encodes a property read request carrying property_data (e.g. the file name of a datalog transfer)
+scomx_enc_result_t scomx_encode_read_property_data(uint32_t dst_addr, scom_object_type_t object_type, uint32_t object_id, uint16_t property_id,
+                                                   const char *const data, size_t data_len);
+// Encodes a step of a datalog file transfer (4.8); filename is only sent with SCOMX_PROP_SD_START
+// of SCOMX_DATALOG_FILE_ACCESS, NULL otherwise
+scomx_enc_result_t scomx_encode_datalog_transfer(uint32_t object_id, scomx_datalog_property_t property_id, const char *filename);
+// Encodes a request to read the message with the given index from the Xcom-232i
+scomx_enc_result_t scomx_encode_read_message(uint32_t index);
+
 // Encodes a generic property write request
 scomx_enc_result_t scomx_encode_write_property(uint32_t dst_addr, scom_object_type_t object_type, uint32_t object_id, uint16_t property_id, const char *const data,
                                                size_t data_len);
@@ -411,6 +508,12 @@ uint32_t scomx_result_int(scomx_dec_result_t res);
 // Reads native float value from the response if the response is valid and long enough. May not work
 // on all platforms.
 float scomx_result_float(scomx_dec_result_t res);
+// Decodes a property value of the given Scom format as a number (BOOL, ENUM, LONG ENUM, INT32 or FLOAT).
+// The length of the data wins over the format: the Xcom-232i sends all user infos as 4 byte FLOAT,
+// including those documented as ENUM or BOOL. Returns 0 if the data is too short.
+float scomx_decode_value(scom_format_t format, const char *const data, size_t data_len);
+// Decodes the property_data of a message object; returns 0 on success, -1 if data is too short
+int scomx_decode_message(const char *const data, size_t data_len, scomx_message_t *msg);
 
 #ifdef __cplusplus
 }
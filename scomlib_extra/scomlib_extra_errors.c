@@ -2,6 +2,10 @@
 
 const char *scomx_err2str(scom_error_t err)
 {
+    if (err == SCOMX_ERROR_CANCELLED) {
+        return "cancelled";
+    }
+
     switch (err) {
     case SCOM_ERROR_NO_ERROR:
         return "no error";
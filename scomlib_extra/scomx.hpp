@@ -0,0 +1,281 @@
+#ifndef SCOMX_HPP
+#define SCOMX_HPP
+
+// Header-only C++17 layer over scomlib_extra with compile-time typed objects
+//
+//   using BattVoltage = scomx::UserInfo<SCOMX_XT_INFO_BATTERY_VOLTAGE, float>;
+//   using ChargerAllowed = scomx::Param<SCOMX_XT_PARAM_CHARGER_ALLOWED, bool>;
+//
+//   static constexpr auto batt_voltage_frame = scomx::read_frame<BattVoltage>(SCOMX_DEST_XTM_ALL);
+//   scomx_enc_result_t enc = batt_voltage_frame.enc();
+//   bus_transfer(&enc, &dec);
+//   std::optional<float> volts = scomx::decode<BattVoltage>(dec);
+//
+// The value type of an object is checked against the object catalog: Param<1125, float> does not
+// compile because 1125 is a BOOL parameter. Read frames are constant expressions (header, property
+// and both checksums), so a poll loop sends precomputed frames without encoding anything at runtime.
+// Decoding picks the conversion at compile time; only the data length is checked at runtime.
+
+#include "scomx_catalog.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <type_traits>
+
+namespace scomx {
+
+namespace detail {
+
+struct CatalogEntry {
+    uint16_t object_type;
+    uint32_t id;
+    scom_format_t format;
+};
+
+#define SCOMX_CATALOG_ENTRY(object_type, id, format) {object_type, id, format},
+inline constexpr CatalogEntry catalog[] = {SCOMX_CATALOG_FORMATS(SCOMX_CATALOG_ENTRY)};
+#undef SCOMX_CATALOG_ENTRY
+
+// format of an object in the catalog, SCOM_FORMAT_INVALID_FORMAT if it is not listed
+constexpr scom_format_t catalog_format(uint16_t object_type, uint32_t id)
+{
+    for (const CatalogEntry &entry : catalog) {
+        if (entry.object_type == object_type && entry.id == id) {
+            return entry.format;
+        }
+    }
+    return SCOM_FORMAT_INVALID_FORMAT;
+}
+
+template <typename T> constexpr bool is_integer_v = (std::is_integral_v<T> && !std::is_same_v<T, bool>) || std::is_enum_v<T>;
+
+// can a value of the given format be represented by T
+template <typename T> constexpr bool compatible(scom_format_t format)
+{
+    switch (format) {
+    case SCOM_FORMAT_FLOAT:
+        return std::is_floating_point_v<T>;
+    case SCOM_FORMAT_BOOL:
+        return std::is_same_v<T, bool>;
+    case SCOM_FORMAT_ENUM:
+    case SCOM_FORMAT_INT32:
+        return is_integer_v<T>;
+    case SCOM_FORMAT_INVALID_FORMAT:
+        // not in the catalog - trust the caller
+        return std::is_arithmetic_v<T> || std::is_enum_v<T>;
+    default:
+        // LONG ENUM is not a member of scom_format_t
+        return format == SCOMX_FORMAT_LONG_ENUM && is_integer_v<T>;
+    }
+}
+
+template <size_t N> constexpr void put_le16(std::array<char, N> &buf, size_t pos, uint16_t val)
+{
+    buf[pos] = static_cast<char>(val & 0xFF);
+    buf[pos + 1] = static_cast<char>(val >> 8);
+}
+
+template <size_t N> constexpr void put_le32(std::array<char, N> &buf, size_t pos, uint32_t val)
+{
+    put_le16(buf, pos, static_cast<uint16_t>(val & 0xFFFF));
+    put_le16(buf, pos + 2, static_cast<uint16_t>(val >> 16));
+}
+
+// same checksum as scom_calc_checksum() of the data link layer
+template <size_t N> constexpr uint16_t checksum(const std::array<char, N> &buf, size_t pos, size_t len)
+{
+    uint8_t a = 0xFF;
+    uint8_t b = 0;
+
+    for (size_t i = pos; i < pos + len; i++) {
+        a = static_cast<uint8_t>(a + static_cast<uint8_t>(buf[i]));
+        b = static_cast<uint8_t>(b + a);
+    }
+    return static_cast<uint16_t>(a | (b << 8));
+}
+
+inline uint32_t read_le32(const char *p)
+{
+    return static_cast<uint32_t>(static_cast<uint8_t>(p[0])) | static_cast<uint32_t>(static_cast<uint8_t>(p[1])) << 8 |
+           static_cast<uint32_t>(static_cast<uint8_t>(p[2])) << 16 | static_cast<uint32_t>(static_cast<uint8_t>(p[3])) << 24;
+}
+
+inline uint16_t read_le16(const char *p)
+{
+    return static_cast<uint16_t>(static_cast<uint8_t>(p[0]) | static_cast<uint8_t>(p[1]) << 8);
+}
+
+inline float read_le_float(const char *p)
+{
+    uint32_t bits = read_le32(p);
+    float val;
+    std::memcpy(&val, &bits, sizeof(val));
+    return val;
+}
+
+constexpr size_t SERVICE_HEADER_SIZE = 10; // flags, service_id, object_type, object_id, property_id
+constexpr size_t CHECKSUM_SIZE = 2;
+
+} // namespace detail
+
+// A Scom object with its value type. Object type, property and format are compile-time constants.
+template <uint32_t Id, typename T, uint16_t ObjectType, uint16_t PropertyId> struct Object {
+    using value_type = T;
+    static constexpr uint32_t id = Id;
+    static constexpr uint16_t object_type = ObjectType;
+    static constexpr uint16_t property_id = PropertyId;
+    static constexpr scom_format_t format = detail::catalog_format(ObjectType, Id);
+
+    static_assert(detail::compatible<T>(format), "value type does not match the format of the object in the catalog");
+
+    // size of the property data of a write
+    static constexpr size_t data_size()
+    {
+        if constexpr (std::is_same_v<T, bool>) {
+            return 1;
+        } else if constexpr (std::is_floating_point_v<T>) {
+            return 4;
+        } else if (format == SCOM_FORMAT_ENUM) {
+            return 2;
+        } else if (format == SCOM_FORMAT_INVALID_FORMAT) {
+            return sizeof(T) <= 2 ? 2 : 4;
+        } else {
+            return 4;
+        }
+    }
+};
+
+// "value" of a user info (read-only)
+template <uint32_t Id, typename T> using UserInfo = Object<Id, T, SCOM_USER_INFO_OBJECT_TYPE, SCOMX_PROP_USER_INFO_VALUE>;
+
+// "unsaved_value_qsp" of a parameter: written to RAM only, no flash wear (see protocol 4.5.4)
+template <uint32_t Id, typename T> using Param = Object<Id, T, SCOM_PARAMETER_OBJECT_TYPE, SCOMX_PROP_PARAMETER_UNSAVED_VALUE_QSP>;
+
+// "value_qsp" of a parameter: persistent, for settings that are changed rarely
+template <uint32_t Id, typename T> using PersistentParam = Object<Id, T, SCOM_PARAMETER_OBJECT_TYPE, SCOMX_PROP_PARAMETER_VALUE_QSP>;
+
+// A complete request frame, ready to be written to the port
+template <size_t N> struct Frame {
+    std::array<char, N> bytes{};
+
+    static constexpr size_t size()
+    {
+        return N;
+    }
+
+    // view for bus_transfer() and serial_write(); the frame must outlive the result
+    scomx_enc_result_t enc() const
+    {
+        scomx_enc_result_t res;
+        res.error = SCOM_ERROR_NO_ERROR;
+        res.data = const_cast<char *>(bytes.data());
+        res.length = N;
+        return res;
+    }
+};
+
+namespace detail {
+
+// header, service header and checksums around data_size bytes of property data (filled by the caller)
+template <size_t N> constexpr void encode_request(std::array<char, N> &buf, uint32_t dst_addr, uint8_t service_id, uint16_t object_type,
+                                                  uint32_t object_id, uint16_t property_id)
+{
+    constexpr size_t data_length = N - SCOM_FRAME_HEADER_SIZE - CHECKSUM_SIZE;
+
+    buf[0] = static_cast<char>(0xAA);
+    buf[1] = 0; // frame flags of a request
+    put_le32(buf, 2, SCOMX_DEST_GATEWAY);
+    put_le32(buf, 6, dst_addr);
+    put_le16(buf, 10, static_cast<uint16_t>(data_length));
+    put_le16(buf, 12, checksum(buf, 1, SCOM_FRAME_HEADER_SIZE - 1 - CHECKSUM_SIZE));
+
+    buf[SCOM_FRAME_HEADER_SIZE] = 0; // service flags
+    buf[SCOM_FRAME_HEADER_SIZE + 1] = static_cast<char>(service_id);
+    put_le16(buf, SCOM_FRAME_HEADER_SIZE + 2, object_type);
+    put_le32(buf, SCOM_FRAME_HEADER_SIZE + 4, object_id);
+    put_le16(buf, SCOM_FRAME_HEADER_SIZE + 8, property_id);
+}
+
+template <size_t N> constexpr void finish_request(std::array<char, N> &buf)
+{
+    constexpr size_t data_length = N - SCOM_FRAME_HEADER_SIZE - CHECKSUM_SIZE;
+    put_le16(buf, SCOM_FRAME_HEADER_SIZE + data_length, checksum(buf, SCOM_FRAME_HEADER_SIZE, data_length));
+}
+
+} // namespace detail
+
+template <typename Obj> using ReadFrame = Frame<SCOM_FRAME_HEADER_SIZE + detail::SERVICE_HEADER_SIZE + detail::CHECKSUM_SIZE>;
+template <typename Obj> using WriteFrame = Frame<SCOM_FRAME_HEADER_SIZE + detail::SERVICE_HEADER_SIZE + Obj::data_size() + detail::CHECKSUM_SIZE>;
+
+// Read request for the object at dst_addr, usable as a constant expression
+template <typename Obj> constexpr ReadFrame<Obj> read_frame(uint32_t dst_addr)
+{
+    ReadFrame<Obj> frame;
+    detail::encode_request(frame.bytes, dst_addr, SCOM_READ_PROPERTY_SERVICE, Obj::object_type, Obj::id, Obj::property_id);
+    detail::finish_request(frame.bytes);
+    return frame;
+}
+
+// Write request for a parameter; float values are encoded at runtime (no constexpr bit cast in C++17)
+template <typename Obj> WriteFrame<Obj> write_frame(uint32_t dst_addr, typename Obj::value_type value)
+{
+    static_assert(Obj::object_type == SCOM_PARAMETER_OBJECT_TYPE, "only parameters can be written");
+
+    WriteFrame<Obj> frame;
+    constexpr size_t pos = SCOM_FRAME_HEADER_SIZE + detail::SERVICE_HEADER_SIZE;
+    using T = typename Obj::value_type;
+
+    detail::encode_request(frame.bytes, dst_addr, SCOM_WRITE_PROPERTY_SERVICE, Obj::object_type, Obj::id, Obj::property_id);
+    if constexpr (std::is_same_v<T, bool>) {
+        frame.bytes[pos] = value ? 1 : 0;
+    } else if constexpr (std::is_floating_point_v<T>) {
+        float val = static_cast<float>(value);
+        uint32_t bits;
+        std::memcpy(&bits, &val, sizeof(bits));
+        detail::put_le32(frame.bytes, pos, bits);
+    } else if constexpr (Obj::data_size() == 2) {
+        detail::put_le16(frame.bytes, pos, static_cast<uint16_t>(value));
+    } else {
+        detail::put_le32(frame.bytes, pos, static_cast<uint32_t>(value));
+    }
+    detail::finish_request(frame.bytes);
+    return frame;
+}
+
+// Value of a response to read_frame<Obj>(), nullopt on an error, a response to another object or
+// too short data. The Xcom-232i sends user infos as FLOAT whatever their documented format.
+template <typename Obj> std::optional<typename Obj::value_type> decode(const scomx_dec_result_t &res)
+{
+    using T = typename Obj::value_type;
+
+    if (res.error != SCOM_ERROR_NO_ERROR || res.service_id != SCOM_READ_PROPERTY_SERVICE || res.object_type != Obj::object_type ||
+        res.object_id != Obj::id || res.property_id != Obj::property_id) {
+        return std::nullopt;
+    }
+
+    if (res.length >= 4) {
+        if constexpr (std::is_floating_point_v<T>) {
+            return static_cast<T>(detail::read_le_float(res.data));
+        } else if constexpr (std::is_same_v<T, bool>) {
+            return detail::read_le_float(res.data) != 0.0f;
+        } else if constexpr (Obj::format == SCOM_FORMAT_INT32) {
+            return static_cast<T>(static_cast<int32_t>(detail::read_le32(res.data)));
+        } else if constexpr (Obj::format == SCOMX_FORMAT_LONG_ENUM) {
+            return static_cast<T>(detail::read_le32(res.data));
+        } else {
+            return static_cast<T>(detail::read_le_float(res.data));
+        }
+    } else if (res.length >= 2) {
+        return static_cast<T>(detail::read_le16(res.data));
+    } else if (res.length >= 1) {
+        return static_cast<T>(res.data[0] != 0);
+    }
+    return std::nullopt;
+}
+
+} // namespace scomx
+
+#endif
@@ -0,0 +1,41 @@
+#include "scomx_catalog.h"
+
+#include <stddef.h>
+
+const scomx_object_info_t *scomx_catalog_find(scom_object_type_t object_type, uint32_t id)
+{
+    // the generated table is sorted by (object type, id), infos first
+    size_t lo = 0;
+    size_t hi = SCOMX_CATALOG_SIZE;
+    int type_rank = object_type == SCOM_USER_INFO_OBJECT_TYPE ? 0 : 1;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        const scomx_object_info_t *info = &scomx_catalog[mid];
+        int rank = info->object_type == SCOM_USER_INFO_OBJECT_TYPE ? 0 : 1;
+
+        if (rank < type_rank || (rank == type_rank && info->id < id)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (lo < SCOMX_CATALOG_SIZE && scomx_catalog[lo].object_type == object_type && scomx_catalog[lo].id == id) {
+        return &scomx_catalog[lo];
+    }
+    return NULL;
+}
+
+const char *scomx_catalog_label(const scomx_object_info_t *info, int value)
+{
+    if (info == NULL) {
+        return NULL;
+    }
+    for (size_t i = 0; i < info->num_labels; i++) {
+        if (info->labels[i].value == value) {
+            return info->labels[i].label;
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,60 @@
+#ifndef SCOMX_CATALOG_H
+#define SCOMX_CATALOG_H
+
+#include "scomlib_extra.h"
+
+// Typed catalog of the parameters and user infos of the "Xtender serial protocol appendix"
+//
+// scomx_catalog_gen.h and scomx_catalog_gen.c are generated at build time by tools/gen_object_catalog.py.
+// Every object gets a name derived from its device, kind and description, e.g.
+//   #define SCOMX_XT_INFO_BATTERY_VOLTAGE 3000
+//   #define SCOMX_XT_INFO_BATTERY_VOLTAGE_FORMAT SCOM_FORMAT_FLOAT
+// so configuration tables refer to objects by name and get the data type at compile time. The
+// table below holds the remaining metadata for the few places that need it at runtime.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "scomx_catalog_gen.h"
+
+// object id and Scom format of a catalog entry, for table initializers: {SCOMX_OBJECT(SCOMX_XT_PARAM_CHARGER_ALLOWED), ...}
+#define SCOMX_OBJECT(name) name, name##_FORMAT
+
+/** \brief label of an ENUM or BOOL value */
+typedef struct {
+    int value;
+    const char *label;
+} scomx_enum_label_t;
+
+/** \brief metadata of one object */
+typedef struct {
+    uint32_t id;
+    scom_object_type_t object_type; // SCOM_USER_INFO_OBJECT_TYPE or SCOM_PARAMETER_OBJECT_TYPE
+    const char *device;             // "Xtender", "VarioTrack", ...
+    const char *level;              // access level of a parameter ("Basic", "Expert", ...), NULL for infos
+    const char *description;
+    const char *unit;               // NULL if the object has no unit
+    scom_format_t format;
+    float default_value;            // NAN where the appendix gives no number
+    float min_value;
+    float max_value;
+    const scomx_enum_label_t *labels;
+    size_t num_labels;
+} scomx_object_info_t;
+
+// all objects, sorted by object type (infos first) and id
+extern const scomx_object_info_t scomx_catalog[SCOMX_CATALOG_SIZE];
+
+// Returns the catalog entry of an object or NULL; BSP and Xcom-CAN BMS infos share their ids,
+// the first one is returned
+const scomx_object_info_t *scomx_catalog_find(scom_object_type_t object_type, uint32_t id);
+
+// Returns the label of an ENUM/BOOL value or NULL
+const char *scomx_catalog_label(const scomx_object_info_t *info, int value);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
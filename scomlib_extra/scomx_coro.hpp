@@ -0,0 +1,785 @@
+#ifndef SCOMX_CORO_HPP
+#define SCOMX_CORO_HPP
+
+// Header-only C++20 coroutine client for the Xcom-232i on a single-threaded reactor
+//
+//   scomx::Reactor reactor;
+//   scomx::Bus bus(reactor, fd); // raw serial port opened and configured by the application
+//
+//   scomx::Task<> poll(scomx::Bus &bus)
+//   {
+//       std::optional<float> volts = co_await bus.read<BattVoltage>(SCOMX_DEST_XTM_ALL);
+//       scom_error_t err = co_await bus.write<ChargerAllowed>(SCOMX_DEST_XTM(0), true);
+//   }
+//
+//   scomx::spawn(poll(bus));
+//   reactor.run();
+//
+// Requests are queued by priority and sent one at a time: the Xcom-232i handles a single frame and
+// a new request goes out only after the response of the previous one or its timeout. Every request
+// has a timeout (from the moment its frame is sent) and can be cancelled with a std::stop_token.
+// A cancelled request that is already on the wire still occupies the bus until its response or
+// timeout, the awaiting coroutine is resumed right away with SCOMX_ERROR_CANCELLED.
+//
+// Nothing blocks and no thread is created. An application with its own event loop adds
+// Reactor::fd() to it and calls run_once(0) whenever that fd is readable. All coroutines run on
+// the thread that runs the reactor; only Reactor::post() and std::stop_source::request_stop() may
+// be called from other threads.
+
+#include "scomx.hpp"
+
+#include <chrono>
+#include <coroutine>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <stop_token>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <termios.h>
+#include <unistd.h>
+
+namespace scomx {
+
+// REACTOR
+
+class Reactor {
+  public:
+    using Clock = std::chrono::steady_clock;
+    using TimerId = uint64_t;
+
+    Reactor()
+    {
+        epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+        wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        add_internal(wake_fd_);
+        add_internal(timer_fd_);
+    }
+
+    ~Reactor()
+    {
+        close(timer_fd_);
+        close(wake_fd_);
+        close(epoll_fd_);
+    }
+
+    Reactor(const Reactor &) = delete;
+    Reactor &operator=(const Reactor &) = delete;
+
+    // readable whenever run_once() has something to do (fd events, due timers, posted calls)
+    int fd() const
+    {
+        return epoll_fd_;
+    }
+
+    // call handler(events) on the reactor thread for EPOLLIN/EPOLLOUT/... on fd
+    int watch(int fd, uint32_t events, std::function<void(uint32_t)> handler)
+    {
+        struct epoll_event ev = {};
+        ev.events = events;
+        ev.data.fd = fd;
+        if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev) != 0) {
+            return -1;
+        }
+        handlers_[fd] = std::move(handler);
+        return 0;
+    }
+
+    int modify(int fd, uint32_t events)
+    {
+        struct epoll_event ev = {};
+        ev.events = events;
+        ev.data.fd = fd;
+        return epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd, &ev);
+    }
+
+    void unwatch(int fd)
+    {
+        epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+        handlers_.erase(fd);
+    }
+
+    TimerId add_timer(Clock::time_point deadline, std::function<void()> fn)
+    {
+        TimerId id = ++last_timer_;
+        timers_.emplace(std::make_pair(deadline, id), std::move(fn));
+        arm_timer();
+        return id;
+    }
+
+    void cancel_timer(Clock::time_point deadline, TimerId id)
+    {
+        timers_.erase(std::make_pair(deadline, id));
+    }
+
+    // run fn on the reactor thread; safe to call from any thread
+    void post(std::function<void()> fn)
+    {
+        {
+            std::lock_guard<std::mutex> lock(posted_mutex_);
+            posted_.push_back(std::move(fn));
+        }
+        uint64_t one = 1;
+        (void)!write(wake_fd_, &one, sizeof(one));
+    }
+
+    // wait up to timeout_ms (-1 forever, 0 poll) and dispatch what is ready; returns -1 on error
+    int run_once(int timeout_ms)
+    {
+        struct epoll_event events[16];
+
+        int n = epoll_wait(epoll_fd_, events, 16, timeout_ms);
+        if (n < 0) {
+            return errno == EINTR ? 0 : -1;
+        }
+
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            if (fd == wake_fd_ || fd == timer_fd_) {
+                uint64_t count;
+                (void)!read(fd, &count, sizeof(count));
+                continue;
+            }
+            auto it = handlers_.find(fd);
+            if (it != handlers_.end()) {
+                auto handler = it->second; // the handler may unwatch its fd
+                handler(events[i].events);
+            }
+        }
+
+        run_timers();
+        run_posted();
+        return 0;
+    }
+
+    void run()
+    {
+        stopped_ = false;
+        while (!stopped_ && run_once(-1) == 0) {
+        }
+    }
+
+    void stop()
+    {
+        post([this] { stopped_ = true; });
+    }
+
+  private:
+    void add_internal(int fd)
+    {
+        struct epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev);
+    }
+
+    // make timer_fd_ readable at the earliest deadline
+    void arm_timer()
+    {
+        struct itimerspec its = {};
+        if (!timers_.empty()) {
+            auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(timers_.begin()->first.first.time_since_epoch()).count();
+            its.it_value.tv_sec = ns / 1000000000;
+            its.it_value.tv_nsec = ns % 1000000000;
+            if (its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0) {
+                its.it_value.tv_nsec = 1; // zero would disarm the timer
+            }
+        }
+        // steady_clock is CLOCK_MONOTONIC on Linux
+        timerfd_settime(timer_fd_, TFD_TIMER_ABSTIME, &its, nullptr);
+    }
+
+    void run_timers()
+    {
+        auto now = Clock::now();
+        while (!timers_.empty() && timers_.begin()->first.first <= now) {
+            auto fn = std::move(timers_.begin()->second);
+            timers_.erase(timers_.begin());
+            fn();
+        }
+        arm_timer();
+    }
+
+    void run_posted()
+    {
+        std::deque<std::function<void()>> posted;
+        {
+            std::lock_guard<std::mutex> lock(posted_mutex_);
+            posted.swap(posted_);
+        }
+        for (auto &fn : posted) {
+            fn();
+        }
+    }
+
+    int epoll_fd_;
+    int wake_fd_;
+    int timer_fd_;
+    bool stopped_ = false;
+    TimerId last_timer_ = 0;
+    std::unordered_map<int, std::function<void(uint32_t)>> handlers_;
+    std::map<std::pair<Clock::time_point, TimerId>, std::function<void()>> timers_;
+    std::mutex posted_mutex_;
+    std::deque<std::function<void()>> posted_;
+};
+
+// TASKS
+
+template <typename T = void> class Task;
+
+namespace detail {
+
+struct PromiseBase {
+    std::coroutine_handle<> continuation;
+    std::exception_ptr exception;
+
+    std::suspend_always initial_suspend() noexcept
+    {
+        return {};
+    }
+
+    // resume the awaiting coroutine, if any (symmetric transfer)
+    struct FinalAwaiter {
+        bool await_ready() noexcept
+        {
+            return false;
+        }
+        template <typename P> std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept
+        {
+            auto next = h.promise().continuation;
+            return next ? next : std::noop_coroutine();
+        }
+        void await_resume() noexcept
+        {
+        }
+    };
+
+    FinalAwaiter final_suspend() noexcept
+    {
+        return {};
+    }
+
+    void unhandled_exception()
+    {
+        exception = std::current_exception();
+    }
+};
+
+template <typename T> struct Promise : PromiseBase {
+    std::optional<T> value;
+
+    Task<T> get_return_object();
+    void return_value(T v)
+    {
+        value = std::move(v);
+    }
+    T result()
+    {
+        if (exception) {
+            std::rethrow_exception(exception);
+        }
+        return std::move(*value);
+    }
+};
+
+template <> struct Promise<void> : PromiseBase {
+    Task<void> get_return_object();
+    void return_void()
+    {
+    }
+    void result()
+    {
+        if (exception) {
+            std::rethrow_exception(exception);
+        }
+    }
+};
+
+} // namespace detail
+
+// Lazily started coroutine; runs when it is awaited or passed to spawn()
+template <typename T> class [[nodiscard]] Task {
+  public:
+    using promise_type = detail::Promise<T>;
+
+    explicit Task(std::coroutine_handle<promise_type> h) : handle_(h)
+    {
+    }
+    Task(Task &&other) noexcept : handle_(std::exchange(other.handle_, nullptr))
+    {
+    }
+    Task(const Task &) = delete;
+    ~Task()
+    {
+        if (handle_) {
+            handle_.destroy();
+        }
+    }
+
+    bool await_ready() const noexcept
+    {
+        return false;
+    }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+    {
+        handle_.promise().continuation = awaiting;
+        return handle_;
+    }
+    T await_resume()
+    {
+        return handle_.promise().result();
+    }
+
+  private:
+    std::coroutine_handle<promise_type> handle_;
+};
+
+namespace detail {
+
+template <typename T> Task<T> Promise<T>::get_return_object()
+{
+    return Task<T>(std::coroutine_handle<Promise<T>>::from_promise(*this));
+}
+
+inline Task<void> Promise<void>::get_return_object()
+{
+    return Task<void>(std::coroutine_handle<Promise<void>>::from_promise(*this));
+}
+
+// eagerly started coroutine that owns itself
+struct Detached {
+    struct promise_type {
+        Detached get_return_object()
+        {
+            return {};
+        }
+        std::suspend_never initial_suspend() noexcept
+        {
+            return {};
+        }
+        std::suspend_never final_suspend() noexcept
+        {
+            return {};
+        }
+        void return_void()
+        {
+        }
+        void unhandled_exception()
+        {
+            std::terminate();
+        }
+    };
+};
+
+inline Detached run_detached(Task<void> task)
+{
+    co_await std::move(task);
+}
+
+} // namespace detail
+
+// start a task without awaiting it; it frees itself when it finishes
+inline void spawn(Task<void> task)
+{
+    detail::run_detached(std::move(task));
+}
+
+// BUS
+
+// same order as bus_priority_t of the daemon's request queue
+enum class Priority { Urgent = 0, Interactive = 1, Background = 2 };
+
+struct RequestOptions {
+    std::chrono::milliseconds timeout{500};
+    Priority priority = Priority::Interactive;
+    std::stop_token stop;
+};
+
+// decoded response frame; data is only valid when error is SCOM_ERROR_NO_ERROR
+struct Response {
+    scom_error_t error = SCOM_ERROR_NO_ERROR;
+    scom_frame_flags_t frame_flags = {};
+    uint32_t src_addr = 0;
+    uint8_t service_id = 0;
+    uint16_t object_type = 0;
+    uint32_t object_id = 0;
+    uint16_t property_id = 0;
+    std::vector<char> data;
+
+    // the response in the form scomx::decode<Obj>() and the C helpers expect
+    scomx_dec_result_t dec() const
+    {
+        scomx_dec_result_t res = {};
+        res.error = error;
+        res.frame_flags = frame_flags;
+        res.src_addr = src_addr;
+        res.service_id = service_id;
+        res.object_type = object_type;
+        res.object_id = object_id;
+        res.property_id = property_id;
+        res.data = const_cast<char *>(data.data());
+        res.length = data.size();
+        return res;
+    }
+};
+
+class Bus {
+    // a request from submit() until its waiter is resumed; lives in the awaiting coroutine frame
+    struct Pending {
+        std::vector<char> frame;
+        RequestOptions opts;
+        Response response;
+        std::coroutine_handle<> waiter;
+        uint64_t id = 0;
+        std::optional<std::stop_callback<std::function<void()>>> on_stop;
+    };
+
+  public:
+    // fd is the serial port, opened and configured (raw, baud rate, any VMIN/VTIME) by the application; it is
+    // switched to non-blocking mode and stays owned by the caller
+    Bus(Reactor &reactor, int fd) : reactor_(reactor), fd_(fd)
+    {
+        fcntl(fd_, F_SETFL, fcntl(fd_, F_GETFL) | O_NONBLOCK);
+        reactor_.watch(fd_, EPOLLIN, [this](uint32_t events) { on_io(events); });
+    }
+
+    ~Bus()
+    {
+        reactor_.unwatch(fd_);
+    }
+
+    Bus(const Bus &) = delete;
+    Bus &operator=(const Bus &) = delete;
+
+    // Awaitable for one request frame
+    class Request {
+      public:
+        Request(Bus &bus, std::vector<char> frame, RequestOptions opts) : bus_(bus)
+        {
+            pending_.frame = std::move(frame);
+            pending_.opts = std::move(opts);
+        }
+
+        bool await_ready() const noexcept
+        {
+            return false;
+        }
+
+        void await_suspend(std::coroutine_handle<> h)
+        {
+            pending_.waiter = h;
+            bus_.submit(&pending_);
+        }
+
+        Response await_resume()
+        {
+            return std::move(pending_.response);
+        }
+
+      private:
+        Bus &bus_;
+        Pending pending_;
+    };
+
+    // send an encoded request (e.g. scomx_encode_read_property()); the frame is copied
+    Request transfer(const scomx_enc_result_t &enc, RequestOptions opts = {})
+    {
+        if (enc.error != SCOM_ERROR_NO_ERROR) {
+            return Request(*this, {}, std::move(opts)); // completes with SCOM_ERROR_INVALID_FRAME
+        }
+        return Request(*this, std::vector<char>(enc.data, enc.data + enc.length), std::move(opts));
+    }
+
+    template <size_t N> Request transfer(const Frame<N> &frame, RequestOptions opts = {})
+    {
+        return Request(*this, std::vector<char>(frame.bytes.begin(), frame.bytes.end()), std::move(opts));
+    }
+
+    // untyped property read
+    Request read(uint32_t dst_addr, scom_object_type_t object_type, uint32_t object_id, uint16_t property_id, RequestOptions opts = {})
+    {
+        return transfer(scomx_encode_read_property(dst_addr, object_type, object_id, property_id), std::move(opts));
+    }
+
+    // typed read of a catalog object; nullopt on any error
+    template <typename Obj> Task<std::optional<typename Obj::value_type>> read(uint32_t dst_addr, RequestOptions opts = {})
+    {
+        static constexpr auto frame = read_frame<Obj>(0); // destination patched below
+        Response res = co_await transfer(with_destination(frame, dst_addr), std::move(opts));
+        co_return decode<Obj>(res.dec());
+    }
+
+    // typed parameter write; returns the Scom result
+    template <typename Obj> Task<scom_error_t> write(uint32_t dst_addr, typename Obj::value_type value, RequestOptions opts = {})
+    {
+        if (opts.priority == Priority::Interactive) {
+            opts.priority = Priority::Urgent; // writes preempt reads, as in the daemon
+        }
+        Response res = co_await transfer(write_frame<Obj>(dst_addr, value), std::move(opts));
+        co_return res.error;
+    }
+
+    // number of requests waiting for the bus, not counting the one on the wire
+    size_t queued() const
+    {
+        size_t count = 0;
+        for (const auto &queue : queues_) {
+            count += queue.size();
+        }
+        return count;
+    }
+
+  private:
+    // read frames are constant up to the destination address; rewrite it and the header checksum
+    template <size_t N> static Frame<N> with_destination(Frame<N> frame, uint32_t dst_addr)
+    {
+        detail::put_le32(frame.bytes, 6, dst_addr);
+        detail::put_le16(frame.bytes, 12, detail::checksum(frame.bytes, 1, SCOM_FRAME_HEADER_SIZE - 3));
+        return frame;
+    }
+
+    void submit(Pending *p)
+    {
+        p->id = ++last_id_;
+        if (p->frame.empty()) {
+            complete_later(p, SCOM_ERROR_INVALID_FRAME);
+            return;
+        }
+        if (p->opts.stop.stop_requested()) {
+            complete_later(p, SCOMX_ERROR_CANCELLED);
+            return;
+        }
+
+        queues_[static_cast<int>(p->opts.priority)].push_back(p);
+        if (p->opts.stop.stop_possible()) {
+            uint64_t id = p->id;
+            // may run on another thread - hop to the reactor and look the request up by id
+            p->on_stop.emplace(p->opts.stop, std::function<void()>([this, id] { reactor_.post([this, id] { cancel(id); }); }));
+        }
+        start_next();
+    }
+
+    // finish the request on the next reactor iteration so that await_suspend() returns first
+    void complete_later(Pending *p, scom_error_t error)
+    {
+        p->response.error = error;
+        reactor_.post([h = p->waiter] { h.resume(); });
+    }
+
+    void complete(Pending *p, scom_error_t error)
+    {
+        p->response.error = error;
+        p->on_stop.reset();
+        p->waiter.resume();
+    }
+
+    void cancel(uint64_t id)
+    {
+        for (auto &queue : queues_) {
+            for (auto it = queue.begin(); it != queue.end(); ++it) {
+                if ((*it)->id == id) {
+                    Pending *p = *it;
+                    queue.erase(it);
+                    complete(p, SCOMX_ERROR_CANCELLED);
+                    return;
+                }
+            }
+        }
+        if (inflight_ && inflight_->id == id) {
+            // the frame is on the wire: keep the bus busy until its response or timeout
+            Pending *p = inflight_;
+            inflight_ = nullptr;
+            complete(p, SCOMX_ERROR_CANCELLED);
+        }
+    }
+
+    void start_next()
+    {
+        if (busy_) {
+            return;
+        }
+        for (auto &queue : queues_) {
+            if (!queue.empty()) {
+                inflight_ = queue.front();
+                queue.pop_front();
+                break;
+            }
+        }
+        if (inflight_ == nullptr) {
+            return;
+        }
+
+        busy_ = true;
+        tx_ = inflight_->frame;
+        tx_done_ = 0;
+        rx_.clear();
+        deadline_ = Reactor::Clock::now() + inflight_->opts.timeout;
+        timer_ = reactor_.add_timer(deadline_, [this] { on_timeout(); });
+        flush_tx();
+    }
+
+    void flush_tx()
+    {
+        while (tx_done_ < tx_.size()) {
+            ssize_t ret = ::write(fd_, tx_.data() + tx_done_, tx_.size() - tx_done_);
+            if (ret < 0 && errno == EINTR) {
+                continue;
+            }
+            if (ret < 0 && errno == EAGAIN) {
+                reactor_.modify(fd_, EPOLLIN | EPOLLOUT);
+                return;
+            }
+            if (ret <= 0) {
+                finish(SCOM_ERROR_STACK_PORT_WRITE_FAILED);
+                return;
+            }
+            tx_done_ += ret;
+        }
+        reactor_.modify(fd_, EPOLLIN);
+    }
+
+    void on_io(uint32_t events)
+    {
+        if (events & EPOLLOUT) {
+            flush_tx();
+        }
+        if (events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+            char buf[256];
+            // 0 is an empty input on a tty in raw mode (VMIN=0, VTIME=0), not an end of file:
+            // only a hangup, an error condition or a failed read breaks the port
+            bool failed = events & (EPOLLERR | EPOLLHUP);
+            for (;;) {
+                ssize_t ret = ::read(fd_, buf, sizeof(buf));
+                if (ret > 0) {
+                    rx_.insert(rx_.end(), buf, buf + ret);
+                    continue;
+                }
+                if (ret < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (ret < 0 && errno != EAGAIN) {
+                    failed = true;
+                }
+                break;
+            }
+            parse(); // a response that arrived before the hangup still counts
+            if (failed && busy_) {
+                finish(SCOM_ERROR_STACK_PORT_READ_FAILED);
+            }
+        }
+    }
+
+    // extract a response frame from rx_, resynchronizing on the start byte after garbage
+    void parse()
+    {
+        while (!rx_.empty()) {
+            if (!busy_) {
+                rx_.clear(); // late response of a timed out request
+                return;
+            }
+            if (static_cast<uint8_t>(rx_[0]) != 0xAA) {
+                rx_.erase(rx_.begin());
+                continue;
+            }
+            if (rx_.size() < SCOM_FRAME_HEADER_SIZE) {
+                return;
+            }
+
+            // scomlib_extra decodes into a static buffer - fine, everything runs on this thread
+            scomx_header_dec_result_t hdr = scomx_decode_frame_header(rx_.data(), SCOM_FRAME_HEADER_SIZE);
+            if (hdr.error != SCOM_ERROR_NO_ERROR || hdr.length_to_read == 0 || hdr.length_to_read > SCOMX_MAX_FRAME_SIZE) {
+                rx_.erase(rx_.begin());
+                continue;
+            }
+            if (rx_.size() < SCOM_FRAME_HEADER_SIZE + hdr.length_to_read) {
+                return;
+            }
+
+            scomx_dec_result_t dec = scomx_decode_frame(rx_.data() + SCOM_FRAME_HEADER_SIZE, hdr.length_to_read);
+            rx_.erase(rx_.begin(), rx_.begin() + SCOM_FRAME_HEADER_SIZE + hdr.length_to_read);
+
+            if (!matches_request(dec)) {
+                continue; // late response to a timed out or cancelled frame
+            }
+
+            if (inflight_) {
+                Response &res = inflight_->response;
+                res.frame_flags = hdr.frame_flags;
+                res.src_addr = dec.src_addr;
+                res.service_id = dec.service_id;
+                res.object_type = dec.object_type;
+                res.object_id = dec.object_id;
+                res.property_id = dec.property_id;
+                if (dec.error == SCOM_ERROR_NO_ERROR) {
+                    res.data.assign(dec.data, dec.data + dec.length);
+                }
+            }
+            finish(dec.error);
+        }
+    }
+
+    // the response echoes service, object and property of the frame on the wire
+    bool matches_request(const scomx_dec_result_t &dec) const
+    {
+        const char *req = tx_.data() + SCOM_FRAME_HEADER_SIZE;
+        if (dec.error != SCOM_ERROR_NO_ERROR) {
+            return true; // the property header of error responses is not decoded
+        }
+        return dec.service_id == static_cast<uint8_t>(req[1]) && dec.object_type == detail::read_le16(&req[2]) &&
+               dec.object_id == detail::read_le32(&req[4]) && dec.property_id == detail::read_le16(&req[8]);
+    }
+
+    void on_timeout()
+    {
+        // anything that still arrives belongs to this request
+        tcflush(fd_, TCIFLUSH);
+        rx_.clear();
+        timer_ = 0;
+        finish(SCOM_ERROR_RESPONSE_TIMEOUT);
+    }
+
+    // the frame on the wire is done: resume its waiter and send the next one
+    void finish(scom_error_t error)
+    {
+        if (timer_) {
+            reactor_.cancel_timer(deadline_, timer_);
+            timer_ = 0;
+        }
+        busy_ = false;
+        reactor_.modify(fd_, EPOLLIN);
+
+        Pending *p = std::exchange(inflight_, nullptr);
+        if (p) {
+            complete(p, error);
+        }
+        start_next();
+    }
+
+    Reactor &reactor_;
+    int fd_;
+    std::deque<Pending *> queues_[3];
+    Pending *inflight_ = nullptr; // NULL while busy_ if the request on the wire was cancelled
+    bool busy_ = false;
+    uint64_t last_id_ = 0;
+    std::vector<char> tx_;
+    size_t tx_done_ = 0;
+    std::vector<char> rx_;
+    Reactor::Clock::time_point deadline_;
+    Reactor::TimerId timer_ = 0;
+};
+
+} // namespace scomx
+
+#endif
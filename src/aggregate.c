@@ -0,0 +1,98 @@
+//
+//  Windowed min/max/mean of the poll list entries
+//
+//  See aggregate.h. Only the poll loop uses this.
+//
+
+#include "aggregate.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define error_message(fmt, ...) fprintf(stderr, "[AGGREGATE ERROR] " fmt, ##__VA_ARGS__)
+
+typedef struct {
+    float min;
+    float max;
+    double sum;
+    unsigned count;
+} stats_t;
+
+typedef struct {
+    unsigned window_s; // 0 if the entry is not aggregated
+    time_t end;        // end of the open window, 0 before the first sample
+    stats_t open;
+    stats_t closed;    // last window that ended, count 0 once taken
+    time_t closed_end;
+} window_t;
+
+static window_t *g_windows = NULL;
+static size_t g_num_params = 0;
+
+void aggregate_bind(const config_t *cfg)
+{
+    free(g_windows);
+    g_num_params = 0;
+    g_windows = calloc(cfg->num_parameters ? cfg->num_parameters : 1, sizeof(window_t));
+    if (g_windows == NULL) {
+        error_message("out of memory\n");
+        return;
+    }
+    for (size_t i = 0; i < cfg->num_parameters; i++) {
+        g_windows[i].window_s = cfg->parameters[i].aggregate_s;
+    }
+    g_num_params = cfg->num_parameters;
+}
+
+// close the open window of w if it has ended by now
+static void roll(window_t *w, time_t now)
+{
+    if (w->end != 0 && now < w->end) {
+        return;
+    }
+    if (w->end != 0 && w->open.count > 0) {
+        w->closed = w->open;
+        w->closed_end = w->end;
+    }
+    w->open.count = 0;
+    w->open.sum = 0.0;
+    w->end = now - now % (time_t)w->window_s + (time_t)w->window_s;
+}
+
+void aggregate_sample(size_t idx, float value, time_t now)
+{
+    if (idx >= g_num_params || g_windows[idx].window_s == 0) {
+        return;
+    }
+    window_t *w = &g_windows[idx];
+
+    roll(w, now);
+    if (w->open.count == 0 || value < w->open.min) {
+        w->open.min = value;
+    }
+    if (w->open.count == 0 || value > w->open.max) {
+        w->open.max = value;
+    }
+    w->open.sum += value;
+    w->open.count++;
+}
+
+int aggregate_take(size_t idx, time_t now, aggregate_t *out)
+{
+    if (idx >= g_num_params || g_windows[idx].window_s == 0 || g_windows[idx].end == 0) {
+        return 0;
+    }
+    window_t *w = &g_windows[idx];
+
+    roll(w, now);
+    if (w->closed.count == 0) {
+        return 0;
+    }
+    out->min = w->closed.min;
+    out->max = w->closed.max;
+    out->mean = (float)(w->closed.sum / w->closed.count);
+    out->count = w->closed.count;
+    out->end = w->closed_end;
+    w->closed.count = 0;
+    return 1;
+}
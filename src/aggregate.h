@@ -0,0 +1,37 @@
+#ifndef AGGREGATE_H
+#define AGGREGATE_H
+
+#include "config.h"
+#include <time.h>
+
+/*
+# Windowed aggregates
+
+A poll list entry with `aggregate_s` keeps the minimum, maximum and mean of every sample taken
+within a window of that many seconds. Windows are aligned to the wall clock (a 60 s window ends
+on every full minute), so the aggregates of several entries and several days line up. Every
+entry keeps the running statistics of the open window and of the last closed one: the memory
+does not depend on the poll rate or the window length.
+
+The poll loop feeds every value it publishes (reads and derived entries) and collects the closed
+windows once per cycle; a window in which no sample succeeded is dropped.
+*/
+
+typedef struct {
+    float min;
+    float max;
+    float mean;
+    unsigned count;   // samples in the window
+    time_t end;       // end of the window (wall clock)
+} aggregate_t;
+
+// match the windows to the poll list of cfg; open windows are dropped
+void aggregate_bind(const config_t *cfg);
+
+// sample of entry idx (published value) taken at now
+void aggregate_sample(size_t idx, float value, time_t now);
+
+// 1 and the window in *out if a window of entry idx has ended by now and was not taken yet
+int aggregate_take(size_t idx, time_t now, aggregate_t *out);
+
+#endif
@@ -0,0 +1,221 @@
+//
+//  Alert rules evaluated on every sample
+//
+//  See alerts.h. Only the poll loop uses this.
+//
+
+#include "alerts.h"
+#include "health.h"
+#include "schedule.h"
+
+#include <json-c/json.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define error_message(fmt, ...) fprintf(stderr, "[ALERTS ERROR] " fmt, ##__VA_ARGS__)
+
+#define STATE_UNKNOWN -1
+#define STATE_OFF 0
+#define STATE_ON 1
+
+typedef struct {
+    float threshold;
+    float clear;        // the rule clears beyond this value
+    uint8_t above;
+    int8_t state;       // STATE_*
+    uint32_t first_burst; // into g_burst
+    uint32_t num_burst;
+    const char *name;
+    const char *entry;
+} predicate_t;
+
+// predicates grouped by entry: those of entry i are g_predicates[g_first[i] .. g_first[i + 1]]
+static predicate_t *g_predicates = NULL;
+static size_t *g_first = NULL;
+static size_t g_num_entries = 0;
+static size_t *g_burst = NULL;
+
+// names of the rules, owned here - the topics of removed rules are cleared on the next bind
+static char **g_names = NULL;
+static char **g_entries = NULL;
+static size_t g_num_rules = 0;
+
+static const char *g_topic_root = "studer";
+static struct mosquitto *g_mosq = NULL;
+
+void alerts_init(const char *topic_root, struct mosquitto *mosq)
+{
+    g_topic_root = topic_root;
+    g_mosq = mosq;
+}
+
+static size_t entry_index(const config_t *cfg, const char *name)
+{
+    size_t i;
+    for (i = 0; i < cfg->num_parameters && strcmp(cfg->parameters[i].name, name) != 0; i++) {
+    }
+    return i; // config_load() checked that it exists
+}
+
+static void clear_topic(const char *name)
+{
+    char topic[256];
+    snprintf(topic, sizeof(topic), "%s/alert/%s", g_topic_root, name);
+    if (g_mosq != NULL) {
+        health_publish(g_mosq, NULL, topic, 0, NULL, 1, true);
+    }
+}
+
+static void free_rules(void)
+{
+    for (size_t r = 0; r < g_num_rules; r++) {
+        free(g_names[r]);
+        free(g_entries[r]);
+    }
+    free(g_names);
+    free(g_entries);
+    free(g_predicates);
+    free(g_first);
+    free(g_burst);
+    g_names = g_entries = NULL;
+    g_predicates = NULL;
+    g_first = g_burst = NULL;
+    g_num_rules = g_num_entries = 0;
+}
+
+void alerts_bind(const config_t *cfg)
+{
+    // rules that are gone must not leave a retained state behind
+    for (size_t r = 0; r < g_num_rules; r++) {
+        size_t k;
+        for (k = 0; k < cfg->num_alerts && strcmp(cfg->alerts[k].name, g_names[r]) != 0; k++) {
+        }
+        if (k == cfg->num_alerts) {
+            clear_topic(g_names[r]);
+        }
+    }
+    free_rules();
+
+    size_t n = cfg->num_alerts;
+    size_t num_burst = 0;
+    for (size_t r = 0; r < n; r++) {
+        num_burst += cfg->alerts[r].num_burst;
+    }
+    g_predicates = calloc(n ? n : 1, sizeof(predicate_t));
+    g_first = calloc(cfg->num_parameters + 1, sizeof(size_t));
+    g_burst = calloc(num_burst ? num_burst : 1, sizeof(size_t));
+    g_names = calloc(n ? n : 1, sizeof(char *));
+    g_entries = calloc(n ? n : 1, sizeof(char *));
+    if (g_predicates == NULL || g_first == NULL || g_burst == NULL || g_names == NULL || g_entries == NULL) {
+        error_message("out of memory\n");
+        free_rules();
+        return;
+    }
+    g_num_entries = cfg->num_parameters;
+    g_num_rules = n;
+
+    // count per entry, then place every rule behind the ones of the entries before it
+    size_t *idx = calloc(n ? n : 1, sizeof(size_t));
+    if (idx == NULL) {
+        error_message("out of memory\n");
+        free_rules();
+        return;
+    }
+    for (size_t r = 0; r < n; r++) {
+        idx[r] = entry_index(cfg, cfg->alerts[r].entry);
+        g_first[idx[r] + 1]++;
+    }
+    for (size_t i = 0; i < g_num_entries; i++) {
+        g_first[i + 1] += g_first[i];
+    }
+
+    size_t burst = 0;
+    for (size_t r = 0; r < n; r++) {
+        const alert_rule_t *rule = &cfg->alerts[r];
+        size_t slot = g_first[idx[r]];
+        while (g_predicates[slot].name != NULL) {
+            slot++;
+        }
+        predicate_t *p = &g_predicates[slot];
+
+        g_names[r] = strdup(rule->name);
+        g_entries[r] = strdup(rule->entry);
+        p->name = g_names[r] ? g_names[r] : "";
+        p->entry = g_entries[r] ? g_entries[r] : "";
+        p->above = (uint8_t)rule->above;
+        p->threshold = rule->threshold;
+        p->clear = rule->above ? rule->threshold - rule->hysteresis : rule->threshold + rule->hysteresis;
+        p->state = STATE_UNKNOWN;
+        p->first_burst = (uint32_t)burst;
+        p->num_burst = (uint32_t)rule->num_burst;
+        for (size_t j = 0; j < rule->num_burst; j++) {
+            g_burst[burst++] = entry_index(cfg, rule->burst[j]);
+        }
+    }
+    free(idx);
+
+    if (n > 0) {
+        printf("[%ld] %zu alert rules on %s/alert\n", time(NULL), n, g_topic_root);
+    }
+}
+
+static void publish_state(const predicate_t *p, float value)
+{
+    char topic[256];
+
+    struct json_object *obj = json_object_new_object();
+    json_object_object_add(obj, "state", json_object_new_string(p->state == STATE_ON ? "on" : "off"));
+    json_object_object_add(obj, "entry", json_object_new_string(p->entry));
+    json_object_object_add(obj, "value", json_object_new_double(round(value * 1000) / 1000));
+    json_object_object_add(obj, "threshold", json_object_new_double(round(p->threshold * 1000) / 1000));
+    json_object_object_add(obj, "timestamp", json_object_new_int64(time(NULL)));
+
+    const char *json_str = json_object_to_json_string(obj);
+    snprintf(topic, sizeof(topic), "%s/alert/%s", g_topic_root, p->name);
+    if (g_mosq != NULL) {
+        health_publish(g_mosq, NULL, topic, (int)strlen(json_str), json_str, 1, true);
+    }
+    json_object_put(obj);
+}
+
+void alerts_check(size_t idx, float value)
+{
+    if (idx >= g_num_entries) {
+        return;
+    }
+
+    for (size_t k = g_first[idx]; k < g_first[idx + 1]; k++) {
+        predicate_t *p = &g_predicates[k];
+        int fires = p->above ? value > p->threshold : value < p->threshold;
+        int clears = p->above ? value < p->clear : value > p->clear;
+        int8_t state = p->state;
+
+        if (fires) {
+            state = STATE_ON;
+        } else if (clears || state == STATE_UNKNOWN) {
+            state = STATE_OFF;
+        }
+
+        if (state != p->state) {
+            int known = p->state != STATE_UNKNOWN;
+            p->state = state;
+            publish_state(p, value);
+            if (known || state == STATE_ON) {
+                printf("[%ld] Alert %s %s: %s = %.3f\n", time(NULL), p->name, state == STATE_ON ? "fired" : "cleared", p->entry, value);
+            }
+        }
+
+        // keep the related entries at their burst rate while the rule fires
+        if (p->state == STATE_ON && p->num_burst > 0) {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            for (uint32_t b = 0; b < p->num_burst; b++) {
+                schedule_burst(g_burst[p->first_burst + b], &now);
+            }
+        }
+    }
+}
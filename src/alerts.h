@@ -0,0 +1,31 @@
+#ifndef ALERTS_H
+#define ALERTS_H
+
+#include "config.h"
+#include <mosquitto.h>
+
+/*
+# Alerts
+
+The alert rules of the configuration (config.h) are compiled into a flat array of threshold
+predicates, grouped by the entry they watch, and evaluated on every sample right after it is
+decoded - no broker or Home Assistant in the loop. A rule fires when its entry goes above (or
+below) the threshold and clears once it is back by the hysteresis.
+
+Every change of state is published at once with QoS 1 (retained) on <root>/alert/<name>:
+  {"state": "on", "entry": "batt_voltage", "value": 45.8, "threshold": 46.0, "timestamp": 1503571330}
+The first sample after startup or a reload publishes the current state, so a retained "on" of a
+previous run never sticks. While a rule fires, its `burst` entries are read at their burst rate
+(see schedule.h).
+*/
+
+// topic_root is the common MQTT topic prefix (e.g. "studer")
+void alerts_init(const char *topic_root, struct mosquitto *mosq);
+
+// compile the rules of cfg; the topics of rules that are gone are cleared
+void alerts_bind(const config_t *cfg);
+
+// evaluate the rules watching entry idx against its new value (published value)
+void alerts_check(size_t idx, float value);
+
+#endif
@@ -0,0 +1,435 @@
+//
+//  Serial bus access: single SCOM round trips and the request queue that lets
+//  other threads and local clients share the one serial link
+//
+
+#include "bus.h"
+#include "bus_stats.h"
+#include "pacing.h"
+#include "serial.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+// per-priority FIFO lists
+static bus_request_t *g_queue_head[BUS_PRIO_COUNT];
+static bus_request_t *g_queue_tail[BUS_PRIO_COUNT];
+static int g_queue_length = 0;
+static int g_shutdown = 0;
+
+static pthread_mutex_t g_queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_queue_cond;  // signalled when a request is queued
+static pthread_cond_t g_done_cond;   // signalled when a request is completed
+
+// fields of an encoded request frame: frame header, service header (flags, service_id), then the
+// property header (object_type, object_id, property_id)
+#define REQUEST_DST_ADDR_OFFSET 6
+#define REQUEST_OBJECT_ID_OFFSET (SCOM_FRAME_HEADER_SIZE + 2 + 2)
+
+// frame_flags of the last response header; only touched by the bus thread
+static scom_frame_flags_t g_frame_flags;
+
+// where a round trip spent its time, for the bus statistics
+typedef struct {
+    struct timespec header;   // frame header of the answer complete
+    struct timespec body;     // rest of the frame complete
+    size_t received;          // bytes of the answer
+} transfer_times_t;
+
+static int64_t elapsed_ns(const struct timespec *from, const struct timespec *to)
+{
+    return (int64_t)(to->tv_sec - from->tv_sec) * 1000000000 + (to->tv_nsec - from->tv_nsec);
+}
+
+static int transfer(const scomx_enc_result_t *enc, scomx_dec_result_t *dec, transfer_times_t *times)
+{
+    scomx_header_dec_result_t dechdr;
+    int bytecounter; // bytes transferred, -1 on an error of the port
+    char readbuf[SCOMX_MAX_FRAME_SIZE];
+
+    memset(dec, 0, sizeof(*dec));
+
+    if (enc->error != SCOM_ERROR_NO_ERROR) {
+        dec->error = enc->error;
+        return -1;
+    }
+
+#ifdef SERIAL_DEBUG
+    printf("[SCOM DEBUG] Encoded command (%zu bytes): ", enc->length);
+    for (size_t i = 0; i < enc->length; i++) {
+        printf("%02X ", (unsigned char)enc->data[i]);
+    }
+    printf("\n");
+#endif
+
+    // Write the encoded command to the serial port
+    bytecounter = serial_write(enc->data, enc->length);
+    if (bytecounter < 0 || (size_t)bytecounter != enc->length) {
+        printf("Serial write failed: sent %d of %zu bytes\n", bytecounter, enc->length);
+        serial_flush(); // Clear buffer on write failure
+        dec->error = SCOM_ERROR_STACK_PORT_WRITE_FAILED;
+        return -1;
+    }
+
+    // Read the frame header from the serial port
+    bytecounter = serial_read(readbuf, SCOM_FRAME_HEADER_SIZE);
+    times->received = bytecounter > 0 ? (size_t)bytecounter : 0;
+    if (bytecounter != SCOM_FRAME_HEADER_SIZE) {
+        if (bytecounter == 0) {
+            printf("Serial timeout: no header received (inverter disconnected?)\n");
+        } else {
+            printf("Serial header read failed: got %d of %d bytes\n", bytecounter, SCOM_FRAME_HEADER_SIZE);
+        }
+        serial_flush(); // Clear buffer on error
+        dec->error = SCOM_ERROR_STACK_PORT_READ_FAILED;
+        return -1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &times->header);
+
+    // Decode the frame header
+    dechdr = scomx_decode_frame_header(readbuf, SCOM_FRAME_HEADER_SIZE);
+    if (dechdr.error != SCOM_ERROR_NO_ERROR) {
+#ifdef SERIAL_DEBUG
+        printf("[SCOM DEBUG] Header decode failed: error %d\n", dechdr.error);
+#endif
+        serial_flush(); // Clear buffer on error
+        dec->error = dechdr.error;
+        return -1;
+    }
+    g_frame_flags = dechdr.frame_flags;
+#ifdef SERIAL_DEBUG
+    printf("[SCOM DEBUG] Header decoded, need to read %zu more bytes\n", dechdr.length_to_read);
+#endif
+
+    // Sanity check on length to prevent hang
+    if (dechdr.length_to_read > sizeof(readbuf) || dechdr.length_to_read == 0) {
+#ifdef SERIAL_DEBUG
+        printf("[SCOM DEBUG] Invalid length_to_read: %zu (buffer size: %zu)\n", dechdr.length_to_read, sizeof(readbuf));
+#endif
+        serial_flush(); // Clear buffer on error
+        dec->error = SCOM_ERROR_INVALID_FRAME;
+        return -1;
+    }
+
+    // Read the frame data from the serial port
+    bytecounter = serial_read(readbuf, dechdr.length_to_read);
+    times->received += bytecounter > 0 ? (size_t)bytecounter : 0;
+    if (bytecounter < 0 || (size_t)bytecounter != dechdr.length_to_read) {
+        if (bytecounter == 0) {
+            printf("Serial timeout: no data received\n");
+        } else {
+            printf("Serial data read failed: got %d of %zu bytes\n", bytecounter, dechdr.length_to_read);
+        }
+        serial_flush(); // Clear buffer on error
+        dec->error = SCOM_ERROR_STACK_PORT_READ_FAILED;
+        return -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &times->body);
+
+    // Decode the frame data
+    *dec = scomx_decode_frame(readbuf, dechdr.length_to_read);
+#ifdef SERIAL_DEBUG
+    if (dec->error != SCOM_ERROR_NO_ERROR) {
+        printf("[SCOM DEBUG] Frame decode failed: error %d (%s)\n", dec->error, scomx_err2str(dec->error));
+    }
+#endif
+
+    return 0;
+}
+
+int bus_transfer(const scomx_enc_result_t *enc, scomx_dec_result_t *dec)
+{
+    struct timespec start, end;
+    transfer_times_t times;
+
+    // taken now: the answer is decoded into the buffer that holds the request
+    int tracked = enc->error == SCOM_ERROR_NO_ERROR && enc->length >= REQUEST_OBJECT_ID_OFFSET + 4;
+    uint32_t dst_addr = tracked ? scom_read_le32(&enc->data[REQUEST_DST_ADDR_OFFSET]) : 0;
+    uint32_t object_id = tracked ? scom_read_le32(&enc->data[REQUEST_OBJECT_ID_OFFSET]) : 0;
+    size_t request_length = enc->length;
+
+    memset(&times, 0, sizeof(times));
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int ret = transfer(enc, dec, &times);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    // the turnaround and outcome of every round trip steer the request rate
+    int64_t turnaround_ns = elapsed_ns(&start, &end);
+    if (ret == 0) {
+        int slow_down = dec->error == SCOM_ERROR_GATEWAY_BUSY || dec->error == SCOM_ERROR_RESPONSE_TIMEOUT;
+        // a long answer is not a slow one: only the time the gateway took counts
+        int64_t wire_ns = (int64_t)(request_length + times.received) * serial_byte_time_ns();
+        pacing_record(slow_down ? PACING_SLOW_DOWN : PACING_OK, turnaround_ns > wire_ns ? turnaround_ns - wire_ns : 0);
+    } else if (dec->error != SCOM_ERROR_STACK_PORT_WRITE_FAILED && enc->error == SCOM_ERROR_NO_ERROR) {
+        pacing_record(PACING_TIMEOUT, turnaround_ns); // no or a broken answer
+    }
+
+    // attributed to the target of the request, also when the answer is broken
+    if (tracked) {
+        int complete = times.body.tv_sec != 0;
+        bus_stats_record(dst_addr, object_id, turnaround_ns, complete ? elapsed_ns(&start, &times.header) : -1,
+                         complete ? elapsed_ns(&times.header, &times.body) : -1, request_length + times.received, dec->error);
+    }
+    return ret;
+}
+
+scom_frame_flags_t bus_frame_flags(void)
+{
+    return g_frame_flags;
+}
+
+void bus_init(void)
+{
+    pthread_condattr_t attr;
+
+    // deadlines in bus_idle() are on the monotonic clock
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&g_queue_cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    pthread_cond_init(&g_done_cond, NULL);
+}
+
+int bus_submit(bus_request_t *req)
+{
+    int prio = req->request.priority;
+    if (prio < 0 || prio >= BUS_PRIO_COUNT) {
+        prio = BUS_PRIO_INTERACTIVE;
+    }
+
+    pthread_mutex_lock(&g_queue_mutex);
+    if (g_shutdown) {
+        pthread_mutex_unlock(&g_queue_mutex);
+        return -1;
+    }
+
+    req->done = 0;
+    req->next = NULL;
+    if (g_queue_tail[prio]) {
+        g_queue_tail[prio]->next = req;
+    } else {
+        g_queue_head[prio] = req;
+    }
+    g_queue_tail[prio] = req;
+    g_queue_length++;
+
+    pthread_cond_signal(&g_queue_cond);
+    pthread_mutex_unlock(&g_queue_mutex);
+    return 0;
+}
+
+int bus_submit_wait(bus_request_t *req)
+{
+    if (bus_submit(req) != 0) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&g_queue_mutex);
+    while (!req->done) {
+        pthread_cond_wait(&g_done_cond, &g_queue_mutex);
+    }
+    pthread_mutex_unlock(&g_queue_mutex);
+
+    return req->response.error == SCOM_ERROR_STACK_PORT_NOT_FOUND ? -1 : 0;
+}
+
+void bus_execute(bus_request_t *req)
+{
+    const bus_api_request_t *rq = &req->request;
+    bus_api_response_t *rs = &req->response;
+    scomx_enc_result_t enc;
+    scomx_dec_result_t dec;
+
+    memset(rs, 0, sizeof(*rs));
+    rs->magic = BUS_API_MAGIC;
+
+    if (rq->service_id == SCOM_WRITE_PROPERTY_SERVICE) {
+        enc = scomx_encode_write_property(rq->dst_addr, (scom_object_type_t)rq->object_type, rq->object_id, rq->property_id, rq->data,
+                                          rq->data_len > BUS_API_MAX_DATA ? BUS_API_MAX_DATA : rq->data_len);
+    } else if (rq->service_id == SCOM_READ_PROPERTY_SERVICE) {
+        if (scomx_is_multicast(rq->dst_addr) && rq->object_type == SCOM_PARAMETER_OBJECT_TYPE) {
+            // the gateway would only answer with an error - save the bus time
+            // (user infos at 100 are system totals and can be read)
+            rs->error = SCOM_ERROR_MULTICAST_READ_NOT_SUPPORTED;
+            return;
+        }
+        enc = scomx_encode_read_property(rq->dst_addr, (scom_object_type_t)rq->object_type, rq->object_id, rq->property_id);
+    } else {
+        rs->error = SCOM_ERROR_SERVICE_NOT_SUPPORTED;
+        return;
+    }
+
+#ifdef SERIAL_DEBUG
+    printf("[SCOM DEBUG] Queued %s of object %u (type %u, property %u) at addr %u\n",
+           rq->service_id == SCOM_WRITE_PROPERTY_SERVICE ? "write" : "read", rq->object_id, rq->object_type, rq->property_id, rq->dst_addr);
+#endif
+
+    bus_transfer(&enc, &dec);
+    rs->error = dec.error;
+    rs->src_addr = dec.src_addr;
+
+    if (dec.error == SCOM_ERROR_NO_ERROR) {
+        // make sure the answer belongs to our request (stale frames after a timeout)
+        if (dec.service_id != rq->service_id || dec.object_type != rq->object_type || dec.object_id != rq->object_id ||
+            dec.property_id != rq->property_id) {
+            printf("Queued request response mismatch: expected obj_id=%u, got obj_id=%u addr=%u\n", rq->object_id, dec.object_id, dec.src_addr);
+            serial_flush();
+            rs->error = SCOM_ERROR_STACK_PROPERTY_HEADER_DOESNT_MATCH;
+        } else {
+            rs->data_len = dec.length > BUS_API_MAX_DATA ? BUS_API_MAX_DATA : dec.length;
+            memcpy(rs->data, dec.data, rs->data_len);
+        }
+    }
+}
+
+// take the next request to execute; background requests only if allow_background
+// caller holds g_queue_mutex
+static bus_request_t *dequeue_locked(int allow_background)
+{
+    int last = allow_background ? BUS_PRIO_BACKGROUND : BUS_PRIO_BACKGROUND - 1;
+
+    for (int prio = 0; prio <= last; prio++) {
+        bus_request_t *req = g_queue_head[prio];
+        if (req) {
+            g_queue_head[prio] = req->next;
+            if (g_queue_head[prio] == NULL) {
+                g_queue_tail[prio] = NULL;
+            }
+            req->next = NULL;
+            g_queue_length--;
+            return req;
+        }
+    }
+    return NULL;
+}
+
+static void complete(bus_request_t *req)
+{
+    if (req->on_complete) {
+        // asynchronous request - the callback owns it from now on and may free it
+        req->on_complete(req);
+        return;
+    }
+
+    pthread_mutex_lock(&g_queue_mutex);
+    req->done = 1;
+    pthread_cond_broadcast(&g_done_cond);
+    pthread_mutex_unlock(&g_queue_mutex);
+}
+
+static int service(int allow_background)
+{
+    int executed = 0;
+    int background_done = !allow_background;
+
+    for (;;) {
+        pthread_mutex_lock(&g_queue_mutex);
+        bus_request_t *req = g_queue_length ? dequeue_locked(!background_done) : NULL;
+        pthread_mutex_unlock(&g_queue_mutex);
+
+        if (req == NULL) {
+            break;
+        }
+        if (req->request.priority >= BUS_PRIO_BACKGROUND) {
+            background_done = 1;
+        }
+
+        bus_execute(req);
+        complete(req);
+        executed++;
+    }
+
+    return executed;
+}
+
+int bus_service_pending(void)
+{
+    return service(1);
+}
+
+int bus_service_urgent(void)
+{
+    return service(0);
+}
+
+void bus_idle(unsigned usec)
+{
+    struct timespec deadline;
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += usec / 1000000;
+    deadline.tv_nsec += (long)(usec % 1000000) * 1000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    bus_idle_until(&deadline);
+}
+
+static int deadline_passed(const struct timespec *deadline)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec > deadline->tv_sec || (now.tv_sec == deadline->tv_sec && now.tv_nsec >= deadline->tv_nsec);
+}
+
+void bus_idle_until(const struct timespec *deadline)
+{
+    for (;;) {
+        bus_service_pending();
+
+        // a steady stream of client requests must not hold up the poll loop past its deadline;
+        // what is still queued runs in the next gap
+        if (deadline_passed(deadline)) {
+            return;
+        }
+
+        pthread_mutex_lock(&g_queue_mutex);
+        int rc = 0;
+        while (g_queue_length == 0 && !g_shutdown && rc != ETIMEDOUT) {
+            rc = pthread_cond_timedwait(&g_queue_cond, &g_queue_mutex, deadline);
+        }
+        int pending = g_queue_length;
+        pthread_mutex_unlock(&g_queue_mutex);
+
+        if (!pending || g_shutdown) {
+            return;
+        }
+    }
+}
+
+void bus_pace(void)
+{
+    bus_idle(pacing_gap_us());
+}
+
+void bus_shutdown(void)
+{
+    bus_request_t *req;
+
+    pthread_mutex_lock(&g_queue_mutex);
+    g_shutdown = 1;
+    pthread_cond_broadcast(&g_queue_cond);
+    pthread_mutex_unlock(&g_queue_mutex);
+
+    for (;;) {
+        pthread_mutex_lock(&g_queue_mutex);
+        req = dequeue_locked(1);
+        pthread_mutex_unlock(&g_queue_mutex);
+        if (req == NULL) {
+            break;
+        }
+
+        memset(&req->response, 0, sizeof(req->response));
+        req->response.magic = BUS_API_MAGIC;
+        req->response.error = SCOM_ERROR_STACK_PORT_NOT_FOUND;
+        complete(req);
+    }
+}
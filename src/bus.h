@@ -0,0 +1,71 @@
+#ifndef BUS_H
+#define BUS_H
+
+#include "../scomlib_extra/scomlib_extra.h"
+#include "bus_api.h"
+#include <time.h>
+
+// Single SCOM round trip on the serial port: send the encoded request, read and decode the response.
+// Returns 0 when a complete response frame was decoded (dec->error holds the SCOM result,
+// which may be an application error reported by the device) or -1 on a transport failure
+// (write failed, timeout, broken frame). The serial input buffer is flushed on failure.
+// Every round trip is accounted in the request pacing (pacing.h) and the bus statistics (bus_stats.h).
+// Only the thread that owns the serial port may call this.
+int bus_transfer(const scomx_enc_result_t *enc, scomx_dec_result_t *dec);
+
+// Xcom-232i status flags (is_message_pending, ...) from the last response header (bus thread only)
+scom_frame_flags_t bus_frame_flags(void);
+
+// A request queued for execution on the serial bus by the thread owning the port
+typedef struct bus_request {
+    bus_api_request_t request;
+    bus_api_response_t response;
+
+    // called on the bus thread once the response is filled in; the callback takes ownership
+    // of the request and may free it. NULL for requests queued with bus_submit_wait().
+    void (*on_complete)(struct bus_request *req);
+    void *ctx;
+
+    int done; // set when a bus_submit_wait() request is completed; protected by the queue lock
+    struct bus_request *next;
+} bus_request_t;
+
+// initialize the request queue
+void bus_init(void);
+
+// queue a request; it is completed asynchronously via req->on_complete
+// returns -1 if the bus is shutting down
+int bus_submit(bus_request_t *req);
+
+// queue a request and block the calling thread until it has been executed
+// returns -1 if the bus is shutting down before the request was executed
+int bus_submit_wait(bus_request_t *req);
+
+// BUS THREAD FUNCTIONS
+
+// execute a single request right now (bus thread only)
+void bus_execute(bus_request_t *req);
+
+// execute all queued urgent and interactive requests plus at most one background request;
+// call before every background poll so queued requests wait at most one frame time
+// returns the number of executed requests
+int bus_service_pending(void);
+
+// same without the background request, for gaps that only preemption may use (between the
+// members of a snapshot set)
+int bus_service_urgent(void);
+
+// sleep for up to usec microseconds, executing queued requests as soon as they arrive
+void bus_idle(unsigned usec);
+
+// same up to an absolute CLOCK_MONOTONIC deadline; returns once it has passed, also while
+// requests are still queued (at most one service pass late)
+void bus_idle_until(const struct timespec *deadline);
+
+// leave the bus alone for the current adaptive request gap (pacing_gap_us())
+void bus_pace(void);
+
+// fail all queued requests and reject new ones; wakes every waiter
+void bus_shutdown(void);
+
+#endif
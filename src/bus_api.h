@@ -0,0 +1,78 @@
+#ifndef BUS_API_H
+#define BUS_API_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+# Serial bus request API
+
+The daemon owns the Xcom-232i serial port. Other programs on the same host (e.g. tools/studer_reset)
+must not open the tty themselves - they connect to the daemon's unix socket instead and send
+read/write property requests, which the daemon multiplexes onto the serial link between its own
+background polls.
+
+The protocol is a simple exchange of fixed-size structs over a SOCK_STREAM socket: the client
+writes one bus_api_request_t and reads back one bus_api_response_t, as many times as it likes on
+the same connection. All integers are in host byte order (the socket is local). Property data is
+passed as raw SCOM bytes, i.e. little endian as on the wire.
+*/
+
+#define BUS_API_SOCKET_PATH "/tmp/studer232-to-mqtt.sock"
+#define BUS_API_MAGIC 0x53425553 // "SUBS"
+#define BUS_API_MAX_DATA 64
+
+/** \brief request priorities, lower value is served first */
+typedef enum {
+    BUS_PRIO_URGENT = 0,      // parameter writes - preempt everything else
+    BUS_PRIO_INTERACTIVE = 1, // reads requested by a client or a user
+    BUS_PRIO_BACKGROUND = 2,  // bulk transfers; interleaved one frame at a time with polling
+} bus_priority_t;
+
+#define BUS_PRIO_COUNT 3
+
+typedef struct {
+    uint32_t magic;       // BUS_API_MAGIC
+    uint8_t service_id;   // SCOM_READ_PROPERTY_SERVICE or SCOM_WRITE_PROPERTY_SERVICE
+    uint8_t priority;     // bus_priority_t
+    uint16_t object_type; // scom_object_type_t
+    uint32_t dst_addr;
+    uint32_t object_id;
+    uint16_t property_id;
+    uint16_t data_len;    // number of valid bytes in data (writes only)
+    char data[BUS_API_MAX_DATA];
+} bus_api_request_t;
+
+typedef struct {
+    uint32_t magic;    // BUS_API_MAGIC
+    int32_t error;     // scom_error_t, SCOM_ERROR_NO_ERROR on success
+    uint32_t src_addr; // address of the device that answered
+    uint16_t data_len; // number of valid bytes in data (reads only)
+    uint16_t reserved;
+    char data[BUS_API_MAX_DATA];
+} bus_api_response_t;
+
+// CLIENT FUNCTIONS
+
+// connect to the daemon; returns socket fd or -1 if the daemon is not running
+int bus_client_connect(const char *path);
+
+// send a request and wait for the response; returns 0 when a response was received
+// (check response->error for the SCOM result) or -1 when the connection failed
+int bus_client_transfer(int fd, const bus_api_request_t *request, bus_api_response_t *response);
+
+// helpers building the request for the common cases
+int bus_client_read_property(int fd, uint32_t dst_addr, uint16_t object_type, uint32_t object_id, uint16_t property_id, bus_api_response_t *response);
+int bus_client_write_property(int fd, uint32_t dst_addr, uint16_t object_type, uint32_t object_id, uint16_t property_id, const void *data,
+                              uint16_t data_len, bus_api_response_t *response);
+
+void bus_client_close(int fd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
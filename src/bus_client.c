@@ -0,0 +1,130 @@
+//
+//  Client side of the serial bus request API (see bus_api.h)
+//
+
+#include "bus_api.h"
+#include "../scomlib/scom_data_link.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static int write_all(int fd, const void *ptr, size_t size)
+{
+    const char *buf = (const char *)ptr;
+    size_t done = 0;
+
+    while (done < size) {
+        ssize_t ret = write(fd, buf + done, size - done);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret <= 0) {
+            return -1;
+        }
+        done += ret;
+    }
+    return 0;
+}
+
+static int read_all(int fd, void *ptr, size_t size)
+{
+    char *buf = (char *)ptr;
+    size_t done = 0;
+
+    while (done < size) {
+        ssize_t ret = read(fd, buf + done, size - done);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret <= 0) {
+            return -1;
+        }
+        done += ret;
+    }
+    return 0;
+}
+
+int bus_client_connect(const char *path)
+{
+    struct sockaddr_un addr;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+int bus_client_transfer(int fd, const bus_api_request_t *request, bus_api_response_t *response)
+{
+    if (write_all(fd, request, sizeof(*request)) != 0) {
+        return -1;
+    }
+    if (read_all(fd, response, sizeof(*response)) != 0) {
+        return -1;
+    }
+    if (response->magic != BUS_API_MAGIC) {
+        return -1;
+    }
+    return 0;
+}
+
+int bus_client_read_property(int fd, uint32_t dst_addr, uint16_t object_type, uint32_t object_id, uint16_t property_id, bus_api_response_t *response)
+{
+    bus_api_request_t req;
+
+    memset(&req, 0, sizeof(req));
+    req.magic = BUS_API_MAGIC;
+    req.service_id = SCOM_READ_PROPERTY_SERVICE;
+    req.priority = BUS_PRIO_INTERACTIVE;
+    req.object_type = object_type;
+    req.dst_addr = dst_addr;
+    req.object_id = object_id;
+    req.property_id = property_id;
+
+    return bus_client_transfer(fd, &req, response);
+}
+
+int bus_client_write_property(int fd, uint32_t dst_addr, uint16_t object_type, uint32_t object_id, uint16_t property_id, const void *data,
+                              uint16_t data_len, bus_api_response_t *response)
+{
+    bus_api_request_t req;
+
+    if (data_len > BUS_API_MAX_DATA) {
+        return -1;
+    }
+
+    memset(&req, 0, sizeof(req));
+    req.magic = BUS_API_MAGIC;
+    req.service_id = SCOM_WRITE_PROPERTY_SERVICE;
+    req.priority = BUS_PRIO_URGENT;
+    req.object_type = object_type;
+    req.dst_addr = dst_addr;
+    req.object_id = object_id;
+    req.property_id = property_id;
+    req.data_len = data_len;
+    memcpy(req.data, data, data_len);
+
+    return bus_client_transfer(fd, &req, response);
+}
+
+void bus_client_close(int fd)
+{
+    if (fd >= 0) {
+        close(fd);
+    }
+}
@@ -0,0 +1,183 @@
+//
+//  Unix-socket server of the serial bus request API (see bus_api.h)
+//
+//  Every client connection gets its own thread which reads requests, queues them
+//  on the bus and blocks until the poll loop has executed them.
+//
+
+#define _GNU_SOURCE // accept4()
+
+#include "bus_server.h"
+#include "bus.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define error_message(fmt, ...) fprintf(stderr, "[BUS ERROR] " fmt, ##__VA_ARGS__)
+
+#define BUS_SERVER_BACKLOG 4
+
+static int g_listen_fd = -1;
+static char g_socket_path[108];
+static pthread_t g_accept_thread;
+
+static int read_request(int fd, bus_api_request_t *req)
+{
+    char *buf = (char *)req;
+    size_t done = 0;
+
+    while (done < sizeof(*req)) {
+        ssize_t ret = read(fd, buf + done, sizeof(*req) - done);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret <= 0) {
+            return -1; // client closed the connection
+        }
+        done += ret;
+    }
+    return 0;
+}
+
+static int write_response(int fd, const bus_api_response_t *res)
+{
+    const char *buf = (const char *)res;
+    size_t done = 0;
+
+    while (done < sizeof(*res)) {
+        ssize_t ret = send(fd, buf + done, sizeof(*res) - done, MSG_NOSIGNAL);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret <= 0) {
+            return -1;
+        }
+        done += ret;
+    }
+    return 0;
+}
+
+static void *client_thread(void *arg)
+{
+    int fd = (int)(intptr_t)arg;
+    bus_request_t req;
+
+    printf("[%ld] Bus client connected (fd %d)\n", time(NULL), fd);
+
+    while (read_request(fd, &req.request) == 0) {
+        if (req.request.magic != BUS_API_MAGIC) {
+            error_message("invalid request magic from client fd %d\n", fd);
+            break;
+        }
+
+        // clients may only ask for interactive or urgent service - background is for bulk transfers
+        if (req.request.priority > BUS_PRIO_INTERACTIVE) {
+            req.request.priority = BUS_PRIO_INTERACTIVE;
+        }
+        req.on_complete = NULL;
+        req.ctx = NULL;
+
+        if (bus_submit_wait(&req) != 0) {
+            // daemon shutting down - still answer so the client does not hang
+            write_response(fd, &req.response);
+            break;
+        }
+
+        if (write_response(fd, &req.response) != 0) {
+            break;
+        }
+    }
+
+    printf("[%ld] Bus client disconnected (fd %d)\n", time(NULL), fd);
+    close(fd);
+    return NULL;
+}
+
+static void *accept_thread(void *arg __attribute__((unused)))
+{
+    for (;;) {
+        int fd = accept4(g_listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            break; // listening socket closed by bus_server_stop()
+        }
+
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, client_thread, (void *)(intptr_t)fd) != 0) {
+            error_message("failed to create client thread\n");
+            close(fd);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+    return NULL;
+}
+
+int bus_server_start(const char *path)
+{
+    struct sockaddr_un addr;
+
+    g_listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (g_listen_fd < 0) {
+        error_message("socket error %d: %s\n", errno, strerror(errno));
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+    snprintf(g_socket_path, sizeof(g_socket_path), "%s", path);
+
+    unlink(path); // stale socket from a previous run
+
+    if (bind(g_listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        error_message("bind(%s) error %d: %s\n", path, errno, strerror(errno));
+        close(g_listen_fd);
+        g_listen_fd = -1;
+        return -1;
+    }
+
+    // clients can write parameters - only the daemon's user and group may connect
+    chmod(path, 0660);
+
+    if (listen(g_listen_fd, BUS_SERVER_BACKLOG) != 0) {
+        error_message("listen error %d: %s\n", errno, strerror(errno));
+        close(g_listen_fd);
+        g_listen_fd = -1;
+        return -1;
+    }
+
+    if (pthread_create(&g_accept_thread, NULL, accept_thread, NULL) != 0) {
+        error_message("failed to create accept thread\n");
+        close(g_listen_fd);
+        g_listen_fd = -1;
+        return -1;
+    }
+
+    return 0;
+}
+
+void bus_server_stop(void)
+{
+    if (g_listen_fd < 0) {
+        return;
+    }
+
+    // shutdown() wakes the accept thread blocked in accept()
+    shutdown(g_listen_fd, SHUT_RDWR);
+    pthread_join(g_accept_thread, NULL);
+    close(g_listen_fd);
+    g_listen_fd = -1;
+
+    unlink(g_socket_path);
+}
@@ -0,0 +1,10 @@
+#ifndef BUS_SERVER_H
+#define BUS_SERVER_H
+
+// start listening on the unix socket at path and serve bus_api requests in background threads
+int bus_server_start(const char *path);
+
+// stop accepting clients and remove the socket file
+void bus_server_stop(void);
+
+#endif
@@ -0,0 +1,210 @@
+//
+//  Latency histograms and utilisation of the serial bus
+//
+//  See bus_stats.h. Recording is a few array increments; the percentiles are only worked out
+//  when a window is taken.
+//
+
+#include "bus_stats.h"
+#include "../scomlib_extra/scomlib_extra.h"
+#include "serial.h"
+
+#include <string.h>
+#include <time.h>
+
+typedef struct {
+    uint32_t counts[BUS_STATS_BUCKETS];
+    uint32_t count;
+    uint32_t max_us;
+    uint64_t sum_us;
+} histogram_t;
+
+typedef struct {
+    uint32_t key;
+    histogram_t header;
+    histogram_t body;
+} target_t;
+
+typedef struct {
+    target_t *entries;
+    size_t count;
+    size_t capacity;
+} target_table_t;
+
+static target_t g_address_entries[BUS_STATS_MAX_ADDRESSES];
+static target_t g_object_entries[BUS_STATS_MAX_OBJECTS];
+static target_table_t g_addresses = {g_address_entries, 0, BUS_STATS_MAX_ADDRESSES};
+static target_table_t g_objects = {g_object_entries, 0, BUS_STATS_MAX_OBJECTS};
+
+static uint64_t g_requests = 0;
+static uint64_t g_busy_ns = 0;
+static uint64_t g_wire_bytes = 0;
+static uint32_t g_untracked = 0;
+static uint32_t g_errors[BUS_STATS_MAX_ERROR];
+static uint32_t g_retries[BUS_STATS_MAX_ERROR];
+static struct timespec g_window_start;
+
+// counter of error; cancelled requests have their own, unknown values share the last one
+static unsigned error_bucket(scom_error_t error)
+{
+    return (unsigned)error <= SCOMX_ERROR_CANCELLED ? (unsigned)error : BUS_STATS_MAX_ERROR - 1;
+}
+
+// values below BUS_STATS_SUB_BUCKETS have a bucket each, above that every power of two is split
+// into BUS_STATS_SUB_BUCKETS buckets
+static unsigned bucket_of(uint32_t us)
+{
+    if (us < BUS_STATS_SUB_BUCKETS) {
+        return us;
+    }
+    unsigned shift = (unsigned)(31 - __builtin_clz(us)) - BUS_STATS_SUB_BITS;
+    unsigned bucket = (shift + 1) * BUS_STATS_SUB_BUCKETS + ((us >> shift) - BUS_STATS_SUB_BUCKETS);
+    return bucket < BUS_STATS_BUCKETS ? bucket : BUS_STATS_BUCKETS - 1;
+}
+
+// highest value that falls into bucket
+static uint32_t bucket_limit(unsigned bucket)
+{
+    if (bucket < BUS_STATS_SUB_BUCKETS) {
+        return bucket;
+    }
+    unsigned shift = bucket / BUS_STATS_SUB_BUCKETS - 1;
+    uint32_t low = (uint32_t)(BUS_STATS_SUB_BUCKETS + bucket % BUS_STATS_SUB_BUCKETS) << shift;
+    return low + (1u << shift) - 1;
+}
+
+static void histogram_add(histogram_t *h, int64_t ns)
+{
+    uint32_t us = ns / 1000 > UINT32_MAX ? UINT32_MAX : (uint32_t)(ns / 1000);
+
+    h->counts[bucket_of(us)]++;
+    h->count++;
+    h->sum_us += us;
+    if (us > h->max_us) {
+        h->max_us = us;
+    }
+}
+
+static uint32_t percentile(const histogram_t *h, unsigned pct)
+{
+    // rank of the sample, rounded up
+    uint64_t rank = ((uint64_t)h->count * pct + 99) / 100;
+    uint64_t seen = 0;
+
+    for (unsigned b = 0; b < BUS_STATS_BUCKETS; b++) {
+        seen += h->counts[b];
+        if (seen >= rank && seen > 0) {
+            uint32_t limit = bucket_limit(b);
+            return limit < h->max_us ? limit : h->max_us;
+        }
+    }
+    return h->max_us;
+}
+
+static void summarize(const histogram_t *h, bus_latency_t *latency)
+{
+    latency->count = h->count;
+    latency->mean_us = h->count ? (uint32_t)(h->sum_us / h->count) : 0;
+    latency->p50_us = percentile(h, 50);
+    latency->p90_us = percentile(h, 90);
+    latency->p99_us = percentile(h, 99);
+    latency->max_us = h->max_us;
+}
+
+// entry of key, added when there is room; NULL otherwise
+static target_t *find_target(target_table_t *table, uint32_t key)
+{
+    for (size_t i = 0; i < table->count; i++) {
+        if (table->entries[i].key == key) {
+            return &table->entries[i];
+        }
+    }
+    if (table->count == table->capacity) {
+        return NULL;
+    }
+    target_t *target = &table->entries[table->count++];
+    memset(target, 0, sizeof(*target));
+    target->key = key;
+    return target;
+}
+
+void bus_stats_record(uint32_t dst_addr, uint32_t object_id, int64_t busy_ns, int64_t header_ns, int64_t body_ns,
+                      size_t wire_bytes, scom_error_t error)
+{
+    if (g_window_start.tv_sec == 0) {
+        clock_gettime(CLOCK_MONOTONIC, &g_window_start);
+    }
+
+    g_requests++;
+    g_busy_ns += busy_ns > 0 ? (uint64_t)busy_ns : 0;
+    g_wire_bytes += wire_bytes;
+    if (error != SCOM_ERROR_NO_ERROR) {
+        g_errors[error_bucket(error)]++;
+    }
+    if (header_ns < 0 || body_ns < 0) {
+        return;
+    }
+
+    target_t *address = find_target(&g_addresses, dst_addr);
+    target_t *object = find_target(&g_objects, object_id);
+    if (address == NULL || object == NULL) {
+        g_untracked++;
+    }
+    if (address != NULL) {
+        histogram_add(&address->header, header_ns);
+        histogram_add(&address->body, body_ns);
+    }
+    if (object != NULL) {
+        histogram_add(&object->header, header_ns);
+        histogram_add(&object->body, body_ns);
+    }
+}
+
+void bus_stats_retry(scom_error_t error)
+{
+    g_retries[error_bucket(error)]++;
+}
+
+static size_t take_targets(target_table_t *table, bus_target_stats_t *out)
+{
+    for (size_t i = 0; i < table->count; i++) {
+        out[i].key = table->entries[i].key;
+        summarize(&table->entries[i].header, &out[i].header);
+        summarize(&table->entries[i].body, &out[i].body);
+    }
+    size_t count = table->count;
+    table->count = 0;
+    return count;
+}
+
+void bus_stats_take(bus_stats_t *stats)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (g_window_start.tv_sec == 0) {
+        g_window_start = now;
+    }
+    double window_ns = (double)(now.tv_sec - g_window_start.tv_sec) * 1e9 + (double)(now.tv_nsec - g_window_start.tv_nsec);
+
+    memset(stats, 0, sizeof(*stats));
+    stats->window_s = window_ns / 1e9;
+    stats->requests = g_requests;
+    stats->untracked = g_untracked;
+    if (window_ns > 0) {
+        stats->busy_pct = 100.0 * (double)g_busy_ns / window_ns;
+        stats->wire_pct = 100.0 * (double)g_wire_bytes * serial_byte_time_ns() / window_ns;
+    }
+    memcpy(stats->errors, g_errors, sizeof(g_errors));
+    memcpy(stats->retries, g_retries, sizeof(g_retries));
+    stats->num_addresses = take_targets(&g_addresses, stats->addresses);
+    stats->num_objects = take_targets(&g_objects, stats->objects);
+
+    g_requests = 0;
+    g_busy_ns = 0;
+    g_wire_bytes = 0;
+    g_untracked = 0;
+    memset(g_errors, 0, sizeof(g_errors));
+    memset(g_retries, 0, sizeof(g_retries));
+    g_window_start = now;
+}
@@ -0,0 +1,78 @@
+#ifndef BUS_STATS_H
+#define BUS_STATS_H
+
+#include "../scomlib/scom_data_link.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+# Bus statistics
+
+Where the time on the serial link goes. Every round trip (bus_transfer()) is accounted with
+
+- request-to-header: from writing the request until the frame header of the answer is in, i.e.
+  the time the Xcom-232i takes to get the value from the device, plus the wire time
+- header-to-body: from the header until the rest of the frame is in
+
+in log-linear histograms (HDR style: BUS_STATS_SUB_BUCKETS buckets per power of two, so a
+percentile is at most 1/8 off) per destination address and per object ID. Round trips without a
+complete answer (timeouts) only count as busy time and as an error.
+
+Errors are counted by scom_error_t, retries of read_param() by the error that caused them. The
+bus is busy from writing a request until its answer is in or the read timed out; the wire time is
+what the bytes of the request and the answer alone take at the current baud rate. The difference
+is the turnaround of the gateway and the devices.
+
+bus_stats_take() summarizes the window since the last call and starts a new one. Only the bus
+thread uses this.
+*/
+
+#define BUS_STATS_SUB_BITS 3
+#define BUS_STATS_SUB_BUCKETS (1 << BUS_STATS_SUB_BITS)
+#define BUS_STATS_BUCKETS (23 * BUS_STATS_SUB_BUCKETS) // up to 2^24 us (16 s)
+#define BUS_STATS_MAX_ADDRESSES 16
+#define BUS_STATS_MAX_OBJECTS 64
+// by error: the scom_error_t values (below 0x100), SCOMX_ERROR_CANCELLED (0x100) and anything else
+#define BUS_STATS_MAX_ERROR 0x102
+
+typedef struct {
+    uint32_t count;
+    uint32_t mean_us;
+    uint32_t p50_us; // upper bounds of the buckets holding the percentiles
+    uint32_t p90_us;
+    uint32_t p99_us;
+    uint32_t max_us;
+} bus_latency_t;
+
+typedef struct {
+    uint32_t key; // destination address or object ID
+    bus_latency_t header;
+    bus_latency_t body;
+} bus_target_stats_t;
+
+typedef struct {
+    double window_s;
+    uint64_t requests;
+    double busy_pct;         // share of the window the link was in use
+    double wire_pct;         // share of the window the bytes alone take at the baud rate
+    uint32_t untracked;      // answers of addresses or objects beyond the tables
+    uint32_t errors[BUS_STATS_MAX_ERROR];  // round trips by scom_error_t
+    uint32_t retries[BUS_STATS_MAX_ERROR]; // read_param() retries by the error that caused them
+    size_t num_addresses;
+    size_t num_objects;
+    bus_target_stats_t addresses[BUS_STATS_MAX_ADDRESSES];
+    bus_target_stats_t objects[BUS_STATS_MAX_OBJECTS];
+} bus_stats_t;
+
+// account one round trip to object_id at dst_addr: busy_ns in total, header_ns until the header
+// and body_ns after it (both < 0 without a complete header), wire_bytes sent and received
+void bus_stats_record(uint32_t dst_addr, uint32_t object_id, int64_t busy_ns, int64_t header_ns, int64_t body_ns,
+                      size_t wire_bytes, scom_error_t error);
+
+// account a retry caused by error
+void bus_stats_retry(scom_error_t error);
+
+// summary of the window since the last call; starts a new window
+void bus_stats_take(bus_stats_t *stats);
+
+#endif
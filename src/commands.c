@@ -0,0 +1,301 @@
+//
+//  MQTT command topics for parameter writes
+//
+//  A command is queued on the bus with urgent priority so it reaches the inverter ahead of
+//  the background polling. Once the write has been acknowledged the value is read back
+//  right away on the same bus slot and the outcome is published on the result topic.
+//
+
+#include "commands.h"
+#include "bus.h"
+#include "health.h"
+
+#include <json-c/json.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+static const char *g_topic_root = NULL;
+static const command_t *g_commands = NULL;
+static size_t g_num_commands = 0;
+
+// in-flight command, owned by the bus from bus_submit() until on_complete()
+typedef struct {
+    bus_request_t bus;
+    const command_t *command;
+    struct mosquitto *mosq;
+    float requested;
+    struct timespec received;
+} command_request_t;
+
+static double elapsed_ms(const struct timespec *since)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec) * 1e3 + (now.tv_nsec - since->tv_nsec) / 1e6;
+}
+
+static void command_topic(const command_t *cmd, const char *suffix, char *buf, size_t size)
+{
+    if (suffix) {
+        snprintf(buf, size, "%s/%s/%s/%s", g_topic_root, cmd->mqtt_prefix, cmd->name, suffix);
+    } else {
+        snprintf(buf, size, "%s/%s/%s", g_topic_root, cmd->mqtt_prefix, cmd->name);
+    }
+}
+
+// parse the MQTT payload into a number; accepts ON/OFF and true/false for booleans
+static int parse_value(const command_t *cmd, const char *payload, float *value)
+{
+    char *end;
+
+    if (cmd->format == SCOM_FORMAT_BOOL) {
+        if (strcasecmp(payload, "on") == 0 || strcasecmp(payload, "true") == 0 || strcmp(payload, "1") == 0) {
+            *value = 1.0f;
+            return 0;
+        }
+        if (strcasecmp(payload, "off") == 0 || strcasecmp(payload, "false") == 0 || strcmp(payload, "0") == 0) {
+            *value = 0.0f;
+            return 0;
+        }
+        return -1;
+    }
+
+    double val = strtod(payload, &end);
+    if (end == payload || *end != '\0' || !isfinite(val)) {
+        return -1;
+    }
+    if (cmd->format != SCOM_FORMAT_FLOAT && val != floor(val)) {
+        return -1; // integers and enums must be whole numbers
+    }
+
+    *value = (float)val;
+    return 0;
+}
+
+// encode the value in the SCOM format of the parameter; returns the data length
+static uint16_t encode_value(scom_format_t format, float value, char *buf)
+{
+    switch (format) {
+    case SCOM_FORMAT_BOOL:
+        buf[0] = value != 0.0f ? 1 : 0;
+        return 1;
+    case SCOM_FORMAT_ENUM:
+        scom_write_le16(buf, (uint16_t)value);
+        return 2;
+    case SCOM_FORMAT_INT32:
+        scom_write_le32(buf, (uint32_t)(int32_t)value);
+        return 4;
+    default:
+        if (format == SCOMX_FORMAT_LONG_ENUM) {
+            scom_write_le32(buf, (uint32_t)value);
+            return 4;
+        }
+        scom_write_le_float(buf, value);
+        return 4;
+    }
+}
+
+// read-back of one device after the write
+typedef struct {
+    int address;
+    scom_error_t error;
+    float value;
+} command_readback_t;
+
+// the read-back matches the request (FLOAT parameters are stored in 16 bit fixed point internally)
+static int readback_matches(const command_t *cmd, float requested, float value)
+{
+    if (cmd->format == SCOM_FORMAT_FLOAT) {
+        return fabsf(value - requested) <= 0.01f * fmaxf(1.0f, fabsf(requested));
+    }
+    return value == requested;
+}
+
+static void publish_result(command_request_t *creq, scom_error_t error, const command_readback_t *readbacks, int count)
+{
+    char topic[256];
+    const command_t *cmd = creq->command;
+    double latency = elapsed_ms(&creq->received);
+    // a signal has nothing to read back, the acknowledged write is all the confirmation there is
+    int verified = cmd->signal ? error == SCOM_ERROR_NO_ERROR : count > 0;
+
+    for (int i = 0; i < count; i++) {
+        if (readbacks[i].error != SCOM_ERROR_NO_ERROR) {
+            if (error == SCOM_ERROR_NO_ERROR) {
+                error = readbacks[i].error; // report the first failed verification
+            }
+            verified = 0;
+        } else if (!readback_matches(cmd, creq->requested, readbacks[i].value)) {
+            verified = 0;
+        }
+    }
+
+    struct json_object *result = json_object_new_object();
+    json_object_object_add(result, "success", json_object_new_boolean(error == SCOM_ERROR_NO_ERROR));
+    json_object_object_add(result, "verified", json_object_new_boolean(verified));
+    json_object_object_add(result, "requested", json_object_new_double(creq->requested));
+    if (count > 0 && readbacks[0].error == SCOM_ERROR_NO_ERROR) {
+        json_object_object_add(result, "value", json_object_new_double(readbacks[0].value));
+    }
+    if (scomx_is_multicast(cmd->address) && !cmd->signal) {
+        struct json_object *devices = json_object_new_array();
+        for (int i = 0; i < count; i++) {
+            struct json_object *dev = json_object_new_object();
+            json_object_object_add(dev, "address", json_object_new_int(readbacks[i].address));
+            if (readbacks[i].error == SCOM_ERROR_NO_ERROR) {
+                json_object_object_add(dev, "value", json_object_new_double(readbacks[i].value));
+            }
+            json_object_object_add(dev, "error", json_object_new_string(scomx_err2str(readbacks[i].error)));
+            json_object_array_add(devices, dev);
+        }
+        json_object_object_add(result, "devices", devices);
+    }
+    json_object_object_add(result, "error", json_object_new_string(scomx_err2str(error)));
+    json_object_object_add(result, "latency_ms", json_object_new_double(round(latency * 10) / 10));
+
+    const char *json_str = json_object_to_json_string(result);
+    command_topic(cmd, "result", topic, sizeof(topic));
+    health_publish(creq->mosq, NULL, topic, (int)strlen(json_str), json_str, 1, false);
+    json_object_put(result);
+
+    if (count > 0 && error == SCOM_ERROR_NO_ERROR) {
+        char value_str[32];
+        snprintf(value_str, sizeof(value_str), "%g", readbacks[0].value);
+        command_topic(cmd, NULL, topic, sizeof(topic));
+        health_publish(creq->mosq, NULL, topic, (int)strlen(value_str), value_str, 1, true);
+    }
+
+    printf("[%ld] Command %s = %g: %s%s (%.1f ms)\n", time(NULL), cmd->name, creq->requested, scomx_err2str(error),
+           error == SCOM_ERROR_NO_ERROR && !verified ? ", read-back differs" : "", latency);
+}
+
+// read the value in RAM back from one device (bus thread only)
+static void read_back(const command_t *cmd, int address, command_readback_t *rb)
+{
+    bus_request_t req;
+
+    memset(&req, 0, sizeof(req));
+    req.request.magic = BUS_API_MAGIC;
+    req.request.service_id = SCOM_READ_PROPERTY_SERVICE;
+    req.request.priority = BUS_PRIO_URGENT;
+    req.request.object_type = SCOM_PARAMETER_OBJECT_TYPE;
+    req.request.dst_addr = address;
+    req.request.object_id = cmd->parameter;
+    req.request.property_id = SCOMX_PROP_PARAMETER_UNSAVED_VALUE_QSP;
+
+    bus_execute(&req);
+
+    rb->address = address;
+    rb->error = (scom_error_t)req.response.error;
+    rb->value = rb->error == SCOM_ERROR_NO_ERROR ? scomx_decode_value(cmd->format, req.response.data, req.response.data_len) : 0.0f;
+}
+
+// runs on the bus thread right after the write frame has been answered
+static void command_write_done(bus_request_t *req)
+{
+    command_request_t *creq = (command_request_t *)req->ctx;
+    const command_t *cmd = creq->command;
+    scom_error_t error = (scom_error_t)req->response.error;
+    command_readback_t readbacks[COMMAND_MAX_MULTICAST];
+    int count = 0;
+
+    if (error == SCOM_ERROR_NO_ERROR && !cmd->signal) {
+        // confirm with immediate read-backs while we still own the bus slot; for a multicast
+        // write the verification reads of all devices go out back-to-back without any polling between
+        if (scomx_is_multicast(cmd->address)) {
+            int members = cmd->multicast_count < COMMAND_MAX_MULTICAST ? cmd->multicast_count : COMMAND_MAX_MULTICAST;
+            for (int i = 0; i < members; i++) {
+                read_back(cmd, SCOMX_DEST_MULTICAST_MEMBER(cmd->address, i), &readbacks[count++]);
+            }
+        } else {
+            read_back(cmd, cmd->address, &readbacks[count++]);
+        }
+    }
+
+    publish_result(creq, error, readbacks, count);
+
+    // bus_request_t is the first member - the bus no longer touches it after on_complete()
+    free(creq);
+}
+
+void commands_init(const char *topic_root, const command_t *table, size_t count)
+{
+    g_topic_root = topic_root;
+    g_commands = table;
+    g_num_commands = count;
+}
+
+void commands_subscribe(struct mosquitto *mosq)
+{
+    char topic[256];
+
+    if (g_num_commands == 0) {
+        return;
+    }
+
+    snprintf(topic, sizeof(topic), "%s/+/+/set", g_topic_root);
+    mosquitto_subscribe(mosq, NULL, topic, 1);
+    printf("[%ld] Subscribed to command topics %s (%zu commands)\n", time(NULL), topic, g_num_commands);
+}
+
+int commands_handle_message(struct mosquitto *mosq, const struct mosquitto_message *msg)
+{
+    char topic[256];
+    char payload[64];
+    const command_t *cmd = NULL;
+
+    for (size_t i = 0; i < g_num_commands; i++) {
+        command_topic(&g_commands[i], "set", topic, sizeof(topic));
+        if (strcmp(topic, msg->topic) == 0) {
+            cmd = &g_commands[i];
+            break;
+        }
+    }
+    if (cmd == NULL) {
+        return 0;
+    }
+
+    if (msg->payloadlen <= 0 || msg->payloadlen >= (int)sizeof(payload)) {
+        printf("[%ld] Command %s: invalid payload length %d\n", time(NULL), cmd->name, msg->payloadlen);
+        return 1;
+    }
+    memcpy(payload, msg->payload, msg->payloadlen);
+    payload[msg->payloadlen] = '\0';
+
+    command_request_t *creq = calloc(1, sizeof(*creq));
+    if (creq == NULL) {
+        return 1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &creq->received);
+    creq->command = cmd;
+    creq->mosq = mosq;
+
+    if (parse_value(cmd, payload, &creq->requested) != 0) {
+        printf("[%ld] Command %s: cannot parse value '%s'\n", time(NULL), cmd->name, payload);
+        publish_result(creq, SCOM_ERROR_INVALID_DATA, NULL, 0);
+        free(creq);
+        return 1;
+    }
+
+    bus_api_request_t *rq = &creq->bus.request;
+    rq->magic = BUS_API_MAGIC;
+    rq->service_id = SCOM_WRITE_PROPERTY_SERVICE;
+    rq->priority = BUS_PRIO_URGENT;
+    rq->object_type = SCOM_PARAMETER_OBJECT_TYPE;
+    rq->dst_addr = cmd->address;
+    rq->object_id = cmd->parameter;
+    // unsaved_value_qsp - frequent writes must not wear out the flash (see protocol 4.5.4)
+    rq->property_id = SCOMX_PROP_PARAMETER_UNSAVED_VALUE_QSP;
+    rq->data_len = encode_value(cmd->format, creq->requested, rq->data);
+    creq->bus.on_complete = command_write_done;
+    creq->bus.ctx = creq;
+
+    if (bus_submit(&creq->bus) != 0) {
+        free(creq); // shutting down
+    }
+    return 1;
+}
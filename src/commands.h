@@ -0,0 +1,40 @@
+#ifndef COMMANDS_H
+#define COMMANDS_H
+
+#include "../scomlib_extra/scomx_catalog.h"
+#include <mosquitto.h>
+#include <stddef.h>
+
+// A writable parameter exposed as an MQTT command topic:
+//   <root>/<mqtt_prefix>/<name>/set     - payload is the new value ("1", "ON", "52.5", ...)
+//   <root>/<mqtt_prefix>/<name>/result  - JSON outcome of the write and its read-back
+//   <root>/<mqtt_prefix>/<name>         - read-back value after a successful write (retained)
+//
+// With a multicast address (e.g. SCOMX_DEST_XTM_ALL) the value is written to all devices of the kind
+// in one frame and then read back from the first multicast_count devices behind that address.
+//
+// parameter and format are normally given together with SCOMX_OBJECT() from the object catalog.
+typedef struct {
+    int parameter;        // parameter object id (e.g. 1125)
+    scom_format_t format; // SCOM_FORMAT_BOOL, SCOM_FORMAT_ENUM, SCOMX_FORMAT_LONG_ENUM, SCOM_FORMAT_INT32 or SCOM_FORMAT_FLOAT
+    int address;          // device address (e.g. 101) or multicast address (e.g. 100)
+    char *name;           // Technical ID: xt1_charger_allowed
+    char *friendly_name;  // Display name: Studer 1 Charger Allowed
+    char *mqtt_prefix;
+    int multicast_count;  // number of devices to verify behind a multicast address (0 for unicast)
+    int signal;           // 1 for a signal parameter (e.g. 1142 Force a new cycle): it triggers an action and has no value to read back
+} command_t;
+
+#define COMMAND_MAX_MULTICAST 15
+
+// register the command table; topic_root is the common MQTT topic prefix (e.g. "studer")
+void commands_init(const char *topic_root, const command_t *table, size_t count);
+
+// subscribe to all command topics (call from the connect callback)
+void commands_subscribe(struct mosquitto *mosq);
+
+// handle an incoming MQTT message; returns 1 if it was a command topic
+// the write is queued with urgent priority and executed by the poll loop within one frame time
+int commands_handle_message(struct mosquitto *mosq, const struct mosquitto_message *msg);
+
+#endif
@@ -0,0 +1,492 @@
+//
+//  Runtime configuration file
+//
+//  The file is parsed into a fresh config_t so that a reload either succeeds as a whole or
+//  leaves the running configuration untouched.
+//
+
+#include "config.h"
+#include "sampler.h"
+
+#include <json-c/json.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define error_message(fmt, ...) fprintf(stderr, "[CONFIG ERROR] " fmt, ##__VA_ARGS__)
+
+static char *dup_or_null(const char *s)
+{
+    return s ? strdup(s) : NULL;
+}
+
+static void free_parameters(parameter_t *params, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        free(params[i].name);
+        free(params[i].friendly_name);
+        free(params[i].mqtt_prefix);
+        free(params[i].unit);
+        free(params[i].device_class);
+        free(params[i].snapshot_set);
+        free(params[i].expression);
+    }
+    free(params);
+}
+
+static void free_alerts(alert_rule_t *alerts, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        free(alerts[i].name);
+        free(alerts[i].entry);
+        for (size_t j = 0; j < alerts[i].num_burst; j++) {
+            free(alerts[i].burst[j]);
+        }
+        free(alerts[i].burst);
+    }
+    free(alerts);
+}
+
+void config_free(config_t *cfg)
+{
+    if (cfg == NULL) {
+        return;
+    }
+    free(cfg->mqtt_server);
+    free(cfg->mqtt_topic);
+    free(cfg->serial_port);
+    free(cfg->datalog_dir);
+    free_parameters(cfg->parameters, cfg->num_parameters);
+    free_alerts(cfg->alerts, cfg->num_alerts);
+    free(cfg);
+}
+
+static int copy_parameter(parameter_t *dst, const parameter_t *src)
+{
+    *dst = *src;
+    dst->name = dup_or_null(src->name);
+    dst->friendly_name = dup_or_null(src->friendly_name);
+    dst->mqtt_prefix = dup_or_null(src->mqtt_prefix);
+    dst->unit = dup_or_null(src->unit ? src->unit : "");
+    dst->device_class = dup_or_null(src->device_class);
+    dst->snapshot_set = src->snapshot_set && src->snapshot_set[0] ? strdup(src->snapshot_set) : NULL;
+    dst->expression = dup_or_null(src->expression);
+    return dst->name && dst->friendly_name && dst->mqtt_prefix && dst->unit ? 0 : -1;
+}
+
+// Move the members of every snapshot set behind the first member of the set, keeping the order
+// of everything else
+static void group_snapshot_sets(config_t *cfg)
+{
+    parameter_t *params = cfg->parameters;
+
+    for (size_t i = 0; i < cfg->num_parameters; i++) {
+        const char *set = params[i].snapshot_set;
+        if (set == NULL) {
+            continue;
+        }
+        size_t end = i; // last member moved so far
+        for (size_t j = i + 1; j < cfg->num_parameters; j++) {
+            if (params[j].snapshot_set == NULL || strcmp(params[j].snapshot_set, set) != 0) {
+                continue;
+            }
+            parameter_t member = params[j];
+            memmove(&params[end + 2], &params[end + 1], (j - end - 1) * sizeof(parameter_t));
+            params[++end] = member;
+        }
+        i = end;
+    }
+}
+
+static int copy_parameters(config_t *cfg, const parameter_t *parameters, size_t num_parameters)
+{
+    cfg->parameters = calloc(num_parameters ? num_parameters : 1, sizeof(parameter_t));
+    if (cfg->parameters == NULL) {
+        return -1;
+    }
+    for (size_t i = 0; i < num_parameters; i++) {
+        cfg->num_parameters++;
+        if (copy_parameter(&cfg->parameters[i], &parameters[i]) != 0) {
+            return -1;
+        }
+    }
+    group_snapshot_sets(cfg);
+    return 0;
+}
+
+config_t *config_defaults(const char *mqtt_server, int mqtt_port, const char *mqtt_topic, const char *serial_port, const char *datalog_dir,
+                          int datalog_max_age_days, const parameter_t *parameters, size_t num_parameters)
+{
+    config_t *cfg = calloc(1, sizeof(*cfg));
+    if (cfg == NULL) {
+        return NULL;
+    }
+
+    cfg->mqtt_server = dup_or_null(mqtt_server);
+    cfg->mqtt_port = mqtt_port;
+    cfg->mqtt_topic = dup_or_null(mqtt_topic);
+    cfg->serial_port = dup_or_null(serial_port);
+    cfg->datalog_dir = dup_or_null(datalog_dir);
+    cfg->datalog_max_age_days = datalog_max_age_days;
+
+    if (copy_parameters(cfg, parameters, num_parameters) != 0) {
+        config_free(cfg);
+        return NULL;
+    }
+    return cfg;
+}
+
+// string member of obj, or NULL when missing; -1 if it has the wrong type
+static int get_string(struct json_object *obj, const char *key, const char **out)
+{
+    struct json_object *val;
+
+    *out = NULL;
+    if (!json_object_object_get_ex(obj, key, &val) || json_object_is_type(val, json_type_null)) {
+        return 0;
+    }
+    if (!json_object_is_type(val, json_type_string)) {
+        error_message("\"%s\" must be a string\n", key);
+        return -1;
+    }
+    *out = json_object_get_string(val);
+    return 0;
+}
+
+// integer member of obj; *found is 0 when missing; -1 if it has the wrong type
+static int get_int(struct json_object *obj, const char *key, int *out, int *found)
+{
+    struct json_object *val;
+
+    *found = 0;
+    if (!json_object_object_get_ex(obj, key, &val)) {
+        return 0;
+    }
+    if (!json_object_is_type(val, json_type_int)) {
+        error_message("\"%s\" must be an integer\n", key);
+        return -1;
+    }
+    *out = json_object_get_int(val);
+    *found = 1;
+    return 0;
+}
+
+// number member of obj, unchanged when missing; -1 if it has the wrong type
+static int get_double(struct json_object *obj, const char *key, double *out)
+{
+    struct json_object *val;
+
+    if (!json_object_object_get_ex(obj, key, &val)) {
+        return 0;
+    }
+    if (!json_object_is_type(val, json_type_double) && !json_object_is_type(val, json_type_int)) {
+        error_message("\"%s\" must be a number\n", key);
+        return -1;
+    }
+    *out = json_object_get_double(val);
+    return 0;
+}
+
+// boolean member of obj, unchanged when missing; -1 if it has the wrong type
+static int get_bool(struct json_object *obj, const char *key, int *out)
+{
+    struct json_object *val;
+
+    if (!json_object_object_get_ex(obj, key, &val)) {
+        return 0;
+    }
+    if (!json_object_is_type(val, json_type_boolean)) {
+        error_message("\"%s\" must be true or false\n", key);
+        return -1;
+    }
+    *out = json_object_get_boolean(val);
+    return 0;
+}
+
+static int parse_parameter(struct json_object *obj, size_t idx, parameter_t *param)
+{
+    const char *name, *friendly_name, *mqtt_prefix, *unit, *device_class, *snapshot_set, *expression;
+    int found_param, found_addr, found_sign, found_aggregate;
+    int aggregate_s = 0;
+    int interval_ms = 0, burst_interval_ms = 0, found_interval, found_burst;
+    double burst_threshold = 0.0;
+
+    memset(param, 0, sizeof(*param));
+    param->sign = 1;
+
+    if (!json_object_is_type(obj, json_type_object) || get_int(obj, "parameter", &param->parameter, &found_param) != 0 ||
+        get_int(obj, "address", &param->address, &found_addr) != 0 || get_int(obj, "sign", &param->sign, &found_sign) != 0 ||
+        get_string(obj, "name", &name) != 0 || get_string(obj, "friendly_name", &friendly_name) != 0 ||
+        get_string(obj, "mqtt_prefix", &mqtt_prefix) != 0 || get_string(obj, "unit", &unit) != 0 ||
+        get_string(obj, "device_class", &device_class) != 0 || get_string(obj, "snapshot_set", &snapshot_set) != 0 ||
+        get_string(obj, "expression", &expression) != 0 || get_int(obj, "aggregate_s", &aggregate_s, &found_aggregate) != 0 ||
+        get_bool(obj, "aggregate_only", &param->aggregate_only) != 0 || get_bool(obj, "history", &param->history) != 0 ||
+        get_int(obj, "poll_interval_ms", &interval_ms, &found_interval) != 0 ||
+        get_int(obj, "burst_interval_ms", &burst_interval_ms, &found_burst) != 0 || get_double(obj, "burst_threshold", &burst_threshold) != 0) {
+        error_message("parameters[%zu] is invalid\n", idx);
+        return -1;
+    }
+    if (name == NULL || mqtt_prefix == NULL || (expression == NULL && (!found_param || !found_addr)) || found_param != found_addr) {
+        error_message("parameters[%zu] needs \"name\", \"mqtt_prefix\" and \"parameter\" with \"address\" or an \"expression\"\n", idx);
+        return -1;
+    }
+    if (param->sign != 1 && param->sign != -1) {
+        error_message("parameters[%zu] (%s): \"sign\" must be 1 or -1\n", idx, name);
+        return -1;
+    }
+    if (aggregate_s < 0 || (param->aggregate_only && aggregate_s == 0)) {
+        error_message("parameters[%zu] (%s): \"aggregate_only\" needs a positive \"aggregate_s\"\n", idx, name);
+        return -1;
+    }
+    param->aggregate_s = (unsigned)aggregate_s;
+    if (interval_ms < 0 || burst_interval_ms < 0 || burst_interval_ms > interval_ms || burst_threshold < 0.0) {
+        error_message("parameters[%zu] (%s): \"burst_interval_ms\" must be between 0 and \"poll_interval_ms\", "
+                      "\"burst_threshold\" must not be negative\n", idx, name);
+        return -1;
+    }
+    param->schedule.interval_ms = (unsigned)interval_ms;
+    param->schedule.burst_interval_ms = (unsigned)burst_interval_ms;
+    param->schedule.burst_threshold = (float)burst_threshold;
+
+    const scomx_object_info_t *info = found_param ? scomx_catalog_find(SCOM_USER_INFO_OBJECT_TYPE, (uint32_t)param->parameter) : NULL;
+    if (!found_param) {
+        param->format = SCOM_FORMAT_FLOAT; // only computed
+    } else if (info == NULL) {
+        printf("Config: user info %d (%s) is not in the object catalog, decoding it as FLOAT\n", param->parameter, name);
+        param->format = SCOM_FORMAT_FLOAT;
+    } else {
+        param->format = info->format;
+    }
+
+    param->name = strdup(name);
+    param->friendly_name = strdup(friendly_name ? friendly_name : name);
+    param->mqtt_prefix = strdup(mqtt_prefix);
+    param->unit = strdup(unit ? unit : (info && info->unit ? info->unit : ""));
+    param->device_class = dup_or_null(device_class);
+    param->snapshot_set = snapshot_set && snapshot_set[0] ? strdup(snapshot_set) : NULL;
+    param->expression = dup_or_null(expression);
+    return param->name && param->friendly_name && param->mqtt_prefix && param->unit && (!expression || param->expression) ? 0 : -1;
+}
+
+static int parse_parameters(struct json_object *array, config_t *cfg)
+{
+    size_t count = json_object_array_length(array);
+
+    cfg->parameters = calloc(count ? count : 1, sizeof(parameter_t));
+    if (cfg->parameters == NULL) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        cfg->num_parameters++;
+        if (parse_parameter(json_object_array_get_idx(array, i), i, &cfg->parameters[i]) != 0) {
+            return -1;
+        }
+        // the name is the MQTT topic and the Home Assistant unique_id
+        for (size_t j = 0; j < i; j++) {
+            if (strcmp(cfg->parameters[j].name, cfg->parameters[i].name) == 0) {
+                error_message("parameters[%zu]: duplicate name \"%s\"\n", i, cfg->parameters[i].name);
+                return -1;
+            }
+        }
+    }
+    group_snapshot_sets(cfg);
+    return 0;
+}
+
+static int has_entry(const config_t *cfg, const char *name)
+{
+    for (size_t i = 0; i < cfg->num_parameters; i++) {
+        if (strcmp(cfg->parameters[i].name, name) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int parse_alert(struct json_object *obj, size_t idx, const config_t *cfg, alert_rule_t *rule)
+{
+    const char *name, *entry;
+    double above = 0.0, below = 0.0, hysteresis = 0.0;
+    struct json_object *burst = NULL;
+
+    if (!json_object_is_type(obj, json_type_object) || get_string(obj, "name", &name) != 0 || get_string(obj, "entry", &entry) != 0 ||
+        get_double(obj, "above", &above) != 0 || get_double(obj, "below", &below) != 0 ||
+        get_double(obj, "hysteresis", &hysteresis) != 0) {
+        error_message("alerts[%zu] is invalid\n", idx);
+        return -1;
+    }
+    int has_above = json_object_object_get_ex(obj, "above", NULL);
+    int has_below = json_object_object_get_ex(obj, "below", NULL);
+    if (name == NULL || entry == NULL || has_above == has_below || hysteresis < 0.0) {
+        error_message("alerts[%zu] needs \"name\", \"entry\" and either \"above\" or \"below\"\n", idx);
+        return -1;
+    }
+    if (!has_entry(cfg, entry)) {
+        error_message("alerts[%zu] (%s): no poll list entry \"%s\"\n", idx, name, entry);
+        return -1;
+    }
+
+    rule->name = strdup(name);
+    rule->entry = strdup(entry);
+    rule->above = has_above;
+    rule->threshold = (float)(has_above ? above : below);
+    rule->hysteresis = (float)hysteresis;
+    if (rule->name == NULL || rule->entry == NULL) {
+        return -1;
+    }
+
+    if (json_object_object_get_ex(obj, "burst", &burst) && !json_object_is_type(burst, json_type_array)) {
+        error_message("alerts[%zu] (%s): \"burst\" must be an array of entry names\n", idx, name);
+        return -1;
+    }
+    size_t count = burst ? json_object_array_length(burst) : 0;
+    rule->burst = calloc(count ? count : 1, sizeof(char *));
+    if (rule->burst == NULL) {
+        return -1;
+    }
+    for (size_t j = 0; j < count; j++) {
+        struct json_object *item = json_object_array_get_idx(burst, j);
+        if (!json_object_is_type(item, json_type_string) || !has_entry(cfg, json_object_get_string(item))) {
+            error_message("alerts[%zu] (%s): burst[%zu] is not a poll list entry\n", idx, name, j);
+            return -1;
+        }
+        rule->burst[rule->num_burst] = strdup(json_object_get_string(item));
+        if (rule->burst[rule->num_burst++] == NULL) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int parse_alerts(struct json_object *array, config_t *cfg)
+{
+    size_t count = json_object_array_length(array);
+
+    cfg->alerts = calloc(count ? count : 1, sizeof(alert_rule_t));
+    if (cfg->alerts == NULL) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        cfg->num_alerts++;
+        if (parse_alert(json_object_array_get_idx(array, i), i, cfg, &cfg->alerts[i]) != 0) {
+            return -1;
+        }
+        // the name is the MQTT topic
+        for (size_t j = 0; j < i; j++) {
+            if (strcmp(cfg->alerts[j].name, cfg->alerts[i].name) == 0) {
+                error_message("alerts[%zu]: duplicate name \"%s\"\n", i, cfg->alerts[i].name);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+config_t *config_load(const char *path, const config_t *defaults)
+{
+    const char *str;
+    int found;
+
+    struct json_object *root = json_object_from_file(path);
+    if (root == NULL) {
+        error_message("cannot parse %s: %s", path, json_util_get_last_err()); // json-c ends it with a newline
+        return NULL;
+    }
+    if (!json_object_is_type(root, json_type_object)) {
+        error_message("%s: top level must be an object\n", path);
+        json_object_put(root);
+        return NULL;
+    }
+
+    config_t *cfg = config_defaults(defaults->mqtt_server, defaults->mqtt_port, defaults->mqtt_topic, defaults->serial_port, defaults->datalog_dir,
+                                    defaults->datalog_max_age_days, NULL, 0);
+    if (cfg == NULL) {
+        json_object_put(root);
+        return NULL;
+    }
+
+    int ok = 1;
+    if (get_string(root, "mqtt_server", &str) != 0) {
+        ok = 0;
+    } else if (str) {
+        free(cfg->mqtt_server);
+        cfg->mqtt_server = strdup(str);
+    }
+    if (get_string(root, "mqtt_topic", &str) != 0) {
+        ok = 0;
+    } else if (str) {
+        free(cfg->mqtt_topic);
+        cfg->mqtt_topic = strdup(str);
+    }
+    if (get_string(root, "serial_port", &str) != 0) {
+        ok = 0;
+    } else if (str) {
+        free(cfg->serial_port);
+        cfg->serial_port = strdup(str);
+    }
+    if (get_string(root, "datalog_dir", &str) != 0) {
+        ok = 0;
+    } else if (str) {
+        free(cfg->datalog_dir);
+        cfg->datalog_dir = strdup(str);
+    }
+    if (get_int(root, "mqtt_port", &cfg->mqtt_port, &found) != 0 || get_int(root, "datalog_max_age_days", &cfg->datalog_max_age_days, &found) != 0) {
+        ok = 0;
+    }
+
+    int period_ms = (int)defaults->sample_period_ms;
+    cfg->sample_overrun = defaults->sample_overrun;
+    if (get_int(root, "sample_period_ms", &period_ms, &found) != 0) {
+        ok = 0;
+    } else if (period_ms < 0) {
+        error_message("\"sample_period_ms\" must not be negative\n");
+        ok = 0;
+    }
+    cfg->sample_period_ms = (unsigned)period_ms;
+    if (get_string(root, "sample_overrun", &str) != 0) {
+        ok = 0;
+    } else if (str && strcmp(str, "skip") == 0) {
+        cfg->sample_overrun = SAMPLER_SKIP;
+    } else if (str && strcmp(str, "catch_up") == 0) {
+        cfg->sample_overrun = SAMPLER_CATCH_UP;
+    } else if (str) {
+        error_message("\"sample_overrun\" must be \"skip\" or \"catch_up\"\n");
+        ok = 0;
+    }
+
+    // the poll list is replaced as a whole
+    struct json_object *params;
+    free(cfg->parameters);
+    cfg->parameters = NULL;
+    if (!ok) {
+        // nothing to parse
+    } else if (!json_object_object_get_ex(root, "parameters", &params)) {
+        ok = copy_parameters(cfg, defaults->parameters, defaults->num_parameters) == 0;
+    } else if (!json_object_is_type(params, json_type_array)) {
+        error_message("\"parameters\" must be an array\n");
+        ok = 0;
+    } else {
+        ok = parse_parameters(params, cfg) == 0;
+    }
+
+    // alert rules refer to the poll list
+    struct json_object *alerts;
+    if (!ok || !json_object_object_get_ex(root, "alerts", &alerts)) {
+        // none
+    } else if (!json_object_is_type(alerts, json_type_array)) {
+        error_message("\"alerts\" must be an array\n");
+        ok = 0;
+    } else {
+        ok = parse_alerts(alerts, cfg) == 0;
+    }
+
+    json_object_put(root);
+    if (!ok) {
+        error_message("%s not loaded\n", path);
+        config_free(cfg);
+        return NULL;
+    }
+    return cfg;
+}
@@ -0,0 +1,95 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include "../scomlib_extra/scomx_catalog.h"
+#include <stddef.h>
+
+// Runtime configuration (JSON file, see README "Configuration File")
+//
+// Every key is optional; whatever the file does not set is taken from the compiled-in defaults
+// of main.h. The poll list replaces the compiled-in one as a whole:
+//   {
+//     "mqtt_server": "192.168.1.10", "mqtt_port": 1883, "mqtt_topic": "studer",
+//     "sample_period_ms": 1000, "sample_overrun": "skip",
+//     "parameters": [
+//       {"parameter": 3000, "address": 100, "name": "batt_voltage", "friendly_name": "Studer DC Battery Voltage",
+//        "mqtt_prefix": "DC", "unit": "V", "sign": 1, "device_class": "voltage", "snapshot_set": "battery"}
+//     ]
+//   }
+// The Scom format of a parameter comes from the object catalog. An entry with an "expression"
+// over other entries needs no "parameter"/"address" - it is computed (see derived.h), e.g.
+//   {"name": "inverter_efficiency", "mqtt_prefix": "AC", "unit": "%",
+//    "expression": "100 * total_output_active_power / total_input_active_power"}
+// "aggregate_s": 60 adds the min/max/mean of every minute (see aggregate.h), "aggregate_only": true
+// publishes those instead of every sample. "poll_interval_ms": 5000, "burst_interval_ms": 0 and
+// "burst_threshold": 0.2 read an entry every 5 s, and every cycle while it changes by more than 0.2.
+// "history": true keeps the samples of an entry on disk (about 1 MiB per entry, see history.h).
+// Alert rules watch poll list entries (a derived entry for combined conditions):
+//   "alerts": [{"name": "battery_low", "entry": "batt_voltage", "below": 46.0, "hysteresis": 1.0,
+//               "burst": ["batt_voltage", "l1_batt_current"]}]
+// Parameters with the same snapshot_set are moved together (behind the first one) so that they are read back to back.
+
+// Adaptive polling of an entry (see schedule.h); interval 0 reads it every cycle
+typedef struct {
+    unsigned interval_ms;       // base rate
+    unsigned burst_interval_ms; // rate while the value moves away from its trend
+    float burst_threshold;      // deviation that starts a burst (0: never)
+} poll_schedule_t;
+
+// A user info polled every cycle (or as its schedule says)
+typedef struct {
+    int parameter;
+    scom_format_t format;    // Scom format of the user info (from the object catalog)
+    int address;             // 0 for entries that are only computed
+    char *name;              // Technical ID: xt1_input_active_power
+    char *friendly_name;     // Display name: Studer 1 Input Active Power
+    char *mqtt_prefix;
+    char *unit;
+    int sign;
+    char *device_class;      // Home Assistant device class
+    char *snapshot_set;      // read back to back with the other members of the set (NULL: none)
+    char *expression;        // computed from other entries instead of read (NULL: read)
+    unsigned aggregate_s;    // window of the min/max/mean in seconds (0: none)
+    int aggregate_only;      // publish the aggregates only, not every sample
+    int history;             // keep the history on disk (see history.h)
+    poll_schedule_t schedule;
+} parameter_t;
+
+// Alert rule evaluated on every sample of its entry (see alerts.h)
+typedef struct {
+    char *name;              // topic <mqtt_topic>/alert/<name>
+    char *entry;             // name of the poll list entry it watches
+    int above;               // fires above the threshold (0: below)
+    float threshold;
+    float hysteresis;        // clears this far back on the other side of the threshold
+    char **burst;            // entries read at their burst rate while it fires (see schedule.h)
+    size_t num_burst;
+} alert_rule_t;
+
+typedef struct {
+    char *mqtt_server;
+    int mqtt_port;
+    char *mqtt_topic;
+    char *serial_port;
+    char *datalog_dir;
+    int datalog_max_age_days;
+    unsigned sample_period_ms; // fixed-rate sampling (sampler.h), 0 polls back to back
+    int sample_overrun;        // SAMPLER_SKIP or SAMPLER_CATCH_UP
+
+    parameter_t *parameters;
+    size_t num_parameters;
+    alert_rule_t *alerts;      // none compiled in
+    size_t num_alerts;
+} config_t;
+
+// deep copy of the compiled-in settings (sampling off); returns NULL when out of memory
+config_t *config_defaults(const char *mqtt_server, int mqtt_port, const char *mqtt_topic, const char *serial_port, const char *datalog_dir,
+                          int datalog_max_age_days, const parameter_t *parameters, size_t num_parameters);
+
+// load path on top of defaults; returns NULL (after printing the reason) if the file cannot be
+// read or is invalid - the caller keeps its current configuration then
+config_t *config_load(const char *path, const config_t *defaults);
+
+void config_free(config_t *cfg);
+
+#endif
@@ -0,0 +1,520 @@
+//
+//  Datalog file transfer from the Xcom-232i SD card
+//
+//  A transfer is a chain of READ_PROPERTY frames: SD_Start is answered with the first block,
+//  every SD_Ack_Continue with the next one and SD_Nack_Retry repeats the last one. Only one
+//  frame is sent per call so the live polling keeps running between the blocks.
+//
+
+#include "datalog.h"
+#include "bus.h"
+#include "health.h"
+
+#include <errno.h>
+#include <json-c/json.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define error_message(fmt, ...) fprintf(stderr, "[DATALOG ERROR] " fmt, ##__VA_ARGS__)
+
+#define DATALOG_LIST_INTERVAL 3600 // seconds between two directory listings
+#define DATALOG_RETRY_INTERVAL 60  // seconds before a failed transfer is resumed
+#define DATALOG_MAX_RETRIES 3      // nackAndRetry attempts per block
+#define DATALOG_MAX_FILES 64       // files queued from one listing
+#define DATALOG_SETTLE_TIME 600    // seconds after midnight before the file of the previous day is complete
+#define DATALOG_MAX_COLUMNS 256
+#define DATALOG_MAX_LINE 8192
+#define DATALOG_NAME_LEN 16 // "LGYYMMDD.CSV"
+
+typedef enum {
+    XFER_IDLE,
+    XFER_DIRECTORY,
+    XFER_FILE,
+} xfer_kind_t;
+
+// incremental CSV parser; the header line names the columns, rows starting with a timestamp are samples
+typedef struct {
+    char line[DATALOG_MAX_LINE];
+    size_t line_len;
+    int overflow; // current line does not fit the buffer and is dropped
+    char *columns[DATALOG_MAX_COLUMNS];
+    int num_columns;
+    int data_rows;
+    int publish; // 0 while replaying the stored part of a resumed file
+} csv_parser_t;
+
+// transfer in progress
+static struct {
+    xfer_kind_t kind;
+    char name[DATALOG_NAME_LEN];
+    scomx_datalog_property_t next_action;
+    uint32_t block; // index of the block carried by the next response
+    uint32_t skip;  // blocks stored by an earlier attempt
+    int retries;
+    FILE *out;
+    char *listing;
+    size_t listing_len;
+} g_xfer;
+
+static int g_enabled = 0;
+static char g_dir[256];
+static int g_max_age_days = 0;
+static const char *g_topic_root = NULL;
+static struct mosquitto *g_mosq = NULL;
+
+static char g_queue[DATALOG_MAX_FILES][DATALOG_NAME_LEN];
+static int g_queue_len = 0;
+static int g_queue_pos = 0;
+static time_t g_last_listing = 0;
+static time_t g_retry_after = 0;
+
+static csv_parser_t g_csv;
+
+// CSV PARSER
+
+static void csv_reset(int publish)
+{
+    for (int i = 0; i < g_csv.num_columns; i++) {
+        free(g_csv.columns[i]);
+    }
+    memset(&g_csv, 0, sizeof(g_csv));
+    g_csv.publish = publish;
+}
+
+static char *trim(char *s)
+{
+    while (*s == ' ' || *s == '"') {
+        s++;
+    }
+    size_t len = strlen(s);
+    while (len > 0 && (s[len - 1] == ' ' || s[len - 1] == '"')) {
+        s[--len] = '\0';
+    }
+    return s;
+}
+
+// "2017-10-10 00:00" or "10.10.2017 00:00" in the local time of the Xcom-232i
+static int parse_timestamp(const char *s, time_t *ts)
+{
+    struct tm tm;
+    int year, month, day, hour, min, sec = 0;
+
+    if (sscanf(s, "%d-%d-%d %d:%d:%d", &year, &month, &day, &hour, &min, &sec) < 5) {
+        sec = 0;
+        if (sscanf(s, "%d.%d.%d %d:%d:%d", &day, &month, &year, &hour, &min, &sec) < 5) {
+            return -1;
+        }
+    }
+    if (year < 2000 || month < 1 || month > 12 || day < 1 || day > 31) {
+        return -1;
+    }
+
+    memset(&tm, 0, sizeof(tm));
+    tm.tm_year = year - 1900;
+    tm.tm_mon = month - 1;
+    tm.tm_mday = day;
+    tm.tm_hour = hour;
+    tm.tm_min = min;
+    tm.tm_sec = sec;
+    tm.tm_isdst = -1;
+    *ts = mktime(&tm);
+    return *ts == (time_t)-1 ? -1 : 0;
+}
+
+static void publish_sample(time_t ts, char **fields, int num_fields)
+{
+    char topic[256];
+    char name[16];
+
+    struct json_object *values = json_object_new_object();
+    for (int i = 1; i < num_fields; i++) {
+        char *end;
+        double val = strtod(fields[i], &end);
+        if (end == fields[i] || *trim(end) != '\0') {
+            continue; // empty or not a number
+        }
+        const char *column = i < g_csv.num_columns ? g_csv.columns[i] : NULL;
+        if (column == NULL || *column == '\0') {
+            snprintf(name, sizeof(name), "col%d", i);
+            column = name;
+        }
+        json_object_object_add(values, column, json_object_new_double(val));
+    }
+
+    struct json_object *sample = json_object_new_object();
+    json_object_object_add(sample, "file", json_object_new_string(g_xfer.name));
+    json_object_object_add(sample, "timestamp", json_object_new_int64(ts));
+    json_object_object_add(sample, "values", values);
+
+    const char *json_str = json_object_to_json_string(sample);
+    snprintf(topic, sizeof(topic), "%s/datalog", g_topic_root);
+    health_publish(g_mosq, NULL, topic, (int)strlen(json_str), json_str, 1, false);
+    json_object_put(sample);
+}
+
+static void csv_line(void)
+{
+    char *fields[DATALOG_MAX_COLUMNS];
+    int num_fields = 0;
+    time_t ts;
+
+    g_csv.line[g_csv.line_len] = '\0';
+    if (g_csv.line_len > 0 && g_csv.line[g_csv.line_len - 1] == '\r') {
+        g_csv.line[g_csv.line_len - 1] = '\0';
+    }
+    if (g_csv.overflow || g_csv.line[0] == '\0') {
+        return;
+    }
+
+    // split in place
+    char *p = g_csv.line;
+    fields[num_fields++] = p;
+    for (; *p && num_fields < DATALOG_MAX_COLUMNS; p++) {
+        if (*p == ',' || *p == ';') {
+            *p = '\0';
+            fields[num_fields++] = p + 1;
+        }
+    }
+
+    if (parse_timestamp(trim(fields[0]), &ts) == 0) {
+        g_csv.data_rows++;
+        if (g_csv.publish) {
+            publish_sample(ts, fields, num_fields);
+        }
+    } else if (g_csv.data_rows == 0 && g_csv.num_columns == 0) {
+        // first line of the file names the columns; the lines after the samples are ignored
+        for (int i = 0; i < num_fields; i++) {
+            g_csv.columns[i] = strdup(trim(fields[i]));
+        }
+        g_csv.num_columns = num_fields;
+    }
+}
+
+static void csv_feed(const char *data, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        if (data[i] == '\n') {
+            csv_line();
+            g_csv.line_len = 0;
+            g_csv.overflow = 0;
+        } else if (g_csv.line_len < DATALOG_MAX_LINE - 1) {
+            g_csv.line[g_csv.line_len++] = data[i];
+        } else {
+            g_csv.overflow = 1;
+        }
+    }
+}
+
+static void csv_finish(void)
+{
+    if (g_csv.line_len > 0) {
+        csv_line(); // last line without a line feed
+    }
+    csv_reset(0);
+}
+
+// FILES
+
+static void file_path(const char *name, const char *suffix, char *buf, size_t size)
+{
+    snprintf(buf, size, "%s/%s%s", g_dir, name, suffix);
+}
+
+// local time of the end of the day recorded in LGYYMMDD.CSV; 0 if the name is not a datalog file
+static time_t file_day_end(const char *name)
+{
+    struct tm tm;
+    int yy, mm, dd;
+    char ext[8];
+
+    if (strlen(name) != 12 || sscanf(name, "LG%2d%2d%2d.%3s", &yy, &mm, &dd, ext) != 4 || strcmp(ext, "CSV") != 0) {
+        return 0;
+    }
+
+    memset(&tm, 0, sizeof(tm));
+    tm.tm_year = 100 + yy;
+    tm.tm_mon = mm - 1;
+    tm.tm_mday = dd + 1;
+    tm.tm_isdst = -1;
+    return mktime(&tm);
+}
+
+static int compare_names(const void *a, const void *b)
+{
+    return strcmp((const char *)a, (const char *)b);
+}
+
+// queue the completed files of the listing that are not stored yet, oldest first
+static void queue_files(void)
+{
+    time_t now = time(NULL);
+    char path[512];
+    struct stat st;
+
+    g_queue_len = 0;
+    g_queue_pos = 0;
+
+    char *saveptr = NULL;
+    for (char *name = strtok_r(g_xfer.listing, "\r\n", &saveptr); name; name = strtok_r(NULL, "\r\n", &saveptr)) {
+        time_t day_end = file_day_end(name);
+        if (day_end == 0 || now < day_end + DATALOG_SETTLE_TIME || now - day_end > (time_t)g_max_age_days * 86400) {
+            continue; // not a datalog file, still being written or too old
+        }
+        file_path(name, "", path, sizeof(path));
+        if (stat(path, &st) == 0) {
+            continue; // already downloaded
+        }
+        if (g_queue_len < DATALOG_MAX_FILES) {
+            snprintf(g_queue[g_queue_len++], DATALOG_NAME_LEN, "%s", name);
+        }
+    }
+
+    qsort(g_queue, g_queue_len, DATALOG_NAME_LEN, compare_names);
+
+    if (g_queue_len > 0) {
+        printf("[%ld] Datalog: %d file(s) to download\n", time(NULL), g_queue_len);
+    }
+}
+
+// open the partial file of a transfer; blocks stored by an earlier attempt are replayed into the
+// parser without publishing so the parser continues exactly where it stopped
+static int open_part(void)
+{
+    char path[512];
+    char buf[SCOMX_DATALOG_BLOCK_SIZE];
+    struct stat st;
+
+    file_path(g_xfer.name, ".part", path, sizeof(path));
+
+    g_xfer.skip = 0;
+    csv_reset(0);
+    if (stat(path, &st) == 0) {
+        g_xfer.skip = (uint32_t)(st.st_size / SCOMX_DATALOG_BLOCK_SIZE);
+        if (truncate(path, (off_t)g_xfer.skip * SCOMX_DATALOG_BLOCK_SIZE) != 0) {
+            g_xfer.skip = 0;
+        }
+    }
+
+    g_xfer.out = fopen(path, g_xfer.skip > 0 ? "r+b" : "wb");
+    if (g_xfer.out == NULL) {
+        error_message("cannot open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < g_xfer.skip; i++) {
+        if (fread(buf, 1, sizeof(buf), g_xfer.out) != sizeof(buf)) {
+            break;
+        }
+        csv_feed(buf, sizeof(buf));
+    }
+    fseek(g_xfer.out, 0, SEEK_END);
+    g_csv.publish = 1;
+
+    if (g_xfer.skip > 0) {
+        printf("[%ld] Datalog: resuming %s after block %u\n", time(NULL), g_xfer.name, g_xfer.skip);
+    }
+    return 0;
+}
+
+// TRANSFER
+
+static void start_transfer(xfer_kind_t kind, const char *name)
+{
+    g_xfer.kind = kind;
+    snprintf(g_xfer.name, sizeof(g_xfer.name), "%s", name ? name : "");
+    g_xfer.next_action = SCOMX_PROP_SD_START;
+    g_xfer.block = 0;
+    g_xfer.skip = 0;
+    g_xfer.retries = 0;
+    g_xfer.listing_len = 0;
+}
+
+static void end_transfer(void)
+{
+    if (g_xfer.out) {
+        fclose(g_xfer.out);
+        g_xfer.out = NULL;
+    }
+    csv_reset(0);
+    g_xfer.kind = XFER_IDLE;
+}
+
+static void transfer_failed(const char *reason)
+{
+    printf("[%ld] Datalog: transfer of %s failed at block %u (%s), retrying in %d s\n", time(NULL),
+           g_xfer.kind == XFER_FILE ? g_xfer.name : "directory list", g_xfer.block, reason, DATALOG_RETRY_INTERVAL);
+    if (g_xfer.kind == XFER_FILE) {
+        g_queue_pos++; // a broken file must not block the newer ones - it is queued again by the next listing
+    }
+    end_transfer();
+    g_retry_after = time(NULL) + DATALOG_RETRY_INTERVAL;
+}
+
+static int store_block(const char *data, size_t len)
+{
+    if (g_xfer.kind == XFER_DIRECTORY) {
+        char *listing = realloc(g_xfer.listing, g_xfer.listing_len + len + 1);
+        if (listing == NULL) {
+            return -1;
+        }
+        g_xfer.listing = listing;
+        memcpy(g_xfer.listing + g_xfer.listing_len, data, len);
+        g_xfer.listing_len += len;
+        g_xfer.listing[g_xfer.listing_len] = '\0';
+        return 0;
+    }
+
+    if (g_xfer.block < g_xfer.skip) {
+        return 0; // stored and parsed by an earlier attempt
+    }
+    if (fwrite(data, 1, len, g_xfer.out) != len || fflush(g_xfer.out) != 0) {
+        error_message("cannot write %s.part: %s\n", g_xfer.name, strerror(errno));
+        return -1;
+    }
+    csv_feed(data, len);
+    return 0;
+}
+
+static void transfer_finished(void)
+{
+    char part[512];
+    char path[512];
+
+    if (g_xfer.kind == XFER_DIRECTORY) {
+        if (g_xfer.listing) {
+            queue_files();
+        }
+        end_transfer();
+        return;
+    }
+
+    csv_finish();
+    fclose(g_xfer.out);
+    g_xfer.out = NULL;
+
+    file_path(g_xfer.name, ".part", part, sizeof(part));
+    file_path(g_xfer.name, "", path, sizeof(path));
+    if (rename(part, path) != 0) {
+        error_message("cannot rename %s: %s\n", part, strerror(errno));
+    }
+    printf("[%ld] Datalog: %s downloaded (%u blocks)\n", time(NULL), g_xfer.name, g_xfer.block + 1);
+
+    g_queue_pos++;
+    end_transfer();
+}
+
+static int transfer_step(void)
+{
+    uint32_t object_id = g_xfer.kind == XFER_FILE ? SCOMX_DATALOG_FILE_ACCESS : SCOMX_DATALOG_DIRECTORY_LIST;
+    scomx_enc_result_t enc;
+    scomx_dec_result_t dec;
+
+    enc = scomx_encode_datalog_transfer(object_id, g_xfer.next_action, g_xfer.kind == XFER_FILE ? g_xfer.name : NULL);
+
+    if (bus_transfer(&enc, &dec) != 0) {
+        // lost or broken block - ask for the same one again
+        if (++g_xfer.retries > DATALOG_MAX_RETRIES) {
+            transfer_failed(scomx_err2str(dec.error));
+        } else if (g_xfer.next_action != SCOMX_PROP_SD_START) {
+            g_xfer.next_action = SCOMX_PROP_SD_NACK_RETRY;
+        }
+        return 1;
+    }
+    if (dec.error != SCOM_ERROR_NO_ERROR) {
+        transfer_failed(scomx_err2str(dec.error)); // e.g. gateway busy while the datalog is written
+        return 1;
+    }
+    if (dec.service_id != SCOM_READ_PROPERTY_SERVICE || dec.object_type != SCOM_DATALOG_TRANSFER_OBJECT_TYPE || dec.object_id != object_id ||
+        (dec.property_id != SCOMX_PROP_SD_DATABLOCK && dec.property_id != SCOMX_PROP_SD_FINISH)) {
+        transfer_failed("unexpected response");
+        return 1;
+    }
+
+    if (store_block(dec.data, dec.length) != 0) {
+        transfer_failed("local storage");
+        return 1;
+    }
+
+    if (dec.property_id == SCOMX_PROP_SD_FINISH) {
+        transfer_finished();
+    } else {
+        g_xfer.next_action = SCOMX_PROP_SD_ACK_CONTINUE;
+        g_xfer.block++;
+        g_xfer.retries = 0;
+    }
+    return 1;
+}
+
+int datalog_init(const char *dir, int max_age_days, const char *topic_root, struct mosquitto *mosq)
+{
+    if (dir == NULL) {
+        return -1;
+    }
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+        error_message("cannot create %s: %s\n", dir, strerror(errno));
+        return -1;
+    }
+
+    snprintf(g_dir, sizeof(g_dir), "%s", dir);
+    g_max_age_days = max_age_days;
+    g_topic_root = topic_root;
+    g_mosq = mosq;
+    g_enabled = 1;
+    return 0;
+}
+
+int datalog_service(void)
+{
+    if (!g_enabled) {
+        return 0;
+    }
+    if (g_xfer.kind != XFER_IDLE) {
+        return transfer_step();
+    }
+
+    time_t now = time(NULL);
+    scom_frame_flags_t flags = bus_frame_flags();
+    if (now < g_retry_after || !flags.is_sd_card_present) {
+        return 0;
+    }
+
+    if (g_queue_pos < g_queue_len) {
+        start_transfer(XFER_FILE, g_queue[g_queue_pos]);
+        if (open_part() != 0) {
+            transfer_failed("local storage");
+            return 0;
+        }
+        return transfer_step();
+    }
+
+    // list the directory every hour and when the Xcom-232i announces a new file
+    if (g_last_listing == 0 || now - g_last_listing >= DATALOG_LIST_INTERVAL ||
+        (flags.is_new_datalogger_file_present && now - g_last_listing >= DATALOG_RETRY_INTERVAL)) {
+        g_last_listing = now;
+        start_transfer(XFER_DIRECTORY, NULL);
+        return transfer_step();
+    }
+    return 0;
+}
+
+void datalog_close(void)
+{
+    scomx_enc_result_t enc;
+    scomx_dec_result_t dec;
+
+    if (g_xfer.kind != XFER_IDLE && g_xfer.next_action != SCOMX_PROP_SD_START) {
+        // release the transfer on the Xcom-232i; the stored blocks are resumed on the next start
+        enc = scomx_encode_datalog_transfer(g_xfer.kind == XFER_FILE ? SCOMX_DATALOG_FILE_ACCESS : SCOMX_DATALOG_DIRECTORY_LIST, SCOMX_PROP_SD_ABORT,
+                                            NULL);
+        bus_transfer(&enc, &dec);
+    }
+    end_transfer();
+
+    free(g_xfer.listing);
+    g_xfer.listing = NULL;
+    g_enabled = 0;
+}
@@ -0,0 +1,27 @@
+#ifndef DATALOG_H
+#define DATALOG_H
+
+#include <mosquitto.h>
+
+// Download of the CSV datalog files from the SD card of the Xcom-232i (4.8 File transfer object)
+//
+// The Xcom-232i records one file per day (LGYYMMDD.CSV) with minute values. Completed files from the
+// last max_age_days days are transferred one 512 byte block per datalog_service() call, stored in dir
+// and parsed while they arrive. Every data row is published on <root>/datalog as JSON:
+//   {"file": "LG171010.CSV", "timestamp": 1507586400, "values": {"XT-Ubat [Vdc]": 52.1, ...}}
+//
+// Blocks are appended to dir/LGYYMMDD.CSV.part as soon as they have been acknowledged. After an
+// interruption (timeout, daemon restart) the transfer restarts and skips the blocks already stored,
+// so no sample is published twice. Finished files are renamed to dir/LGYYMMDD.CSV.
+
+// returns -1 if dir cannot be created (datalog download disabled)
+int datalog_init(const char *dir, int max_age_days, const char *topic_root, struct mosquitto *mosq);
+
+// perform at most one step of the current transfer (bus thread only, call between polls)
+// returns 1 if a frame was sent, 0 otherwise
+int datalog_service(void);
+
+// abort a running transfer and release the resources; the partial file is kept for resuming
+void datalog_close(void);
+
+#endif
@@ -0,0 +1,215 @@
+//
+//  Derived sensors: plan of the poll list and evaluation
+//
+//  See derived.h. Only the poll loop uses this.
+//
+
+#include "derived.h"
+#include "expr.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define error_message(fmt, ...) fprintf(stderr, "[DERIVED ERROR] " fmt, ##__VA_ARGS__)
+
+// planning state of an entry
+#define ENTRY_READ 0    // read from the bus
+#define ENTRY_PENDING 1 // has an expression, not planned yet
+#define ENTRY_DERIVED 2
+
+// what happened to an entry in this cycle
+#define CYCLE_NONE 0    // not read (not due, see schedule.h)
+#define CYCLE_READ 1
+#define CYCLE_FAILED 2
+
+typedef struct {
+    size_t num_params;
+    uint8_t *state;   // ENTRY_* per entry
+    expr_t *exprs;    // per entry, used where state is ENTRY_DERIVED
+    size_t *order;    // derived entries in evaluation order
+    size_t num_derived;
+    float *values;    // last value of every entry
+    uint8_t *valid;   // 1 where values holds a value
+    uint8_t *cycle;   // CYCLE_* per entry
+} plan_t;
+
+static plan_t g_plan;
+
+static void free_plan(plan_t *plan)
+{
+    free(plan->state);
+    free(plan->exprs);
+    free(plan->order);
+    free(plan->values);
+    free(plan->valid);
+    free(plan->cycle);
+    memset(plan, 0, sizeof(*plan));
+}
+
+static int resolve_name(const char *name, size_t len, void *ctx)
+{
+    const config_t *cfg = ctx;
+    for (size_t i = 0; i < cfg->num_parameters; i++) {
+        if (strlen(cfg->parameters[i].name) == len && strncmp(cfg->parameters[i].name, name, len) == 0) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+// 1 if every variable of expr is read or already derived
+static int sources_planned(const plan_t *plan, const expr_t *expr)
+{
+    for (size_t i = 0; i < expr->length; i++) {
+        if (expr->code[i].op == EXPR_VAR && plan->state[expr->code[i].var] == ENTRY_PENDING) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int derived_plan(const config_t *cfg)
+{
+    size_t n = cfg->num_parameters;
+    plan_t plan = {.num_params = n};
+    size_t pending = 0;
+
+    plan.state = calloc(n ? n : 1, sizeof(uint8_t));
+    plan.exprs = calloc(n ? n : 1, sizeof(expr_t));
+    plan.order = calloc(n ? n : 1, sizeof(size_t));
+    plan.values = calloc(n ? n : 1, sizeof(float));
+    plan.valid = calloc(n ? n : 1, sizeof(uint8_t));
+    plan.cycle = calloc(n ? n : 1, sizeof(uint8_t));
+    if (plan.state == NULL || plan.exprs == NULL || plan.order == NULL || plan.values == NULL || plan.valid == NULL || plan.cycle == NULL) {
+        error_message("out of memory\n");
+        free_plan(&plan);
+        return -1;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        const parameter_t *param = &cfg->parameters[i];
+        if (param->expression == NULL) {
+            continue;
+        }
+        if (expr_compile(param->expression, &plan.exprs[i], resolve_name, (void *)cfg) != 0) {
+            error_message("%s: invalid expression\n", param->name);
+            free_plan(&plan);
+            return -1;
+        }
+        plan.state[i] = ENTRY_PENDING;
+        pending++;
+    }
+
+    // derive whatever has its sources; break a cycle by reading one of its entries from the bus
+    while (pending > 0) {
+        int progress = 0;
+        for (size_t i = 0; i < n; i++) {
+            if (plan.state[i] == ENTRY_PENDING && sources_planned(&plan, &plan.exprs[i])) {
+                plan.state[i] = ENTRY_DERIVED;
+                plan.order[plan.num_derived++] = i;
+                pending--;
+                progress = 1;
+            }
+        }
+        if (progress) {
+            continue;
+        }
+        size_t i;
+        for (i = 0; i < n; i++) {
+            if (plan.state[i] == ENTRY_PENDING && cfg->parameters[i].address != 0) {
+                break;
+            }
+        }
+        if (i == n) {
+            error_message("circular expressions without a parameter to read instead\n");
+            free_plan(&plan);
+            return -1;
+        }
+        printf("[%ld] %s cannot be derived (circular expressions), reading it from the bus\n", time(NULL), cfg->parameters[i].name);
+        plan.state[i] = ENTRY_READ;
+        pending--;
+    }
+
+    free_plan(&g_plan);
+    g_plan = plan;
+
+    size_t saved = 0;
+    for (size_t k = 0; k < plan.num_derived; k++) {
+        saved += cfg->parameters[plan.order[k]].address != 0;
+    }
+    if (plan.num_derived > 0) {
+        printf("[%ld] %zu sensors derived, %zu bus reads per cycle saved\n", time(NULL), plan.num_derived, saved);
+    }
+    return 0;
+}
+
+int derived_is_derived(size_t idx)
+{
+    return idx < g_plan.num_params && g_plan.state[idx] == ENTRY_DERIVED;
+}
+
+void derived_begin_cycle(void)
+{
+    if (g_plan.num_params > 0) {
+        memset(g_plan.cycle, CYCLE_NONE, g_plan.num_params);
+    }
+}
+
+void derived_set(size_t idx, float value)
+{
+    if (idx < g_plan.num_params) {
+        g_plan.values[idx] = value;
+        g_plan.valid[idx] = 1;
+        g_plan.cycle[idx] = CYCLE_READ;
+    }
+}
+
+void derived_failed(size_t idx)
+{
+    if (idx < g_plan.num_params) {
+        g_plan.valid[idx] = 0;
+        g_plan.cycle[idx] = CYCLE_FAILED;
+    }
+}
+
+size_t derived_count(void)
+{
+    return g_plan.num_derived;
+}
+
+size_t derived_entry(size_t k)
+{
+    return g_plan.order[k];
+}
+
+int derived_eval(size_t k, float *value)
+{
+    size_t idx = g_plan.order[k];
+    const expr_t *expr = &g_plan.exprs[idx];
+
+    int updated = 0, complete = 1;
+    for (size_t i = 0; i < expr->length; i++) {
+        if (expr->code[i].op != EXPR_VAR) {
+            continue;
+        }
+        size_t var = expr->code[i].var;
+        if (g_plan.cycle[var] == CYCLE_FAILED) {
+            derived_failed(idx);
+            return -1;
+        }
+        updated |= g_plan.cycle[var] == CYCLE_READ;
+        complete &= g_plan.valid[var];
+    }
+    if (!updated || !complete) {
+        return 1;
+    }
+    if (expr_eval(expr, g_plan.values, value) != 0) {
+        derived_failed(idx);
+        return -1;
+    }
+    derived_set(idx, *value); // input of the entries that follow
+    return 0;
+}
@@ -0,0 +1,48 @@
+#ifndef DERIVED_H
+#define DERIVED_H
+
+#include "config.h"
+
+/*
+# Derived sensors
+
+A poll list entry with an `expression` (see expr.h) is computed from the values of other
+entries instead of being read from the Xcom-232i. The plan made for a poll list decides:
+
+- an entry whose expression only uses entries that are read (or derived themselves) is derived:
+  it costs no bus time and is computed at the end of every cycle, in dependency order,
+- an entry whose expression cannot be planned (circular) is read from the bus if it has a
+  `parameter` and `address`; otherwise the plan fails.
+
+A derived value is computed in every cycle in which one of its sources was read, from the last
+value of the others (entries are not read every cycle when they have a schedule, see
+schedule.h). If a source failed in this cycle, or has no value yet, the derived entry fails or
+waits. The `sign` of an entry only applies to bus reads - expressions work on the published
+values.
+*/
+
+// plan the poll list of cfg; on error (invalid expression, circular entries without a bus source)
+// the reason is printed, -1 is returned and the previous plan stays in place
+int derived_plan(const config_t *cfg);
+
+// 1 if entry idx is computed instead of read
+int derived_is_derived(size_t idx);
+
+// forget the values of the previous cycle
+void derived_begin_cycle(void);
+
+// value of entry idx read in this cycle (sign applied)
+void derived_set(size_t idx, float value);
+
+// entry idx failed in this cycle (read failed, device absent)
+void derived_failed(size_t idx);
+
+// number of derived entries; the k-th one in evaluation order
+size_t derived_count(void);
+size_t derived_entry(size_t k);
+
+// compute the k-th derived entry; returns -1 if a source failed this cycle or the result is not
+// a number, 1 if there is nothing new (no source read this cycle, or one without a value yet)
+int derived_eval(size_t k, float *value);
+
+#endif
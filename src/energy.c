@@ -0,0 +1,93 @@
+//
+//  Energy integration of the active power entries
+//
+//  See energy.h. Only the poll loop uses this; the counters are kept by state_file.c.
+//
+
+#include "energy.h"
+#include "state_file.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define error_message(fmt, ...) fprintf(stderr, "[ENERGY ERROR] " fmt, ##__VA_ARGS__)
+
+typedef struct {
+    double to_kw;     // unit of the entry in kW, 0 if it is not integrated
+    int have_sample;
+    float value;      // previous sample
+    int64_t time_ns;
+} integrator_t;
+
+static integrator_t *g_integrators = NULL;
+static size_t g_num_params = 0;
+
+// kW per unit of an active power, 0 if param is something else
+static double unit_to_kw(const parameter_t *param)
+{
+    if (param->device_class == NULL || strcmp(param->device_class, "power") != 0) {
+        return 0.0;
+    }
+    if (strcmp(param->unit, "kW") == 0) {
+        return 1.0;
+    }
+    if (strcmp(param->unit, "W") == 0) {
+        return 0.001;
+    }
+    return 0.0;
+}
+
+int energy_tracked(const parameter_t *param)
+{
+    return unit_to_kw(param) != 0.0;
+}
+
+void energy_bind(const config_t *cfg)
+{
+    free(g_integrators);
+    g_num_params = 0;
+    g_integrators = calloc(cfg->num_parameters ? cfg->num_parameters : 1, sizeof(integrator_t));
+    if (g_integrators == NULL) {
+        error_message("out of memory\n");
+        return;
+    }
+    for (size_t i = 0; i < cfg->num_parameters; i++) {
+        g_integrators[i].to_kw = unit_to_kw(&cfg->parameters[i]);
+    }
+    g_num_params = cfg->num_parameters;
+}
+
+void energy_sample(size_t idx, float value, const struct timespec *when)
+{
+    if (idx >= g_num_params || g_integrators[idx].to_kw == 0.0) {
+        return;
+    }
+    integrator_t *integ = &g_integrators[idx];
+    int64_t now_ns = (int64_t)when->tv_sec * 1000000000 + when->tv_nsec;
+
+    if (integ->have_sample && now_ns > integ->time_ns && now_ns - integ->time_ns <= (int64_t)ENERGY_MAX_GAP_S * 1000000000) {
+        double hours = (double)(now_ns - integ->time_ns) / 3.6e12;
+        double p0 = integ->value * integ->to_kw;
+        double p1 = value * integ->to_kw;
+        double positive = 0.0, negative = 0.0;
+
+        if (p0 >= 0.0 && p1 >= 0.0) {
+            positive = (p0 + p1) / 2.0 * hours;
+        } else if (p0 <= 0.0 && p1 <= 0.0) {
+            negative = -(p0 + p1) / 2.0 * hours;
+        } else {
+            // linear in between: split at the zero crossing
+            double t0 = hours * p0 / (p0 - p1);
+            double area0 = p0 * t0 / 2.0;
+            double area1 = p1 * (hours - t0) / 2.0;
+            positive = p0 > 0.0 ? area0 : area1;
+            negative = p0 > 0.0 ? -area1 : -area0;
+        }
+        state_file_add_energy(idx, positive, negative);
+    }
+
+    integ->have_sample = 1;
+    integ->value = value;
+    integ->time_ns = now_ns;
+}
@@ -0,0 +1,37 @@
+#ifndef ENERGY_H
+#define ENERGY_H
+
+#include "config.h"
+#include <time.h>
+
+/*
+# Energy integration
+
+Every active power entry of the poll list (device class "power", unit W or kW) is integrated
+into two kWh counters with the trapezoidal rule over the CLOCK_MONOTONIC times of its samples,
+so the energy follows every read rather than the published values. Power with the published
+sign counts towards `energy`, negative power towards `energy_returned`; an interval crossing zero
+is split at the interpolated crossing, so both counters only ever increase.
+
+The counters live in the warm-restart state file (state_file.h): a crash loses nothing. The
+poll loop flushes the file to disk before it publishes them (every ENERGY_PUBLISH_INTERVAL_S),
+so a published value is never ahead of the disk and Home Assistant never sees a counter going
+back, even after a power cut.
+
+A gap of more than ENERGY_MAX_GAP_S between two samples (device not answering, serial port
+lost, daemon restarted) is not integrated.
+*/
+
+#define ENERGY_MAX_GAP_S 60
+#define ENERGY_PUBLISH_INTERVAL_S 30
+
+// 1 if param is integrated
+int energy_tracked(const parameter_t *param);
+
+// match the integration to the poll list of cfg (state_file_bind() first)
+void energy_bind(const config_t *cfg);
+
+// sample of entry idx (published value) taken at when (CLOCK_MONOTONIC)
+void energy_sample(size_t idx, float value, const struct timespec *when);
+
+#endif
@@ -0,0 +1,266 @@
+//
+//  Arithmetic expressions over poll list values
+//
+//  Recursive descent parser emitting postfix code; see expr.h for the syntax.
+//
+
+#include "expr.h"
+
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define error_message(fmt, ...) fprintf(stderr, "[EXPR ERROR] " fmt, ##__VA_ARGS__)
+
+typedef struct {
+    const char *text;
+    const char *pos;
+    expr_t *expr;
+    int depth; // stack depth at run time after the code emitted so far
+    expr_resolve_t resolve;
+    void *ctx;
+} parser_t;
+
+static int parse_sum(parser_t *p);
+
+static int fail(parser_t *p, const char *what)
+{
+    error_message("%s at position %d of \"%s\"\n", what, (int)(p->pos - p->text) + 1, p->text);
+    return -1;
+}
+
+static void skip_space(parser_t *p)
+{
+    while (isspace((unsigned char)*p->pos)) {
+        p->pos++;
+    }
+}
+
+static int emit(parser_t *p, expr_op_t op, int argc, int var, float value)
+{
+    if (p->expr->length >= EXPR_MAX_CODE) {
+        return fail(p, "expression too long");
+    }
+    expr_insn_t *insn = &p->expr->code[p->expr->length++];
+    insn->op = (uint8_t)op;
+    insn->argc = (uint8_t)argc;
+    insn->var = (uint16_t)var;
+    insn->value = value;
+
+    if (op == EXPR_CONST || op == EXPR_VAR) {
+        p->depth++;
+    } else if (op == EXPR_MIN || op == EXPR_MAX) {
+        p->depth -= argc - 1;
+    } else if (op != EXPR_NEG && op != EXPR_ABS) {
+        p->depth--;
+    }
+    if (p->depth > EXPR_MAX_STACK) {
+        return fail(p, "expression nested too deeply");
+    }
+    return 0;
+}
+
+// function call arguments after the opening parenthesis; returns their number or -1
+static int parse_args(parser_t *p)
+{
+    int argc = 0;
+    for (;;) {
+        if (parse_sum(p) != 0) {
+            return -1;
+        }
+        argc++;
+        skip_space(p);
+        if (*p->pos == ')') {
+            p->pos++;
+            return argc;
+        }
+        if (*p->pos != ',' || argc >= 255) {
+            return fail(p, "expected ',' or ')'");
+        }
+        p->pos++;
+    }
+}
+
+static int parse_primary(parser_t *p)
+{
+    skip_space(p);
+
+    if (*p->pos == '(') {
+        p->pos++;
+        if (parse_sum(p) != 0) {
+            return -1;
+        }
+        skip_space(p);
+        if (*p->pos != ')') {
+            return fail(p, "expected ')'");
+        }
+        p->pos++;
+        return 0;
+    }
+
+    if (isdigit((unsigned char)*p->pos) || *p->pos == '.') {
+        char *end;
+        float value = strtof(p->pos, &end);
+        if (end == p->pos) {
+            return fail(p, "invalid number");
+        }
+        p->pos = end;
+        return emit(p, EXPR_CONST, 0, 0, value);
+    }
+
+    if (isalpha((unsigned char)*p->pos) || *p->pos == '_') {
+        const char *name = p->pos;
+        while (isalnum((unsigned char)*p->pos) || *p->pos == '_') {
+            p->pos++;
+        }
+        size_t len = (size_t)(p->pos - name);
+
+        skip_space(p);
+        if (*p->pos == '(') {
+            expr_op_t op;
+            if (len == 3 && strncmp(name, "min", 3) == 0) {
+                op = EXPR_MIN;
+            } else if (len == 3 && strncmp(name, "max", 3) == 0) {
+                op = EXPR_MAX;
+            } else if (len == 3 && strncmp(name, "abs", 3) == 0) {
+                op = EXPR_ABS;
+            } else {
+                p->pos = name;
+                return fail(p, "unknown function");
+            }
+            p->pos++;
+            int argc = parse_args(p);
+            if (argc < 0) {
+                return -1;
+            }
+            if (op == EXPR_ABS && argc != 1) {
+                return fail(p, "abs() takes one argument");
+            }
+            return emit(p, op, argc, 0, 0.0f);
+        }
+
+        int var = p->resolve(name, len, p->ctx);
+        if (var < 0) {
+            error_message("unknown parameter \"%.*s\" in \"%s\"\n", (int)len, name, p->text);
+            return -1;
+        }
+        return emit(p, EXPR_VAR, 0, var, 0.0f);
+    }
+
+    return fail(p, *p->pos ? "unexpected character" : "unexpected end");
+}
+
+static int parse_unary(parser_t *p)
+{
+    skip_space(p);
+    if (*p->pos == '-') {
+        p->pos++;
+        return parse_unary(p) != 0 ? -1 : emit(p, EXPR_NEG, 0, 0, 0.0f);
+    }
+    return parse_primary(p);
+}
+
+static int parse_product(parser_t *p)
+{
+    if (parse_unary(p) != 0) {
+        return -1;
+    }
+    for (;;) {
+        skip_space(p);
+        char c = *p->pos;
+        if (c != '*' && c != '/') {
+            return 0;
+        }
+        p->pos++;
+        if (parse_unary(p) != 0 || emit(p, c == '*' ? EXPR_MUL : EXPR_DIV, 0, 0, 0.0f) != 0) {
+            return -1;
+        }
+    }
+}
+
+static int parse_sum(parser_t *p)
+{
+    if (parse_product(p) != 0) {
+        return -1;
+    }
+    for (;;) {
+        skip_space(p);
+        char c = *p->pos;
+        if (c != '+' && c != '-') {
+            return 0;
+        }
+        p->pos++;
+        if (parse_product(p) != 0 || emit(p, c == '+' ? EXPR_ADD : EXPR_SUB, 0, 0, 0.0f) != 0) {
+            return -1;
+        }
+    }
+}
+
+int expr_compile(const char *text, expr_t *expr, expr_resolve_t resolve, void *ctx)
+{
+    parser_t p = {.text = text, .pos = text, .expr = expr, .depth = 0, .resolve = resolve, .ctx = ctx};
+
+    expr->length = 0;
+    if (parse_sum(&p) != 0) {
+        return -1;
+    }
+    skip_space(&p);
+    if (*p.pos != '\0') {
+        return fail(&p, "unexpected character");
+    }
+    return 0;
+}
+
+int expr_eval(const expr_t *expr, const float *vars, float *result)
+{
+    float stack[EXPR_MAX_STACK];
+    int sp = 0;
+
+    for (size_t i = 0; i < expr->length; i++) {
+        const expr_insn_t *insn = &expr->code[i];
+        switch ((expr_op_t)insn->op) {
+        case EXPR_CONST:
+            stack[sp++] = insn->value;
+            break;
+        case EXPR_VAR:
+            stack[sp++] = vars[insn->var];
+            break;
+        case EXPR_NEG:
+            stack[sp - 1] = -stack[sp - 1];
+            break;
+        case EXPR_ABS:
+            stack[sp - 1] = fabsf(stack[sp - 1]);
+            break;
+        case EXPR_ADD:
+            sp--;
+            stack[sp - 1] += stack[sp];
+            break;
+        case EXPR_SUB:
+            sp--;
+            stack[sp - 1] -= stack[sp];
+            break;
+        case EXPR_MUL:
+            sp--;
+            stack[sp - 1] *= stack[sp];
+            break;
+        case EXPR_DIV:
+            sp--;
+            stack[sp - 1] /= stack[sp];
+            break;
+        case EXPR_MIN:
+        case EXPR_MAX:
+            for (int n = 1; n < insn->argc; n++) {
+                sp--;
+                if (insn->op == EXPR_MIN ? stack[sp] < stack[sp - 1] : stack[sp] > stack[sp - 1]) {
+                    stack[sp - 1] = stack[sp];
+                }
+            }
+            break;
+        }
+    }
+
+    *result = stack[0];
+    return isfinite(*result) ? 0 : -1;
+}
@@ -0,0 +1,57 @@
+#ifndef EXPR_H
+#define EXPR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+# Arithmetic expressions over poll list values
+
+    l1_input_active_power + l2_input_active_power + l3_input_active_power
+    100 * total_output_active_power / total_input_active_power
+    max(l1_output_active_power, l2_output_active_power, l3_output_active_power) - min(...)
+
+Numbers, parameter names, `+ - * /`, unary minus, parentheses and the functions `min`, `max`
+(any number of arguments) and `abs`. An expression is compiled once into a flat program for a
+small stack machine; names are resolved to variable indices by the caller at compile time.
+*/
+
+#define EXPR_MAX_CODE 64  // instructions per expression
+#define EXPR_MAX_STACK 16 // nesting depth
+
+typedef enum {
+    EXPR_CONST,
+    EXPR_VAR,
+    EXPR_NEG,
+    EXPR_ADD,
+    EXPR_SUB,
+    EXPR_MUL,
+    EXPR_DIV,
+    EXPR_MIN, // argc operands
+    EXPR_MAX, // argc operands
+    EXPR_ABS,
+} expr_op_t;
+
+typedef struct {
+    uint8_t op;   // expr_op_t
+    uint8_t argc; // EXPR_MIN/EXPR_MAX
+    uint16_t var; // EXPR_VAR
+    float value;  // EXPR_CONST
+} expr_insn_t;
+
+typedef struct {
+    expr_insn_t code[EXPR_MAX_CODE];
+    size_t length;
+} expr_t;
+
+// maps the name (not terminated, len characters) to a variable index; -1 if unknown
+typedef int (*expr_resolve_t)(const char *name, size_t len, void *ctx);
+
+// compile text; returns -1 and prints the reason if it is invalid
+int expr_compile(const char *text, expr_t *expr, expr_resolve_t resolve, void *ctx);
+
+// evaluate with the variable values vars; returns -1 if the result is not a finite number
+// (division by zero)
+int expr_eval(const expr_t *expr, const float *vars, float *result);
+
+#endif
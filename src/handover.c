@@ -0,0 +1,402 @@
+//
+//  Zero-downtime handover of the serial port to a new daemon process
+//
+//  See handover.h for the protocol.
+//
+
+#define _GNU_SOURCE // accept4(), MSG_CMSG_CLOEXEC
+
+#include "handover.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define error_message(fmt, ...) fprintf(stderr, "[HANDOVER ERROR] " fmt, ##__VA_ARGS__)
+
+static int g_listen_fd = -1;
+static char g_socket_path[108];
+static ino_t g_socket_ino = 0; // to tell our socket file from the one of a successor
+static pid_t g_successor_pid = 0;
+static pid_t g_predecessor_pid = 0;
+
+static void make_msg(handover_msg_t *msg)
+{
+    memset(msg, 0, sizeof(*msg));
+    msg->magic = HANDOVER_MAGIC;
+    msg->version = HANDOVER_VERSION;
+    msg->pid = (int32_t)getpid();
+}
+
+static int valid_msg(const handover_msg_t *msg, ssize_t len)
+{
+    return len == (ssize_t)sizeof(*msg) && msg->magic == HANDOVER_MAGIC && msg->version == HANDOVER_VERSION;
+}
+
+static int socket_address(const char *path, struct sockaddr_un *addr)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        error_message("socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr->sun_path, path);
+    return 0;
+}
+
+int handover_listen(const char *path)
+{
+    struct sockaddr_un addr;
+    struct stat st;
+
+    if (socket_address(path, &addr) != 0) {
+        return -1;
+    }
+
+    g_listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (g_listen_fd < 0) {
+        error_message("socket error %d: %s\n", errno, strerror(errno));
+        return -1;
+    }
+
+    unlink(path); // stale socket, or the one of the predecessor that is about to exit
+
+    if (bind(g_listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(g_listen_fd, 1) != 0) {
+        error_message("bind(%s) error %d: %s\n", path, errno, strerror(errno));
+        close(g_listen_fd);
+        g_listen_fd = -1;
+        return -1;
+    }
+    chmod(path, 0600); // whoever connects gets the serial port
+
+    snprintf(g_socket_path, sizeof(g_socket_path), "%s", path);
+    g_socket_ino = stat(path, &st) == 0 ? st.st_ino : 0;
+    return 0;
+}
+
+int handover_accept(void)
+{
+    if (g_listen_fd < 0) {
+        return -1;
+    }
+
+    int conn = accept4(g_listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (conn < 0) {
+        return -1; // EAGAIN: nobody is waiting
+    }
+
+    // the successor sends its request right after connecting
+    struct pollfd pfd = {.fd = conn, .events = POLLIN};
+    handover_msg_t msg;
+    ssize_t len = -1;
+    if (poll(&pfd, 1, 1000) == 1) {
+        len = recv(conn, &msg, sizeof(msg), 0);
+    }
+    if (!valid_msg(&msg, len)) {
+        error_message("invalid handover request\n");
+        close(conn);
+        return -1;
+    }
+
+    // the kernel's word on who is connected, not the pid in the message
+    struct ucred cred;
+    socklen_t cred_len = sizeof(cred);
+    g_successor_pid = getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) == 0 ? cred.pid : msg.pid;
+
+    printf("Handover requested by pid %d\n", (int)g_successor_pid);
+    return conn;
+}
+
+int handover_send(int conn, int serial_fd)
+{
+    handover_msg_t msg;
+    make_msg(&msg);
+
+    struct iovec iov = {.iov_base = &msg, .iov_len = sizeof(msg)};
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    memset(&control, 0, sizeof(control));
+
+    struct msghdr hdr = {0};
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = control.buf;
+    hdr.msg_controllen = sizeof(control.buf);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &serial_fd, sizeof(int));
+
+    if (sendmsg(conn, &hdr, MSG_NOSIGNAL) != (ssize_t)sizeof(msg)) {
+        error_message("sendmsg error %d: %s\n", errno, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+int handover_wait_ready(int conn)
+{
+    struct pollfd pfd = {.fd = conn, .events = POLLIN};
+    char ready;
+
+    for (;;) {
+        int ret = poll(&pfd, 1, HANDOVER_READY_TIMEOUT_S * 1000);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret == 0) {
+            error_message("successor not ready after %d s\n", HANDOVER_READY_TIMEOUT_S);
+            return -1;
+        }
+        if (ret < 0 || recv(conn, &ready, 1, 0) != 1) {
+            return -1; // successor exited before its first cycle
+        }
+        return 0;
+    }
+}
+
+void handover_close(void)
+{
+    struct stat st;
+
+    if (g_listen_fd < 0) {
+        return;
+    }
+    close(g_listen_fd);
+    g_listen_fd = -1;
+
+    // a successor may have bound the same path meanwhile
+    if (stat(g_socket_path, &st) == 0 && st.st_ino == g_socket_ino) {
+        unlink(g_socket_path);
+    }
+}
+
+int handover_spawn(const char *exe_path, int argc, const char *argv[])
+{
+    // the successor is not waited for - it outlives this process
+    signal(SIGCHLD, SIG_IGN);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        error_message("fork error %d: %s\n", errno, strerror(errno));
+        return -1;
+    }
+    if (pid > 0) {
+        return (int)pid;
+    }
+
+    // child: drop everything but stdio - the serial port comes over the handover socket
+    for (int fd = 3; fd < 1024; fd++) {
+        close(fd);
+    }
+    signal(SIGCHLD, SIG_DFL);
+
+    const char **args = calloc((size_t)argc + 2, sizeof(char *));
+    if (args == NULL) {
+        _exit(1);
+    }
+    args[0] = exe_path;
+    args[1] = "--takeover";
+    for (int i = 1; i < argc; i++) {
+        args[i + 1] = argv[i];
+    }
+    execv(exe_path, (char *const *)args);
+    error_message("cannot execute %s: %s\n", exe_path, strerror(errno));
+    _exit(1);
+}
+
+int handover_request(const char *path, int *serial_fd)
+{
+    struct sockaddr_un addr;
+
+    if (socket_address(path, &addr) != 0) {
+        return -1;
+    }
+
+    int conn = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (conn < 0) {
+        error_message("socket error %d: %s\n", errno, strerror(errno));
+        return -1;
+    }
+    if (connect(conn, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        printf("No running daemon to take over from (%s)\n", strerror(errno));
+        close(conn);
+        return -1;
+    }
+
+    handover_msg_t msg;
+    make_msg(&msg);
+    if (send(conn, &msg, sizeof(msg), MSG_NOSIGNAL) != (ssize_t)sizeof(msg)) {
+        error_message("send error %d: %s\n", errno, strerror(errno));
+        close(conn);
+        return -1;
+    }
+
+    // the predecessor answers once its current poll cycle is finished
+    struct iovec iov = {.iov_base = &msg, .iov_len = sizeof(msg)};
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct msghdr hdr = {0};
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = control.buf;
+    hdr.msg_controllen = sizeof(control.buf);
+
+    ssize_t len = recvmsg(conn, &hdr, MSG_CMSG_CLOEXEC);
+    struct cmsghdr *cmsg = len > 0 ? CMSG_FIRSTHDR(&hdr) : NULL;
+    if (!valid_msg(&msg, len) || cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+        error_message("no serial port received\n");
+        close(conn);
+        return -1;
+    }
+    memcpy(serial_fd, CMSG_DATA(cmsg), sizeof(int));
+
+    // the serial fd was opened without O_CLOEXEC, keep it that way
+    fcntl(*serial_fd, F_SETFD, 0);
+
+    g_predecessor_pid = msg.pid;
+    printf("Serial port taken over from pid %d\n", msg.pid);
+    return conn;
+}
+
+// sd_notify(3) without libsystemd: a datagram to $NOTIFY_SOCKET, with pass_fd attached unless < 0
+static int notify(const char *state, int pass_fd)
+{
+    const char *path = getenv("NOTIFY_SOCKET");
+    struct sockaddr_un addr;
+
+    if (path == NULL || (path[0] != '/' && path[0] != '@') || strlen(path) >= sizeof(addr.sun_path)) {
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    if (addr.sun_path[0] == '@') {
+        addr.sun_path[0] = '\0'; // abstract namespace
+    }
+
+    int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    struct iovec iov = {.iov_base = (void *)state, .iov_len = strlen(state)};
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct msghdr hdr = {0};
+    hdr.msg_name = &addr;
+    hdr.msg_namelen = (socklen_t)(offsetof(struct sockaddr_un, sun_path) + strlen(path));
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    if (pass_fd >= 0) {
+        memset(&control, 0, sizeof(control));
+        hdr.msg_control = control.buf;
+        hdr.msg_controllen = sizeof(control.buf);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &pass_fd, sizeof(int));
+    }
+
+    int ret = sendmsg(fd, &hdr, MSG_NOSIGNAL) == (ssize_t)iov.iov_len ? 0 : -1;
+    close(fd);
+    return ret;
+}
+
+// Make pid the main process of the service and wait until systemd has processed that
+// (sd_notify_barrier(3): systemd closes the passed pipe end once all earlier messages are
+// handled). 0 when not started by systemd.
+static int notify_main_pid(pid_t pid)
+{
+    char state[32];
+    int pipefd[2];
+
+    if (getenv("NOTIFY_SOCKET") == NULL) {
+        return 0;
+    }
+
+    snprintf(state, sizeof(state), "MAINPID=%d", (int)pid);
+    if (notify(state, -1) != 0 || pipe2(pipefd, O_CLOEXEC) != 0) {
+        error_message("cannot notify systemd: %s\n", strerror(errno));
+        return -1;
+    }
+    int ret = notify("BARRIER=1", pipefd[1]);
+    close(pipefd[1]);
+
+    // only POLLHUP is expected: the write end is gone once systemd closed its copy
+    struct pollfd pfd = {.fd = pipefd[0], .events = 0};
+    while (ret == 0 && (ret = poll(&pfd, 1, HANDOVER_NOTIFY_TIMEOUT_S * 1000)) < 0 && errno == EINTR) {
+        ret = 0;
+    }
+    close(pipefd[0]);
+    if (ret != 1) {
+        error_message("systemd did not confirm MAINPID=%d\n", (int)pid);
+        return -1;
+    }
+    return 0;
+}
+
+void handover_abort(void)
+{
+    pid_t pid = g_successor_pid;
+
+    g_successor_pid = 0;
+    if (pid <= 0 || pid == getpid()) {
+        return;
+    }
+
+    // take the service back before the successor goes, so systemd never sees its main process exit
+    notify_main_pid(getpid());
+
+    // it may hold the serial port - nobody else touches the bus until it is gone
+    if (kill(pid, SIGKILL) == 0) {
+        printf("Killed successor pid %d\n", (int)pid);
+    }
+    // children are reaped automatically (SIGCHLD ignored): waitpid() returns once it is gone
+    if (waitpid(pid, NULL, 0) < 0 && errno == ECHILD) {
+        for (int i = 0; i < HANDOVER_NOTIFY_TIMEOUT_S * 100 && kill(pid, 0) == 0; i++) {
+            usleep(10000); // started by someone else
+        }
+    }
+}
+
+int handover_ready(int conn)
+{
+    char ready = 1;
+
+    // the predecessor exits once it has the byte: systemd must know the new main process by then,
+    // or Restart=always restarts the service
+    if (notify_main_pid(getpid()) != 0) {
+        close(conn);
+        notify_main_pid(g_predecessor_pid);
+        return -1;
+    }
+    if (send(conn, &ready, 1, MSG_NOSIGNAL) != 1) {
+        error_message("predecessor is gone\n");
+        close(conn);
+        return -1;
+    }
+    close(conn);
+    return 0;
+}
@@ -0,0 +1,81 @@
+#ifndef HANDOVER_H
+#define HANDOVER_H
+
+#include <stdint.h>
+
+/*
+# Zero-downtime handover between two daemon processes
+
+A running daemon (the predecessor) listens on a unix socket. A new daemon started with
+`--takeover` (the successor) connects to it and asks for the serial port:
+
+1. successor -> predecessor: handover_msg_t request
+2. predecessor finishes its poll cycle, stops serving the bus and sends a handover_msg_t reply
+   carrying the open serial fd (SCM_RIGHTS). It stops polling but keeps its MQTT session.
+3. successor opens the port with the received fd, restores the warm-restart state and polls.
+   After its first complete cycle it makes itself the main process of the systemd service
+   (MAINPID, waiting for systemd to confirm), sends one byte and takes over the listening socket.
+4. predecessor disconnects cleanly from the broker (no "offline" last will) and exits.
+
+If the byte does not come within HANDOVER_READY_TIMEOUT_S, the predecessor makes itself the main
+process again, kills the successor and waits until it is gone before it resumes polling - two
+processes must never drive the serial port. A successor that cannot deliver the byte (or get
+systemd's confirmation) exits.
+
+The systemd unit needs NotifyAccess=all for the MAINPID messages (see install-service.sh).
+
+The broker connection is not handed over: libmosquitto cannot adopt a connected socket, so the
+successor opens its own session and both are connected for the duration of one cycle.
+*/
+
+#define HANDOVER_MAGIC 0x31564f48 // "HOV1" in little endian
+#define HANDOVER_VERSION 1
+
+// the predecessor gives up waiting for the successor after this many seconds
+#define HANDOVER_READY_TIMEOUT_S 120
+// longest wait for systemd to process a MAINPID change, or for a killed successor to go away
+#define HANDOVER_NOTIFY_TIMEOUT_S 5
+
+typedef struct {
+    uint32_t magic;   // HANDOVER_MAGIC
+    uint32_t version; // HANDOVER_VERSION
+    int32_t pid;      // sender
+} handover_msg_t;
+
+// PREDECESSOR SIDE
+
+// listen for a successor on path (non-blocking); returns -1 on error
+int handover_listen(const char *path);
+
+// accept a waiting successor and read its request; returns the connection or -1 if nobody asked
+int handover_accept(void);
+
+// send the serial fd to the successor; returns -1 if it is gone
+int handover_send(int conn, int serial_fd);
+
+// wait until the successor completed its first cycle; returns -1 if it went away or timed out
+int handover_wait_ready(int conn);
+
+// after a failed handover: become the main process of the service again, kill the successor and
+// wait until it is gone; call before using the serial port again
+void handover_abort(void);
+
+// close the listening socket; the path is only removed while it still belongs to this process
+void handover_close(void);
+
+// spawn the successor: the executable at exe_path is started with --takeover and argv[1..]
+// (the file may have been replaced since this process started); returns its pid or -1
+int handover_spawn(const char *exe_path, int argc, const char *argv[]);
+
+// SUCCESSOR SIDE
+
+// ask the predecessor listening on path for the serial fd; returns the connection, which has to
+// be passed to handover_ready() later, or -1 if there is no predecessor
+int handover_request(const char *path, int *serial_fd);
+
+// tell systemd (NotifyAccess=all) that this process is the main process of the service now,
+// then the predecessor that the first cycle is complete, and close the connection; returns -1 if
+// either failed - the predecessor goes on polling then and this process has to exit
+int handover_ready(int conn);
+
+#endif
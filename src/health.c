@@ -0,0 +1,195 @@
+//
+//  Health statistics of the daemon
+//
+//  See health.h.
+//
+
+#include "health.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+// QoS 1 messages tracked until their acknowledgement
+#define MAX_INFLIGHT 256
+
+static struct timespec g_cycle_start;
+static uint32_t g_cycles = 0;
+static int64_t g_cycle_sum_ns = 0;
+static int64_t g_cycle_max_ns = 0;
+static uint64_t g_reads = 0;
+static uint64_t g_failed = 0;
+
+static struct timespec g_window_start;
+static int64_t g_window_cpu_us = -1; // CPU time at the start of the window
+
+// written by the MQTT thread
+static uint32_t g_connects = 0;
+
+// QoS 0 messages not written yet; QoS 1 messages by ID, so the publish callback tells them apart
+static int g_unwritten = 0;
+static pthread_mutex_t g_inflight_lock = PTHREAD_MUTEX_INITIALIZER;
+static int g_inflight[MAX_INFLIGHT];
+static size_t g_num_inflight = 0;
+
+static int64_t elapsed_ns(const struct timespec *from, const struct timespec *to)
+{
+    return (int64_t)(to->tv_sec - from->tv_sec) * 1000000000 + (to->tv_nsec - from->tv_nsec);
+}
+
+static int64_t cpu_time_us(void)
+{
+    struct rusage usage;
+
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+    return (int64_t)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000 + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+// resident set size now; the peak from getrusage() if /proc is not there
+static double rss_mib(void)
+{
+    unsigned long size, resident;
+    FILE *f = fopen("/proc/self/statm", "r");
+
+    if (f != NULL) {
+        int fields = fscanf(f, "%lu %lu", &size, &resident);
+        fclose(f);
+        if (fields == 2) {
+            return (double)resident * (double)sysconf(_SC_PAGESIZE) / (1024.0 * 1024.0);
+        }
+    }
+
+    struct rusage usage;
+    return getrusage(RUSAGE_SELF, &usage) == 0 ? usage.ru_maxrss / 1024.0 : 0.0;
+}
+
+void health_cycle_begin(void)
+{
+    clock_gettime(CLOCK_MONOTONIC, &g_cycle_start);
+    if (g_window_cpu_us < 0) {
+        g_window_start = g_cycle_start;
+        g_window_cpu_us = cpu_time_us();
+    }
+}
+
+void health_cycle_end(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int64_t ns = elapsed_ns(&g_cycle_start, &now);
+    g_cycles++;
+    g_cycle_sum_ns += ns;
+    if (ns > g_cycle_max_ns) {
+        g_cycle_max_ns = ns;
+    }
+}
+
+void health_read(int ok)
+{
+    g_reads++;
+    if (!ok) {
+        g_failed++;
+    }
+}
+
+void health_connected(void)
+{
+    __atomic_add_fetch(&g_connects, 1, __ATOMIC_RELAXED);
+}
+
+void health_disconnected(void)
+{
+    // libmosquitto drops the QoS 0 messages it still had queued, QoS 1 ones are sent again
+    __atomic_store_n(&g_unwritten, 0, __ATOMIC_RELAXED);
+}
+
+int health_publish(struct mosquitto *mosq, int *mid, const char *topic, int payloadlen, const void *payload, int qos, bool retain)
+{
+    int local_mid = 0;
+    int rc;
+
+    if (qos == 0) {
+        // counted first: the callback may run before mosquitto_publish() returns
+        __atomic_add_fetch(&g_unwritten, 1, __ATOMIC_RELAXED);
+        rc = mosquitto_publish(mosq, mid, topic, payloadlen, payload, qos, retain);
+        if (rc != MOSQ_ERR_SUCCESS) {
+            __atomic_sub_fetch(&g_unwritten, 1, __ATOMIC_RELAXED);
+        }
+        return rc;
+    }
+
+    // the acknowledgement is read by the MQTT thread, never inside mosquitto_publish(): holding
+    // the lock keeps the callback from looking for the ID before it is recorded
+    pthread_mutex_lock(&g_inflight_lock);
+    rc = mosquitto_publish(mosq, &local_mid, topic, payloadlen, payload, qos, retain);
+    if (rc == MOSQ_ERR_SUCCESS && g_num_inflight < MAX_INFLIGHT) {
+        g_inflight[g_num_inflight++] = local_mid;
+    }
+    pthread_mutex_unlock(&g_inflight_lock);
+    if (mid != NULL) {
+        *mid = local_mid;
+    }
+    return rc;
+}
+
+void health_published(int mid)
+{
+    pthread_mutex_lock(&g_inflight_lock);
+    for (size_t i = 0; i < g_num_inflight; i++) {
+        if (g_inflight[i] == mid) {
+            g_inflight[i] = g_inflight[--g_num_inflight];
+            pthread_mutex_unlock(&g_inflight_lock);
+            return;
+        }
+    }
+    pthread_mutex_unlock(&g_inflight_lock);
+    __atomic_sub_fetch(&g_unwritten, 1, __ATOMIC_RELAXED);
+}
+
+void health_take(health_stats_t *stats)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int64_t cpu_us = cpu_time_us();
+    if (g_window_cpu_us < 0) {
+        g_window_start = now;
+        g_window_cpu_us = cpu_us;
+    }
+    double window_s = elapsed_ns(&g_window_start, &now) / 1e9;
+    uint32_t connects = __atomic_load_n(&g_connects, __ATOMIC_RELAXED);
+
+    stats->window_s = window_s;
+    stats->cycles = g_cycles;
+    stats->cycle_ms = g_cycles ? g_cycle_sum_ns / 1e6 / g_cycles : 0.0;
+    stats->cycle_max_ms = g_cycle_max_ns / 1e6;
+    stats->reads_per_s = window_s > 0 ? g_reads / window_s : 0.0;
+    stats->failure_pct = g_reads ? 100.0 * g_failed / g_reads : 0.0;
+    stats->cpu_per_cycle_ms = g_cycles ? (cpu_us - g_window_cpu_us) / 1e3 / g_cycles : 0.0;
+    stats->rss_mib = rss_mib();
+    stats->reconnects = connects > 1 ? connects - 1 : 0;
+
+    g_cycles = 0;
+    g_cycle_sum_ns = 0;
+    g_cycle_max_ns = 0;
+    g_reads = 0;
+    g_failed = 0;
+    g_window_start = now;
+    g_window_cpu_us = cpu_us;
+}
+
+uint32_t health_backlog(void)
+{
+    int unwritten = __atomic_load_n(&g_unwritten, __ATOMIC_RELAXED);
+
+    pthread_mutex_lock(&g_inflight_lock);
+    size_t inflight = g_num_inflight;
+    pthread_mutex_unlock(&g_inflight_lock);
+    // a QoS 1 message beyond MAX_INFLIGHT is taken for a QoS 0 one when acknowledged
+    return (unwritten > 0 ? (uint32_t)unwritten : 0) + (uint32_t)inflight;
+}
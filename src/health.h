@@ -0,0 +1,68 @@
+#ifndef HEALTH_H
+#define HEALTH_H
+
+#include <mosquitto.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+# Daemon health
+
+Statistics of the daemon itself, published as Home Assistant diagnostic sensors every
+HEALTH_PUBLISH_INTERVAL_S:
+
+- cycle duration: mean time of a poll cycle (first read group to the end of the derived values)
+- reads/s and the share of failed reads
+- CPU time of the process per cycle (user + system, from getrusage() over the window)
+- resident memory
+- broker reconnects since start
+- publish backlog: messages handed to libmosquitto that are not written to the broker connection
+  yet (QoS 0) or not acknowledged yet (QoS 1). Every publish goes through health_publish(),
+  which counts it until the publish callback reports its message ID; QoS 0 messages still
+  queued when the connection breaks are dropped by libmosquitto and no longer counted.
+
+The poll loop only adds up a few counters per cycle; everything else is worked out when a
+window is taken. health_connected(), health_disconnected() and health_published() are called on
+the MQTT thread.
+*/
+
+#define HEALTH_PUBLISH_INTERVAL_S 60
+
+typedef struct {
+    double window_s;
+    uint32_t cycles;
+    double cycle_ms;         // mean duration of a poll cycle
+    double cycle_max_ms;
+    double reads_per_s;
+    double failure_pct;      // failed reads of all reads
+    double cpu_per_cycle_ms; // user + system time of the process per cycle
+    double rss_mib;
+    uint32_t reconnects;     // broker connections after the first one
+} health_stats_t;
+
+// a poll cycle starts / ends (poll loop)
+void health_cycle_begin(void);
+void health_cycle_end(void);
+
+// outcome of one read_param()
+void health_read(int ok);
+
+// the broker accepted a connection (connect callback)
+void health_connected(void);
+
+// the broker connection is lost (disconnect callback)
+void health_disconnected(void);
+
+// mosquitto_publish() that counts the message in the publish backlog
+int health_publish(struct mosquitto *mosq, int *mid, const char *topic, int payloadlen, const void *payload, int qos, bool retain);
+
+// message mid was written to the broker connection or acknowledged (publish callback)
+void health_published(int mid);
+
+// summary of the window since the last call; starts a new window
+void health_take(health_stats_t *stats);
+
+// messages published that are not written or acknowledged yet
+uint32_t health_backlog(void);
+
+#endif
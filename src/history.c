@@ -0,0 +1,340 @@
+//
+//  History of the poll list entries: files, minute/hour roll-ups and the query socket
+//
+//  See history.h. The poll loop appends and flushes; the query thread reads a copy of an
+//  entry's file state taken under the lock and copies the other blocks out of the mapping,
+//  dropping those the ring overwrites meanwhile, so a slow client never holds up the poll loop.
+//
+
+#define _GNU_SOURCE // accept4()
+
+#include "history.h"
+#include "history_file.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define error_message(fmt, ...) fprintf(stderr, "[HISTORY ERROR] " fmt, ##__VA_ARGS__)
+
+#define HISTORY_SERVER_BACKLOG 4
+#define HISTORY_SEND_TIMEOUT_S 5
+
+// running mean of the current step of a coarser tier
+typedef struct {
+    int64_t start_ms;
+    double sum;
+    unsigned count;
+} rollup_t;
+
+typedef struct {
+    char name[HISTORY_NAME_LEN];
+    history_file_t file;
+    rollup_t rollup[HISTORY_TIERS];
+} entry_t;
+
+static const uint32_t g_tier_steps[HISTORY_TIERS] = HISTORY_TIER_STEPS_S;
+
+static char g_dir[192];
+static entry_t *g_entries = NULL;
+static size_t g_num_entries = 0;
+
+// g_lock guards the content of the entries (appends, flushes, copies for queries); g_files_lock
+// keeps the mappings alive while a query reads them
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_rwlock_t g_files_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+static int g_listen_fd = -1;
+static char g_socket_path[108];
+static pthread_t g_accept_thread;
+
+int history_open(const char *dir)
+{
+    struct stat st;
+
+    snprintf(g_dir, sizeof(g_dir), "%s", dir);
+    mkdir(dir, 0755);
+    if (stat(dir, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        error_message("cannot use %s: %s\n", dir, strerror(errno));
+        g_dir[0] = '\0';
+        return -1;
+    }
+    return 0;
+}
+
+static void close_entries(void)
+{
+    for (size_t i = 0; i < g_num_entries; i++) {
+        history_file_close(&g_entries[i].file);
+    }
+    free(g_entries);
+    g_entries = NULL;
+    g_num_entries = 0;
+}
+
+void history_bind(const config_t *cfg)
+{
+    pthread_rwlock_wrlock(&g_files_lock);
+    pthread_mutex_lock(&g_lock);
+
+    close_entries();
+    if (g_dir[0] != '\0') {
+        g_entries = calloc(cfg->num_parameters ? cfg->num_parameters : 1, sizeof(entry_t));
+        if (g_entries == NULL) {
+            error_message("out of memory\n");
+        } else {
+            g_num_entries = cfg->num_parameters;
+            for (size_t i = 0; i < g_num_entries; i++) {
+                snprintf(g_entries[i].name, sizeof(g_entries[i].name), "%s", cfg->parameters[i].name);
+                if (cfg->parameters[i].history) {
+                    history_file_open(&g_entries[i].file, g_dir, g_entries[i].name, 1);
+                }
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&g_lock);
+    pthread_rwlock_unlock(&g_files_lock);
+}
+
+void history_sample(size_t idx, float value)
+{
+    struct timespec now;
+
+    if (idx >= g_num_entries) {
+        return;
+    }
+    clock_gettime(CLOCK_REALTIME, &now);
+    int64_t now_ms = (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+    entry_t *entry = &g_entries[idx];
+
+    pthread_mutex_lock(&g_lock);
+    history_file_append(&entry->file, 0, now_ms, value);
+
+    // the mean of a step is appended once a sample of the next step arrives
+    for (int t = 1; t < HISTORY_TIERS; t++) {
+        rollup_t *rollup = &entry->rollup[t];
+        int64_t step_ms = (int64_t)g_tier_steps[t] * 1000;
+        int64_t start_ms = now_ms - now_ms % step_ms;
+        if (rollup->count > 0 && rollup->start_ms != start_ms) {
+            history_file_append(&entry->file, t, rollup->start_ms, (float)(rollup->sum / rollup->count));
+            rollup->count = 0;
+            rollup->sum = 0.0;
+        }
+        rollup->start_ms = start_ms;
+        rollup->sum += value;
+        rollup->count++;
+    }
+    pthread_mutex_unlock(&g_lock);
+}
+
+void history_flush(void)
+{
+    pthread_mutex_lock(&g_lock);
+    for (size_t i = 0; i < g_num_entries; i++) {
+        history_file_flush(&g_entries[i].file);
+    }
+    pthread_mutex_unlock(&g_lock);
+}
+
+void history_close(void)
+{
+    pthread_rwlock_wrlock(&g_files_lock);
+    pthread_mutex_lock(&g_lock);
+    close_entries();
+    g_dir[0] = '\0';
+    pthread_mutex_unlock(&g_lock);
+    pthread_rwlock_unlock(&g_files_lock);
+}
+
+// buffered answer of a query
+typedef struct {
+    int fd;
+    int failed;
+    size_t length;
+    char buf[4096];
+} reply_t;
+
+static void reply_flush(reply_t *reply)
+{
+    size_t done = 0;
+    while (!reply->failed && done < reply->length) {
+        ssize_t ret = send(reply->fd, reply->buf + done, reply->length - done, MSG_NOSIGNAL);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret <= 0) {
+            reply->failed = 1; // client gone or not reading
+        }
+        done += ret > 0 ? (size_t)ret : 0;
+    }
+    reply->length = 0;
+}
+
+static void reply_line(reply_t *reply, const char *line)
+{
+    size_t length = strlen(line);
+    if (reply->length + length > sizeof(reply->buf)) {
+        reply_flush(reply);
+    }
+    memcpy(reply->buf + reply->length, line, length);
+    reply->length += length;
+}
+
+static void reply_sample(int64_t time_ms, float value, void *ctx)
+{
+    char line[64];
+    snprintf(line, sizeof(line), "%" PRId64 " %.3f\n", time_ms, value);
+    reply_line(ctx, line);
+}
+
+static void serve_query(int fd)
+{
+    char request[HISTORY_MAX_REQUEST];
+    size_t length = 0;
+    reply_t *reply = malloc(sizeof(reply_t));
+
+    if (reply == NULL) {
+        return;
+    }
+    reply->fd = fd;
+    reply->failed = 0;
+    reply->length = 0;
+
+    // one line
+    while (length < sizeof(request) - 1 && memchr(request, '\n', length) == NULL) {
+        ssize_t ret = read(fd, request + length, sizeof(request) - 1 - length);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret <= 0) {
+            break;
+        }
+        length += (size_t)ret;
+    }
+    request[length] = '\0';
+
+    char name[HISTORY_NAME_LEN];
+    long long from_s, to_s;
+    int tier = -1;
+    int fields = sscanf(request, "%63s %lld %lld %d", name, &from_s, &to_s, &tier);
+    if (fields < 3 || tier < -1 || tier >= HISTORY_TIERS) {
+        reply_line(reply, "error expected: <name> <from> <to> [<tier>]\n");
+        reply_flush(reply);
+        free(reply);
+        return;
+    }
+
+    pthread_rwlock_rdlock(&g_files_lock);
+    size_t i;
+    for (i = 0; i < g_num_entries && strcmp(g_entries[i].name, name) != 0; i++) {
+    }
+    if (i == g_num_entries || g_entries[i].file.map == NULL) {
+        pthread_rwlock_unlock(&g_files_lock);
+        reply_line(reply, "error no history of this name\n");
+        reply_flush(reply);
+        free(reply);
+        return;
+    }
+
+    // copy of the head blocks as they are now, the mapping stays shared
+    history_file_t *file = malloc(sizeof(history_file_t));
+    if (file != NULL) {
+        pthread_mutex_lock(&g_lock);
+        *file = g_entries[i].file;
+        pthread_mutex_unlock(&g_lock);
+
+        int64_t from_ms = (int64_t)from_s * 1000;
+        if (tier < 0) {
+            tier = history_file_pick_tier(file, from_ms);
+        }
+        size_t count = history_file_query(file, tier, from_ms, (int64_t)to_s * 1000 + 999, reply_sample, reply);
+
+        char line[64];
+        snprintf(line, sizeof(line), "end %zu %d\n", count, tier);
+        reply_line(reply, line);
+        free(file);
+    }
+    pthread_rwlock_unlock(&g_files_lock);
+
+    reply_flush(reply);
+    free(reply);
+}
+
+static void *accept_thread(void *arg __attribute__((unused)))
+{
+    for (;;) {
+        int fd = accept4(g_listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            break; // listening socket closed by history_server_stop()
+        }
+
+        // a client that stops reading must not keep the files locked
+        struct timeval timeout = {.tv_sec = HISTORY_SEND_TIMEOUT_S, .tv_usec = 0};
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        serve_query(fd);
+        close(fd);
+    }
+    return NULL;
+}
+
+int history_server_start(const char *path)
+{
+    struct sockaddr_un addr;
+
+    g_listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (g_listen_fd < 0) {
+        error_message("socket error %d: %s\n", errno, strerror(errno));
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+    snprintf(g_socket_path, sizeof(g_socket_path), "%s", path);
+
+    unlink(path); // stale socket from a previous run
+
+    if (bind(g_listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        error_message("bind(%s) error %d: %s\n", path, errno, strerror(errno));
+        close(g_listen_fd);
+        g_listen_fd = -1;
+        return -1;
+    }
+
+    if (listen(g_listen_fd, HISTORY_SERVER_BACKLOG) != 0 || pthread_create(&g_accept_thread, NULL, accept_thread, NULL) != 0) {
+        error_message("cannot serve %s\n", path);
+        close(g_listen_fd);
+        g_listen_fd = -1;
+        unlink(path);
+        return -1;
+    }
+    return 0;
+}
+
+void history_server_stop(void)
+{
+    if (g_listen_fd < 0) {
+        return;
+    }
+
+    // shutdown() wakes the accept thread blocked in accept()
+    shutdown(g_listen_fd, SHUT_RDWR);
+    pthread_join(g_accept_thread, NULL);
+    close(g_listen_fd);
+    g_listen_fd = -1;
+
+    unlink(g_socket_path);
+}
@@ -0,0 +1,54 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include "config.h"
+
+/*
+# History
+
+Every value the daemon publishes for a poll list entry with "history" on is also appended to the
+entry's history file (`<dir>/<name>.hist`, see history_file.h): every sample in tier 0, the means
+of every minute and every hour in the coarser tiers. The history outlives broker and Home Assistant outages; it is
+queried with `tools/studer_history` or through the history socket.
+
+The blocks being written are kept in memory and written to the files when full, every
+HISTORY_FLUSH_INTERVAL_S and on shutdown: a crash loses at most that much of the history, the SD
+card sees few writes.
+
+## History socket
+
+One request per connection, a line of text:
+
+    <name> <from> <to> [<tier>]
+
+with the unix times `from` and `to` in seconds and the tier (0 samples, 1 minutes, 2 hours);
+without a tier the finest one reaching back to `from` is used. The answer is a line per sample,
+`<unix time in ms> <value>`, then `end <samples> <tier>`; or a single `error <reason>` line.
+*/
+
+#define HISTORY_FLUSH_INTERVAL_S 900
+#define HISTORY_MAX_REQUEST 256
+
+// keep the history in dir (created if needed)
+int history_open(const char *dir);
+
+// open the history files of the poll list entries of cfg with history on (the files of other
+// entries stay on disk)
+void history_bind(const config_t *cfg);
+
+// sample of entry idx (published value), taken now
+void history_sample(size_t idx, float value);
+
+// write the blocks in memory to the files
+void history_flush(void);
+
+// flush and close all files
+void history_close(void);
+
+// serve queries on the unix socket at path from a background thread
+int history_server_start(const char *path);
+
+// stop serving queries and remove the socket file
+void history_server_stop(void);
+
+#endif
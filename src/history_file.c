@@ -0,0 +1,500 @@
+//
+//  History file: Gorilla-compressed blocks in per-tier rings of a memory-mapped file
+//
+//  See history_file.h. Used by the daemon (history.c) and by tools reading the files directly.
+//
+
+#include "history_file.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define error_message(fmt, ...) fprintf(stderr, "[HISTORY ERROR] " fmt, ##__VA_ARGS__)
+
+#define BLOCK_BITS (uint32_t)(sizeof(((history_block_t *)0)->data) * 8)
+#define MAX_SAMPLE_BITS 80 // 4 + 32 timestamp, 2 + 5 + 5 + 32 value
+#define NO_WINDOW 32       // leading zeros of a value without a previous XOR
+
+static const uint32_t g_tier_blocks[HISTORY_TIERS] = HISTORY_TIER_BLOCKS;
+static const uint32_t g_tier_steps[HISTORY_TIERS] = HISTORY_TIER_STEPS_S;
+
+static size_t file_size(void)
+{
+    size_t blocks = 1;
+    for (int t = 0; t < HISTORY_TIERS; t++) {
+        blocks += g_tier_blocks[t];
+    }
+    return blocks * HISTORY_BLOCK_SIZE;
+}
+
+static history_block_t *mapped_block(const history_file_t *file, int tier, uint32_t slot)
+{
+    size_t index = 1 + slot;
+    for (int t = 0; t < tier; t++) {
+        index += g_tier_blocks[t];
+    }
+    return (history_block_t *)(file->map + index * HISTORY_BLOCK_SIZE);
+}
+
+// write a block into the mapping; its sequence number is 0 while the rest is written, so a
+// reader can tell a block that changed under it (see load_block())
+static void store_block(history_file_t *file, int tier, uint32_t slot, const history_block_t *block)
+{
+    history_block_t *mapped = mapped_block(file, tier, slot);
+    size_t offset = offsetof(history_block_t, start_ms);
+
+    __atomic_store_n(&mapped->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy((uint8_t *)mapped + offset, (const uint8_t *)block + offset, sizeof(*block) - offset);
+    __atomic_store_n(&mapped->seq, block->seq, __ATOMIC_RELEASE);
+}
+
+// copy of a block; the head of a writable file is the copy in memory. Returns 0 for an empty
+// block and for one rewritten during the copy or after file was copied from the writer: the
+// ring overwrote it with samples newer than the head of file.
+static int load_block(const history_file_t *file, int tier, uint32_t slot, history_block_t *copy)
+{
+    if (file->writable && slot == file->head[tier]) {
+        *copy = file->open[tier];
+        return copy->seq != 0 && copy->count > 0;
+    }
+
+    const history_block_t *mapped = mapped_block(file, tier, slot);
+    uint64_t seq = __atomic_load_n(&mapped->seq, __ATOMIC_ACQUIRE);
+    memcpy(copy, mapped, sizeof(*copy));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (seq == 0 || __atomic_load_n(&mapped->seq, __ATOMIC_RELAXED) != seq || (file->writable && seq >= file->open[tier].seq)) {
+        return 0;
+    }
+    copy->seq = seq;
+    return copy->count > 0;
+}
+
+static void put_bits(history_block_t *block, uint32_t *pos, uint64_t value, int n)
+{
+    for (int i = n - 1; i >= 0; i--, (*pos)++) {
+        if ((value >> i) & 1) {
+            block->data[*pos >> 3] |= (uint8_t)(0x80 >> (*pos & 7));
+        }
+    }
+}
+
+static uint64_t get_bits(const history_block_t *block, uint32_t *pos, int n)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < n; i++, (*pos)++) {
+        value = (value << 1) | ((block->data[*pos >> 3] >> (7 - (*pos & 7))) & 1);
+    }
+    return value;
+}
+
+// n-bit two's complement field
+static int64_t sign_extend(uint64_t value, int n)
+{
+    return (int64_t)(value << (64 - n)) >> (64 - n);
+}
+
+static uint32_t float_bits(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static float bits_float(uint32_t bits)
+{
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+static void encode(history_block_t *block, history_codec_t *codec, int64_t time_ms, float value)
+{
+    uint32_t bits = float_bits(value);
+
+    if (block->count == 0) {
+        block->start_ms = time_ms;
+        put_bits(block, &codec->pos, bits, 32);
+        codec->delta_ms = 0;
+        codec->leading = NO_WINDOW;
+        codec->trailing = 0;
+    } else {
+        int64_t delta = time_ms - codec->time_ms;
+        int64_t dod = delta - codec->delta_ms;
+        if (dod == 0) {
+            put_bits(block, &codec->pos, 0x0, 1);
+        } else if (dod >= -64 && dod <= 63) {
+            put_bits(block, &codec->pos, 0x2, 2);
+            put_bits(block, &codec->pos, (uint64_t)dod & 0x7f, 7);
+        } else if (dod >= -256 && dod <= 255) {
+            put_bits(block, &codec->pos, 0x6, 3);
+            put_bits(block, &codec->pos, (uint64_t)dod & 0x1ff, 9);
+        } else if (dod >= -2048 && dod <= 2047) {
+            put_bits(block, &codec->pos, 0xe, 4);
+            put_bits(block, &codec->pos, (uint64_t)dod & 0xfff, 12);
+        } else {
+            put_bits(block, &codec->pos, 0xf, 4);
+            put_bits(block, &codec->pos, (uint64_t)dod & 0xffffffff, 32);
+        }
+        codec->delta_ms = delta;
+
+        uint32_t xor = bits ^ codec->value;
+        if (xor == 0) {
+            put_bits(block, &codec->pos, 0x0, 1);
+        } else {
+            int leading = __builtin_clz(xor);
+            int trailing = __builtin_ctz(xor);
+            if (codec->leading != NO_WINDOW && leading >= codec->leading && trailing >= codec->trailing) {
+                put_bits(block, &codec->pos, 0x2, 2);
+                put_bits(block, &codec->pos, xor >> codec->trailing, 32 - codec->leading - codec->trailing);
+            } else {
+                int length = 32 - leading - trailing;
+                put_bits(block, &codec->pos, 0x3, 2);
+                put_bits(block, &codec->pos, (uint64_t)leading, 5);
+                put_bits(block, &codec->pos, (uint64_t)(length - 1), 5);
+                put_bits(block, &codec->pos, xor >> trailing, length);
+                codec->leading = (uint8_t)leading;
+                codec->trailing = (uint8_t)trailing;
+            }
+        }
+    }
+
+    codec->time_ms = time_ms;
+    codec->value = bits;
+    codec->count++;
+    block->count = codec->count;
+    block->bits = codec->pos;
+}
+
+// next sample of block; 0 after the last one
+static int decode(const history_block_t *block, history_codec_t *codec, int64_t *time_ms, float *value)
+{
+    // every sample starts with room for the largest one (see history_file_append())
+    if (codec->count >= block->count || codec->pos + MAX_SAMPLE_BITS > BLOCK_BITS) {
+        return 0;
+    }
+
+    if (codec->count == 0) {
+        codec->time_ms = block->start_ms;
+        codec->delta_ms = 0;
+        codec->value = (uint32_t)get_bits(block, &codec->pos, 32);
+        codec->leading = NO_WINDOW;
+        codec->trailing = 0;
+    } else {
+        int64_t dod;
+        if (get_bits(block, &codec->pos, 1) == 0) {
+            dod = 0;
+        } else if (get_bits(block, &codec->pos, 1) == 0) {
+            dod = sign_extend(get_bits(block, &codec->pos, 7), 7);
+        } else if (get_bits(block, &codec->pos, 1) == 0) {
+            dod = sign_extend(get_bits(block, &codec->pos, 9), 9);
+        } else if (get_bits(block, &codec->pos, 1) == 0) {
+            dod = sign_extend(get_bits(block, &codec->pos, 12), 12);
+        } else {
+            dod = sign_extend(get_bits(block, &codec->pos, 32), 32);
+        }
+        codec->delta_ms += dod;
+        codec->time_ms += codec->delta_ms;
+
+        if (get_bits(block, &codec->pos, 1) != 0) {
+            if (get_bits(block, &codec->pos, 1) != 0) {
+                int leading = (int)get_bits(block, &codec->pos, 5);
+                int length = (int)get_bits(block, &codec->pos, 5) + 1;
+                if (leading + length > 32) {
+                    return 0; // damaged block
+                }
+                codec->leading = (uint8_t)leading;
+                codec->trailing = (uint8_t)(32 - leading - length);
+            }
+            int length = 32 - codec->leading - codec->trailing;
+            codec->value ^= (uint32_t)get_bits(block, &codec->pos, length) << codec->trailing;
+        }
+    }
+
+    codec->count++;
+    *time_ms = codec->time_ms;
+    *value = bits_float(codec->value);
+    return 1;
+}
+
+static int make_dir(const char *dir)
+{
+    char parent[256];
+    snprintf(parent, sizeof(parent), "%s", dir);
+    char *slash = strrchr(parent, '/');
+    if (slash != NULL && slash != parent) {
+        *slash = '\0';
+        mkdir(parent, 0755);
+    }
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+        error_message("cannot create %s: %s\n", dir, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+static int header_valid(const history_header_t *header)
+{
+    if (header->magic != HISTORY_FILE_MAGIC || header->version != HISTORY_FILE_VERSION || header->block_size != HISTORY_BLOCK_SIZE ||
+        header->tiers != HISTORY_TIERS) {
+        return 0;
+    }
+    for (int t = 0; t < HISTORY_TIERS; t++) {
+        if (header->tier_step_s[t] != g_tier_steps[t] || header->tier_blocks[t] != g_tier_blocks[t]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// start a new head block behind the current one
+static void advance(history_file_t *file, int tier)
+{
+    uint64_t seq = file->open[tier].seq + 1;
+
+    file->head[tier] = (file->head[tier] + 1) % g_tier_blocks[tier];
+    memset(&file->open[tier], 0, sizeof(file->open[tier]));
+    memset(&file->codec[tier], 0, sizeof(file->codec[tier]));
+    file->open[tier].seq = seq;
+    file->dirty[tier] = 0;
+}
+
+// find the head block of every tier and resume writing in it
+static void resume(history_file_t *file)
+{
+    for (int t = 0; t < HISTORY_TIERS; t++) {
+        uint64_t max_seq = 0;
+        file->head[t] = 0;
+        for (uint32_t s = 0; s < g_tier_blocks[t]; s++) {
+            const history_block_t *block = mapped_block(file, t, s);
+            if (block->seq > max_seq) {
+                max_seq = block->seq;
+                file->head[t] = s;
+            }
+        }
+
+        memset(&file->codec[t], 0, sizeof(file->codec[t]));
+        file->dirty[t] = 0;
+        if (max_seq == 0) {
+            memset(&file->open[t], 0, sizeof(file->open[t]));
+            file->open[t].seq = 1;
+            continue;
+        }
+
+        file->open[t] = *mapped_block(file, t, file->head[t]);
+        int64_t time_ms;
+        float value;
+        while (decode(&file->open[t], &file->codec[t], &time_ms, &value)) {
+        }
+        if (file->codec[t].count != file->open[t].count || file->codec[t].pos + MAX_SAMPLE_BITS > BLOCK_BITS) {
+            advance(file, t); // full (or damaged): keep it as it is
+        }
+    }
+}
+
+int history_file_open(history_file_t *file, const char *dir, const char *name, int writable)
+{
+    char path[256];
+    size_t size = file_size();
+
+    memset(file, 0, sizeof(*file));
+    if (writable && make_dir(dir) != 0) {
+        return -1;
+    }
+    snprintf(path, sizeof(path), "%s/%s.hist", dir, name);
+
+    int fd = open(path, writable ? O_RDWR | O_CREAT | O_CLOEXEC : O_RDONLY | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        if (writable || errno != ENOENT) {
+            error_message("cannot open %s: %s\n", path, strerror(errno));
+        }
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (st.st_size != (off_t)size && (!writable || ftruncate(fd, 0) != 0 || ftruncate(fd, (off_t)size) != 0))) {
+        error_message("%s has another layout\n", path);
+        close(fd);
+        return -1;
+    }
+
+    void *map = mmap(NULL, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        error_message("mmap error %d: %s\n", errno, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    file->map = map;
+    file->size = size;
+    file->writable = writable;
+
+    history_header_t *header = (history_header_t *)file->map;
+    if (!header_valid(header)) {
+        // truncating clears the file without writing megabytes of zeros to the card
+        if (!writable || ftruncate(fd, 0) != 0 || ftruncate(fd, (off_t)size) != 0) {
+            error_message("%s has another layout\n", path);
+            munmap(file->map, size);
+            file->map = NULL;
+            close(fd);
+            return -1;
+        }
+        header->magic = HISTORY_FILE_MAGIC;
+        header->version = HISTORY_FILE_VERSION;
+        header->block_size = HISTORY_BLOCK_SIZE;
+        header->tiers = HISTORY_TIERS;
+        for (int t = 0; t < HISTORY_TIERS; t++) {
+            header->tier_step_s[t] = g_tier_steps[t];
+            header->tier_blocks[t] = g_tier_blocks[t];
+        }
+        snprintf(header->name, sizeof(header->name), "%s", name);
+    }
+    close(fd); // the mapping keeps the file open
+
+    if (writable) {
+        resume(file);
+    }
+    return 0;
+}
+
+void history_file_append(history_file_t *file, int tier, int64_t time_ms, float value)
+{
+    if (file->map == NULL || !file->writable || tier < 0 || tier >= HISTORY_TIERS) {
+        return;
+    }
+    history_block_t *block = &file->open[tier];
+    history_codec_t *codec = &file->codec[tier];
+
+    // a block ends when full or when the interval does not fit the 32-bit delta-of-delta
+    if (block->count > 0) {
+        int64_t dod = time_ms - codec->time_ms - codec->delta_ms;
+        if (codec->pos + MAX_SAMPLE_BITS > BLOCK_BITS || dod < INT32_MIN || dod > INT32_MAX) {
+            store_block(file, tier, file->head[tier], block);
+            advance(file, tier);
+        }
+    }
+
+    encode(&file->open[tier], &file->codec[tier], time_ms, value);
+    file->dirty[tier] = 1;
+}
+
+void history_file_flush(history_file_t *file)
+{
+    if (file->map == NULL || !file->writable) {
+        return;
+    }
+    for (int t = 0; t < HISTORY_TIERS; t++) {
+        if (file->dirty[t]) {
+            store_block(file, t, file->head[t], &file->open[t]);
+            file->dirty[t] = 0;
+        }
+    }
+}
+
+void history_file_close(history_file_t *file)
+{
+    if (file->map == NULL) {
+        return;
+    }
+    if (file->writable) {
+        history_file_flush(file);
+        msync(file->map, file->size, MS_SYNC);
+    }
+    munmap(file->map, file->size);
+    file->map = NULL;
+}
+
+typedef struct {
+    uint32_t slot;
+    uint64_t seq;
+    int64_t start_ms;
+} block_ref_t;
+
+// non-empty blocks of tier in sequence order; returns their number
+static uint32_t ordered_blocks(const history_file_t *file, int tier, block_ref_t *refs)
+{
+    history_block_t block;
+    uint32_t n = 0;
+
+    for (uint32_t s = 0; s < g_tier_blocks[tier]; s++) {
+        if (!load_block(file, tier, s, &block)) {
+            continue;
+        }
+        uint32_t i = n++;
+        for (; i > 0 && refs[i - 1].seq > block.seq; i--) {
+            refs[i] = refs[i - 1];
+        }
+        refs[i].slot = s;
+        refs[i].seq = block.seq;
+        refs[i].start_ms = block.start_ms;
+    }
+    return n;
+}
+
+size_t history_file_query(const history_file_t *file, int tier, int64_t from_ms, int64_t to_ms, history_sample_cb_t cb, void *ctx)
+{
+    block_ref_t refs[HISTORY_MAX_TIER_BLOCKS];
+    history_block_t block;
+    size_t found = 0;
+
+    if (file->map == NULL || tier < 0 || tier >= HISTORY_TIERS) {
+        return 0;
+    }
+    uint32_t n = ordered_blocks(file, tier, refs);
+    for (uint32_t b = 0; b < n; b++) {
+        // the samples of a block come before the start of the next one
+        if ((b + 1 < n && refs[b + 1].start_ms < from_ms) || refs[b].start_ms > to_ms) {
+            continue;
+        }
+        // a block overwritten since it was listed holds newer samples than the query covers
+        if (!load_block(file, tier, refs[b].slot, &block) || block.seq != refs[b].seq) {
+            continue;
+        }
+        history_codec_t codec;
+        int64_t time_ms;
+        float value;
+        memset(&codec, 0, sizeof(codec));
+        while (decode(&block, &codec, &time_ms, &value)) {
+            if (time_ms >= from_ms && time_ms <= to_ms) {
+                cb(time_ms, value, ctx);
+                found++;
+            }
+        }
+    }
+    return found;
+}
+
+int64_t history_file_oldest(const history_file_t *file, int tier)
+{
+    block_ref_t refs[HISTORY_MAX_TIER_BLOCKS];
+
+    if (file->map == NULL || tier < 0 || tier >= HISTORY_TIERS) {
+        return 0;
+    }
+    return ordered_blocks(file, tier, refs) > 0 ? refs[0].start_ms : 0;
+}
+
+int history_file_pick_tier(const history_file_t *file, int64_t from_ms)
+{
+    int best = 0;
+    int64_t best_oldest = 0;
+
+    for (int t = 0; t < HISTORY_TIERS; t++) {
+        int64_t oldest = history_file_oldest(file, t);
+        if (oldest != 0 && oldest <= from_ms) {
+            return t;
+        }
+        if (oldest != 0 && (best_oldest == 0 || oldest < best_oldest)) {
+            best = t;
+            best_oldest = oldest;
+        }
+    }
+    return best;
+}
@@ -0,0 +1,112 @@
+#ifndef HISTORY_FILE_H
+#define HISTORY_FILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+# History file
+
+The history of one poll list entry: a memory-mapped file of fixed size holding the samples at
+HISTORY_TIERS resolutions. Every tier is a ring of HISTORY_BLOCK_SIZE blocks; a full ring
+overwrites its oldest block, so the file never grows.
+
+    header block | tier 0 blocks (every sample) | tier 1 blocks (1 min means) | tier 2 blocks (1 h means)
+
+A block holds a run of samples compressed like Gorilla (Pelkonen et al., VLDB 2015), adapted to
+32-bit floats and millisecond timestamps:
+
+- timestamp: delta-of-delta, `0` for the same interval as before, `10` + 7 bits, `110` + 9 bits,
+  `1110` + 12 bits or `1111` + 32 bits,
+- value: XOR with the previous one, `0` if equal, `10` + the meaningful bits if they fit the
+  window of the previous XOR, otherwise `11` + 5 bits leading zeros + 5 bits length - 1 + bits.
+
+The first sample of a block is stored as is (timestamp in the block header, value as 32 bits).
+A steady signal polled at a fixed rate costs a few bits per sample.
+
+The block being written (the head of a tier) lives in memory and only reaches the mapping when
+it is full or on history_file_flush(): the SD card sees a block written once or a few times,
+not once per sample. A block is written with sequence number 0 first and its own last, so a
+query running next to the writer copies a block and drops it when the number changed. Blocks carry an increasing sequence number; on open the head of every
+tier is the block with the highest one, and writing resumes in it if it has room.
+*/
+
+#define HISTORY_FILE_MAGIC 0x31534948 // "HIS1" in little endian
+#define HISTORY_FILE_VERSION 1
+#define HISTORY_BLOCK_SIZE 4096
+#define HISTORY_TIERS 3
+#define HISTORY_NAME_LEN 64
+
+// resolution and size of the tiers (1 MiB per entry). A 1 Hz sample costs 12 to 32 bits when
+// the value is noisy and about 7 bits when it is steady (the jitter of the read times), so the
+// rings hold 2 to 6 days of samples (10 days of a steady value), 6 weeks to 3 months of minute
+// means and 1 to 2.5 years of hour means
+#define HISTORY_TIER_STEPS_S {0, 60, 3600}
+#define HISTORY_TIER_BLOCKS {192, 48, 8}
+#define HISTORY_MAX_TIER_BLOCKS 192 // largest of HISTORY_TIER_BLOCKS
+
+typedef struct {
+    uint64_t seq;      // 0: empty block
+    int64_t start_ms;  // wall-clock time of the first sample
+    uint32_t count;    // samples
+    uint32_t bits;     // bits of data used
+    uint8_t data[HISTORY_BLOCK_SIZE - 24];
+} history_block_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t block_size;
+    uint32_t tiers;
+    uint32_t tier_step_s[HISTORY_TIERS];
+    uint32_t tier_blocks[HISTORY_TIERS];
+    char name[HISTORY_NAME_LEN];
+} history_header_t;
+
+// encoder/decoder position within a block
+typedef struct {
+    uint32_t pos;      // bit position
+    uint32_t count;
+    int64_t time_ms;   // previous sample
+    int64_t delta_ms;
+    uint32_t value;    // previous value (bits of the float)
+    uint8_t leading;   // XOR window of the previous value (leading 32 when there is none yet)
+    uint8_t trailing;
+} history_codec_t;
+
+typedef struct {
+    uint8_t *map;      // whole file, NULL when closed
+    size_t size;
+    int writable;
+    uint32_t head[HISTORY_TIERS]; // block written next in every tier
+    history_block_t open[HISTORY_TIERS]; // copy of the head blocks (writable files)
+    history_codec_t codec[HISTORY_TIERS];
+    int dirty[HISTORY_TIERS];
+} history_file_t;
+
+// callback of history_file_query(), samples in time order within a tier
+typedef void (*history_sample_cb_t)(int64_t time_ms, float value, void *ctx);
+
+// open (writable: create) the history of name in dir; a file of another layout is reinitialized
+// when writable, refused otherwise
+int history_file_open(history_file_t *file, const char *dir, const char *name, int writable);
+
+// append a sample to tier; time_ms should not go back
+void history_file_append(history_file_t *file, int tier, int64_t time_ms, float value);
+
+// write the head blocks that changed into the mapping (the kernel writes them back)
+void history_file_flush(history_file_t *file);
+
+// flush, sync and unmap
+void history_file_close(history_file_t *file);
+
+// samples of tier within [from_ms, to_ms]; returns their number
+size_t history_file_query(const history_file_t *file, int tier, int64_t from_ms, int64_t to_ms, history_sample_cb_t cb, void *ctx);
+
+// time of the oldest sample of tier, 0 if it is empty
+int64_t history_file_oldest(const history_file_t *file, int tier);
+
+// finest tier that reaches back to from_ms, the one reaching back furthest if none does
+int history_file_pick_tier(const history_file_t *file, int64_t from_ms);
+
+#endif
@@ -16,8 +16,26 @@
 #include "main.h"
 #include "../scomlib_extra/scomlib_extra.h"
 #include "serial.h"
+#include "bus.h"
+#include "bus_stats.h"
+#include "bus_server.h"
+#include "shm_snapshot.h"
+#include "state_file.h"
+#include "handover.h"
+#include "sampler.h"
+#include "snapshot_sets.h"
+#include "derived.h"
+#include "energy.h"
+#include "aggregate.h"
+#include "history.h"
+#include "schedule.h"
+#include "alerts.h"
+#include "health.h"
+#include "messages.h"
+#include "datalog.h"
 #include <mosquitto.h>
 #include <json-c/json.h>
+#include <math.h>
 #include <stdio.h>
 #include <string.h>
 #include <termios.h> // for baud rate constant
@@ -28,11 +46,12 @@
 #include <stdlib.h>   // for exit()
 
 // Constants
-#define SCOM_MAX_FRAME_SIZE 128
 #define MAX_REQUEST_ATTEMPTS 3
 #define MQTT_HEALTH_CHECK_INTERVAL 60  // seconds
-#define DELAY_BETWEEN_PARAMS_US 10000  // 10ms in microseconds
-#define DELAY_END_OF_CYCLE_US 100000   // 100ms in microseconds
+#define BAUD_PROBE_TIMEOUT_DS 5        // 0.5s per baud rate probe (in deciseconds)
+#define SERIAL_REOPEN_WAIT_MS 1000     // how long one wait for an unplugged adapter lasts
+#define REPORT_INTERVAL 60             // seconds between two sampling jitter / snapshot skew reports
+#define BUS_STATS_INTERVAL 300         // seconds between two bus latency / utilisation reports
 
 // MQTT connection state tracking (protected by mutex)
 static int mqtt_connected = 0;
@@ -40,9 +59,21 @@ static int comm_status_online = 0;  // Track if we're receiving valid serial dat
 static time_t last_mqtt_check = 0;
 static pthread_mutex_t mqtt_mutex = PTHREAD_MUTEX_INITIALIZER;
 
+// Process start, for the time-to-first-publish metric
+static struct timespec g_start_time;
+
 // Global for cleanup on signal
 static struct mosquitto *g_mqtt_client = NULL;
 static volatile sig_atomic_t g_shutdown_requested = 0;
+static volatile sig_atomic_t g_reload_requested = 0;
+static volatile sig_atomic_t g_upgrade_requested = 0;
+static volatile int g_handover_active = 0; // the serial port is being handed to a successor
+
+// Active configuration. Only the main loop replaces it (between two poll cycles); the MQTT
+// thread reads it under config_mutex when it republishes the discovery configs.
+static config_t *g_config = NULL;
+static config_t *g_defaults = NULL; // compiled-in settings, base of every reload
+static pthread_mutex_t config_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 // Signal handler for graceful shutdown
 void signal_handler(int signum)
@@ -51,25 +82,63 @@ void signal_handler(int signum)
     g_shutdown_requested = 1;
 }
 
-// Publish Home Assistant MQTT Discovery config for a single sensor
-void publish_discovery_config(struct mosquitto *mosq, const parameter_t *param)
+// SIGHUP: reload the configuration file before the next poll cycle
+void reload_handler(int signum __attribute__((unused)))
 {
-    char config_topic[256];
-    char unique_id[128];
+    g_reload_requested = 1;
+}
+
+// SIGUSR2: start the (upgraded) binary and hand the serial port over to it
+void upgrade_handler(int signum __attribute__((unused)))
+{
+    g_upgrade_requested = 1;
+}
+
+// Discovery topic of a sensor: homeassistant/sensor/xtender_<name>/config
+static void discovery_topic(const parameter_t *param, char *topic, size_t size)
+{
+    snprintf(topic, size, "homeassistant/sensor/xtender_%s/config", param->name);
+}
+
+// Suffix of the name and topic of the energy counters of an active power entry (see energy.h)
+static const char *const energy_suffix[2] = {"_energy", "_energy_returned"};
+
+// Add the device all sensors are grouped under to a discovery config
+static void add_discovery_device(struct json_object *config)
+{
+    // Device with empty name - keeps sensors grouped but prevents name concatenation
+    struct json_object *device = json_object_new_object();
+    struct json_object *identifiers = json_object_new_array();
+    json_object_array_add(identifiers, json_object_new_string("studer_xtender"));
+    json_object_object_add(device, "identifiers", identifiers);
+    json_object_object_add(device, "name", json_object_new_string(""));  // Empty name prevents concatenation
+    json_object_object_add(device, "manufacturer", json_object_new_string("Studer Innotec"));
+    json_object_object_add(device, "model", json_object_new_string("Xtender XTM4000-48"));
+    json_object_object_add(config, "device", device);
+}
+
+// Aggregates of an entry with aggregate_s (see aggregate.h): topic suffix and name suffix
+static const char *const aggregate_suffix[3] = {"_min", "_max", "_mean"};
+static const char *const aggregate_label[3] = {"Min", "Max", "Mean"};
+
+// Discovery config of the sensor of param, or of one of its aggregates (suffix NULL for the
+// samples; caller frees the string)
+static char *build_sensor_config(const parameter_t *param, const char *suffix, const char *label, int expire_after)
+{
+    char unique_id[160];
     char state_topic[256];
+    char name[192];
     
     // Create unique_id: xtender_<name>
-    snprintf(unique_id, sizeof(unique_id), "xtender_%s", param->name);
+    snprintf(unique_id, sizeof(unique_id), "xtender_%s%s", param->name, suffix ? suffix : "");
     
     // State topic
-    snprintf(state_topic, sizeof(state_topic), "%s/%s/%s", mqtt_topic, param->mqtt_prefix, param->name);
-    
-    // Discovery topic: homeassistant/sensor/<unique_id>/config
-    snprintf(config_topic, sizeof(config_topic), "homeassistant/sensor/%s/config", unique_id);
+    snprintf(state_topic, sizeof(state_topic), "%s/%s/%s%s", mqtt_topic, param->mqtt_prefix, param->name, suffix ? suffix : "");
+    snprintf(name, sizeof(name), "%s%s%s", param->friendly_name, label ? " " : "", label ? label : "");
     
     // Build JSON config
     struct json_object *config = json_object_new_object();
-    json_object_object_add(config, "name", json_object_new_string(param->friendly_name));
+    json_object_object_add(config, "name", json_object_new_string(name));
     json_object_object_add(config, "unique_id", json_object_new_string(unique_id));
     json_object_object_add(config, "object_id", json_object_new_string(unique_id));
     json_object_object_add(config, "has_entity_name", json_object_new_boolean(false));
@@ -77,7 +146,7 @@ void publish_discovery_config(struct mosquitto *mosq, const parameter_t *param)
     json_object_object_add(config, "availability_topic", json_object_new_string("studer/commstatus"));
     json_object_object_add(config, "payload_available", json_object_new_string("online"));
     json_object_object_add(config, "payload_not_available", json_object_new_string("offline"));
-    json_object_object_add(config, "expire_after", json_object_new_int(20));
+    json_object_object_add(config, "expire_after", json_object_new_int(expire_after));
     
     // Add unit of measurement (convert kW/kVA to W/VA)
     if (strcmp(param->unit, "kW") == 0) {
@@ -86,51 +155,694 @@ void publish_discovery_config(struct mosquitto *mosq, const parameter_t *param)
     } else if (strcmp(param->unit, "kVA") == 0) {
         json_object_object_add(config, "unit_of_measurement", json_object_new_string("VA"));
         json_object_object_add(config, "value_template", json_object_new_string("{{ value | float * 1000 }}"));
-    } else {
+    } else if (param->unit[0] != '\0') {
         json_object_object_add(config, "unit_of_measurement", json_object_new_string(param->unit));
     }
     
     // Add device class and state class
-    json_object_object_add(config, "device_class", json_object_new_string(param->device_class));
+    if (param->device_class != NULL && param->device_class[0] != '\0') {
+        json_object_object_add(config, "device_class", json_object_new_string(param->device_class));
+    }
     json_object_object_add(config, "state_class", json_object_new_string("measurement"));
     
-    // Add device with empty name - keeps sensors grouped but prevents name concatenation
-    struct json_object *device = json_object_new_object();
-    struct json_object *identifiers = json_object_new_array();
-    json_object_array_add(identifiers, json_object_new_string("studer_xtender"));
-    json_object_object_add(device, "identifiers", identifiers);
-    json_object_object_add(device, "name", json_object_new_string(""));  // Empty name prevents concatenation
-    json_object_object_add(device, "manufacturer", json_object_new_string("Studer Innotec"));
-    json_object_object_add(device, "model", json_object_new_string("Xtender XTM4000-48"));
-    json_object_object_add(config, "device", device);
-    
-    // Get JSON string and publish
-    const char *json_str = json_object_to_json_string(config);
-    mosquitto_publish(mosq, NULL, config_topic, (int)strlen(json_str), json_str, 0, true);
+    add_discovery_device(config);
     
+    // json-c fields keep their insertion order, so equal configs give equal strings
+    char *json_str = strdup(json_object_to_json_string(config));
     json_object_put(config);  // Free JSON object
+    return json_str;
+}
+
+// Build the Home Assistant MQTT Discovery config of a single sensor (caller frees the string)
+char *build_discovery_config(const parameter_t *param)
+{
+    return build_sensor_config(param, NULL, NULL, 20);
+}
+
+// Discovery config of an energy counter (retained, no expiry: it is published every
+// ENERGY_PUBLISH_INTERVAL_S only)
+static char *build_energy_discovery_config(const parameter_t *param, int returned)
+{
+    char unique_id[160];
+    char state_topic[256];
+    char name[192];
+
+    snprintf(unique_id, sizeof(unique_id), "xtender_%s%s", param->name, energy_suffix[returned]);
+    snprintf(state_topic, sizeof(state_topic), "%s/%s/%s%s", mqtt_topic, param->mqtt_prefix, param->name, energy_suffix[returned]);
+    snprintf(name, sizeof(name), "%s %s", param->friendly_name, returned ? "Energy Returned" : "Energy");
+
+    struct json_object *config = json_object_new_object();
+    json_object_object_add(config, "name", json_object_new_string(name));
+    json_object_object_add(config, "unique_id", json_object_new_string(unique_id));
+    json_object_object_add(config, "object_id", json_object_new_string(unique_id));
+    json_object_object_add(config, "has_entity_name", json_object_new_boolean(false));
+    json_object_object_add(config, "state_topic", json_object_new_string(state_topic));
+    json_object_object_add(config, "unit_of_measurement", json_object_new_string("kWh"));
+    json_object_object_add(config, "device_class", json_object_new_string("energy"));
+    json_object_object_add(config, "state_class", json_object_new_string("total_increasing"));
+    add_discovery_device(config);
+
+    char *json_str = strdup(json_object_to_json_string(config));
+    json_object_put(config);
+    return json_str;
+}
+
+static void energy_discovery_topic(const parameter_t *param, int returned, char *topic, size_t size)
+{
+    snprintf(topic, size, "homeassistant/sensor/xtender_%s%s/config", param->name, energy_suffix[returned]);
+}
+
+// Remove the energy counters of param from Home Assistant
+static void retract_energy_discovery_configs(struct mosquitto *mosq, const parameter_t *param)
+{
+    char config_topic[256];
+    for (int returned = 0; returned < 2; returned++) {
+        energy_discovery_topic(param, returned, config_topic, sizeof(config_topic));
+        health_publish(mosq, NULL, config_topic, 0, NULL, 0, true);
+    }
+}
+
+static void aggregate_discovery_topic(const parameter_t *param, int k, char *topic, size_t size)
+{
+    snprintf(topic, size, "homeassistant/sensor/xtender_%s%s/config", param->name, aggregate_suffix[k]);
+}
+
+// Remove the aggregates of param from Home Assistant
+static void retract_aggregate_discovery_configs(struct mosquitto *mosq, const parameter_t *param)
+{
+    char config_topic[256];
+    for (int k = 0; k < 3; k++) {
+        aggregate_discovery_topic(param, k, config_topic, sizeof(config_topic));
+        health_publish(mosq, NULL, config_topic, 0, NULL, 0, true);
+    }
+}
+
+// Diagnostic sensors of the daemon itself (see health.h), on <mqtt_topic>/daemon/<key>
+static const struct {
+    const char *key;
+    const char *name;
+    const char *unit;
+    const char *device_class;
+    const char *state_class;
+} health_sensors[] = {
+    {"cycle_time_ms", "Studer Daemon Cycle Time", "ms", "duration", "measurement"},
+    {"reads_per_s", "Studer Daemon Read Rate", "reads/s", NULL, "measurement"},
+    {"read_failure_pct", "Studer Daemon Read Failures", "%", NULL, "measurement"},
+    {"cpu_per_cycle_ms", "Studer Daemon CPU per Cycle", "ms", "duration", "measurement"},
+    {"rss_mib", "Studer Daemon Memory", "MiB", "data_size", "measurement"},
+    {"mqtt_reconnects", "Studer Daemon MQTT Reconnects", NULL, NULL, "total_increasing"},
+    {"publish_backlog", "Studer Daemon Publish Backlog", "messages", NULL, "measurement"},
+};
+#define NUM_HEALTH_SENSORS (sizeof(health_sensors) / sizeof(health_sensors[0]))
+
+// Discovery config of health sensor k. No availability topic: the daemon is most interesting
+// when the inverter is offline; a sensor expires when the daemon stops publishing.
+static char *build_health_discovery_config(size_t k)
+{
+    char unique_id[160];
+    char state_topic[256];
+
+    snprintf(unique_id, sizeof(unique_id), "xtender_daemon_%s", health_sensors[k].key);
+    snprintf(state_topic, sizeof(state_topic), "%s/daemon/%s", mqtt_topic, health_sensors[k].key);
+
+    struct json_object *config = json_object_new_object();
+    json_object_object_add(config, "name", json_object_new_string(health_sensors[k].name));
+    json_object_object_add(config, "unique_id", json_object_new_string(unique_id));
+    json_object_object_add(config, "object_id", json_object_new_string(unique_id));
+    json_object_object_add(config, "has_entity_name", json_object_new_boolean(false));
+    json_object_object_add(config, "state_topic", json_object_new_string(state_topic));
+    json_object_object_add(config, "entity_category", json_object_new_string("diagnostic"));
+    json_object_object_add(config, "expire_after", json_object_new_int(HEALTH_PUBLISH_INTERVAL_S * 3));
+    if (health_sensors[k].unit != NULL) {
+        json_object_object_add(config, "unit_of_measurement", json_object_new_string(health_sensors[k].unit));
+    }
+    if (health_sensors[k].device_class != NULL) {
+        json_object_object_add(config, "device_class", json_object_new_string(health_sensors[k].device_class));
+    }
+    json_object_object_add(config, "state_class", json_object_new_string(health_sensors[k].state_class));
+    add_discovery_device(config);
+
+    char *json_str = strdup(json_object_to_json_string(config));
+    json_object_put(config);
+    return json_str;
+}
+
+static void publish_health_discovery_configs(struct mosquitto *mosq)
+{
+    char config_topic[256];
+    for (size_t k = 0; k < NUM_HEALTH_SENSORS; k++) {
+        char *json_str = build_health_discovery_config(k);
+        if (json_str == NULL) {
+            continue;
+        }
+        snprintf(config_topic, sizeof(config_topic), "homeassistant/sensor/xtender_daemon_%s/config", health_sensors[k].key);
+        health_publish(mosq, NULL, config_topic, (int)strlen(json_str), json_str, 0, true);
+        free(json_str);
+    }
+}
+
+// Publish Home Assistant MQTT Discovery config for a single sensor (and its aggregates and energy
+// counters)
+void publish_discovery_config(struct mosquitto *mosq, const parameter_t *param)
+{
+    char config_topic[256];
+    discovery_topic(param, config_topic, sizeof(config_topic));
+
+    // An entry that only publishes aggregates has no sensor of its own
+    char *json_str = build_discovery_config(param);
+    if (json_str == NULL) {
+        return;
+    }
+    health_publish(mosq, NULL, config_topic, param->aggregate_only ? 0 : (int)strlen(json_str),
+                      param->aggregate_only ? NULL : json_str, 0, true);
+    free(json_str);
+
+    for (int k = 0; param->aggregate_s > 0 && k < 3; k++) {
+        aggregate_discovery_topic(param, k, config_topic, sizeof(config_topic));
+        json_str = build_sensor_config(param, aggregate_suffix[k], aggregate_label[k], (int)param->aggregate_s * 2 + 20);
+        if (json_str != NULL) {
+            health_publish(mosq, NULL, config_topic, (int)strlen(json_str), json_str, 0, true);
+            free(json_str);
+        }
+    }
+
+    for (int returned = 0; energy_tracked(param) && returned < 2; returned++) {
+        energy_discovery_topic(param, returned, config_topic, sizeof(config_topic));
+        json_str = build_energy_discovery_config(param, returned);
+        if (json_str != NULL) {
+            health_publish(mosq, NULL, config_topic, (int)strlen(json_str), json_str, 0, true);
+            free(json_str);
+        }
+    }
+}
+
+// An empty retained config removes the sensor from Home Assistant
+void retract_discovery_config(struct mosquitto *mosq, const parameter_t *param)
+{
+    char config_topic[256];
+    discovery_topic(param, config_topic, sizeof(config_topic));
+    health_publish(mosq, NULL, config_topic, 0, NULL, 0, true);
+
+    if (energy_tracked(param)) {
+        retract_energy_discovery_configs(mosq, param);
+    }
+    if (param->aggregate_s > 0) {
+        retract_aggregate_discovery_configs(mosq, param);
+    }
+}
+
+// Publish the windows that ended since the last cycle
+static void publish_aggregates(struct mosquitto *mosq)
+{
+    time_t now = time(NULL);
+
+    for (size_t i = 0; i < g_config->num_parameters; i++) {
+        const parameter_t *param = &g_config->parameters[i];
+        aggregate_t agg;
+
+        if (!aggregate_take(i, now, &agg)) {
+            continue;
+        }
+        const float values[3] = {agg.min, agg.max, agg.mean};
+        for (int k = 0; k < 3; k++) {
+            char topic[256];
+            char value_str[32];
+            snprintf(topic, sizeof(topic), "%s/%s/%s%s", mqtt_topic, param->mqtt_prefix, param->name, aggregate_suffix[k]);
+            snprintf(value_str, sizeof(value_str), "%.3f", values[k]);
+            health_publish(mosq, NULL, topic, (int)strlen(value_str), value_str, 0, false);
+        }
+    }
+}
+
+// Publish the energy counters - only what is on disk, so they never go back after a power cut
+static void publish_energy_counters(struct mosquitto *mosq)
+{
+    state_file_flush();
+
+    for (size_t i = 0; i < g_config->num_parameters; i++) {
+        const parameter_t *param = &g_config->parameters[i];
+        double counters[2];
+
+        if (!energy_tracked(param) || !state_file_energy(i, &counters[0], &counters[1])) {
+            continue;
+        }
+        for (int returned = 0; returned < 2; returned++) {
+            char topic[256];
+            char value_str[32];
+            snprintf(topic, sizeof(topic), "%s/%s/%s%s", mqtt_topic, param->mqtt_prefix, param->name, energy_suffix[returned]);
+            snprintf(value_str, sizeof(value_str), "%.4f", counters[returned]);
+            health_publish(mosq, NULL, topic, (int)strlen(value_str), value_str, 0, true);
+        }
+    }
 }
 
+static const parameter_t *find_parameter(const config_t *cfg, const char *name)
+{
+    for (size_t i = 0; i < cfg->num_parameters; i++) {
+        if (strcmp(cfg->parameters[i].name, name) == 0) {
+            return &cfg->parameters[i];
+        }
+    }
+    return NULL;
+}
+
+static int setting_changed(const char *a, const char *b)
+{
+    return (a == NULL || b == NULL) ? a != b : strcmp(a, b) != 0;
+}
+
+// Describe the poll list to the readers of the shared-memory snapshot
+static void describe_snapshot(const config_t *cfg)
+{
+    for (size_t i = 0; i < cfg->num_parameters; i++) {
+        shm_snapshot_describe(i, cfg->parameters[i].parameter, cfg->parameters[i].address, cfg->parameters[i].name);
+    }
+}
+
+// Plan the cycle of the poll list of cfg: read groups (snapshot sets) and the sampling clock
+static void configure_cycle(const config_t *cfg)
+{
+    snapshot_sets_bind(cfg);
+    sampler_init(cfg->sample_period_ms, snapshot_sets_groups(), cfg->sample_overrun);
+    if (sampler_enabled()) {
+        printf("[%ld] Fixed-rate sampling every %u ms, %s on overrun\n", time(NULL), cfg->sample_period_ms,
+               cfg->sample_overrun == SAMPLER_CATCH_UP ? "catching up" : "skipping cycles");
+    }
+}
+
+// Compute and publish the derived sensors from the values read in this cycle
+static void publish_derived_values(struct mosquitto *mosq)
+{
+    for (size_t k = 0; k < derived_count(); k++) {
+        size_t idx = derived_entry(k);
+        const parameter_t *param = &g_config->parameters[idx];
+        char topic[256];
+        char value_str[32];
+        float value;
+        struct timespec now;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        snprintf(topic, sizeof(topic), "%s/%s/%s", mqtt_topic, param->mqtt_prefix, param->name);
+        int rc = derived_eval(k, &value);
+        if (rc > 0) {
+            continue; // sources not read in this cycle
+        }
+        if (rc < 0) {
+            shm_snapshot_update(idx, 0.0f, SHM_STATUS_FAILED);
+            if (!param->aggregate_only) {
+                health_publish(mosq, NULL, topic, 3, "nAn", 0, false);
+            }
+            continue;
+        }
+
+        alerts_check(idx, value);
+        shm_snapshot_update(idx, value, SHM_STATUS_OK);
+        state_file_record(idx, STATE_READ_OK, value, 0);
+        energy_sample(idx, value, &now);
+        aggregate_sample(idx, value, time(NULL));
+        history_sample(idx, value);
+        if (!param->aggregate_only) {
+            snprintf(value_str, sizeof(value_str), "%.3f", value);
+            health_publish(mosq, NULL, topic, (int)strlen(value_str), value_str, 0, false);
+        }
+    }
+}
+
+// 1 if an entry of the read group starting at first is due (a snapshot set is read as a whole)
+static int group_due(size_t first)
+{
+    struct timespec now;
+    int due = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    for (size_t i = first; i < g_config->num_parameters && (i == first || !snapshot_sets_starts_group(i)); i++) {
+        due |= !derived_is_derived(i) && schedule_due(i, &now);
+    }
+    return due;
+}
+
+// Log what adaptive polling saved since the last report
+static void report_schedule(void)
+{
+    schedule_stats_t stats;
+
+    schedule_take_stats(&stats);
+    if (stats.skipped == 0 && stats.bursts == 0) {
+        return; // no entry has a schedule
+    }
+    printf("[%ld] Adaptive polling: %llu reads, %llu skipped, %llu bursts, %u entries bursting\n", time(NULL), stats.reads,
+           stats.skipped, stats.bursts, stats.bursting);
+}
+
+// Log the jitter of the fixed-rate sampling since the last report
+static void report_sampler(void)
+{
+    sampler_stats_t stats;
+
+    sampler_take_stats(&stats);
+    printf("[%ld] Sampling: %llu cycles, jitter avg %llu us max %u us, %llu overruns, %llu cycles skipped\n", time(NULL),
+           (unsigned long long)stats.cycles, (unsigned long long)(stats.samples ? stats.jitter_sum_us / stats.samples : 0),
+           stats.jitter_max_us, (unsigned long long)stats.overruns, (unsigned long long)stats.skipped);
+}
+
+// Publish the largest skew within every snapshot set since the last report
+static void report_snapshot_sets(struct mosquitto *mosq)
+{
+    for (size_t i = 0; i < snapshot_sets_count(); i++) {
+        snapshot_set_skew_t skew;
+        char topic[256];
+        char value_str[32];
+
+        snapshot_sets_take_skew(i, &skew);
+        if (skew.cycles == 0) {
+            continue;
+        }
+        printf("[%ld] Snapshot set %s: skew avg %.1f ms max %.1f ms over %u cycles\n", time(NULL), skew.name, skew.skew_avg_us / 1000.0,
+               skew.skew_max_us / 1000.0, skew.cycles);
+        snprintf(topic, sizeof(topic), "%s/daemon/skew/%s", mqtt_topic, skew.name);
+        snprintf(value_str, sizeof(value_str), "%.1f", skew.skew_max_us / 1000.0);
+        health_publish(mosq, NULL, topic, (int)strlen(value_str), value_str, 0, false);
+    }
+}
+
+static struct json_object *latency_json(const bus_latency_t *latency)
+{
+    struct json_object *obj = json_object_new_object();
+    json_object_object_add(obj, "mean", json_object_new_int64(latency->mean_us));
+    json_object_object_add(obj, "p50", json_object_new_int64(latency->p50_us));
+    json_object_object_add(obj, "p90", json_object_new_int64(latency->p90_us));
+    json_object_object_add(obj, "p99", json_object_new_int64(latency->p99_us));
+    json_object_object_add(obj, "max", json_object_new_int64(latency->max_us));
+    return obj;
+}
+
+// percentage with one decimal, not the 17 digits of the double
+static struct json_object *percent_json(double pct)
+{
+    char str[16];
+    snprintf(str, sizeof(str), "%.1f", pct);
+    return json_object_new_double_s(pct, str);
+}
+
+// {"<address or object ID>": {"count": n, "header_us": {...}, "body_us": {...}}, ...}; the
+// target with the highest 90th percentile request-to-header latency is returned in slowest
+static struct json_object *targets_json(const bus_target_stats_t *targets, size_t count, const bus_target_stats_t **slowest)
+{
+    struct json_object *obj = json_object_new_object();
+    char key[16];
+
+    *slowest = NULL;
+    for (size_t i = 0; i < count; i++) {
+        struct json_object *target = json_object_new_object();
+        json_object_object_add(target, "count", json_object_new_int64(targets[i].header.count));
+        json_object_object_add(target, "header_us", latency_json(&targets[i].header));
+        json_object_object_add(target, "body_us", latency_json(&targets[i].body));
+        snprintf(key, sizeof(key), "%u", targets[i].key);
+        json_object_object_add(obj, key, target);
+        if (*slowest == NULL || targets[i].header.p90_us > (*slowest)->header.p90_us) {
+            *slowest = &targets[i];
+        }
+    }
+    return obj;
+}
+
+static struct json_object *error_counts_json(const uint32_t *counts, uint32_t *total)
+{
+    struct json_object *obj = json_object_new_object();
+
+    *total = 0;
+    for (unsigned e = 0; e < BUS_STATS_MAX_ERROR; e++) {
+        if (counts[e] > 0) {
+            json_object_object_add(obj, scomx_err2str((scom_error_t)e), json_object_new_int64(counts[e]));
+            *total += counts[e];
+        }
+    }
+    return obj;
+}
+
+// Publish the latencies, errors and utilisation of the serial bus since the last report
+static void report_bus_stats(struct mosquitto *mosq)
+{
+    static bus_stats_t stats; // a few KiB, kept off the stack
+    const bus_target_stats_t *slowest_address, *slowest_object;
+    uint32_t errors, retries;
+    char topic[256];
+
+    bus_stats_take(&stats);
+    if (stats.requests == 0) {
+        return;
+    }
+
+    struct json_object *obj = json_object_new_object();
+    json_object_object_add(obj, "window_s", json_object_new_int64(llround(stats.window_s)));
+    json_object_object_add(obj, "requests", json_object_new_int64((int64_t)stats.requests));
+    json_object_object_add(obj, "busy_pct", percent_json(stats.busy_pct));
+    json_object_object_add(obj, "wire_pct", percent_json(stats.wire_pct));
+    json_object_object_add(obj, "errors", error_counts_json(stats.errors, &errors));
+    json_object_object_add(obj, "retries", error_counts_json(stats.retries, &retries));
+    json_object_object_add(obj, "addresses", targets_json(stats.addresses, stats.num_addresses, &slowest_address));
+    json_object_object_add(obj, "objects", targets_json(stats.objects, stats.num_objects, &slowest_object));
+    if (stats.untracked > 0) {
+        json_object_object_add(obj, "untracked", json_object_new_int64(stats.untracked));
+    }
+
+    const char *json_str = json_object_to_json_string(obj);
+    snprintf(topic, sizeof(topic), "%s/daemon/bus", mqtt_topic);
+    health_publish(mosq, NULL, topic, (int)strlen(json_str), json_str, 0, false);
+    json_object_put(obj);
+
+    printf("[%ld] Bus: %llu requests, busy %.1f%% (wire %.1f%%), %u errors, %u retries", time(NULL),
+           (unsigned long long)stats.requests, stats.busy_pct, stats.wire_pct, errors, retries);
+    if (slowest_address != NULL && slowest_object != NULL) {
+        printf(", slowest address %u (p90 %.1f ms), slowest object %u (p90 %.1f ms)", slowest_address->key,
+               slowest_address->header.p90_us / 1000.0, slowest_object->key, slowest_object->header.p90_us / 1000.0);
+    }
+    printf("\n");
+}
+
+static int publish_health_value(struct mosquitto *mosq, const char *key, double value, int decimals)
+{
+    char topic[256];
+    char value_str[32];
+
+    snprintf(topic, sizeof(topic), "%s/daemon/%s", mqtt_topic, key);
+    snprintf(value_str, sizeof(value_str), "%.*f", decimals, value);
+    return health_publish(mosq, NULL, topic, (int)strlen(value_str), value_str, 0, false);
+}
+
+// Publish the health sensors of the daemon for the last window
+static void report_health(struct mosquitto *mosq)
+{
+    health_stats_t stats;
+
+    health_take(&stats);
+    uint32_t backlog = health_backlog();
+
+    publish_health_value(mosq, "reads_per_s", stats.reads_per_s, 1);
+    publish_health_value(mosq, "read_failure_pct", stats.failure_pct, 2);
+    if (stats.cycles > 0) {
+        publish_health_value(mosq, "cycle_time_ms", stats.cycle_ms, 1);
+        publish_health_value(mosq, "cpu_per_cycle_ms", stats.cpu_per_cycle_ms, 2);
+    }
+    publish_health_value(mosq, "rss_mib", stats.rss_mib, 1);
+    publish_health_value(mosq, "mqtt_reconnects", stats.reconnects, 0);
+    publish_health_value(mosq, "publish_backlog", backlog, 0);
+
+    printf("[%ld] Health: %u cycles of %.1f ms (max %.1f ms), %.1f reads/s, %.2f%% failed, CPU %.2f ms/cycle, RSS %.1f MiB, "
+           "backlog %u, %u reconnects\n",
+           time(NULL), stats.cycles, stats.cycle_ms, stats.cycle_max_ms, stats.reads_per_s, stats.failure_pct, stats.cpu_per_cycle_ms,
+           stats.rss_mib, backlog, stats.reconnects);
+}
+
+// Last values of the previous run, taken from the state file by the poll loop before the broker
+// connection is started and published once by the connect callback (guarded by config_mutex)
+typedef struct {
+    char topic[256];
+    char value[32];
+} restored_value_t;
+
+static restored_value_t *g_restored = NULL;
+static size_t g_num_restored = 0;
+
+static void prepare_restored_values(const config_t *cfg)
+{
+    int64_t now_ns = (int64_t)time(NULL) * 1000000000;
+
+    g_restored = calloc(cfg->num_parameters ? cfg->num_parameters : 1, sizeof(restored_value_t));
+    if (g_restored == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < cfg->num_parameters; i++) {
+        const parameter_t *param = &cfg->parameters[i];
+        float value;
+        int64_t timestamp_ns;
+
+        if (!state_file_last_value(i, &value, &timestamp_ns) || now_ns - timestamp_ns > (int64_t)STATE_RESTORE_MAX_AGE_S * 1000000000 ||
+            state_file_device_skip(param->address) || param->aggregate_only) {
+            continue;
+        }
+        restored_value_t *restored = &g_restored[g_num_restored++];
+        snprintf(restored->topic, sizeof(restored->topic), "%s/%s/%s", mqtt_topic, param->mqtt_prefix, param->name);
+        snprintf(restored->value, sizeof(restored->value), "%.3f", value);
+    }
+}
+
+// Called with config_mutex held; the values are not retained, live values are not either
+static size_t publish_restored_values(struct mosquitto *mosq)
+{
+    size_t published = g_num_restored;
+
+    for (size_t i = 0; i < g_num_restored; i++) {
+        health_publish(mosq, NULL, g_restored[i].topic, (int)strlen(g_restored[i].value), g_restored[i].value, 0, false);
+    }
+    free(g_restored);
+    g_restored = NULL;
+    g_num_restored = 0;
+    return published;
+}
+
+// Load the configuration file again and swap the poll list. Called by the main loop between two
+// cycles, so no read of the old list is in flight. Only the discovery configs that differ are
+// republished, sensors that are gone are retracted.
+static void reload_config(struct mosquitto *mosq)
+{
+    printf("[%ld] Reloading %s\n", time(NULL), config_path);
+
+    config_t *cfg = config_load(config_path, g_defaults);
+
+    // the shared-memory snapshot in use cannot describe a longer poll list
+    if (cfg != NULL && shm_snapshot_enabled() && cfg->num_parameters > SHM_SNAPSHOT_MAX_PARAMS) {
+        printf("[%ld] %zu parameters do not fit into the shared-memory snapshot (max %d)\n", time(NULL), cfg->num_parameters,
+               SHM_SNAPSHOT_MAX_PARAMS);
+        config_free(cfg);
+        cfg = NULL;
+    }
+    if (cfg == NULL || derived_plan(cfg) != 0) {
+        printf("[%ld] Configuration not reloaded, keeping the current one\n", time(NULL));
+        config_free(cfg);
+        return;
+    }
+
+    // these are bound to the broker session, the serial port and the datalog at startup
+    if (setting_changed(cfg->mqtt_server, g_config->mqtt_server) || cfg->mqtt_port != g_config->mqtt_port ||
+        setting_changed(cfg->mqtt_topic, g_config->mqtt_topic) || setting_changed(cfg->serial_port, g_config->serial_port) ||
+        setting_changed(cfg->datalog_dir, g_config->datalog_dir) || cfg->datalog_max_age_days != g_config->datalog_max_age_days) {
+        printf("[%ld] Broker, topic, serial port and datalog settings changed - restart required to apply them\n", time(NULL));
+    }
+
+    size_t retracted = 0, published = 0;
+
+    // the MQTT thread must not republish the old list while it is being replaced
+    pthread_mutex_lock(&config_mutex);
+    for (size_t i = 0; i < g_config->num_parameters; i++) {
+        if (find_parameter(cfg, g_config->parameters[i].name) == NULL) {
+            retract_discovery_config(mosq, &g_config->parameters[i]);
+            retracted++;
+        }
+    }
+    for (size_t i = 0; i < cfg->num_parameters; i++) {
+        const parameter_t *old = find_parameter(g_config, cfg->parameters[i].name);
+        char *new_json = build_discovery_config(&cfg->parameters[i]);
+        char *old_json = old ? build_discovery_config(old) : NULL;
+
+        if (new_json != NULL && (old_json == NULL || strcmp(old_json, new_json) != 0 ||
+                                 old->aggregate_s != cfg->parameters[i].aggregate_s || old->aggregate_only != cfg->parameters[i].aggregate_only)) {
+            publish_discovery_config(mosq, &cfg->parameters[i]);
+            published++;
+        }
+        if (old != NULL && energy_tracked(old) && !energy_tracked(&cfg->parameters[i])) {
+            retract_energy_discovery_configs(mosq, old);
+        }
+        if (old != NULL && old->aggregate_s > 0 && cfg->parameters[i].aggregate_s == 0) {
+            retract_aggregate_discovery_configs(mosq, old);
+        }
+        free(new_json);
+        free(old_json);
+    }
+    config_t *old_config = g_config;
+    g_config = cfg;
+
+    // restored values not published yet belong to the old list
+    free(g_restored);
+    g_restored = NULL;
+    g_num_restored = 0;
+    pthread_mutex_unlock(&config_mutex);
+
+    config_free(old_config);
+
+    if (shm_snapshot_reset(cfg->num_parameters) == 0) {
+        describe_snapshot(cfg);
+    }
+    state_file_bind(cfg->parameters, cfg->num_parameters);
+    energy_bind(cfg);
+    aggregate_bind(cfg);
+    history_bind(cfg);
+    schedule_bind(cfg);
+    alerts_bind(cfg);
+    configure_cycle(cfg);
+
+    printf("[%ld] Configuration reloaded: %zu sensors, %zu discovery configs published, %zu retracted\n", time(NULL),
+           cfg->num_parameters, published, retracted);
+}
+
+
 // MQTT callbacks
 void on_connect(struct mosquitto *mosq, void *obj __attribute__((unused)), int rc)
 {
     pthread_mutex_lock(&mqtt_mutex);
     mqtt_connected = (rc == 0) ? 1 : 0;
+    // Reset status flag so we republish online after reconnection
+    if (rc == 0) {
+        comm_status_online = 0;
+    }
     pthread_mutex_unlock(&mqtt_mutex);
     
     printf("[%ld] MQTT connect callback: rc=%d (%s)\n", time(NULL), rc, 
            rc == 0 ? "success" : "failed");
     
     if (rc == 0) {
-        // Reset status flag so we republish online after reconnection
-        comm_status_online = false;
+        health_connected();
         
         // Publish Home Assistant discovery configs for all sensors
         printf("[%ld] Publishing MQTT Discovery configs...\n", time(NULL));
-        for (size_t i = 0; i < NUM_PARAMETERS; i++) {
-            publish_discovery_config(mosq, &requested_parameters[i]);
+        pthread_mutex_lock(&config_mutex);
+        size_t num_sensors = g_config->num_parameters;
+        for (size_t i = 0; i < num_sensors; i++) {
+            publish_discovery_config(mosq, &g_config->parameters[i]);
         }
-        printf("[%ld] Discovery configs published (%zu sensors)\n", time(NULL), NUM_PARAMETERS);
+        pthread_mutex_unlock(&config_mutex);
+        publish_health_discovery_configs(mosq);
+        printf("[%ld] Discovery configs published (%zu sensors)\n", time(NULL), num_sensors);
+
+        // Last values of the previous run, on the first connect. They are at most
+        // STATE_RESTORE_MAX_AGE_S old and of devices that answered, so the sensors are marked
+        // available with them; the first failed read sets the status back to offline.
+        pthread_mutex_lock(&config_mutex);
+        size_t restored = publish_restored_values(mosq);
+        pthread_mutex_unlock(&config_mutex);
+        if (restored > 0) {
+            pthread_mutex_lock(&mqtt_mutex);
+            health_publish(mosq, NULL, "studer/commstatus", 6, "online", 0, true);
+            comm_status_online = 1;
+            pthread_mutex_unlock(&mqtt_mutex);
+            printf("[%ld] Published %zu values restored from the state file\n", time(NULL), restored);
+        }
+
+        // (Re)subscribe to the parameter write commands
+        commands_subscribe(mosq);
+    }
+}
+
+void on_message(struct mosquitto *mosq, void *obj __attribute__((unused)), const struct mosquitto_message *msg)
+{
+    // during a handover the successor is subscribed too and executes the commands
+    if (g_handover_active) {
+        return;
+    }
+    if (!commands_handle_message(mosq, msg)) {
+#ifdef SERIAL_DEBUG
+        printf("[%ld] Ignoring message on %s\n", time(NULL), msg->topic);
+#endif
     }
 }
 
@@ -140,20 +852,25 @@ void on_disconnect(struct mosquitto *mosq __attribute__((unused)),
     pthread_mutex_lock(&mqtt_mutex);
     mqtt_connected = 0;
     pthread_mutex_unlock(&mqtt_mutex);
+    health_disconnected();
     
     printf("[%ld] MQTT disconnected: rc=%d (%s)\n", time(NULL), rc,
            rc == 0 ? "clean disconnect" : "unexpected disconnect");
 }
 
+// Called by libmosquitto once a message is written to the broker connection (QoS 0) or
+// acknowledged (QoS 1)
+void on_publish(struct mosquitto *mosq __attribute__((unused)), void *obj __attribute__((unused)), int mid)
+{
+    health_published(mid);
+}
+
 // Function to read a parameter from a device at a specific address
-read_param_result_t read_param(int addr, int parameter)
+read_param_result_t read_param(int addr, int parameter, scom_format_t format)
 {
     read_param_result_t result;
     scomx_enc_result_t encresult;
-    scomx_header_dec_result_t dechdr;
     scomx_dec_result_t decres;
-    size_t bytecounter;
-    char readbuf[SCOM_MAX_FRAME_SIZE];
 
     // Initialize result to prevent undefined behavior
     result.value = 0.0f;
@@ -170,79 +887,25 @@ read_param_result_t read_param(int addr, int parameter)
         } else {
             printf("[SCOM DEBUG] Reading param %d from addr %d\n", parameter, addr);
         }
-        printf("[SCOM DEBUG] Encoded command (%zu bytes): ", encresult.length);
-        for (size_t i = 0; i < encresult.length; i++) {
-            printf("%02X ", encresult.data[i]);
-        }
-        printf("\n");
 #endif
 
-        // Write the encoded command to the serial port
-        bytecounter = serial_write(encresult.data, encresult.length);
-        if (bytecounter != encresult.length) {
-            printf("Serial write failed: sent %zu of %zu bytes\n", bytecounter, encresult.length);
-            serial_flush();  // Clear buffer on write failure
-            continue;  // Retry the request
-        }
-        // Read the frame header from the serial port
-        bytecounter = serial_read(readbuf, SCOM_FRAME_HEADER_SIZE);
-        if (bytecounter != SCOM_FRAME_HEADER_SIZE) {
-            if (bytecounter == 0) {
-                printf("Serial timeout: no header received (inverter disconnected?)\n");
-            } else {
-                printf("Serial header read failed: got %zu of %d bytes\n", bytecounter, SCOM_FRAME_HEADER_SIZE);
+        // Send the request and read back the response frame
+        if (bus_transfer(&encresult, &decres) != 0) {
+            if (decres.error == SCOM_ERROR_STACK_PORT_WRITE_FAILED) {
+                bus_stats_retry(decres.error);
+                continue;  // Retry the request
             }
-            serial_flush(); // Clear buffer on error
             result.error = -1;
             return result;
         }
-
-        // Decode the frame header
-        dechdr = scomx_decode_frame_header(readbuf, SCOM_FRAME_HEADER_SIZE);
-        if (dechdr.error != SCOM_ERROR_NO_ERROR) {
-#ifdef SERIAL_DEBUG
-            printf("[SCOM DEBUG] Header decode failed: error %d\n", dechdr.error);
-#endif
-            serial_flush(); // Clear buffer on error
-            result.error = -1;
-            return result;
+        if (decres.error == SCOM_ERROR_GATEWAY_BUSY) {
+            bus_pace(); // the gap has just been widened
+            bus_stats_retry(decres.error);
+            continue;   // Retry the request
         }
-#ifdef SERIAL_DEBUG
-        printf("[SCOM DEBUG] Header decoded, need to read %zu more bytes\n", dechdr.length_to_read);
-#endif
-
-        // Sanity check on length to prevent hang
-        if (dechdr.length_to_read > sizeof(readbuf) || dechdr.length_to_read == 0) {
-#ifdef SERIAL_DEBUG
-            printf("[SCOM DEBUG] Invalid length_to_read: %zu (buffer size: %zu)\n",
-                   dechdr.length_to_read, sizeof(readbuf));
-#endif
-            serial_flush(); // Clear buffer on error
-            result.error = -1;
-            return result;
-        }
-
-        // Read the frame data from the serial port
-        bytecounter = serial_read(readbuf, dechdr.length_to_read);
-        if (bytecounter != dechdr.length_to_read) {
-            if (bytecounter == 0) {
-                printf("Serial timeout: no data received\n");
-            } else {
-                printf("Serial data read failed: got %zu of %zu bytes\n", bytecounter, dechdr.length_to_read);
-            }
-            serial_flush(); // Clear buffer on error
-            result.error = -1;
-            return result;
-        }
-
-        // Decode the frame data
-        decres = scomx_decode_frame(readbuf, dechdr.length_to_read);
         if (decres.error != SCOM_ERROR_NO_ERROR) {
-#ifdef SERIAL_DEBUG
-            printf("[SCOM DEBUG] Frame decode failed: error %d\n", decres.error);
-#endif
             serial_flush(); // Clear buffer on error
-            result.error = -1;
+            result.error = decres.error; // answered with an error (e.g. no such device)
             return result;
         }
 
@@ -256,11 +919,12 @@ read_param_result_t read_param(int addr, int parameter)
                    request_attempt + 1, MAX_REQUEST_ATTEMPTS,
                    parameter, addr, decres.object_id, decres.src_addr);
             serial_flush();  // Flush buffer before retry
+            bus_stats_retry(SCOM_ERROR_STACK_PROPERTY_HEADER_DOESNT_MATCH);
             continue;  // Retry the entire request (outer loop)
         }
 
-        // Extract the float value from the decoded frame
-        result.value = scomx_result_float(decres);
+        // Decode the value in the format of the object
+        result.value = scomx_decode_value(format, decres.data, decres.length);
         result.error = 0; // no error
 
 #ifdef SERIAL_DEBUG
@@ -274,27 +938,257 @@ read_param_result_t read_param(int addr, int parameter)
     return result;
 }
 
+// Milliseconds since the process started
+static long elapsed_ms(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - g_start_time.tv_sec) * 1000 + (now.tv_nsec - g_start_time.tv_nsec) / 1000000;
+}
+
+static int is_mqtt_connected(void)
+{
+    pthread_mutex_lock(&mqtt_mutex);
+    int connected = mqtt_connected;
+    pthread_mutex_unlock(&mqtt_mutex);
+    return connected;
+}
+
+// Connect to the broker in the background: DNS resolution and the TCP handshake run while the
+// serial link is probed, instead of delaying the first read
+static void *broker_connect_thread(void *arg)
+{
+    struct mosquitto *mosq = (struct mosquitto *)arg;
+
+    printf("[%ld] Connecting to MQTT broker %s:%d\n", time(NULL), mqtt_server, mqtt_port);
+    int rc = mosquitto_connect(mosq, mqtt_server, mqtt_port, 60);
+    if (rc != MOSQ_ERR_SUCCESS) {
+        printf("Connect failed, return code %d - continuing anyway (will retry)\n", rc);
+    } else {
+        printf("Initial MQTT connect() succeeded after %ld ms\n", elapsed_ms());
+    }
+
+    // Start the network loop in background thread
+    rc = mosquitto_loop_start(mosq);
+    if (rc != MOSQ_ERR_SUCCESS) {
+        printf("Failed to start mosquitto loop, return code %d\n", rc);
+        g_shutdown_requested = 1;
+    }
+    return NULL;
+}
+
+// Find the baud rate of the Xcom-232i (115200, or its factory default 38400) with one cheap read.
+// Any decoded answer counts, even an error for a missing device - garbage or silence does not.
+static void detect_baud_rate(void)
+{
+    static const struct {
+        int speed;
+        const char *name;
+    } rates[] = {{B115200, "115200"}, {B38400, "38400"}};
+
+    serial_set_read_timeout(BAUD_PROBE_TIMEOUT_DS);
+    for (size_t i = 0; i < sizeof(rates) / sizeof(rates[0]) && !g_shutdown_requested; i++) {
+        scomx_enc_result_t enc = scomx_encode_read_user_info_value(100, SCOMX_XT_INFO_BATTERY_VOLTAGE);
+        scomx_dec_result_t dec;
+
+        if (serial_set_speed(rates[i].speed) == 0 && bus_transfer(&enc, &dec) == 0) {
+            printf("[%ld] Xcom-232i answers at %s baud (%ld ms after start)\n", time(NULL), rates[i].name, elapsed_ms());
+            serial_set_read_timeout(20);
+            return;
+        }
+    }
+
+    // nothing answers (yet) - keep polling at the default rate, the reads report the failure
+    printf("[%ld] No answer at 115200 or 38400 baud, using 115200\n", time(NULL));
+    serial_set_speed(B115200);
+    serial_set_read_timeout(20);
+}
+
+// The USB adapter was unplugged or reset: pause polling until it is back. Waits at most
+// SERIAL_REOPEN_WAIT_MS so signals and queued clients are handled in between.
+static void recover_serial_port(struct mosquitto *mosq, int *lost_logged)
+{
+    struct timespec start, end;
+
+    if (!*lost_logged) {
+        pthread_mutex_lock(&mqtt_mutex);
+        if (comm_status_online) {
+            health_publish(mosq, NULL, "studer/commstatus", 7, "offline", 0, true);
+            comm_status_online = 0;
+        }
+        pthread_mutex_unlock(&mqtt_mutex);
+        printf("[%ld] Serial port lost, polling paused until it is back\n", time(NULL));
+        *lost_logged = 1;
+    }
+
+    // local clients get their error right away instead of a timeout
+    bus_service_pending();
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (serial_wait_reopen(SERIAL_REOPEN_WAIT_MS) != 0) {
+        return;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("[%ld] Serial port reopened after %ld ms, polling resumed\n", time(NULL),
+           (long)((end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000));
+    *lost_logged = 0;
+}
+
+// Hand the serial port over to a successor (see handover.h). Returns 0 once the successor has
+// completed a poll cycle, -1 if this process has to go on polling.
+static int hand_over(int conn)
+{
+    g_handover_active = 1;
+
+    // finish what is queued, then let the successor serve the local clients
+    bus_service_pending();
+    bus_server_stop();
+    datalog_close();
+    state_file_sync();
+    history_server_stop();
+    history_close();
+
+    if (handover_send(conn, serial_get_fd()) == 0 && handover_wait_ready(conn) == 0) {
+        close(conn);
+        printf("[%ld] Successor completed its first cycle, exiting\n", time(NULL));
+        return 0;
+    }
+    close(conn);
+
+    // the successor may have the port open already
+    printf("[%ld] Handover failed, stopping the successor\n", time(NULL));
+    handover_abort();
+    printf("[%ld] Resuming the poll loop\n", time(NULL));
+    g_handover_active = 0;
+
+    // go on from what the successor committed, so energy and seen messages do not roll back
+    state_file_detach();
+    state_file_open(state_file_path);
+    state_file_bind(g_config->parameters, g_config->num_parameters);
+    bus_server_start(bus_socket_path);
+    datalog_init(datalog_dir, datalog_max_age_days, mqtt_topic, g_mqtt_client);
+    if (history_dir != NULL) {
+        history_open(history_dir);
+    }
+    history_bind(g_config);
+    history_server_start(history_socket_path);
+    return -1;
+}
+
 int main(int argc, const char *argv[])
 {
-    // Default serial port if no argument provided
-    const char *port = "/dev/serial/by-path/platform-xhci-hcd.1.auto-usb-0:1.1.1:1.0-port0";
+    clock_gettime(CLOCK_MONOTONIC, &g_start_time);
+
+    // Usage: studer232-to-mqtt [--takeover] [-c config.json] [serial port]
+    const char *port = NULL;
+    int config_required = 0;
+    int takeover = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            config_path = argv[++i];
+            config_required = 1;
+        } else if (strcmp(argv[i], "--takeover") == 0) {
+            takeover = 1;
+        } else {
+            port = argv[i];
+        }
+    }
+
+    // The binary may be replaced while we run - remember where it is to start the new one on SIGUSR2
+    char exe_path[256];
+    ssize_t exe_len = readlink("/proc/self/exe", exe_path, sizeof(exe_path) - 1);
+    exe_path[exe_len > 0 ? exe_len : 0] = '\0';
+
+    g_defaults = config_defaults(mqtt_server, mqtt_port, mqtt_topic, serial_port, datalog_dir, datalog_max_age_days, requested_parameters,
+                                 NUM_PARAMETERS);
+    if (g_defaults == NULL) {
+        return 1;
+    }
 
-    // Check if a port is provided as a command line argument
-    if (argc > 1) {
-        port = argv[1];
+    // The default file is optional, one given with -c is not
+    if (config_required || access(config_path, F_OK) == 0) {
+        g_config = config_load(config_path, g_defaults);
+        if (g_config == NULL) {
+            return 1;
+        }
+        printf("Configuration loaded from %s (%zu sensors)\n", config_path, g_config->num_parameters);
+    } else {
+        g_config = config_defaults(mqtt_server, mqtt_port, mqtt_topic, serial_port, datalog_dir, datalog_max_age_days, requested_parameters,
+                                   NUM_PARAMETERS);
+        if (g_config == NULL) {
+            return 1;
+        }
+    }
+
+    // Settings bound at startup; a reload only swaps the poll list
+    mqtt_server = strdup(g_config->mqtt_server);
+    mqtt_port = g_config->mqtt_port;
+    mqtt_topic = strdup(g_config->mqtt_topic);
+    datalog_dir = g_config->datalog_dir && g_config->datalog_dir[0] ? strdup(g_config->datalog_dir) : NULL;
+    datalog_max_age_days = g_config->datalog_max_age_days;
+    if (port == NULL) {
+        port = strdup(g_config->serial_port);
+    }
+    if (derived_plan(g_config) != 0) {
+        return 1;
     }
+    configure_cycle(g_config);
 
     printf("Studer serial comm test on port %s\n", port);
 
-    // Initialize the serial port
-    if (serial_init(port, B115200, PARITY_EVEN, 1) != 0) {
+    // Take the open port over from a running daemon, or open it
+    int serial_fd;
+    int takeover_conn = takeover ? handover_request(handover_socket_path, &serial_fd) : -1;
+    if (takeover_conn >= 0) {
+        if (serial_adopt(serial_fd, port) != 0) {
+            return 1;
+        }
+    } else if (serial_init(port, B115200, PARITY_EVEN, 1) != 0) {
         return 1;
     }
     printf("Serial connection established\n");
 
+    // A successor takes over from here; while we are taking over, the predecessor still listens
+    if (takeover_conn < 0 && handover_listen(handover_socket_path) == 0) {
+        printf("Handover socket listening on %s\n", handover_socket_path);
+    }
+
+    // Shared-memory snapshot for local consumers (optional - the daemon works without it)
+    if (shm_snapshot_init(SHM_SNAPSHOT_NAME, g_config->num_parameters) == 0) {
+        describe_snapshot(g_config);
+        printf("Shared-memory snapshot available at /dev/shm%s\n", SHM_SNAPSHOT_NAME);
+    }
+
+    // Devices, statistics and last values of the previous run
+    if (state_file_open(state_file_path) == 0) {
+        printf("Warm-restart state kept in %s\n", state_file_path);
+    }
+    state_file_bind(g_config->parameters, g_config->num_parameters);
+    prepare_restored_values(g_config);
+    energy_bind(g_config);
+    aggregate_bind(g_config);
+    schedule_bind(g_config);
+
+    // History of the published values, kept on disk across outages of the broker
+    if (history_dir != NULL && history_open(history_dir) == 0) {
+        printf("History kept in %s\n", history_dir);
+    }
+    history_bind(g_config);
+    if (history_server_start(history_socket_path) == 0) {
+        printf("History queries answered on %s\n", history_socket_path);
+    }
+
+    // Request queue shared by the poll loop and local bus clients (tools, scripts)
+    bus_init();
+    if (bus_server_start(bus_socket_path) == 0) {
+        printf("Serial bus API listening on %s\n", bus_socket_path);
+    }
+
     // Set up signal handlers for graceful shutdown
     signal(SIGINT, signal_handler);   // Ctrl+C
     signal(SIGTERM, signal_handler);  // systemctl stop
+    signal(SIGHUP, reload_handler);   // systemctl reload
+    signal(SIGUSR2, upgrade_handler); // upgrade-service.sh
 
     mosquitto_lib_init();
     struct mosquitto *mqtt_client = mosquitto_new(NULL, true, NULL);
@@ -308,6 +1202,23 @@ int main(int argc, const char *argv[])
     // Set up MQTT callbacks
     mosquitto_connect_callback_set(mqtt_client, on_connect);
     mosquitto_disconnect_callback_set(mqtt_client, on_disconnect);
+    mosquitto_message_callback_set(mqtt_client, on_message);
+    mosquitto_publish_callback_set(mqtt_client, on_publish);
+
+    // Parameter writes arriving on <mqtt_topic>/.../set are queued with urgent priority
+    commands_init(mqtt_topic, writable_parameters, NUM_COMMANDS);
+
+    // Warnings and alarms stored by the Xcom-232i are published on <mqtt_topic>/messages
+    messages_init(mqtt_topic, mqtt_client);
+
+    // Alert rules of the configuration fire on <mqtt_topic>/alert/<name> right after the read
+    alerts_init(mqtt_topic, mqtt_client);
+    alerts_bind(g_config);
+
+    // Minute history from the SD card of the Xcom-232i, downloaded block by block between the polls
+    if (datalog_init(datalog_dir, datalog_max_age_days, mqtt_topic, mqtt_client) == 0) {
+        printf("Datalog files are stored in %s\n", datalog_dir);
+    }
 
     // Set up the last will before connecting
     int rc = mosquitto_will_set(mqtt_client, "studer/commstatus", strlen(lwt_message), lwt_message, 0, true);
@@ -319,26 +1230,29 @@ int main(int argc, const char *argv[])
     // Enable automatic reconnection
     mosquitto_reconnect_delay_set(mqtt_client, 1, 30, true);
 
-    printf("[%ld] Connecting to MQTT broker %s:%d\n", time(NULL), mqtt_server, mqtt_port);
-    rc = mosquitto_connect(mqtt_client, mqtt_server, mqtt_port, 60);
-    if (rc != MOSQ_ERR_SUCCESS) {
-        printf("Connect failed, return code %d - continuing anyway (will retry)\n", rc);
-        mqtt_connected = 0;
-    } else {
-        printf("Initial MQTT connect() succeeded\n");
-        mqtt_connected = 1;
+    pthread_t connect_thread;
+    if (pthread_create(&connect_thread, NULL, broker_connect_thread, mqtt_client) != 0) {
+        printf("Failed to create the broker connect thread\n");
+        return 1;
     }
-    
-    // Start the network loop in background thread
-    rc = mosquitto_loop_start(mqtt_client);
-    if (rc != MOSQ_ERR_SUCCESS) {
-        printf("Failed to start mosquitto loop, return code %d\n", rc);
-        return rc;
+
+    // Meanwhile find the baud rate; a port taken over is already configured
+    if (takeover_conn < 0) {
+        detect_baud_rate();
     }
 
-    // Give the connection a moment to establish
-    sleep(1);
+    // The first manual reconnect check must not race with the initial connect
+    last_mqtt_check = time(NULL);
 
+    int first_publish_done = 0;
+    int handed_over = 0;
+    int takeover_failed = 0;
+    int serial_lost_logged = 0;
+    time_t last_report = time(NULL);
+    time_t last_energy_publish = time(NULL);
+    time_t last_bus_stats = time(NULL);
+    time_t last_health = time(NULL);
+    time_t last_history_flush = time(NULL);
     while (!g_shutdown_requested) {
         // Check MQTT connection status every 60 seconds
         time_t now = time(NULL);
@@ -359,13 +1273,126 @@ int main(int argc, const char *argv[])
             }
         }
 
-        // Iterate over the requested_parameters array
-        for (size_t i = 0; i < NUM_PARAMETERS; i++) {
+        if (now - last_report >= REPORT_INTERVAL) {
+            last_report = now;
+            if (sampler_enabled()) {
+                report_sampler();
+            }
+            report_snapshot_sets(mqtt_client);
+            report_schedule();
+        }
+
+        if (now - last_bus_stats >= BUS_STATS_INTERVAL) {
+            last_bus_stats = now;
+            report_bus_stats(mqtt_client);
+        }
+
+        if (now - last_health >= HEALTH_PUBLISH_INTERVAL_S && is_mqtt_connected()) {
+            last_health = now;
+            report_health(mqtt_client);
+        }
+
+        if (now - last_energy_publish >= ENERGY_PUBLISH_INTERVAL_S && is_mqtt_connected()) {
+            last_energy_publish = now;
+            publish_energy_counters(mqtt_client);
+        }
+
+        if (now - last_history_flush >= HISTORY_FLUSH_INTERVAL_S) {
+            last_history_flush = now;
+            history_flush();
+        }
+
+        // Swap in a new configuration between cycles, never in the middle of one
+        if (g_reload_requested) {
+            g_reload_requested = 0;
+            reload_config(mqtt_client);
+        }
+
+        // Start the upgraded binary; it asks for the serial port through the handover socket
+        if (g_upgrade_requested) {
+            g_upgrade_requested = 0;
+            int pid = exe_path[0] ? handover_spawn(exe_path, argc, argv) : -1;
+            printf("[%ld] Upgrade requested, started %s as pid %d\n", time(NULL), exe_path, pid);
+        }
+
+        // No polling while the adapter is gone (the handover waits for it, too)
+        if (serial_is_lost()) {
+            recover_serial_port(mqtt_client, &serial_lost_logged);
+            continue;
+        }
+
+        // Hand over between two cycles, so the successor starts from a quiet bus
+        int handover_conn = handover_accept();
+        if (handover_conn >= 0 && hand_over(handover_conn) == 0) {
+            handed_over = 1;
+            break;
+        }
+
+        // Fixed-rate sampling: the cycle starts on its scheduled instant
+        if (sampler_enabled()) {
+            sampler_begin_cycle();
+        }
+
+        health_cycle_begin();
+
+        // Iterate over the active poll list (only this thread replaces it)
+        derived_begin_cycle();
+        size_t group = 0;
+        int read_group = 1;
+        for (size_t i = 0; i < g_config->num_parameters; i++) {
             // Get the current parameter
-            parameter_t current_param = requested_parameters[i];
+            parameter_t current_param = g_config->parameters[i];
+
+            // The members of a snapshot set follow each other without background work in between
+            if (snapshot_sets_starts_group(i)) {
+                // Serve queued client requests first so they never wait for a whole cycle
+                bus_service_pending();
+
+                // Fetch new messages as soon as a response announces them
+                messages_service();
+
+                // One block of a datalog file transfer, if any
+                datalog_service();
+
+                // Fixed-rate sampling: every read group has its slot in the cycle
+                if (sampler_enabled()) {
+                    sampler_wait_slot(group);
+                }
+                group++;
+
+                // Adaptive polling: quiet entries rest until their next read
+                read_group = group_due(i);
+            } else {
+                // Parameter writes and client requests still preempt a set, background work waits
+                bus_service_urgent();
+            }
+
+            // Computed at the end of the cycle
+            if (derived_is_derived(i)) {
+                continue;
+            }
+
+            if (!read_group) {
+                schedule_skip(i);
+                continue;
+            }
+
+            // Devices that keep answering with an error are only probed now and then
+            if (state_file_device_skip(current_param.address)) {
+                derived_failed(i);
+                continue;
+            }
 
             // Read the parameter
-            read_param_result_t result = read_param(current_param.address, current_param.parameter);
+            struct timespec read_start, read_end;
+            clock_gettime(CLOCK_MONOTONIC, &read_start);
+            read_param_result_t result = read_param(current_param.address, current_param.parameter, current_param.format);
+            clock_gettime(CLOCK_MONOTONIC, &read_end);
+            health_read(result.error == 0);
+            schedule_sample(i, result.error == 0, result.value * current_param.sign, &read_start);
+            state_file_record(i, result.error == 0 ? STATE_READ_OK : result.error > 0 ? STATE_READ_DEVICE_ERROR : STATE_READ_FAILED,
+                              result.value * current_param.sign,
+                              (int64_t)(read_end.tv_sec - read_start.tv_sec) * 1000000000 + (read_end.tv_nsec - read_start.tv_nsec));
 
             // Current topic
             char topic[256];
@@ -373,10 +1400,17 @@ int main(int argc, const char *argv[])
 
             // Check if the read was successful
             if (result.error == 0) {
+                alerts_check(i, result.value * current_param.sign);
+                snapshot_sets_answered(i, &read_end);
+                derived_set(i, result.value * current_param.sign);
+                energy_sample(i, result.value * current_param.sign, &read_end);
+                aggregate_sample(i, result.value * current_param.sign, time(NULL));
+                history_sample(i, result.value * current_param.sign);
+
                 // First successful read - publish online status if not already done
                 pthread_mutex_lock(&mqtt_mutex);
                 if (!comm_status_online && mqtt_connected) {
-                    mosquitto_publish(mqtt_client, NULL, "studer/commstatus", 6, "online", 0, true);
+                    health_publish(mqtt_client, NULL, "studer/commstatus", 6, "online", 0, true);
                     printf("[%ld] Serial communication established - status set to online\n", time(NULL));
                     comm_status_online = 1;
                 }
@@ -387,57 +1421,142 @@ int main(int argc, const char *argv[])
                 printf("%s = %.3f %s\n", current_param.name, result.value * current_param.sign, current_param.unit);
 #endif
 
+                shm_snapshot_update(i, result.value * current_param.sign, SHM_STATUS_OK);
+
                 // Convert the float value to a string
                 char value_str[32];
                 snprintf(value_str, sizeof(value_str), "%.3f", result.value * current_param.sign);
 
-                // Publish the value to MQTT
-                rc = mosquitto_publish(mqtt_client, NULL, topic, (int)strlen(value_str), value_str, 0, false);
+                // Publish the value to MQTT (aggregated entries may only publish at the end of a window)
+                rc = current_param.aggregate_only ? MOSQ_ERR_SUCCESS
+                                                  : health_publish(mqtt_client, NULL, topic, (int)strlen(value_str), value_str, 0, false);
                 if (rc != MOSQ_ERR_SUCCESS) {
                     printf("Publish failed, return code %d (continuing)\n", rc);
                     // Don't try to reconnect manually - loop_start handles it automatically
+                } else if (!first_publish_done && is_mqtt_connected()) {
+                    // Cold start metric: process start to the first live value on the broker
+                    char metric_topic[256];
+                    char metric_str[32];
+                    long ms = elapsed_ms();
+                    snprintf(metric_topic, sizeof(metric_topic), "%s/daemon/time_to_first_publish_ms", mqtt_topic);
+                    snprintf(metric_str, sizeof(metric_str), "%ld", ms);
+                    health_publish(mqtt_client, NULL, metric_topic, (int)strlen(metric_str), metric_str, 0, true);
+                    printf("[%ld] First value published %ld ms after start\n", time(NULL), ms);
+                    first_publish_done = 1;
                 }
             } else {
                 // Serial read failed - set status to offline
                 pthread_mutex_lock(&mqtt_mutex);
                 if (comm_status_online) {
-                    mosquitto_publish(mqtt_client, NULL, "studer/commstatus", 7, "offline", 0, true);
+                    health_publish(mqtt_client, NULL, "studer/commstatus", 7, "offline", 0, true);
                     printf("[%ld] Serial communication lost - status set to offline\n", time(NULL));
                     comm_status_online = 0;
                 }
                 pthread_mutex_unlock(&mqtt_mutex);
                 
+                shm_snapshot_update(i, 0.0f, SHM_STATUS_FAILED);
+                derived_failed(i);
+
                 // Print an error message
                 printf("%s = read failed\n", current_param.name);
-                mosquitto_publish(mqtt_client, NULL, topic, 3, "nAn", 0, false);
+                if (!current_param.aggregate_only) {
+                    health_publish(mqtt_client, NULL, topic, 3, "nAn", 0, false);
+                }
+
+                // The rest of the cycle would fail as well
+                if (serial_is_lost()) {
+                    break;
+                }
             }
             
-            // Small delay between parameters to avoid overwhelming inverter
-            usleep(DELAY_BETWEEN_PARAMS_US);
+            // Leave the Xcom as much room as the measured bus load asks for (after a whole set)
+            if (snapshot_sets_starts_group(i + 1)) {
+                bus_pace();
+            }
         }
+        snapshot_sets_end_cycle();
+        publish_derived_values(mqtt_client);
+        publish_aggregates(mqtt_client);
 
 #ifdef SERIAL_DEBUG
         printf("---------------------------------------------------------\n");
 #endif
 
-        usleep(DELAY_END_OF_CYCLE_US);
+        state_file_sync();
+        health_cycle_end();
+
+        // First cycle after a takeover: the predecessor may exit now
+        if (takeover_conn >= 0) {
+            int ready = handover_ready(takeover_conn);
+            takeover_conn = -1;
+            if (ready != 0) {
+                // the predecessor polls on: leave the port to it
+                printf("[%ld] Takeover failed, exiting\n", time(NULL));
+                takeover_failed = 1;
+                handed_over = 1; // same clean exit: no last will, the snapshot segment stays
+                break;
+            }
+            if (handover_listen(handover_socket_path) == 0) {
+                printf("[%ld] Takeover complete, handover socket listening on %s\n", time(NULL), handover_socket_path);
+            }
+        }
+
+        // Free-running: the next cycle starts after the adaptive gap
+        if (!sampler_enabled()) {
+            bus_pace();
+        }
     }
 
     // Cleanup
     printf("[%ld] Shutting down gracefully...\n", time(NULL));
+
+    // An initial connect still in progress uses the client
+    pthread_join(connect_thread, NULL);
+
+    // Stop serving bus clients and fail whatever is still queued
+    bus_server_stop();
+    bus_shutdown();
+
+    // Release a running datalog transfer on the Xcom (resumed on the next start)
+    datalog_close();
+
+    // Write what is still in memory (already done before a handover)
+    history_server_stop();
+    history_close();
+
+    handover_close();
     
-    // Force stop the loop immediately (don't wait for thread)
-    mosquitto_loop_stop(mqtt_client, true);
-    
-    // Disconnect forcefully
-    mosquitto_disconnect(mqtt_client);
+    if (handed_over) {
+        // A clean DISCONNECT keeps the broker from publishing the "offline" last will
+        mosquitto_disconnect(mqtt_client);
+        mosquitto_loop_stop(mqtt_client, false);
+    } else {
+        // Force stop the loop immediately (don't wait for thread)
+        mosquitto_loop_stop(mqtt_client, true);
+        
+        // Disconnect forcefully
+        mosquitto_disconnect(mqtt_client);
+    }
     
     // Try to send offline status (best effort, may not work after disconnect)
     // mosquitto_publish(mqtt_client, NULL, "studer/commstatus", 7, "offline", 0, true);
     
     mosquitto_destroy(mqtt_client);
     mosquitto_lib_cleanup();
+
+    // After a handover the successor owns the snapshot segment and the state file; its last
+    // commit must not be overwritten with the state of this process
+    if (handed_over) {
+        shm_snapshot_detach();
+        state_file_detach();
+    } else {
+        shm_snapshot_close();
+        state_file_close();
+    }
+
+    config_free(g_config);
+    config_free(g_defaults);
     
     printf("[%ld] Shutdown complete.\n", time(NULL));
-    return 0;
+    return takeover_failed ? 1 : 0;
 }
@@ -1,75 +1,122 @@
+#include "commands.h"
+#include "config.h"
+
+// Optional configuration file, reloaded on SIGHUP (see config.h); overrides the settings below
+const char *config_path = "/etc/studer232-to-mqtt.json";
+
+// Serial port of the Xcom-232i (the command line argument takes precedence)
+const char *serial_port = "/dev/serial/by-path/platform-xhci-hcd.1.auto-usb-0:1.1.1:1.0-port0";
+
 const char *mqtt_server = "net.ad.kolins.cz";
 int mqtt_port = 1883;
 
 const char *lwt_message = "offline";
 
+// Unix socket through which local tools share the serial port with the daemon
+const char *bus_socket_path = "/tmp/studer232-to-mqtt.sock";
+
+// Unix socket through which a new daemon takes the serial port over (see handover.h)
+const char *handover_socket_path = "/tmp/studer232-to-mqtt.handover.sock";
+
+// Directory for the datalog files downloaded from the Xcom-232i SD card (NULL disables the download)
+const char *datalog_dir = "/var/lib/studer232-to-mqtt";
+// Only the files of the last days are downloaded
+int datalog_max_age_days = 7;
+
+// Warm-restart state (devices, statistics, last values), see state_file.h
+const char *state_file_path = "/var/lib/studer232-to-mqtt/state.bin";
+// History of every published value (see history.h); NULL disables it
+const char *history_dir = "/var/lib/studer232-to-mqtt/history";
+// Unix socket answering history queries (tools/studer_history)
+const char *history_socket_path = "/tmp/studer232-to-mqtt.history.sock";
+
+// Restored values older than this are not published on startup
+#define STATE_RESTORE_MAX_AGE_S 300
+
 // Structure to hold the result of reading a parameter
 typedef struct {
     float value; // Value of the parameter
-    int error;   // Error code (0 if no error)
+    int error;   // 0 if no error, the SCOM error if the Xcom answered with one, -1 on a transport failure
 } read_param_result_t;
 
-typedef struct {
-    int parameter;
-    int address;
-    char *name;              // Technical ID: xt1_input_active_power
-    char *friendly_name;     // Display name: Studer 1 Input Active Power
-    char *mqtt_prefix;
-    char *unit;
-    int sign;
-    char *device_class;      // Home Assistant device class
-} parameter_t;
-
 const char *mqtt_topic = "studer";
 
 // Number of parameters in the array
 #define NUM_PARAMETERS (sizeof(requested_parameters) / sizeof(parameter_t))
 
-// List of parameters
-// param, addr, name (ID), friendly_name, mqtt_prefix, unit, sign, device_class
+// List of parameters (compiled-in default, replaced by "parameters" of the configuration file)
+// param + format (SCOMX_OBJECT), addr, name (ID), friendly_name, mqtt_prefix, unit, sign, device_class, snapshot_set,
+// expression, aggregate_s, aggregate_only, history, schedule (members of a snapshot set are read
+// back to back, see config.h; entries with an expression are computed from the others instead of
+// read, see derived.h; aggregate_s adds windowed min/max/mean, see aggregate.h; history keeps the
+// samples on disk, see history.h; a schedule of zeros reads the entry every cycle, see schedule.h)
 const parameter_t requested_parameters[] = {
-    {3137, 101, "xt1_input_active_power",     "Studer 1 Input Active Power",    "XT", "kW", -1, "power"},
-    {3138, 101, "xt1_input_apparent_power",   "Studer 1 Input Apparent Power",  "XT", "kVA", 1, "apparent_power"},
-    {3136, 101, "xt1_output_active_power",    "Studer 1 Output Active Power",   "XT", "kW", -1, "power"},
-    {3139, 101, "xt1_output_apparent_power",  "Studer 1 Output Apparent Power", "XT", "kVA", 1, "apparent_power"},
-    {3137, 102, "xt2_input_active_power",     "Studer 2 Input Active Power",    "XT", "kW", -1, "power"},
-    {3138, 102, "xt2_input_apparent_power",   "Studer 2 Input Apparent Power",  "XT", "kVA", 1, "apparent_power"},
-    {3136, 102, "xt2_output_active_power",    "Studer 2 Output Active Power",   "XT", "kW", -1, "power"},
-    {3139, 102, "xt2_output_apparent_power",  "Studer 2 Output Apparent Power", "XT", "kVA", 1, "apparent_power"},
-    {3137, 103, "xt3_input_active_power",     "Studer 3 Input Active Power",    "XT", "kW", -1, "power"},
-    {3138, 103, "xt3_input_apparent_power",   "Studer 3 Input Apparent Power",  "XT", "kVA", 1, "apparent_power"},
-    {3136, 103, "xt3_output_active_power",    "Studer 3 Output Active Power",   "XT", "kW", -1, "power"},
-    {3139, 103, "xt3_output_apparent_power",  "Studer 3 Output Apparent Power", "XT", "kVA", 1, "apparent_power"},
-    {3137, 104, "xt4_input_active_power",     "Studer 4 Input Active Power",    "XT", "kW", -1, "power"},
-    {3138, 104, "xt4_input_apparent_power",   "Studer 4 Input Apparent Power",  "XT", "kVA", 1, "apparent_power"},
-    {3136, 104, "xt4_output_active_power",    "Studer 4 Output Active Power",   "XT", "kW", -1, "power"},
-    {3139, 104, "xt4_output_apparent_power",  "Studer 4 Output Apparent Power", "XT", "kVA", 1, "apparent_power"},
-    {3137, 191, "l1_input_active_power",      "Studer L1 Input Active Power",    "AC", "kW", -1, "power"},
-    {3138, 191, "l1_input_apparent_power",    "Studer L1 Input Apparent Power",  "AC", "kVA", 1, "apparent_power"},
-    {3136, 191, "l1_output_active_power",     "Studer L1 Output Active Power",   "AC", "kW", -1, "power"},
-    {3139, 191, "l1_output_apparent_power",   "Studer L1 Output Apparent Power", "AC", "kVA", 1, "apparent_power"},
-    {3137, 192, "l2_input_active_power",      "Studer L2 Input Active Power",    "AC", "kW", -1, "power"},
-    {3138, 192, "l2_input_apparent_power",    "Studer L2 Input Apparent Power",  "AC", "kVA", 1, "apparent_power"},
-    {3136, 192, "l2_output_active_power",     "Studer L2 Output Active Power",   "AC", "kW", -1, "power"},
-    {3139, 192, "l2_output_apparent_power",   "Studer L2 Output Apparent Power", "AC", "kVA", 1, "apparent_power"},
-    {3137, 193, "l3_input_active_power",      "Studer L3 Input Active Power",    "AC", "kW", -1, "power"},
-    {3138, 193, "l3_input_apparent_power",    "Studer L3 Input Apparent Power",  "AC", "kVA", 1, "apparent_power"},
-    {3136, 193, "l3_output_active_power",     "Studer L3 Output Active Power",   "AC", "kW", -1, "power"},
-    {3139, 193, "l3_output_apparent_power",   "Studer L3 Output Apparent Power", "AC", "kVA", 1, "apparent_power"},
-    {3104, 101, "xt1_temperature",            "Studer 1 Temperature",            "XT", "°C",  1, "temperature"},
-    {3104, 102, "xt2_temperature",            "Studer 2 Temperature",            "XT", "°C",  1, "temperature"},
-    {3104, 103, "xt3_temperature",            "Studer 3 Temperature",            "XT", "°C",  1, "temperature"},
-    {3104, 104, "xt4_temperature",            "Studer 4 Temperature",            "XT", "°C",  1, "temperature"},
-    {3085, 100, "output_freq",                "Studer AC Output Frequency",      "AC", "Hz",  1, "frequency"},
-    {3137, 100, "total_input_active_power",   "Studer AC Total Input Active Power",  "AC", "kW", -1, "power"},
-    {3136, 100, "total_output_active_power",  "Studer AC Total Output Active Power", "AC", "kW", -1, "power"},
-    {3000, 100, "batt_voltage",               "Studer DC Battery Voltage",       "DC", "V",   1, "voltage"},
-    {3005, 191, "l1_batt_current",            "Studer L1 Battery Current",       "DC", "A",   1, "current"},
-    {3005, 192, "l2_batt_current",            "Studer L2 Battery Current",       "DC", "A",   1, "current"},
-    {3005, 193, "l3_batt_current",            "Studer L3 Battery Current",       "DC", "A",   1, "current"},
-    {3005, 101, "xt1_batt_current",           "Studer 1 Battery Current",        "DC", "A",   1, "current"},
-    {3005, 102, "xt2_batt_current",           "Studer 2 Battery Current",        "DC", "A",   1, "current"},
-    {3005, 103, "xt3_batt_current",           "Studer 3 Battery Current",        "DC", "A",   1, "current"},
-    {3005, 104, "xt4_batt_current",           "Studer 4 Battery Current",        "DC", "A",   1, "current"},
+    {SCOMX_OBJECT(SCOMX_XT_INFO_INPUT_ACTIVE_POWER_3137), 101,             "xt1_input_active_power",     "Studer 1 Input Active Power",    "XT", "kW", -1, "power", "input_power", NULL, 0, 0, 0, {0, 0, 0.0f}},
+    {SCOMX_OBJECT(SCOMX_XT_INFO_INPUT_POWER_3138), 101,                    "xt1_input_apparent_power",   "Studer 1 Input Apparent Power",  "XT", "kVA", 1, "apparent_power", "input_apparent_power", NULL, 0, 0, 0, {0, 0, 0.0f}},
+    {SCOMX_OBJECT(SCOMX_XT_INFO_OUTPUT_ACTIVE_POWER_3136), 101,            "xt1_output_active_power",    "Studer 1 Output Active Power",   "XT", "kW", -1, "power", "output_power", NULL, 0, 0, 0, {0, 0, 0.0f}},
+    {SCOMX_OBJECT(SCOMX_XT_INFO_OUTPUT_POWER_3139), 101,                   "xt1_output_apparent_power",  "Studer 1 Output Apparent Power", "XT", "kVA", 1, "apparent_power", "output_apparent_power", NULL, 0, 0, 0, {0, 0, 0.0f}},
+    {SCOMX_OBJECT(SCOMX_XT_INFO_INPUT_ACTIVE_POWER_3137), 102,             "xt2_input_active_power",     "Studer 2 Input Active Power",    "XT", "kW", -1, "power", "input_power", NULL, 0, 0, 0, {0, 0, 0.0f}},
+    {SCOMX_OBJECT(SCOMX_XT_INFO_INPUT_POWER_3138), 102,                    "xt2_input_apparent_power",   "Studer 2 Input Apparent Power",  "XT", "kVA", 1, "apparent_power", "input_apparent_power", NULL, 0, 0, 0, {0, 0, 0.0f}},
+    {SCOMX_OBJECT(SCOMX_XT_INFO_OUTPUT_ACTIVE_POWER_3136), 102,            "xt2_output_active_power",    "Studer 2 Output Active Power",   "XT", "kW", -1, "power", "output_power", NULL, 0, 0, 0, {0, 0, 0.0f}},
+    {SCOMX_OBJECT(SCOMX_XT_INFO_OUTPUT_POWER_3139), 102,                   "xt2_output_apparent_power",  "Studer 2 Output Apparent Power", "XT", "kVA", 1, "apparent_power", "output_apparent_power", NULL, 0, 0, 0, {0, 0, 0.0f}},
+    {SCOMX_OBJECT(SCOMX_XT_INFO_INPUT_ACTIVE_POWER_3137), 103,             "xt3_input_active_power",     "Studer 3 Input Active Power",    "XT", "kW", -1, "power", "input_power", NULL, 0, 0, 0, {0, 0, 0.0f}},
+    {SCOMX_OBJECT(SCOMX_XT_INFO_INPUT_POWER_3138), 103,                    "xt3_input_apparent_power",   "Studer 3 Input Apparent Power",  "XT", "kVA", 1, "apparent_power", "input_apparent_power", NULL, 0, 0, 0, {0, 0, 0.0f}},
+    {SCOMX_OBJECT(SCOMX_XT_INFO_OUTPUT_ACTIVE_POWER_3136), 103,            "xt3_output_active_power",    "Studer 3 Output Active Power",   "XT", "kW", -1, "power", "output_power", NULL, 0, 0, 0, {0, 0, 0.0f}},
+    {SCOMX_OBJECT(SCOMX_XT_INFO_OUTPUT_POWER_3139), 103,                   "xt3_output_apparent_power",  "Studer 3 Output Apparent Power", "XT", "kVA", 1, "apparent_power", "output_apparent_power", NULL, 0, 0, 0, {0, 0, 0.0f}},
+    {SCOMX_OBJECT(SCOMX_XT_INFO_INPUT_ACTIVE_POWER_3137), 104,             "xt4_input_active_power",     "Studer 4 Input Active Power",    "XT", "kW", -1, "power", "input_power", NULL, 0, 0, 0, {0, 0, 0.0f}},
+    {SCOMX_OBJECT(SCOMX_XT_INFO_INPUT_POWER_3138), 104,                    "xt4_input_apparent_power",   "Studer 4 Input Apparent Power",  "XT", "kVA", 1, "apparent_power", "input_apparent_power", NULL, 0, 0, 0, {0, 0, 0.0f}},
+    {SCOMX_OBJECT(SCOMX_XT_INFO_OUTPUT_ACTIVE_POWER_3136), 104,            "xt4_output_active_power",    "Studer 4 Output Active Power",   "XT", "kW", -1, "power", "output_power", NULL, 0, 0, 0, {0, 0, 0.0f}},
+    {SCOMX_OBJECT(SCOMX_XT_INFO_OUTPUT_POWER_3139), 104,                   "xt4_output_apparent_power",  "Studer 4 Output Apparent Power", "XT", "kVA", 1, "apparent_power", "output_apparent_power", NULL, 0, 0, 0, {0, 0, 0.0f}},
+    {SCOMX_OBJECT(SCOMX_XT_INFO_INPUT_ACTIVE_POWER_3137), 191,             "l1_input_active_power",      "Studer L1 Input Active Power",    "AC", "kW", -1, "power", "input_power", NULL, 0, 0, 0, {0, 0, 0.0f}},
+    {SCOMX_OBJECT(SCOMX_XT_INFO_INPUT_POWER_3138), 191,                    "l1_input_apparent_power",    "Studer L1 Input Apparent Power",  "AC", "kVA", 1, "apparent_power", "input_apparent_power", NULL, 0, 0, 0, {0, 0, 0.0f}},
+    {SCOMX_OBJECT(SCOMX_XT_INFO_OUTPUT_ACTIVE_POWER_3136), 191,            "l1_output_active_power",     "Studer L1 Output Active Power",   "AC", "kW", -1, "power", "output_power", NULL, 0, 0, 0, {0, 0, 0.0f}},
+    {SCOMX_OBJECT(SCOMX_XT_INFO_OUTPUT_POWER_3139), 191,                   "l1_output_apparent_power",   "Studer L1 Output Apparent Power", "AC", "kVA", 1, "apparent_power", "output_apparent_power", NULL, 0, 0, 0, {0, 0, 0.0f}},
+    {SCOMX_OBJECT(SCOMX_XT_INFO_INPUT_ACTIVE_POWER_3137), 192,             "l2_input_active_power",      "Studer L2 Input Active Power",    "AC", "kW", -1, "power", "input_power", NULL, 0, 0, 0, {0, 0, 0.0f}},
+    {SCOMX_OBJECT(SCOMX_XT_INFO_INPUT_POWER_3138), 192,                    "l2_input_apparent_power",    "Studer L2 Input Apparent Power",  "AC", "kVA", 1, "apparent_power", "input_apparent_power", NULL, 0, 0, 0, {0, 0, 0.0f}},
+    {SCOMX_OBJECT(SCOMX_XT_INFO_OUTPUT_ACTIVE_POWER_3136), 192,            "l2_output_active_power",     "Studer L2 Output Active Power",   "AC", "kW", -1, "power", "output_power", NULL, 0, 0, 0, {0, 0, 0.0f}},
+    {SCOMX_OBJECT(SCOMX_XT_INFO_OUTPUT_POWER_3139), 192,                   "l2_output_apparent_power",   "Studer L2 Output Apparent Power", "AC", "kVA", 1, "apparent_power", "output_apparent_power", NULL, 0, 0, 0, {0, 0, 0.0f}},
+    {SCOMX_OBJECT(SCOMX_XT_INFO_INPUT_ACTIVE_POWER_3137), 193,             "l3_input_active_power",      "Studer L3 Input Active Power",    "AC", "kW", -1, "power", "input_power", NULL, 0, 0, 0, {0, 0, 0.0f}},
+    {SCOMX_OBJECT(SCOMX_XT_INFO_INPUT_POWER_3138), 193,                    "l3_input_apparent_power",    "Studer L3 Input Apparent Power",  "AC", "kVA", 1, "apparent_power", "input_apparent_power", NULL, 0, 0, 0, {0, 0, 0.0f}},
+    {SCOMX_OBJECT(SCOMX_XT_INFO_OUTPUT_ACTIVE_POWER_3136), 193,            "l3_output_active_power",     "Studer L3 Output Active Power",   "AC", "kW", -1, "power", "output_power", NULL, 0, 0, 0, {0, 0, 0.0f}},
+    {SCOMX_OBJECT(SCOMX_XT_INFO_OUTPUT_POWER_3139), 193,                   "l3_output_apparent_power",   "Studer L3 Output Apparent Power", "AC", "kVA", 1, "apparent_power", "output_apparent_power", NULL, 0, 0, 0, {0, 0, 0.0f}},
+    {SCOMX_OBJECT(SCOMX_XT_INFO_ELECTRONIC_TEMPERATURE_1_MINUTE_AVG), 101, "xt1_temperature",            "Studer 1 Temperature",            "XT", "°C",  1, "temperature", NULL, NULL, 0, 0, 0, {0, 0, 0.0f}},
+    {SCOMX_OBJECT(SCOMX_XT_INFO_ELECTRONIC_TEMPERATURE_1_MINUTE_AVG), 102, "xt2_temperature",            "Studer 2 Temperature",            "XT", "°C",  1, "temperature", NULL, NULL, 0, 0, 0, {0, 0, 0.0f}},
+    {SCOMX_OBJECT(SCOMX_XT_INFO_ELECTRONIC_TEMPERATURE_1_MINUTE_AVG), 103, "xt3_temperature",            "Studer 3 Temperature",            "XT", "°C",  1, "temperature", NULL, NULL, 0, 0, 0, {0, 0, 0.0f}},
+    {SCOMX_OBJECT(SCOMX_XT_INFO_ELECTRONIC_TEMPERATURE_1_MINUTE_AVG), 104, "xt4_temperature",            "Studer 4 Temperature",            "XT", "°C",  1, "temperature", NULL, NULL, 0, 0, 0, {0, 0, 0.0f}},
+    {SCOMX_OBJECT(SCOMX_XT_INFO_OUTPUT_FREQUENCY), 100,                    "output_freq",                "Studer AC Output Frequency",      "AC", "Hz",  1, "frequency", NULL, NULL, 0, 0, 0, {0, 0, 0.0f}},
+    {SCOMX_OBJECT(SCOMX_XT_INFO_INPUT_ACTIVE_POWER_3137), 100,             "total_input_active_power",   "Studer AC Total Input Active Power",  "AC", "kW", -1, "power", "input_power", "l1_input_active_power + l2_input_active_power + l3_input_active_power", 0, 0, 1, {0, 0, 0.0f}},
+    {SCOMX_OBJECT(SCOMX_XT_INFO_OUTPUT_ACTIVE_POWER_3136), 100,            "total_output_active_power",  "Studer AC Total Output Active Power", "AC", "kW", -1, "power", "output_power", "l1_output_active_power + l2_output_active_power + l3_output_active_power", 0, 0, 1, {0, 0, 0.0f}},
+    {SCOMX_OBJECT(SCOMX_XT_INFO_BATTERY_VOLTAGE), 100,                     "batt_voltage",               "Studer DC Battery Voltage",       "DC", "V",   1, "voltage", "battery", NULL, 60, 0, 1, {0, 0, 0.0f}},
+    {SCOMX_OBJECT(SCOMX_XT_INFO_BATTERY_CHARGE_CURRENT), 191,              "l1_batt_current",            "Studer L1 Battery Current",       "DC", "A",   1, "current", "battery", NULL, 60, 0, 0, {0, 0, 0.0f}},
+    {SCOMX_OBJECT(SCOMX_XT_INFO_BATTERY_CHARGE_CURRENT), 192,              "l2_batt_current",            "Studer L2 Battery Current",       "DC", "A",   1, "current", "battery", NULL, 60, 0, 0, {0, 0, 0.0f}},
+    {SCOMX_OBJECT(SCOMX_XT_INFO_BATTERY_CHARGE_CURRENT), 193,              "l3_batt_current",            "Studer L3 Battery Current",       "DC", "A",   1, "current", "battery", NULL, 60, 0, 0, {0, 0, 0.0f}},
+    {SCOMX_OBJECT(SCOMX_XT_INFO_BATTERY_CHARGE_CURRENT), 101,              "xt1_batt_current",           "Studer 1 Battery Current",        "DC", "A",   1, "current", "battery", NULL, 60, 0, 0, {0, 0, 0.0f}},
+    {SCOMX_OBJECT(SCOMX_XT_INFO_BATTERY_CHARGE_CURRENT), 102,              "xt2_batt_current",           "Studer 2 Battery Current",        "DC", "A",   1, "current", "battery", NULL, 60, 0, 0, {0, 0, 0.0f}},
+    {SCOMX_OBJECT(SCOMX_XT_INFO_BATTERY_CHARGE_CURRENT), 103,              "xt3_batt_current",           "Studer 3 Battery Current",        "DC", "A",   1, "current", "battery", NULL, 60, 0, 0, {0, 0, 0.0f}},
+    {SCOMX_OBJECT(SCOMX_XT_INFO_BATTERY_CHARGE_CURRENT), 104,              "xt4_batt_current",           "Studer 4 Battery Current",        "DC", "A",   1, "current", "battery", NULL, 60, 0, 0, {0, 0, 0.0f}},
+};
+
+// Number of writable parameters in the array
+#define NUM_COMMANDS (sizeof(writable_parameters) / sizeof(command_t))
+
+// Parameters that can be written via <mqtt_topic>/<mqtt_prefix>/<name>/set
+// param + format (SCOMX_OBJECT), addr, name (ID), friendly_name, mqtt_prefix, multicast_count, signal
+const command_t writable_parameters[] = {
+    {SCOMX_OBJECT(SCOMX_XT_PARAM_CHARGER_ALLOWED), 101, "xt1_charger_allowed", "Studer 1 Charger Allowed", "XT", 0, 0},
+    {SCOMX_OBJECT(SCOMX_XT_PARAM_CHARGER_ALLOWED), 102, "xt2_charger_allowed", "Studer 2 Charger Allowed", "XT", 0, 0},
+    {SCOMX_OBJECT(SCOMX_XT_PARAM_CHARGER_ALLOWED), 103, "xt3_charger_allowed", "Studer 3 Charger Allowed", "XT", 0, 0},
+    {SCOMX_OBJECT(SCOMX_XT_PARAM_CHARGER_ALLOWED), 104, "xt4_charger_allowed", "Studer 4 Charger Allowed", "XT", 0, 0},
+    {SCOMX_OBJECT(SCOMX_XT_PARAM_FORCE_A_NEW_CYCLE), 101, "xt1_force_new_cycle", "Studer 1 Force New Cycle", "XT", 0, 1},
+    {SCOMX_OBJECT(SCOMX_XT_PARAM_FORCE_A_NEW_CYCLE), 102, "xt2_force_new_cycle", "Studer 2 Force New Cycle", "XT", 0, 1},
+    {SCOMX_OBJECT(SCOMX_XT_PARAM_FORCE_A_NEW_CYCLE), 103, "xt3_force_new_cycle", "Studer 3 Force New Cycle", "XT", 0, 1},
+    {SCOMX_OBJECT(SCOMX_XT_PARAM_FORCE_A_NEW_CYCLE), 104, "xt4_force_new_cycle", "Studer 4 Force New Cycle", "XT", 0, 1},
+    {SCOMX_OBJECT(SCOMX_XT_PARAM_BATTERY_CHARGE_CURRENT), 101, "xt1_batt_charge_current", "Studer 1 Battery Charge Current", "XT", 0, 0},
+    {SCOMX_OBJECT(SCOMX_XT_PARAM_BATTERY_CHARGE_CURRENT), 102, "xt2_batt_charge_current", "Studer 2 Battery Charge Current", "XT", 0, 0},
+    {SCOMX_OBJECT(SCOMX_XT_PARAM_BATTERY_CHARGE_CURRENT), 103, "xt3_batt_charge_current", "Studer 3 Battery Charge Current", "XT", 0, 0},
+    {SCOMX_OBJECT(SCOMX_XT_PARAM_BATTERY_CHARGE_CURRENT), 104, "xt4_batt_charge_current", "Studer 4 Battery Charge Current", "XT", 0, 0},
+    // system-wide settings: one multicast frame to address 100, verified on all 4 Xtenders
+    {SCOMX_OBJECT(SCOMX_XT_PARAM_CHARGER_ALLOWED), 100, "xt_all_charger_allowed", "Studer All Charger Allowed", "XT", 4, 0},
+    {SCOMX_OBJECT(SCOMX_XT_PARAM_FORCE_A_NEW_CYCLE), 100, "xt_all_force_new_cycle", "Studer All Force New Cycle", "XT", 4, 1},
+    {SCOMX_OBJECT(SCOMX_XT_PARAM_BATTERY_CHARGE_CURRENT), 100, "xt_all_batt_charge_current", "Studer All Battery Charge Current", "XT", 4, 0},
 };
 
@@ -0,0 +1,364 @@
+//
+//  Xcom-232i message history reader
+//
+//  Reading message index 0 returns the newest message and clears the pending flag; higher
+//  indexes walk back through the history. The walk is done one frame per call so the
+//  background polling keeps its pace, and goes on across calls until the first message published
+//  before or the end of the store. The published messages are remembered in the warm-restart
+//  state file.
+//
+
+#include "messages.h"
+#include "bus.h"
+#include "health.h"
+#include "state_file.h"
+
+#include <json-c/json.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MESSAGES_FIRST_BATCH 16    // messages read back when none was published before
+#define MESSAGES_MAX_ATTEMPTS 3    // reads of one index before the walk gives up
+#define MESSAGES_RETRY_INTERVAL 60 // seconds before trying again when the gateway refuses to read messages
+
+static const char *g_topic_root = NULL;
+static struct mosquitto *g_mosq = NULL;
+
+// walk through the history in progress
+static int g_fetching = 0;
+static uint32_t g_next_index = 0;
+static unsigned g_attempts = 0;
+static scomx_message_t *g_batch = NULL; // newest first
+static size_t g_batch_count = 0;
+static size_t g_batch_capacity = 0;
+static time_t g_retry_after = 0;
+
+// RCC messages (serial protocol appendix)
+static const struct {
+    uint16_t type;
+    const char *text;
+} message_texts[] = {
+    {0, "Battery low"},
+    {1, "Battery too high"},
+    {2, "Bulk charge too long"},
+    {4, "Input frequency AC-In wrong"},
+    {5, "Input frequency AC-In wrong"},
+    {6, "Input voltage AC-In too high"},
+    {7, "Input voltage AC-In too low"},
+    {8, "Inverter overload SC"},
+    {9, "Charger short circuit"},
+    {10, "System start-up in progress"},
+    {11, "AC-In Energy quota"},
+    {12, "Use of battery temperature sensor"},
+    {13, "Use of additional remote control"},
+    {14, "Over temperature EL"},
+    {15, "Inverter overload BL"},
+    {16, "Fan error detected"},
+    {17, "Programing mode"},
+    {18, "Excessive battery voltage ripple"},
+    {19, "Battery undervoltage"},
+    {20, "Battery overvoltage"},
+    {21, "Transfer not authorized, AC-Out current is higher than {1107}"},
+    {22, "Voltage presence on AC-Out"},
+    {23, "Phase not defined"},
+    {24, "Change the clock battery"},
+    {25, "Unknown Command board. Software upgrade needed"},
+    {26, "Unknown Power board. Software upgrade needed"},
+    {27, "Unknown extension board. Software upgrade needed"},
+    {28, "Voltage incompatibility Power - Command"},
+    {29, "Voltage incompatibility Ext. - Command"},
+    {30, "Power incompatibility Power - Command"},
+    {31, "Command board software incompatibility"},
+    {32, "Power board software incompatibility"},
+    {33, "Extension board software incompatibility"},
+    {34, "FID corruption, call factory"},
+    {35, "Memory structure modified"},
+    {36, "Parameter file lacking"},
+    {37, "Message file lack. SW upgrade advised"},
+    {38, "Upgrade of the device software advised"},
+    {39, "Upgrade of the device software advised"},
+    {40, "Upgrade of the device software advised"},
+    {41, "Over temperature TR"},
+    {42, "Unauthorized energy source at the output"},
+    {43, "Start of monthly test"},
+    {44, "End of successfully monthly test"},
+    {45, "Monthly autonomy test failed"},
+    {46, "Start of weekly test"},
+    {47, "End of successfully weekly test"},
+    {48, "Weekly autonomy test failed"},
+    {49, "Transfer opened because AC-In max current exceeded {1107}"},
+    {50, "Incomplete data transfer"},
+    {51, "The update is finished"},
+    {52, "Your installation is already updated"},
+    {53, "Devices not compatible, software update required"},
+    {54, "Please wait. Data transfer in progress"},
+    {55, "No SD card inserted"},
+    {56, "Upgrade of the RCC software advised"},
+    {57, "Operation finished successfully"},
+    {58, "Master synchronization missing"},
+    {59, "Inverter overload HW"},
+    {60, "Time security 1512 AUX1"},
+    {61, "Time security 1513 AUX2"},
+    {62, "Genset, no AC-In coming after AUX command"},
+    {63, "Save parameter XT"},
+    {64, "Save parameter BSP"},
+    {65, "Save parameter VarioTrack"},
+    {71, "Insufficient disk space on SD card"},
+    {72, "COM identification incorrect"},
+    {73, "Datalogger is enabled on this RCC"},
+    {74, "Save parameter Xcom-MS"},
+    {75, "MPPT MS address changed successfully"},
+    {78, "SMS or email sent"},
+    {79, "More than 9 XTs in the system"},
+    {80, "No battery (or reverse polarity)"},
+    {81, "Earthing fault"},
+    {82, "PV overvoltage"},
+    {83, "No solar production in the last 48h"},
+    {84, "Equalization performed"},
+    {85, "Modem not available"},
+    {86, "Incorrect PIN code, unable to initiate the modem"},
+    {87, "Insufficient Signal from GSM modem"},
+    {88, "No connection to GSM network"},
+    {89, "No Xcom server access"},
+    {90, "Xcom server connected"},
+    {91, "Update finished. Update software of other RCC/Xcom-232i"},
+    {92, "More than 4 RCC or Xcom in the system"},
+    {93, "More than 1 BSP in the system"},
+    {94, "More than 1 Xcom-MS in the system"},
+    {95, "More than 15 VarioTrack in the system"},
+    {121, "Impossible communication with target device"},
+    {124, "SD card not compatible"},
+    {127, "SD card, file(s) corrupted"},
+    {129, "SD card has been prematurely removed"},
+    {130, "Update directory is empty"},
+    {131, "The VarioTrack is configured for 12V batteries"},
+    {132, "The VarioTrack is configured for 24V batteries"},
+    {133, "The VarioTrack is configured for 48V batteries"},
+    {134, "Reception level of the GSM signal"},
+    {137, "VarioTrack master synchronization lost"},
+    {138, "XT master synchronization lost"},
+    {139, "Synchronized on VarioTrack master"},
+    {140, "Synchronized on XT master"},
+    {141, "More than 1 Xcom-SMS in the system"},
+    {142, "More than 15 VarioString in the system"},
+    {143, "Save parameter Xcom-SMS"},
+    {144, "Save parameter VarioString"},
+    {145, "SIM card blocked, PUK code required"},
+    {146, "SIM card missing"},
+    {147, "Install R532 firmware release prior to install an older release"},
+    {148, "Datalogger function interrupted (SD card removed)"},
+    {149, "Parameter setting incomplete"},
+    {150, "Cabling error between PV and VarioString"},
+    {164, "Communication loss with BSP"},
+    {167, "Communication loss with VarioString"},
+    {168, "Synchronized with VarioString master"},
+    {169, "Synchronization with VarioString master lost"},
+    {170, "No solar production in the last 48h on PV1"},
+    {171, "No solar production in the last 48h on PV2"},
+    {172, "FID change impossible. More than one unit"},
+    {173, "Incompatible Xtender. Please contact Studer Innotec SA"},
+    {174, "Inaccessible parameter, managed by the Xcom-CAN"},
+    {175, "Critical undervoltage"},
+    {176, "Calibration setting lost"},
+    {177, "An Xtender has started up"},
+    {178, "No BSP nor Xcom-CAN. Necessary for programming SOC"},
+    {179, "No BTS or BSP. Necessary for programming with temperature"},
+    {180, "Command entry activated"},
+    {181, "Disconnection of BTS"},
+    {182, "BTS/BSP battery temperature measurement used by a device"},
+    {183, "An Xtender has lost communication with the system"},
+    {184, "Check phase orientation or circuit breakers state on AC-In"},
+    {185, "AC-In voltage level with delay too low"},
+    {186, "Critical undervoltage (fast)"},
+    {187, "Critical overvoltage (fast)"},
+    {188, "CAN stage startup"},
+    {189, "Incompatible configuration file"},
+    {190, "The Xcom-SMS is busy"},
+    {191, "Parameter not supported"},
+    {192, "Unknown reference"},
+    {193, "Invalid value"},
+    {194, "Value too low"},
+    {195, "Value too high"},
+    {196, "Writing error"},
+    {197, "Reading error"},
+    {198, "User level insufficient"},
+    {199, "No data for the report"},
+    {200, "Memory full"},
+    {202, "Battery alarm arrives"},
+    {203, "Battery alarm leaves"},
+    {204, "Battery stop arrives"},
+    {205, "Battery stop leaves"},
+    {206, "Board hardware incompatibility"},
+    {207, "AUX1 relay activation"},
+    {208, "AUX1 relay deactivation"},
+    {209, "AUX2 relay activation"},
+    {210, "AUX2 relay deactivation"},
+    {211, "Command entry deactivated"},
+    {212, "VarioTrack software incompatibility. Upgrade needed"},
+    {213, "Battery current limitation by the BSP stopped"},
+    {214, "Half period RMS voltage limit exceeded, transfer opened"},
+    {215, "UPS limit reached, transfer opened"},
+    {216, "Scom watchdog caused the reset of Xcom-232i"},
+    {217, "CAN problem at Xtender declaration"},
+    {218, "CAN problem while writing parameters"},
+    {222, "Front ON/OFF button pressed"},
+    {223, "Main OFF detected"},
+    {224, "Delay before closing transfer relay in progress {1580}"},
+    {225, "Communication with lithium battery lost"},
+    {226, "Communication with lithium battery restored"},
+    {227, "Overload on high voltage DC side"},
+    {229, "Short-circuit on high voltage DC side"},
+    {230, "Bat. notification arrives"},
+    {231, "Bat. notification leaves"},
+    {232, "SD card, unable to access file"},
+    {233, "SD card, file header corruption"},
+    {234, "SD card, file checksum error"},
+    {235, "Communication lost with Xcom-CAN"},
+};
+
+static const char *message_text(uint16_t type)
+{
+    for (size_t i = 0; i < sizeof(message_texts) / sizeof(message_texts[0]); i++) {
+        if (message_texts[i].type == type) {
+            return message_texts[i].text;
+        }
+    }
+    return NULL;
+}
+
+static void publish_message(const scomx_message_t *msg)
+{
+    char topic[256];
+    const char *text = message_text(msg->type);
+
+    struct json_object *obj = json_object_new_object();
+    json_object_object_add(obj, "type", json_object_new_int(msg->type));
+    if (text) {
+        json_object_object_add(obj, "text", json_object_new_string(text));
+    }
+    json_object_object_add(obj, "source", json_object_new_int((int)msg->src_addr));
+    json_object_object_add(obj, "timestamp", json_object_new_int64(msg->timestamp));
+    json_object_object_add(obj, "value", json_object_new_int64(msg->value));
+
+    const char *json_str = json_object_to_json_string(obj);
+    snprintf(topic, sizeof(topic), "%s/messages", g_topic_root);
+    health_publish(g_mosq, NULL, topic, (int)strlen(json_str), json_str, 1, false);
+    json_object_put(obj);
+
+    printf("[%ld] Message from %u: (%03u) %s\n", time(NULL), msg->src_addr, msg->type, text ? text : "unknown message");
+}
+
+// publish the collected messages oldest first and end the walk
+static void finish_fetch(void)
+{
+    for (size_t i = g_batch_count; i-- > 0;) {
+        publish_message(&g_batch[i]);
+        state_file_mark_message(g_batch[i].src_addr, g_batch[i].timestamp, g_batch[i].type);
+    }
+    g_batch_count = 0;
+    g_fetching = 0;
+}
+
+// a message moves one index back when a new one arrives during the walk
+static int in_batch(const scomx_message_t *msg)
+{
+    for (size_t i = 0; i < g_batch_count; i++) {
+        if (g_batch[i].src_addr == msg->src_addr && g_batch[i].timestamp == msg->timestamp && g_batch[i].type == msg->type) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int add_to_batch(const scomx_message_t *msg)
+{
+    if (g_batch_count == g_batch_capacity) {
+        size_t capacity = g_batch_capacity ? 2 * g_batch_capacity : MESSAGES_FIRST_BATCH;
+        scomx_message_t *batch = realloc(g_batch, capacity * sizeof(*batch));
+        if (batch == NULL) {
+            return -1;
+        }
+        g_batch = batch;
+        g_batch_capacity = capacity;
+    }
+    g_batch[g_batch_count++] = *msg;
+    return 0;
+}
+
+static scom_error_t read_message(uint32_t index, scomx_message_t *msg)
+{
+    bus_request_t req;
+
+    memset(&req, 0, sizeof(req));
+    req.request.magic = BUS_API_MAGIC;
+    req.request.service_id = SCOM_READ_PROPERTY_SERVICE;
+    req.request.priority = BUS_PRIO_BACKGROUND;
+    req.request.object_type = SCOM_MESSAGE_OBJECT_TYPE;
+    req.request.dst_addr = SCOMX_DEST_232(0);
+    req.request.object_id = index;
+    req.request.property_id = SCOMX_PROP_MESSAGE;
+
+    bus_execute(&req);
+
+    if (req.response.error != SCOM_ERROR_NO_ERROR) {
+        return (scom_error_t)req.response.error;
+    }
+    if (scomx_decode_message(req.response.data, req.response.data_len, msg) != 0) {
+        return SCOM_ERROR_INVALID_FRAME;
+    }
+    return SCOM_ERROR_NO_ERROR;
+}
+
+void messages_init(const char *topic_root, struct mosquitto *mosq)
+{
+    g_topic_root = topic_root;
+    g_mosq = mosq;
+}
+
+int messages_service(void)
+{
+    scomx_message_t msg;
+
+    if (!g_fetching) {
+        if (!bus_frame_flags().is_message_pending || time(NULL) < g_retry_after) {
+            return 0;
+        }
+        // index 0 sets the read pointer to the newest message
+        g_fetching = 1;
+        g_next_index = 0;
+        g_attempts = 0;
+        g_batch_count = 0;
+    }
+
+    scom_error_t error = read_message(g_next_index, &msg);
+    if (error != SCOM_ERROR_NO_ERROR) {
+        printf("[%ld] Reading message %u failed: %s\n", time(NULL), g_next_index, scomx_err2str(error));
+        if (g_next_index == 0) {
+            g_retry_after = time(NULL) + MESSAGES_RETRY_INTERVAL; // e.g. Xcom-232i firmware < 1.5.0
+            finish_fetch();
+        } else if (++g_attempts >= MESSAGES_MAX_ATTEMPTS) {
+            printf("[%ld] Giving up on messages older than index %u\n", time(NULL), g_next_index);
+            finish_fetch();
+        }
+        return 1;
+    }
+    g_attempts = 0;
+
+    if (state_file_message_seen(msg.src_addr, msg.timestamp, msg.type)) {
+        finish_fetch(); // caught up with what was published before
+        return 1;
+    }
+
+    g_next_index++;
+    if (!in_batch(&msg) && add_to_batch(&msg) != 0) {
+        finish_fetch();
+        return 1;
+    }
+    // without anything published before only the newest messages are of interest
+    if (g_next_index >= msg.total_number || (state_file_messages_seen() == 0 && g_batch_count == MESSAGES_FIRST_BATCH)) {
+        finish_fetch();
+    }
+    return 1;
+}
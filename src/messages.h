@@ -0,0 +1,21 @@
+#ifndef MESSAGES_H
+#define MESSAGES_H
+
+#include <mosquitto.h>
+
+// Message history of the Xcom-232i (warnings, alarms, events - 4.6 Message objects)
+//
+// Every response frame carries the is_message_pending flag. When it is set the messages are read
+// newest first, one frame per messages_service() call, until an already published message or the
+// end of the store is reached.
+// New messages are then published oldest first on <root>/messages as JSON:
+//   {"type": 16, "text": "Fan error detected", "source": 105, "timestamp": 1503571330, "value": 0}
+
+// topic_root is the common MQTT topic prefix (e.g. "studer")
+void messages_init(const char *topic_root, struct mosquitto *mosq);
+
+// read at most one message if new messages are pending (bus thread only, call between polls)
+// returns 1 if a frame was sent, 0 otherwise
+int messages_service(void);
+
+#endif
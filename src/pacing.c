@@ -0,0 +1,96 @@
+//
+//  Adaptive request pacing
+//
+//  See pacing.h for the control rules.
+//
+
+#include "pacing.h"
+
+#include <stdio.h>
+#include <time.h>
+
+// an answer slower than this many times the baseline counts as a sign of bus load
+#define SLOW_FACTOR 2
+// ... and by more than this, so that serial adapter jitter on a near-zero baseline does not count
+#define SLOW_MARGIN_US 5000
+// weight of a new turnaround in the moving average (1/8)
+#define AVG_SHIFT 3
+// the baseline follows a higher average with 1/256 per answer
+#define BASE_SHIFT 8
+
+static unsigned g_gap_us = PACING_INITIAL_GAP_US;
+static int64_t g_avg_us = 0;
+static int64_t g_base_us = 0;
+static uint32_t g_busy = 0;
+static uint32_t g_timeouts = 0;
+static int g_backing_off = 0; // for the log only
+
+static void widen(unsigned gap_us)
+{
+    g_gap_us = gap_us > PACING_MAX_GAP_US ? PACING_MAX_GAP_US : gap_us;
+    if (!g_backing_off) {
+        printf("[%ld] Xcom busy, request gap widened to %u ms\n", time(NULL), g_gap_us / 1000);
+        g_backing_off = 1;
+    }
+}
+
+static void learn_turnaround(int64_t us)
+{
+    if (g_avg_us == 0) {
+        g_avg_us = us;
+        g_base_us = us;
+        return;
+    }
+    g_avg_us += (us - g_avg_us) >> AVG_SHIFT;
+    if (g_avg_us < g_base_us) {
+        g_base_us = g_avg_us;
+    } else {
+        g_base_us += (g_avg_us - g_base_us) >> BASE_SHIFT;
+    }
+}
+
+void pacing_record(int outcome, int64_t turnaround_ns)
+{
+    int64_t us = turnaround_ns / 1000;
+
+    if (outcome == PACING_SLOW_DOWN || outcome == PACING_TIMEOUT) {
+        if (outcome == PACING_SLOW_DOWN) {
+            g_busy++;
+        } else {
+            g_timeouts++;
+        }
+        // the turnaround keeps the step meaningful when the gap was at its minimum
+        widen(g_gap_us * 2 + (unsigned)g_avg_us);
+        return;
+    }
+
+    learn_turnaround(us);
+
+    if (us > g_base_us * SLOW_FACTOR && us > g_base_us + SLOW_MARGIN_US) {
+        widen(g_gap_us + (unsigned)(us / 4));
+        return;
+    }
+
+    g_gap_us -= g_gap_us >> 3;
+    if (g_gap_us < PACING_MIN_GAP_US) {
+        g_gap_us = PACING_MIN_GAP_US;
+    }
+    if (g_backing_off && g_gap_us == PACING_MIN_GAP_US) {
+        printf("[%ld] Xcom answers quickly again, full request rate\n", time(NULL));
+        g_backing_off = 0;
+    }
+}
+
+unsigned pacing_gap_us(void)
+{
+    return g_gap_us;
+}
+
+void pacing_get_stats(pacing_stats_t *stats)
+{
+    stats->gap_us = g_gap_us;
+    stats->turnaround_avg_us = (uint32_t)g_avg_us;
+    stats->turnaround_base_us = (uint32_t)g_base_us;
+    stats->busy = g_busy;
+    stats->timeouts = g_timeouts;
+}
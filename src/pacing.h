@@ -0,0 +1,50 @@
+#ifndef PACING_H
+#define PACING_H
+
+#include <stdint.h>
+
+/*
+# Adaptive request pacing
+
+How fast the Xcom-232i answers depends on what else happens on the Studer bus (RCC consoles,
+the datalogger). Instead of a fixed pause between two requests, the gap is derived from the
+outcome of every round trip on the serial port:
+
+- a clean answer shrinks the gap by 1/8, down to PACING_MIN_GAP_US (full speed on a quiet bus),
+- an answer that takes much longer than usual (more than twice the learned baseline turnaround
+  and at least 5 ms more) keeps the gap and widens it a little,
+- GATEWAY_BUSY, RESPONSE_TIMEOUT from the Xcom or a serial timeout doubles it, up to
+  PACING_MAX_GAP_US.
+
+The turnaround leaves out the wire time of the request and the answer, so a large frame does not
+look like a slow one. The baseline is the lowest smoothed turnaround seen, creeping up slowly so
+that a permanently slower setup (longer bus, more devices) is learned as normal. Only the bus
+thread uses this.
+*/
+
+#define PACING_MIN_GAP_US 1000     // quiet bus
+#define PACING_INITIAL_GAP_US 10000
+#define PACING_MAX_GAP_US 500000   // busy or unresponsive gateway
+
+// Outcome of a round trip passed to pacing_record()
+#define PACING_OK 0
+#define PACING_SLOW_DOWN 1 // the gateway asked for it (busy, internal timeout)
+#define PACING_TIMEOUT 2   // no (complete) answer on the serial port
+
+typedef struct {
+    uint32_t gap_us;            // current pause between two requests
+    uint32_t turnaround_avg_us; // smoothed turnaround of answered requests, without wire time
+    uint32_t turnaround_base_us;
+    uint32_t busy;              // PACING_SLOW_DOWN outcomes since start
+    uint32_t timeouts;          // PACING_TIMEOUT outcomes since start
+} pacing_stats_t;
+
+// account one round trip that took turnaround_ns, not counting the bytes on the wire
+void pacing_record(int outcome, int64_t turnaround_ns);
+
+// pause to leave before the next request
+unsigned pacing_gap_us(void);
+
+void pacing_get_stats(pacing_stats_t *stats);
+
+#endif
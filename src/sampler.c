@@ -0,0 +1,120 @@
+//
+//  Fixed-rate sampling clock
+//
+//  See sampler.h for the schedule and the overrun policies. Only the poll loop uses it.
+//
+
+#include "sampler.h"
+#include "bus.h"
+
+#include <stdio.h>
+#include <time.h>
+
+#define NS_PER_S 1000000000LL
+
+static int64_t g_period_ns = 0; // 0: sampling off
+static size_t g_slots = 1;
+static int g_policy = SAMPLER_SKIP;
+static int64_t g_cycle_ns = 0; // scheduled start of the current cycle (CLOCK_MONOTONIC)
+static int64_t g_next_ns = 0;  // scheduled start of the next cycle, 0 before the first one
+static sampler_stats_t g_stats;
+
+static int64_t clock_ns(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (int64_t)ts.tv_sec * NS_PER_S + ts.tv_nsec;
+}
+
+static void idle_until(int64_t deadline_ns)
+{
+    struct timespec ts = {.tv_sec = deadline_ns / NS_PER_S, .tv_nsec = deadline_ns % NS_PER_S};
+    bus_idle_until(&ts);
+}
+
+// how far the monotonic deadline is off the period boundaries of the wall clock, in
+// [-period/2, period/2)
+static int64_t alignment_error(int64_t deadline_ns)
+{
+    int64_t wall_ns = clock_ns(CLOCK_REALTIME) + (deadline_ns - clock_ns(CLOCK_MONOTONIC));
+    int64_t err = wall_ns % g_period_ns;
+    return err >= g_period_ns / 2 ? err - g_period_ns : err;
+}
+
+void sampler_init(unsigned period_ms, size_t num_slots, int overrun_policy)
+{
+    int64_t period_ns = (int64_t)period_ms * 1000000;
+
+    // a running schedule keeps its phase when only the poll list changes
+    if (period_ns != g_period_ns) {
+        g_next_ns = 0;
+    }
+    g_period_ns = period_ns;
+    g_slots = num_slots ? num_slots : 1;
+    g_policy = overrun_policy;
+}
+
+int sampler_enabled(void)
+{
+    return g_period_ns > 0;
+}
+
+void sampler_begin_cycle(void)
+{
+    int64_t now = clock_ns(CLOCK_MONOTONIC);
+
+    if (g_next_ns == 0) {
+        // first cycle on the next boundary of the wall clock
+        int64_t since_boundary = alignment_error(now);
+        if (since_boundary < 0) {
+            since_boundary += g_period_ns;
+        }
+        g_next_ns = now + g_period_ns - since_boundary;
+    } else {
+        int64_t err = alignment_error(g_next_ns);
+        if (err > SAMPLER_REALIGN_MS * 1000000LL || err < -SAMPLER_REALIGN_MS * 1000000LL) {
+            printf("[%ld] Wall clock stepped, sampling moved by %lld ms\n", time(NULL), (long long)(-err / 1000000));
+            g_next_ns -= err;
+        }
+    }
+
+    if (now > g_next_ns) {
+        int64_t missed = (now - g_next_ns) / g_period_ns + 1; // deadlines that have passed
+        g_stats.overruns++;
+        if (g_policy == SAMPLER_SKIP) {
+            g_next_ns += missed * g_period_ns;
+            g_stats.skipped += (uint64_t)missed;
+        } else if (missed > SAMPLER_MAX_CATCH_UP) {
+            g_next_ns += (missed - SAMPLER_MAX_CATCH_UP) * g_period_ns;
+            g_stats.skipped += (uint64_t)(missed - SAMPLER_MAX_CATCH_UP);
+        }
+    }
+
+    idle_until(g_next_ns);
+    g_cycle_ns = g_next_ns;
+    g_next_ns += g_period_ns;
+    g_stats.cycles++;
+}
+
+void sampler_wait_slot(size_t slot)
+{
+    int64_t deadline = g_cycle_ns + (int64_t)(g_period_ns / (int64_t)g_slots) * (int64_t)slot;
+
+    idle_until(deadline);
+
+    int64_t late_us = (clock_ns(CLOCK_MONOTONIC) - deadline) / 1000;
+    if (late_us < 0) {
+        late_us = 0;
+    }
+    g_stats.samples++;
+    g_stats.jitter_sum_us += (uint64_t)late_us;
+    if (late_us > g_stats.jitter_max_us) {
+        g_stats.jitter_max_us = (uint32_t)late_us;
+    }
+}
+
+void sampler_take_stats(sampler_stats_t *stats)
+{
+    *stats = g_stats;
+    g_stats = (sampler_stats_t){0};
+}
@@ -0,0 +1,58 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+# Fixed-rate sampling clock
+
+Optional replacement for the free-running poll loop (`sample_period_ms` in the configuration).
+Cycles start on absolute CLOCK_MONOTONIC deadlines that line up with multiples of the period on
+the wall clock (a 1000 ms period starts every cycle on a whole second), and parameter i of n is
+read at `cycle start + i * period / n`. The deadline of the next cycle is the previous one plus the
+period, so bus latency never accumulates into drift. A step of the wall clock (NTP, manual) of
+more than SAMPLER_REALIGN_MS moves the schedule back onto the boundaries.
+
+The waits run through bus_idle_until(), so queued client requests are still executed while
+waiting for a deadline.
+
+A cycle that overruns its period is handled by the overrun policy:
+- SAMPLER_SKIP: the missed cycles are dropped and the next one starts on the next boundary,
+- SAMPLER_CATCH_UP: the missed cycles are run back to back with their original deadlines (at
+  most SAMPLER_MAX_CATCH_UP of them, the rest is skipped).
+
+Jitter is the delay of a read behind its scheduled instant.
+*/
+
+#define SAMPLER_SKIP 0
+#define SAMPLER_CATCH_UP 1
+
+#define SAMPLER_MAX_CATCH_UP 3
+#define SAMPLER_REALIGN_MS 20
+
+typedef struct {
+    uint64_t cycles;      // cycles started
+    uint64_t overruns;    // cycles that did not finish within their period
+    uint64_t skipped;     // cycles dropped by the overrun policy
+    uint64_t samples;     // reads started at a scheduled instant
+    uint64_t jitter_sum_us;
+    uint32_t jitter_max_us;
+} sampler_stats_t;
+
+// (re)configure for num_slots reads per cycle; period_ms 0 turns fixed-rate sampling off
+void sampler_init(unsigned period_ms, size_t num_slots, int overrun_policy);
+
+// 1 if fixed-rate sampling is on
+int sampler_enabled(void);
+
+// wait for the start of the next cycle (applies the overrun policy first)
+void sampler_begin_cycle(void);
+
+// wait for the scheduled instant of read slot of the current cycle and account its jitter
+void sampler_wait_slot(size_t slot);
+
+// statistics since the last call; they are reset afterwards
+void sampler_take_stats(sampler_stats_t *stats);
+
+#endif
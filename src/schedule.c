@@ -0,0 +1,117 @@
+//
+//  Adaptive polling: base and burst rate per entry
+//
+//  See schedule.h. Only the poll loop uses this.
+//
+
+#include "schedule.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define error_message(fmt, ...) fprintf(stderr, "[SCHEDULE ERROR] " fmt, ##__VA_ARGS__)
+
+typedef struct {
+    poll_schedule_t config;
+    int64_t next_ns;        // due from then on, 0: next cycle
+    int64_t burst_until_ns; // 0: not bursting
+    int have_trend;
+    float trend;
+} entry_t;
+
+static entry_t *g_entries = NULL;
+static size_t g_num_entries = 0;
+static schedule_stats_t g_stats;
+
+static int64_t to_ns(const struct timespec *ts)
+{
+    return (int64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+}
+
+void schedule_bind(const config_t *cfg)
+{
+    free(g_entries);
+    g_num_entries = 0;
+    g_entries = calloc(cfg->num_parameters ? cfg->num_parameters : 1, sizeof(entry_t));
+    if (g_entries == NULL) {
+        error_message("out of memory\n");
+        return;
+    }
+    for (size_t i = 0; i < cfg->num_parameters; i++) {
+        g_entries[i].config = cfg->parameters[i].schedule;
+    }
+    g_num_entries = cfg->num_parameters;
+    memset(&g_stats, 0, sizeof(g_stats));
+}
+
+int schedule_due(size_t idx, const struct timespec *now)
+{
+    return idx >= g_num_entries || g_entries[idx].next_ns <= to_ns(now);
+}
+
+void schedule_skip(size_t idx __attribute__((unused)))
+{
+    g_stats.skipped++;
+}
+
+void schedule_sample(size_t idx, int ok, float value, const struct timespec *when)
+{
+    g_stats.reads++;
+    if (idx >= g_num_entries || g_entries[idx].config.interval_ms == 0) {
+        return;
+    }
+    entry_t *entry = &g_entries[idx];
+    int64_t now_ns = to_ns(when);
+
+    if (!ok) {
+        entry->next_ns = 0; // retry on the next cycle
+        return;
+    }
+
+    // a deviation from the trend starts or extends a burst
+    if (entry->have_trend && entry->config.burst_threshold > 0.0f && fabsf(value - entry->trend) > entry->config.burst_threshold) {
+        if (entry->burst_until_ns == 0) {
+            g_stats.bursts++;
+            g_stats.bursting++;
+#ifdef SERIAL_DEBUG
+            printf("[%ld] Burst polling entry %zu: %.3f against a trend of %.3f\n", time(NULL), idx, value, entry->trend);
+#endif
+        }
+        entry->burst_until_ns = now_ns + (int64_t)SCHEDULE_BURST_HOLD_MS * 1000000;
+    } else if (entry->burst_until_ns != 0 && now_ns >= entry->burst_until_ns) {
+        entry->burst_until_ns = 0;
+        g_stats.bursting--;
+    }
+    entry->trend = entry->have_trend ? entry->trend + (value - entry->trend) / SCHEDULE_TREND_SAMPLES : value;
+    entry->have_trend = 1;
+
+    // due an eighth early, so that the cycle granularity does not stretch the interval
+    unsigned interval_ms = entry->burst_until_ns != 0 ? entry->config.burst_interval_ms : entry->config.interval_ms;
+    entry->next_ns = now_ns + (int64_t)interval_ms * 1000000 / 8 * 7;
+}
+
+void schedule_burst(size_t idx, const struct timespec *now)
+{
+    if (idx >= g_num_entries || g_entries[idx].config.interval_ms == 0) {
+        return;
+    }
+    entry_t *entry = &g_entries[idx];
+
+    if (entry->burst_until_ns == 0) {
+        g_stats.bursts++;
+        g_stats.bursting++;
+        entry->next_ns = 0;
+    }
+    entry->burst_until_ns = to_ns(now) + (int64_t)SCHEDULE_BURST_HOLD_MS * 1000000;
+}
+
+void schedule_take_stats(schedule_stats_t *stats)
+{
+    *stats = g_stats;
+    g_stats.reads = 0;
+    g_stats.skipped = 0;
+    g_stats.bursts = 0;
+}
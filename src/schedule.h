@@ -0,0 +1,52 @@
+#ifndef SCHEDULE_H
+#define SCHEDULE_H
+
+#include "config.h"
+#include <time.h>
+
+/*
+# Adaptive polling
+
+An entry with a `schedule` is not read every cycle but every `interval_ms` (its base rate). Each
+sample is compared with the trend of the entry (an exponential moving average over the last
+SCHEDULE_TREND_SAMPLES samples); a deviation above `burst_threshold` starts a burst: the entry
+is read every `burst_interval_ms` (0: every cycle) until its samples have stayed within the
+threshold for SCHEDULE_BURST_HOLD_MS, then it decays back to the base rate.
+
+The poll loop reads the entries one after the other, so skipping the quiet ones shortens the
+cycle: a bursting entry is sampled faster the more of the others rest. The members of a snapshot
+set are still read together: the whole set is read when one of them is due. Entries without a
+schedule (interval 0) are read every cycle, as before. A failed read is retried on the next
+cycle. Derived entries follow their sources (see derived.h).
+*/
+
+#define SCHEDULE_TREND_SAMPLES 4
+#define SCHEDULE_BURST_HOLD_MS 10000
+
+typedef struct {
+    unsigned long long reads;   // entries read
+    unsigned long long skipped; // entries left out because they were not due
+    unsigned long long bursts;  // bursts started
+    unsigned bursting;          // entries in a burst now
+} schedule_stats_t;
+
+// match the schedules to the poll list of cfg; every entry is due on the next cycle
+void schedule_bind(const config_t *cfg);
+
+// 1 if entry idx has to be read at now (CLOCK_MONOTONIC)
+int schedule_due(size_t idx, const struct timespec *now);
+
+// entry idx is not read in this cycle
+void schedule_skip(size_t idx);
+
+// sample of entry idx (published value) of a read started at when; a failed read passes ok 0
+void schedule_sample(size_t idx, int ok, float value, const struct timespec *when);
+
+// read entry idx at its burst rate from the next cycle on, for SCHEDULE_BURST_HOLD_MS after now
+// (alert rules, see alerts.h)
+void schedule_burst(size_t idx, const struct timespec *now);
+
+// counters since the last call; bursting is the current number
+void schedule_take_stats(schedule_stats_t *stats);
+
+#endif
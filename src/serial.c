@@ -9,9 +9,11 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <stdio.h>
 #include <string.h>
 #include <strings.h>
+#include <sys/inotify.h>
 #include <termios.h>
 #include <unistd.h>
 #include <time.h>
@@ -20,8 +22,43 @@
 
 int serial_fd = 0;
 
-#ifdef SERIAL_DEBUG
-// Convert termios speed constant to actual baud rate for debug output
+// what is needed to open the port again after the adapter was unplugged
+static char g_port_path[256];
+static struct termios g_tio; // settings last applied to the port
+static int g_have_tio = 0;
+static int g_port_lost = 0;
+
+// keep the settings for serial_wait_reopen()
+static int apply_attribs(int fd, const struct termios *tio)
+{
+    if (tcsetattr(fd, TCSANOW, tio) != 0) {
+        return -1;
+    }
+    g_tio = *tio;
+    g_have_tio = 1;
+    return 0;
+}
+
+// errors that mean the device itself is gone (USB unplug, adapter reset)
+static int device_gone(int err)
+{
+    return err == EIO || err == ENXIO || err == ENODEV || err == EBADF;
+}
+
+static void mark_lost(void)
+{
+    if (g_port_lost) {
+        return;
+    }
+    error_message("serial port %s is gone\n", g_port_path);
+    g_port_lost = 1;
+    if (serial_fd >= 0) {
+        close(serial_fd);
+    }
+    serial_fd = -1; // later reads and writes fail right away
+}
+
+// Convert termios speed constant to actual baud rate
 static int speed_to_baud(int speed) {
     switch(speed) {
         case B0: return 0;
@@ -46,7 +83,6 @@ static int speed_to_baud(int speed) {
         default: return -1;
     }
 }
-#endif
 
 static int set_interface_attribs(int fd, int speed, serial_parity_t parity, int stop_bits)
 {
@@ -86,7 +122,7 @@ static int set_interface_attribs(int fd, int speed, serial_parity_t parity, int
     tio.c_cc[VMIN] = 0;   // minimum number of characters for noncanonical read
     tio.c_cc[VTIME] = 20; // 2 second timeout per read() call (in deciseconds)
 
-    if (tcsetattr(fd, TCSANOW, &tio) != 0) {
+    if (apply_attribs(fd, &tio) != 0) {
         error_message("tcsetattr error %d: %s\n", errno, strerror(errno));
         return -1;
     }
@@ -101,6 +137,7 @@ int serial_init(const char *port_path, int speed, serial_parity_t parity, int st
 
     SERIAL_DEBUG_PRINT("Initializing serial port: %s\n", port_path);
 
+    snprintf(g_port_path, sizeof(g_port_path), "%s", port_path);
     serial_fd = open(port_path, O_RDWR | O_NOCTTY);
     if (serial_fd < 0) {
         error_message("error %d opening %s: %s\n", errno, port_path, strerror(errno));
@@ -118,15 +155,179 @@ int serial_init(const char *port_path, int speed, serial_parity_t parity, int st
     return 0;
 }
 
+int serial_set_speed(int speed)
+{
+    struct termios tio;
+
+    // only the speed changes, parity and timeouts stay as they are
+    if (tcgetattr(serial_fd, &tio) != 0 || cfsetospeed(&tio, speed) != 0 || cfsetispeed(&tio, speed) != 0 ||
+        apply_attribs(serial_fd, &tio) != 0) {
+        error_message("cannot set speed: %s\n", strerror(errno));
+        return -1;
+    }
+    tcflush(serial_fd, TCIOFLUSH); // whatever was received at the old speed is garbage
+    return 0;
+}
+
+unsigned serial_byte_time_ns(void)
+{
+    if (!g_have_tio) {
+        return 0;
+    }
+    int baud = speed_to_baud((int)cfgetospeed(&g_tio));
+    if (baud <= 0) {
+        return 0;
+    }
+    // start bit, 8 data bits, parity and stop bits
+    unsigned bits = 1 + 8 + ((g_tio.c_cflag & PARENB) ? 1 : 0) + ((g_tio.c_cflag & CSTOPB) ? 2 : 1);
+    return (unsigned)(bits * 1000000000ULL / (unsigned)baud);
+}
+
+void serial_set_read_timeout(unsigned deciseconds)
+{
+    struct termios tio;
+
+    if (tcgetattr(serial_fd, &tio) != 0) {
+        return;
+    }
+    tio.c_cc[VTIME] = deciseconds > 255 ? 255 : deciseconds;
+    apply_attribs(serial_fd, &tio);
+}
+
+int serial_adopt(int fd, const char *port_path)
+{
+    struct termios tio;
+
+    // make sure it is a terminal - the settings are kept as the previous owner left them
+    if (tcgetattr(fd, &tio) != 0) {
+        error_message("fd %d is not a serial port: %s\n", fd, strerror(errno));
+        return -1;
+    }
+
+    snprintf(g_port_path, sizeof(g_port_path), "%s", port_path);
+    g_tio = tio;
+    g_have_tio = 1;
+    serial_fd = fd;
+    SERIAL_DEBUG_PRINT("Serial port adopted, fd=%d\n", serial_fd);
+    return 0;
+}
+
+int serial_get_fd(void)
+{
+    return serial_fd;
+}
+
+int serial_is_lost(void)
+{
+    return g_port_lost;
+}
+
+static int try_reopen(void)
+{
+    int fd = open(g_port_path, O_RDWR | O_NOCTTY);
+    if (fd < 0) {
+        return -1;
+    }
+    if (!g_have_tio || tcsetattr(fd, TCSANOW, &g_tio) != 0) {
+        close(fd); // node exists but udev is not done with it yet
+        return -1;
+    }
+    tcflush(fd, TCIOFLUSH);
+
+    serial_fd = fd;
+    g_port_lost = 0;
+    return 0;
+}
+
+// nearest directory on the way to path that exists - udev removes /dev/serial/by-path together
+// with the last adapter
+static void existing_parent(const char *path, char *dir, size_t size)
+{
+    snprintf(dir, size, "%s", path);
+    for (;;) {
+        char *slash = strrchr(dir, '/');
+        if (slash == NULL) {
+            snprintf(dir, size, ".");
+            return;
+        }
+        if (slash == dir) {
+            dir[1] = '\0';
+            return;
+        }
+        *slash = '\0';
+        if (access(dir, F_OK) == 0) {
+            return;
+        }
+    }
+}
+
+int serial_wait_reopen(unsigned timeout_ms)
+{
+    struct timespec start, now;
+    char dir[256];
+
+    if (!g_port_lost) {
+        return 0;
+    }
+
+    int ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (;;) {
+        // watch before trying, so a link created in between is not missed
+        int wd = -1;
+        if (ifd >= 0) {
+            existing_parent(g_port_path, dir, sizeof(dir));
+            wd = inotify_add_watch(ifd, dir, IN_CREATE | IN_MOVED_TO | IN_ATTRIB);
+        }
+        if (try_reopen() == 0) {
+            break;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long elapsed = (now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000;
+        if (elapsed >= (long)timeout_ms) {
+            break;
+        }
+
+        // without inotify the port is tried every 100 ms
+        struct pollfd pfd = {.fd = ifd, .events = POLLIN};
+        long wait = (long)timeout_ms - elapsed;
+        if (ifd < 0 || wd < 0) {
+            usleep((wait < 100 ? wait : 100) * 1000);
+        } else if (poll(&pfd, 1, (int)wait) > 0) {
+            char events[4096];
+            while (read(ifd, events, sizeof(events)) > 0) {
+                // drain - any change below the watched directory is worth a try
+            }
+        }
+        if (wd >= 0) {
+            inotify_rm_watch(ifd, wd);
+        }
+    }
+
+    if (ifd >= 0) {
+        close(ifd);
+    }
+    return g_port_lost ? -1 : 0;
+}
+
 // write to serial port size bytes from ptr
 int serial_write(const void *ptr, unsigned size) {
     SERIAL_DEBUG_PRINT("Writing %u bytes to serial port\n", size);
     SERIAL_DEBUG_HEX("TX", ptr, size);
     
+    if (g_port_lost) {
+        return -1;
+    }
+
     int bytes_written = write(serial_fd, ptr, size);
     
     if (bytes_written < 0) {
         error_message("Write error %d: %s\n", errno, strerror(errno));
+        if (device_gone(errno)) {
+            mark_lost();
+        }
     } else if ((unsigned int)bytes_written != size) {
         SERIAL_DEBUG_PRINT("Warning: Only wrote %d of %u bytes\n", bytes_written, size);
     } else {
@@ -144,13 +345,27 @@ int serial_read(void *ptr, unsigned size)
 
     SERIAL_DEBUG_PRINT("Reading %u bytes from serial port\n", size);
 
+    if (g_port_lost) {
+        return -1;
+    }
+
     while (bts_read < size) {
         int ret = read(serial_fd, buf + bts_read, size - bts_read);
 
         if (ret < 0) {
             error_message("Read error %d: %s\n", errno, strerror(errno));
+            if (device_gone(errno)) {
+                mark_lost();
+            }
             return ret;
         } else if (ret == 0) {
+            // a hung up line reads as end of file instead of timing out
+            struct pollfd pfd = {.fd = serial_fd, .events = POLLIN};
+            if (poll(&pfd, 1, 0) > 0 && (pfd.revents & (POLLHUP | POLLERR | POLLNVAL))) {
+                mark_lost();
+                return -1;
+            }
+
             // timeout
             SERIAL_DEBUG_PRINT("Read timeout after %u bytes (expected %u)\n", bts_read, size);
             if (bts_read > 0) {
@@ -172,5 +387,7 @@ int serial_read(void *ptr, unsigned size)
 // flush/clear serial input buffer
 void serial_flush(void) {
     SERIAL_DEBUG_PRINT("Flushing serial input buffer\n");
-    tcflush(serial_fd, TCIFLUSH);
+    if (!g_port_lost) {
+        tcflush(serial_fd, TCIFLUSH);
+    }
 }
\ No newline at end of file
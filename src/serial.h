@@ -24,6 +24,31 @@ typedef enum {
 // initialize the serial port
 int serial_init(const char *port_path, int speed, serial_parity_t parity, int stop_bits);
 
+// change the baud rate of the open port (termios speed constant, e.g. B38400)
+int serial_set_speed(int speed);
+
+// time one byte takes on the wire at the current settings (start, data, parity and stop bits),
+// 0 before the port is configured
+unsigned serial_byte_time_ns(void);
+
+// time after which a read() without any received byte gives up (2 s after serial_init)
+void serial_set_read_timeout(unsigned deciseconds);
+
+// use a port that is already open and configured (handed over by another process);
+// port_path is where it is opened again after an unplug
+int serial_adopt(int fd, const char *port_path);
+
+// file descriptor of the open port
+int serial_get_fd(void);
+
+// 1 once the device went away (USB unplug, adapter reset: EIO/ENXIO or hangup); reads and
+// writes fail right away until serial_wait_reopen() succeeds
+int serial_is_lost(void);
+
+// wait up to timeout_ms for the device to come back (inotify on its directory) and open it again
+// with the last settings; returns 0 once the port is usable
+int serial_wait_reopen(unsigned timeout_ms);
+
 // write to serial port size bytes from ptr
 int serial_write(const void *ptr, unsigned size);
 
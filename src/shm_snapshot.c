@@ -0,0 +1,168 @@
+//
+//  Shared-memory snapshot of the latest values (writer side)
+//
+//  See shm_snapshot.h for the segment layout and the reader protocol.
+//
+
+#include "shm_snapshot.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define error_message(fmt, ...) fprintf(stderr, "[SHM ERROR] " fmt, ##__VA_ARGS__)
+
+static shm_snapshot_t *g_shm = NULL;
+static char g_shm_name[64];
+
+static int64_t realtime_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// make the sequence counter odd - readers will retry until write_end()
+static inline void write_begin(void)
+{
+    __atomic_store_n(&g_shm->seq, g_shm->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void write_end(void)
+{
+    __atomic_store_n(&g_shm->seq, g_shm->seq + 1, __ATOMIC_RELEASE);
+}
+
+int shm_snapshot_init(const char *name, size_t num_params)
+{
+    if (num_params > SHM_SNAPSHOT_MAX_PARAMS) {
+        error_message("%zu parameters do not fit into the snapshot (max %d)\n", num_params, SHM_SNAPSHOT_MAX_PARAMS);
+        return -1;
+    }
+
+    int fd = shm_open(name, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        error_message("shm_open(%s) error %d: %s\n", name, errno, strerror(errno));
+        return -1;
+    }
+
+    if (ftruncate(fd, sizeof(shm_snapshot_t)) != 0) {
+        error_message("ftruncate error %d: %s\n", errno, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    void *mem = mmap(NULL, sizeof(shm_snapshot_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd); // the mapping keeps the segment alive
+    if (mem == MAP_FAILED) {
+        error_message("mmap error %d: %s\n", errno, strerror(errno));
+        return -1;
+    }
+
+    g_shm = (shm_snapshot_t *)mem;
+    snprintf(g_shm_name, sizeof(g_shm_name), "%s", name);
+
+    // a stale segment from a previous run may be mapped by readers - keep the seqlock protocol
+    write_begin();
+    g_shm->magic = SHM_SNAPSHOT_MAGIC;
+    g_shm->version = SHM_SNAPSHOT_VERSION;
+    g_shm->num_params = (uint32_t)num_params;
+    g_shm->updated_ns = realtime_ns();
+    for (size_t i = 0; i < SHM_SNAPSHOT_MAX_PARAMS; i++) {
+        g_shm->value[i] = 0.0f;
+        g_shm->timestamp_ns[i] = 0;
+        g_shm->status[i] = SHM_STATUS_NO_DATA;
+    }
+    write_end();
+
+    return 0;
+}
+
+int shm_snapshot_reset(size_t num_params)
+{
+    if (g_shm == NULL) {
+        return -1;
+    }
+    if (num_params > SHM_SNAPSHOT_MAX_PARAMS) {
+        error_message("%zu parameters do not fit into the snapshot (max %d)\n", num_params, SHM_SNAPSHOT_MAX_PARAMS);
+        return -1;
+    }
+
+    write_begin();
+    g_shm->num_params = (uint32_t)num_params;
+    g_shm->updated_ns = realtime_ns();
+    for (size_t i = 0; i < SHM_SNAPSHOT_MAX_PARAMS; i++) {
+        g_shm->parameter[i] = 0;
+        g_shm->address[i] = 0;
+        g_shm->name[i][0] = '\0';
+        g_shm->value[i] = 0.0f;
+        g_shm->timestamp_ns[i] = 0;
+        g_shm->status[i] = SHM_STATUS_NO_DATA;
+    }
+    write_end();
+
+    return 0;
+}
+
+int shm_snapshot_enabled(void)
+{
+    return g_shm != NULL;
+}
+
+void shm_snapshot_describe(size_t idx, int parameter, int address, const char *name)
+{
+    if (g_shm == NULL || idx >= g_shm->num_params) {
+        return;
+    }
+
+    write_begin();
+    g_shm->parameter[idx] = (uint32_t)parameter;
+    g_shm->address[idx] = (uint32_t)address;
+    snprintf(g_shm->name[idx], SHM_SNAPSHOT_NAME_LEN, "%s", name);
+    write_end();
+}
+
+void shm_snapshot_update(size_t idx, float value, int status)
+{
+    if (g_shm == NULL || idx >= g_shm->num_params) {
+        return;
+    }
+
+    int64_t now = realtime_ns();
+
+    write_begin();
+    if (status == SHM_STATUS_OK) {
+        g_shm->value[idx] = value; // keep the last good value on failure
+    }
+    g_shm->timestamp_ns[idx] = now;
+    g_shm->status[idx] = status;
+    g_shm->updated_ns = now;
+    write_end();
+}
+
+void shm_snapshot_close(void)
+{
+    if (g_shm == NULL) {
+        return;
+    }
+
+    munmap(g_shm, sizeof(shm_snapshot_t));
+    g_shm = NULL;
+    shm_unlink(g_shm_name);
+}
+
+void shm_snapshot_detach(void)
+{
+    if (g_shm == NULL) {
+        return;
+    }
+
+    munmap(g_shm, sizeof(shm_snapshot_t));
+    g_shm = NULL;
+}
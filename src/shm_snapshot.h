@@ -0,0 +1,122 @@
+#ifndef SHM_SNAPSHOT_H
+#define SHM_SNAPSHOT_H
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+# Shared-memory snapshot of the latest values
+
+The daemon keeps the most recent value of every polled parameter in a POSIX shared-memory
+segment (`/dev/shm/studer232-to-mqtt` by default) so that local consumers can read them without
+going through the MQTT broker.
+
+The segment is a single fixed-layout `shm_snapshot_t` in struct-of-arrays form: entry `i` of
+`parameter[]`, `address[]`, `name[]`, `value[]`, `timestamp_ns[]` and `status[]` all describe the
+same parameter. The layout only changes together with `SHM_SNAPSHOT_VERSION`.
+
+Consistency is provided by a seqlock: the writer makes `seq` odd before it touches the arrays
+and even again when it is done. A reader copies what it needs and retries if `seq` was odd or
+changed meanwhile - see `shm_snapshot_read()`. Readers never block the writer and need no
+syscalls once the segment is mapped (open it O_RDONLY and mmap it PROT_READ).
+*/
+
+#define SHM_SNAPSHOT_NAME "/studer232-to-mqtt"
+#define SHM_SNAPSHOT_MAGIC 0x31445453 // "STD1" in little endian
+#define SHM_SNAPSHOT_VERSION 1
+#define SHM_SNAPSHOT_MAX_PARAMS 128
+#define SHM_SNAPSHOT_NAME_LEN 48
+
+// Per-parameter status values
+#define SHM_STATUS_OK 0        // value is valid
+#define SHM_STATUS_NO_DATA 1   // not read yet since the daemon started
+#define SHM_STATUS_FAILED (-1) // last read failed, value holds the last good reading
+
+typedef struct {
+    uint32_t magic;      // SHM_SNAPSHOT_MAGIC once the segment is initialized
+    uint32_t version;    // SHM_SNAPSHOT_VERSION
+    uint32_t num_params; // number of valid entries in the arrays below
+    uint32_t seq;        // seqlock sequence counter, odd while an update is in progress
+
+    int64_t updated_ns;  // CLOCK_REALTIME of the last update of any entry
+
+    uint32_t parameter[SHM_SNAPSHOT_MAX_PARAMS];              // user info object id (e.g. 3000)
+    uint32_t address[SHM_SNAPSHOT_MAX_PARAMS];                // device address (e.g. 100)
+    char name[SHM_SNAPSHOT_MAX_PARAMS][SHM_SNAPSHOT_NAME_LEN]; // technical id (e.g. batt_voltage)
+
+    float value[SHM_SNAPSHOT_MAX_PARAMS];        // value with the configured sign applied
+    int64_t timestamp_ns[SHM_SNAPSHOT_MAX_PARAMS]; // CLOCK_REALTIME of the last read attempt
+    int32_t status[SHM_SNAPSHOT_MAX_PARAMS];     // SHM_STATUS_*
+} shm_snapshot_t;
+
+// Copy the whole snapshot out of shared memory. Spins until a consistent copy has been taken.
+// `out` must not point into the shared segment.
+static inline void shm_snapshot_read(const shm_snapshot_t *shm, shm_snapshot_t *out)
+{
+    uint32_t seq_begin, seq_end;
+
+    do {
+        seq_begin = __atomic_load_n(&shm->seq, __ATOMIC_ACQUIRE);
+        if (seq_begin & 1) {
+            continue; // writer in progress
+        }
+        memcpy(out, (const void *)shm, sizeof(*out));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        seq_end = __atomic_load_n(&shm->seq, __ATOMIC_RELAXED);
+    } while ((seq_begin & 1) || seq_begin != seq_end);
+}
+
+// Read a single entry consistently. Returns its status.
+static inline int32_t shm_snapshot_read_value(const shm_snapshot_t *shm, uint32_t idx, float *value, int64_t *timestamp_ns)
+{
+    uint32_t seq_begin, seq_end;
+    int32_t status;
+
+    do {
+        seq_begin = __atomic_load_n(&shm->seq, __ATOMIC_ACQUIRE);
+        if (seq_begin & 1) {
+            continue;
+        }
+        *value = shm->value[idx];
+        *timestamp_ns = shm->timestamp_ns[idx];
+        status = shm->status[idx];
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        seq_end = __atomic_load_n(&shm->seq, __ATOMIC_RELAXED);
+    } while ((seq_begin & 1) || seq_begin != seq_end);
+
+    return status;
+}
+
+// WRITER SIDE (daemon only)
+
+// create and map the segment, num_params entries are reported to readers
+int shm_snapshot_init(const char *name, size_t num_params);
+
+// describe entry idx (called once per parameter after shm_snapshot_init)
+void shm_snapshot_describe(size_t idx, int parameter, int address, const char *name);
+
+// resize to num_params entries after the poll list changed; all entries go back to NO_DATA and
+// have to be described again - mapped readers stay valid
+int shm_snapshot_reset(size_t num_params);
+
+// 1 if the segment is mapped
+int shm_snapshot_enabled(void);
+
+// store a new reading for entry idx; status is one of SHM_STATUS_*
+void shm_snapshot_update(size_t idx, float value, int status);
+
+// unmap and remove the segment
+void shm_snapshot_close(void);
+
+// unmap but keep the segment (it belongs to the process that took over)
+void shm_snapshot_detach(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
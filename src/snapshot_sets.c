@@ -0,0 +1,122 @@
+//
+//  Snapshot sets: read groups of the poll list and the skew within each set
+//
+//  See snapshot_sets.h. Only the poll loop uses this.
+//
+
+#include "snapshot_sets.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define error_message(fmt, ...) fprintf(stderr, "[SETS ERROR] " fmt, ##__VA_ARGS__)
+
+typedef struct {
+    const char *name;
+    int64_t first_ns; // first and last good answer in the current cycle, 0 if none
+    int64_t last_ns;
+    uint32_t cycles;
+    uint64_t skew_sum_us;
+    uint32_t skew_max_us;
+} set_state_t;
+
+static int *g_set_of = NULL;        // set index per parameter, -1 outside a set
+static uint8_t *g_starts = NULL;    // 1 where a read group starts
+static size_t g_num_params = 0;
+static size_t g_num_groups = 0;
+static set_state_t *g_sets = NULL;
+static size_t g_num_sets = 0;
+
+int snapshot_sets_bind(const config_t *cfg)
+{
+    size_t n = cfg->num_parameters;
+
+    free(g_set_of);
+    free(g_starts);
+    free(g_sets);
+    g_set_of = calloc(n ? n : 1, sizeof(int));
+    g_starts = calloc(n ? n : 1, sizeof(uint8_t));
+    g_sets = calloc(n ? n : 1, sizeof(set_state_t));
+    g_num_params = g_num_groups = g_num_sets = 0;
+    if (g_set_of == NULL || g_starts == NULL || g_sets == NULL) {
+        error_message("out of memory\n");
+        return -1;
+    }
+
+    // the configuration has already put the members of a set next to each other
+    for (size_t i = 0; i < n; i++) {
+        const char *set = cfg->parameters[i].snapshot_set;
+        int continues = set != NULL && i > 0 && g_set_of[i - 1] >= 0 && strcmp(g_sets[g_set_of[i - 1]].name, set) == 0;
+
+        if (set == NULL) {
+            g_set_of[i] = -1;
+        } else if (continues) {
+            g_set_of[i] = g_set_of[i - 1];
+        } else {
+            g_sets[g_num_sets].name = set;
+            g_set_of[i] = (int)g_num_sets++;
+        }
+        g_starts[i] = !continues;
+        g_num_groups += !continues;
+    }
+    g_num_params = n;
+    return 0;
+}
+
+size_t snapshot_sets_groups(void)
+{
+    return g_num_groups;
+}
+
+int snapshot_sets_starts_group(size_t idx)
+{
+    return idx >= g_num_params || g_starts[idx];
+}
+
+void snapshot_sets_answered(size_t idx, const struct timespec *when)
+{
+    if (idx >= g_num_params || g_set_of[idx] < 0) {
+        return;
+    }
+    set_state_t *set = &g_sets[g_set_of[idx]];
+    int64_t ns = (int64_t)when->tv_sec * 1000000000 + when->tv_nsec;
+    if (set->first_ns == 0) {
+        set->first_ns = ns;
+    }
+    set->last_ns = ns;
+}
+
+void snapshot_sets_end_cycle(void)
+{
+    for (size_t i = 0; i < g_num_sets; i++) {
+        set_state_t *set = &g_sets[i];
+        if (set->last_ns > set->first_ns) {
+            uint32_t skew_us = (uint32_t)((set->last_ns - set->first_ns) / 1000);
+            set->cycles++;
+            set->skew_sum_us += skew_us;
+            if (skew_us > set->skew_max_us) {
+                set->skew_max_us = skew_us;
+            }
+        }
+        set->first_ns = set->last_ns = 0;
+    }
+}
+
+size_t snapshot_sets_count(void)
+{
+    return g_num_sets;
+}
+
+void snapshot_sets_take_skew(size_t i, snapshot_set_skew_t *skew)
+{
+    set_state_t *set = &g_sets[i];
+
+    skew->name = set->name;
+    skew->cycles = set->cycles;
+    skew->skew_avg_us = set->cycles ? (uint32_t)(set->skew_sum_us / set->cycles) : 0;
+    skew->skew_max_us = set->skew_max_us;
+    set->cycles = 0;
+    set->skew_sum_us = 0;
+    set->skew_max_us = 0;
+}
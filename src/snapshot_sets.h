@@ -0,0 +1,49 @@
+#ifndef SNAPSHOT_SETS_H
+#define SNAPSHOT_SETS_H
+
+#include "config.h"
+#include <stdint.h>
+#include <time.h>
+
+/*
+# Snapshot sets
+
+Parameters that belong together (the phases of a power, the currents of all Xtenders) carry the
+same `snapshot_set` name; the configuration puts them next to each other in the poll list. The
+poll loop reads a set back to back: no background work is sent on the bus in between (no
+messages, datalog blocks or bulk client transfers, no pause), and with fixed-rate sampling a set
+takes a single slot. Parameter writes and interactive client requests still go between two
+members, so they wait at most one frame time as everywhere else.
+
+Every parameter outside a set forms a read group of its own, so a cycle is a sequence of read
+groups. The skew of a set is the time between the first and the last good answer of its members
+in one cycle; it is collected per set and taken by snapshot_sets_take_skew().
+*/
+
+typedef struct {
+    const char *name;      // set name (valid until the next snapshot_sets_bind())
+    uint32_t cycles;       // cycles with at least two good answers
+    uint32_t skew_avg_us;
+    uint32_t skew_max_us;
+} snapshot_set_skew_t;
+
+// derive the read groups of cfg (its poll list must stay unchanged until the next call)
+int snapshot_sets_bind(const config_t *cfg);
+
+// number of read groups in a cycle
+size_t snapshot_sets_groups(void);
+
+// 1 if parameter idx is the first of its read group (a new group starts there)
+int snapshot_sets_starts_group(size_t idx);
+
+// a good answer for parameter idx arrived at when (CLOCK_MONOTONIC)
+void snapshot_sets_answered(size_t idx, const struct timespec *when);
+
+// the cycle is complete: account the skew of every set
+void snapshot_sets_end_cycle(void);
+
+// number of sets; skew of set i since the last call (reset afterwards)
+size_t snapshot_sets_count(void);
+void snapshot_sets_take_skew(size_t i, snapshot_set_skew_t *skew);
+
+#endif
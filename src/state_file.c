@@ -0,0 +1,374 @@
+//
+//  Warm-restart state file
+//
+//  See state_file.h for the layout. Only the poll loop (bus thread) updates the state; the MQTT
+//  thread reads the last values once after connecting.
+//
+
+#include "state_file.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define error_message(fmt, ...) fprintf(stderr, "[STATE ERROR] " fmt, ##__VA_ARGS__)
+
+// weight of a new sample in the latency moving average
+#define LATENCY_AVG_WEIGHT 0.1f
+
+#define STATE_SLOTS 2
+
+static state_file_t g_live;
+static state_file_t *g_state = NULL; // &g_live once opened
+static state_file_t *g_slots = NULL; // the slots of the file, NULL if it is not persistent
+
+static int64_t realtime_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void reset_state(void)
+{
+    memset(g_state, 0, sizeof(*g_state));
+    g_state->magic = STATE_FILE_MAGIC;
+    g_state->version = STATE_FILE_VERSION;
+}
+
+// CRC-32 (IEEE 802.3, reflected)
+static uint32_t crc32(const void *data, size_t length)
+{
+    const uint8_t *bytes = data;
+    uint32_t crc = 0xFFFFFFFF;
+
+    for (size_t i = 0; i < length; i++) {
+        crc ^= bytes[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320 & (0u - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+static uint32_t state_crc(const state_file_t *state)
+{
+    static state_file_t copy;
+
+    copy = *state;
+    copy.crc = 0;
+    return crc32(&copy, sizeof(copy));
+}
+
+static int slot_valid(const state_file_t *slot)
+{
+    return slot->magic == STATE_FILE_MAGIC && slot->version == STATE_FILE_VERSION && slot->num_devices <= STATE_FILE_MAX_DEVICES &&
+           slot->num_params <= STATE_FILE_MAX_PARAMS && slot->num_messages <= STATE_FILE_MAX_MESSAGES &&
+           slot->next_message < STATE_FILE_MAX_MESSAGES && slot->crc == state_crc(slot);
+}
+
+// write the state into the slot not written last
+static void commit(void)
+{
+    if (g_slots == NULL) {
+        return;
+    }
+    g_state->seq++;
+    g_state->crc = 0;
+    g_state->crc = state_crc(g_state);
+    g_slots[g_state->seq % STATE_SLOTS] = *g_state;
+}
+
+// create the directory of path (one level, like the datalog directory)
+static void make_parent_dir(const char *path)
+{
+    char dir[256];
+    snprintf(dir, sizeof(dir), "%s", path);
+    char *slash = strrchr(dir, '/');
+    if (slash != NULL && slash != dir) {
+        *slash = '\0';
+        mkdir(dir, 0755);
+    }
+}
+
+static void *map_file(const char *path)
+{
+    make_parent_dir(path);
+
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        error_message("cannot open %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+
+    struct stat st;
+    size_t size = STATE_SLOTS * sizeof(state_file_t);
+    if (fstat(fd, &st) != 0 || (st.st_size != (off_t)size && (ftruncate(fd, 0) != 0 || ftruncate(fd, (off_t)size) != 0))) {
+        error_message("cannot size %s: %s\n", path, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+
+    void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd); // the mapping keeps the file open
+    if (mem == MAP_FAILED) {
+        error_message("mmap error %d: %s\n", errno, strerror(errno));
+        return NULL;
+    }
+    return mem;
+}
+
+int state_file_open(const char *path)
+{
+    g_slots = path ? map_file(path) : NULL;
+    g_state = &g_live;
+
+    // the newest slot that is intact
+    const state_file_t *newest = NULL;
+    int damaged = 0;
+    for (int i = 0; g_slots != NULL && i < STATE_SLOTS; i++) {
+        if (!slot_valid(&g_slots[i])) {
+            damaged |= g_slots[i].magic == STATE_FILE_MAGIC && g_slots[i].version == STATE_FILE_VERSION;
+            continue;
+        }
+        if (newest == NULL || g_slots[i].seq > newest->seq) {
+            newest = &g_slots[i];
+        }
+    }
+    if (damaged) {
+        error_message("%s: %s\n", path, newest != NULL ? "a slot is damaged, using the other one" : "damaged, starting afresh");
+    }
+
+    if (newest != NULL) {
+        *g_state = *newest;
+    } else {
+        reset_state();
+    }
+    return g_slots != NULL ? 0 : -1;
+}
+
+static state_device_t *find_device(int address)
+{
+    if (g_state == NULL) {
+        return NULL;
+    }
+    for (uint32_t i = 0; i < g_state->num_devices; i++) {
+        if (g_state->devices[i].address == (uint32_t)address) {
+            return &g_state->devices[i];
+        }
+    }
+    return NULL;
+}
+
+void state_file_bind(const parameter_t *params, size_t num_params)
+{
+    if (g_state == NULL) {
+        return;
+    }
+
+    // the old entries are few - copy them aside and pick the matching ones
+    static state_file_t old;
+    old = *g_state;
+
+    if (num_params > STATE_FILE_MAX_PARAMS) {
+        error_message("only the first %d of %zu parameters are kept in the state file\n", STATE_FILE_MAX_PARAMS, num_params);
+        num_params = STATE_FILE_MAX_PARAMS;
+    }
+
+    g_state->num_params = (uint32_t)num_params;
+    g_state->num_devices = 0;
+    for (size_t i = 0; i < num_params; i++) {
+        state_param_t *entry = &g_state->params[i];
+        const parameter_t *param = &params[i];
+
+        memset(entry, 0, sizeof(*entry));
+        for (uint32_t j = 0; j < old.num_params; j++) {
+            if (old.params[j].parameter == (uint32_t)param->parameter && old.params[j].address == (uint32_t)param->address &&
+                strncmp(old.params[j].name, param->name, STATE_FILE_NAME_LEN) == 0) {
+                *entry = old.params[j];
+                break;
+            }
+        }
+        entry->parameter = (uint32_t)param->parameter;
+        entry->address = (uint32_t)param->address;
+        snprintf(entry->name, STATE_FILE_NAME_LEN, "%s", param->name);
+
+        if (find_device(param->address) != NULL || g_state->num_devices >= STATE_FILE_MAX_DEVICES) {
+            continue;
+        }
+        state_device_t *dev = &g_state->devices[g_state->num_devices++];
+        memset(dev, 0, sizeof(*dev));
+        dev->address = (uint32_t)param->address;
+        for (uint32_t j = 0; j < old.num_devices; j++) {
+            if (old.devices[j].address == dev->address) {
+                *dev = old.devices[j];
+                break;
+            }
+        }
+    }
+    g_state->updated_ns = realtime_ns();
+}
+
+int state_file_last_value(size_t idx, float *value, int64_t *timestamp_ns)
+{
+    if (g_state == NULL || idx >= g_state->num_params || g_state->params[idx].timestamp_ns == 0) {
+        return 0;
+    }
+    *value = g_state->params[idx].value;
+    *timestamp_ns = g_state->params[idx].timestamp_ns;
+    return 1;
+}
+
+int state_file_device_skip(int address)
+{
+    const state_device_t *dev = find_device(address);
+    return dev != NULL && dev->state == STATE_DEVICE_ABSENT && realtime_ns() < dev->retry_at_ns;
+}
+
+static void record_device(state_device_t *dev, int result, int64_t now)
+{
+    if (result == STATE_READ_OK) {
+        if (dev->state == STATE_DEVICE_ABSENT) {
+            printf("[%ld] Device %u answers again\n", time(NULL), dev->address);
+        }
+        dev->state = STATE_DEVICE_PRESENT;
+        dev->consecutive_errors = 0;
+        dev->last_seen_ns = now;
+    } else if (result == STATE_READ_DEVICE_ERROR) {
+        dev->consecutive_errors++;
+        // a failed probe of an absent device opens the breaker again right away
+        if (dev->state == STATE_DEVICE_ABSENT || dev->consecutive_errors >= STATE_ABSENT_AFTER_ERRORS) {
+            if (dev->state != STATE_DEVICE_ABSENT) {
+                printf("[%ld] Device %u does not answer, probing it every %d s\n", time(NULL), dev->address, STATE_ABSENT_RETRY_S);
+            }
+            dev->state = STATE_DEVICE_ABSENT;
+            dev->retry_at_ns = now + (int64_t)STATE_ABSENT_RETRY_S * 1000000000;
+        }
+    }
+}
+
+void state_file_record(size_t idx, int result, float value, int64_t latency_ns)
+{
+    if (g_state == NULL || idx >= g_state->num_params) {
+        return;
+    }
+
+    int64_t now = realtime_ns();
+    state_param_t *entry = &g_state->params[idx];
+
+    entry->reads++;
+    if (result == STATE_READ_OK) {
+        float latency_us = (float)latency_ns / 1000.0f;
+        entry->value = value;
+        entry->timestamp_ns = now;
+        entry->latency_avg_us = entry->latency_avg_us == 0.0f ? latency_us : entry->latency_avg_us + LATENCY_AVG_WEIGHT * (latency_us - entry->latency_avg_us);
+        if (latency_us > entry->latency_max_us) {
+            entry->latency_max_us = (uint32_t)latency_us;
+        }
+    } else {
+        entry->failures++;
+    }
+
+    state_device_t *dev = find_device((int)entry->address);
+    if (dev != NULL) {
+        record_device(dev, result, now);
+    }
+    g_state->updated_ns = now;
+}
+
+void state_file_add_energy(size_t idx, double kwh, double returned_kwh)
+{
+    if (g_state == NULL || idx >= g_state->num_params) {
+        return;
+    }
+    g_state->params[idx].energy_kwh += kwh;
+    g_state->params[idx].energy_returned_kwh += returned_kwh;
+}
+
+int state_file_energy(size_t idx, double *kwh, double *returned_kwh)
+{
+    if (g_state == NULL || idx >= g_state->num_params) {
+        return 0;
+    }
+    *kwh = g_state->params[idx].energy_kwh;
+    *returned_kwh = g_state->params[idx].energy_returned_kwh;
+    return 1;
+}
+
+int state_file_message_seen(uint32_t src_addr, uint32_t timestamp, uint32_t type)
+{
+    if (g_state == NULL) {
+        return 0;
+    }
+    for (uint32_t i = 0; i < g_state->num_messages; i++) {
+        const state_message_t *msg = &g_state->messages[i];
+        if (msg->src_addr == src_addr && msg->timestamp == timestamp && msg->type == type) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+size_t state_file_messages_seen(void)
+{
+    return g_state != NULL ? g_state->num_messages : 0;
+}
+
+void state_file_mark_message(uint32_t src_addr, uint32_t timestamp, uint32_t type)
+{
+    if (g_state == NULL) {
+        return;
+    }
+    state_message_t *msg = &g_state->messages[g_state->next_message];
+    msg->src_addr = src_addr;
+    msg->timestamp = timestamp;
+    msg->type = type;
+    g_state->next_message = (g_state->next_message + 1) % STATE_FILE_MAX_MESSAGES;
+    if (g_state->num_messages < STATE_FILE_MAX_MESSAGES) {
+        g_state->num_messages++;
+    }
+}
+
+void state_file_sync(void)
+{
+    if (g_slots != NULL) {
+        commit();
+        msync(g_slots, STATE_SLOTS * sizeof(*g_slots), MS_ASYNC);
+    }
+}
+
+void state_file_flush(void)
+{
+    if (g_slots != NULL) {
+        commit();
+        msync(g_slots, STATE_SLOTS * sizeof(*g_slots), MS_SYNC);
+    }
+}
+
+void state_file_close(void)
+{
+    if (g_state == NULL) {
+        return;
+    }
+    if (g_slots != NULL) {
+        commit();
+        msync(g_slots, STATE_SLOTS * sizeof(*g_slots), MS_SYNC);
+        munmap(g_slots, STATE_SLOTS * sizeof(*g_slots));
+        g_slots = NULL;
+    }
+    g_state = NULL;
+}
+
+void state_file_detach(void)
+{
+    if (g_slots != NULL) {
+        munmap(g_slots, STATE_SLOTS * sizeof(*g_slots));
+        g_slots = NULL;
+    }
+    g_state = NULL;
+}
@@ -0,0 +1,148 @@
+#ifndef STATE_FILE_H
+#define STATE_FILE_H
+
+#include "config.h"
+#include <stdint.h>
+
+/*
+# Warm-restart state file
+
+A fixed-layout `state_file_t` kept in memory and committed at the end of every poll cycle into
+one of two slots of a memory-mapped file (MAP_SHARED), which the kernel writes back on its own.
+It holds what the daemon learns while polling:
+
+- the devices of the poll list and whether they answer (a per-address circuit breaker: a device
+  that keeps answering with an error is skipped and probed again every STATE_ABSENT_RETRY_S),
+- per-parameter read and latency statistics,
+- the last good value of every parameter with its timestamp,
+- the energy counters integrated from active power parameters (see energy.h),
+- the last STATE_FILE_MAX_MESSAGES messages of the Xcom-232i published (see messages.h), so a
+  restart does not publish them again.
+
+Every commit goes to the slot not written last, with an increasing sequence number and a CRC-32
+of the content. On startup the newest slot whose CRC matches is restored, so a file torn by a
+power cut or a crash in the middle of a write falls back to the cycle before, and a damaged one
+is discarded instead of being trusted. Parameters are matched by name, parameter and
+address, devices by address. Entries of a different poll list are dropped. The layout only
+changes together with `STATE_FILE_VERSION`; a file with another version is reinitialized.
+*/
+
+#define STATE_FILE_MAGIC 0x31545344 // "DST1" in little endian
+#define STATE_FILE_VERSION 4
+#define STATE_FILE_MAX_PARAMS 128
+#define STATE_FILE_MAX_DEVICES 32
+#define STATE_FILE_NAME_LEN 48
+#define STATE_FILE_MAX_MESSAGES 64
+
+// consecutive error responses after which a device is considered absent
+#define STATE_ABSENT_AFTER_ERRORS 3
+// an absent device is probed again after this many seconds
+#define STATE_ABSENT_RETRY_S 60
+
+// Device state
+#define STATE_DEVICE_UNKNOWN 0
+#define STATE_DEVICE_PRESENT 1
+#define STATE_DEVICE_ABSENT 2
+
+// Outcome of a read passed to state_file_record()
+#define STATE_READ_OK 0
+#define STATE_READ_FAILED 1       // transport failure (timeout, broken frame) - says nothing about the device
+#define STATE_READ_DEVICE_ERROR 2 // the Xcom answered with an error for this device
+
+typedef struct {
+    uint32_t address;
+    int32_t state;               // STATE_DEVICE_*
+    uint32_t consecutive_errors; // error responses since the last good one
+    uint32_t reserved;
+    int64_t last_seen_ns;        // CLOCK_REALTIME of the last good response
+    int64_t retry_at_ns;         // absent devices are skipped until then
+} state_device_t;
+
+typedef struct {
+    uint32_t parameter;
+    uint32_t address;
+    char name[STATE_FILE_NAME_LEN];
+
+    float value;          // last good value with the configured sign applied
+    int64_t timestamp_ns; // CLOCK_REALTIME of that value, 0 if there is none
+
+    uint32_t reads;           // read attempts
+    uint32_t failures;        // failed read attempts
+    float latency_avg_us;     // moving average of the successful reads
+    uint32_t latency_max_us;
+
+    double energy_kwh;          // integrated positive power
+    double energy_returned_kwh; // integrated negative power
+} state_param_t;
+
+// a published message; source, time and type identify it (4.6.3)
+typedef struct {
+    uint32_t src_addr;
+    uint32_t timestamp;
+    uint32_t type;
+} state_message_t;
+
+typedef struct {
+    uint32_t magic;   // STATE_FILE_MAGIC once the file is initialized
+    uint32_t version; // STATE_FILE_VERSION
+    uint32_t crc;     // CRC-32 of the slot with this field 0
+    uint32_t num_devices;
+    uint32_t num_params;
+    uint32_t reserved;
+    uint64_t seq;       // commits so far; the slot with the higher one is newer
+    int64_t updated_ns; // CLOCK_REALTIME of the last update
+
+    state_device_t devices[STATE_FILE_MAX_DEVICES];
+    state_param_t params[STATE_FILE_MAX_PARAMS];
+
+    uint32_t num_messages;
+    uint32_t next_message; // entry of messages overwritten next
+    state_message_t messages[STATE_FILE_MAX_MESSAGES];
+} state_file_t;
+
+// map path (created if needed) and restore its newest valid slot; falls back to memory that is
+// not persisted if the file cannot be used, so the device tracking works either way. Returns 0
+// if the file is persistent.
+int state_file_open(const char *path);
+
+// match the state to the poll list: entry i describes params[i] afterwards
+void state_file_bind(const parameter_t *params, size_t num_params);
+
+// last good value of entry idx; returns 0 if there is none
+int state_file_last_value(size_t idx, float *value, int64_t *timestamp_ns);
+
+// 1 if the device at address is known to be absent and not due for a probe
+int state_file_device_skip(int address);
+
+// account a read of entry idx (result is STATE_READ_*; value and latency are used when it is OK)
+void state_file_record(size_t idx, int result, float value, int64_t latency_ns);
+
+// add to the energy counters of entry idx
+void state_file_add_energy(size_t idx, double kwh, double returned_kwh);
+
+// energy counters of entry idx; returns 0 if there is no such entry
+int state_file_energy(size_t idx, double *kwh, double *returned_kwh);
+
+// 1 if the message was published before
+int state_file_message_seen(uint32_t src_addr, uint32_t timestamp, uint32_t type);
+
+// number of messages remembered
+size_t state_file_messages_seen(void);
+
+// remember a published message, forgetting the oldest of STATE_FILE_MAX_MESSAGES
+void state_file_mark_message(uint32_t src_addr, uint32_t timestamp, uint32_t type);
+
+// commit the state and schedule the write-back of the file (end of a poll cycle)
+void state_file_sync(void);
+
+// commit the state, write the file back and wait for it - everything published before is on
+// disk afterwards
+void state_file_flush(void);
+
+// flush and unmap
+void state_file_close(void);
+
+// unmap without committing (the file belongs to the process that took over)
+void state_file_detach(void);
+
+#endif
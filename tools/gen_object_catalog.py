@@ -0,0 +1,287 @@
+#!/usr/bin/env python3
+#
+#  Generates the typed object catalog (scomx_catalog_gen.h / scomx_catalog_gen.c) from the text
+#  version of the "Xtender serial protocol appendix" (doc/serial_protocol_complete.txt).
+#
+#  usage: gen_object_catalog.py <appendix.txt> <output directory>
+#
+#  The text is an OCR of the PDF tables, so the parser is tolerant: every line starting with
+#  an object number (optionally preceded by the access level) is an object, its Scom format
+#  is the format keyword on the line, and "N:Label" pairs around ENUM/BOOL lines are its labels.
+#  Objects whose format cannot be recognized are skipped.
+#
+
+import math
+import os
+import re
+import sys
+
+# table headings of the appendix -> (C prefix, device, object type)
+SECTIONS = {
+    'Xtender parameters': ('XT_PARAM', 'Xtender', 'SCOM_PARAMETER_OBJECT_TYPE'),
+    'Xtender infos': ('XT_INFO', 'Xtender', 'SCOM_USER_INFO_OBJECT_TYPE'),
+    'RCC parameters': ('RCC_PARAM', 'RCC / Xcom-232i', 'SCOM_PARAMETER_OBJECT_TYPE'),
+    'BSP parameters': ('BSP_PARAM', 'BSP', 'SCOM_PARAMETER_OBJECT_TYPE'),
+    'BSP infos': ('BSP_INFO', 'BSP', 'SCOM_USER_INFO_OBJECT_TYPE'),
+    'Xcom-CAN BMS parameters': ('BMS_PARAM', 'Xcom-CAN BMS', 'SCOM_PARAMETER_OBJECT_TYPE'),
+    'Xcom-CAN BMS infos': ('BMS_INFO', 'Xcom-CAN BMS', 'SCOM_USER_INFO_OBJECT_TYPE'),
+    'VarioTrack parameters': ('VT_PARAM', 'VarioTrack', 'SCOM_PARAMETER_OBJECT_TYPE'),
+    'VarioTrack infos': ('VT_INFO', 'VarioTrack', 'SCOM_USER_INFO_OBJECT_TYPE'),
+    'VarioString parameters': ('VS_PARAM', 'VarioString', 'SCOM_PARAMETER_OBJECT_TYPE'),
+    'VarioString infos': ('VS_INFO', 'VarioString', 'SCOM_USER_INFO_OBJECT_TYPE'),
+}
+END_SECTION = 'RCC messages'
+
+# access levels by their first letter, the OCR garbles the rest ("expen", "asP", "Vv.O.")
+LEVELS = {
+    'b': 'Basic',
+    'e': 'Expert',
+    'i': 'Installer',
+    'q': 'QSP',
+    'a': 'QSP',
+    'v': 'View only',
+}
+
+# OCR variants of the units used in the tables
+UNITS = {
+    'Vdc': 'Vdc', 'Vde': 'Vdc', 'Vdo': 'Vdc',
+    'Adc': 'Adc', 'Ade': 'Adc', 'Ado': 'Adc',
+    'Vac': 'Vac', 'Aac': 'Aac', 'V': 'V', 'Vv': 'V', 'A': 'A',
+    'W': 'W', 'Ww': 'W', 'w': 'W', 'kW': 'kW', 'kVA': 'kVA', 'VA': 'VA',
+    'Wh': 'Wh', 'kWh': 'kWh', 'MWh': 'MWh', 'Ah': 'Ah', 'kAh': 'kAh',
+    '%': '%', '°C': '°C', 'Hz': 'Hz', 'mV/°C/cell': 'mV/°C/cell',
+    'sec': 's', 's': 's', 'min': 'min', 'minutes': 'min', 'Minutes': 'min', 'hours': 'h', 'h': 'h',
+    'None': None, 'days': 'days', 'weeks': 'weeks', 'Ctmp': 'Ctmp', 'Cdyn': 'Cdyn', 'ms': 'ms',
+}
+
+FORMAT_RE = re.compile(r'\b(LONG\s+ENUM|SHORT\s+ENUM|ENUM|BOOL|INT32|FLOAT|STRING|Menu)\b')
+OBJECT_RE = re.compile(r'^\s*(?:([A-Za-z][A-Za-z.]{1,6})[\s_|]*)?(\d{4,5})[\s._|]+(.*)$')
+LABEL_RE = re.compile(r'(?<![\w.])([0-9O]{1,4}):\s?([^\s|:][^|:]*?)(?=\s+[0-9O]{1,4}:|\s+(?:LONG|SHORT|ENUM|BOOL)\b|\s*\||$)')
+NUMBER_RE = re.compile(r'^-?\d+(\.\d+)?,?$')
+
+
+def clean_token(tok):
+    return tok.strip("‘'’“”\",;")
+
+
+def scom_format(fmt, kind):
+    fmt = re.sub(r'\s+', ' ', fmt)
+    if fmt == 'FLOAT':
+        return 'SCOM_FORMAT_FLOAT'
+    if fmt == 'BOOL':
+        return 'SCOM_FORMAT_BOOL'
+    if fmt == 'INT32':
+        return 'SCOM_FORMAT_INT32'
+    if fmt == 'STRING':
+        return 'SCOM_FORMAT_STRING'
+    if fmt == 'LONG ENUM':
+        return 'SCOMX_FORMAT_LONG_ENUM'
+    if fmt == 'SHORT ENUM':
+        return 'SCOM_FORMAT_ENUM'
+    # plain ENUM: the SHORT/LONG prefix is on a neighbouring line of the table cell
+    return 'SCOM_FORMAT_ENUM' if kind == 'SCOM_USER_INFO_OBJECT_TYPE' else 'SCOMX_FORMAT_LONG_ENUM'
+
+
+def parse_labels(text):
+    labels = []
+    for num, label in LABEL_RE.findall(text):
+        label = re.sub(r'\s+(SHORT|LONG|ENUM|BOOL)\b.*$', '', label).strip(" .,_-|«»‘'")
+        if not label:
+            continue
+        labels.append((int(num.replace('O', '0')), label))
+    return labels
+
+
+def split_description(text, kind):
+    """description, unit and numbers (default, min, max) of the text between object number and format"""
+    tokens = text.replace('|', ' ').split()
+    desc = []
+    unit = None
+    numbers = []
+    i = 0
+    # description runs until the first unit, number or label
+    while i < len(tokens):
+        tok = clean_token(tokens[i])
+        following = clean_token(tokens[i + 1]) if i + 1 < len(tokens) else ''
+        # a number belongs to the description when words follow ("Electronic temperature 1 (minute max)")
+        value = NUMBER_RE.match(tokens[i]) and (not following or following in UNITS or NUMBER_RE.match(following))
+        if desc and (tok in UNITS or value or re.match(r'^[0-9O]{1,4}:', tok)):
+            break
+        desc.append(tokens[i])
+        i += 1
+    for tok in tokens[i:]:
+        tok = clean_token(tok)
+        if unit is None and tok in UNITS:
+            unit = UNITS[tok]
+            if unit is None:
+                break
+        elif NUMBER_RE.match(tok):
+            numbers.append(float(tok.rstrip(',')))
+
+    # info tables: drop the short description of the RCC display (e.g. "Ubat", "Psol")
+    if kind == 'SCOM_USER_INFO_OBJECT_TYPE' and len(desc) > 2:
+        while len(desc) > 2 and re.match(r'^\(\w{1,2}\)$', desc[-1]):
+            desc.pop()
+        last = re.sub(r'[^\w]', '', desc[-1])
+        if 0 < len(last) <= 5 and (re.search(r'[A-Z]', last) or last != desc[-1]):
+            desc.pop()
+    while desc and (len(clean_token(desc[-1])) <= 2 and not re.match(r'^\(?\w+\)?$', desc[-1]) or clean_token(desc[-1]) in ('Ss', 's', 'ss')):
+        desc.pop()
+
+    description = ' '.join(desc).strip(" _|.,;'‘")
+    return description, unit, numbers
+
+
+def c_name(prefix, description, used, obj_id):
+    words = re.sub(r'[^A-Za-z0-9]+', ' ', description).upper().split()
+    name = 'SCOMX_%s_%s' % (prefix, '_'.join(words[:8]) if words else str(obj_id))
+    if name in used:
+        name = '%s_%d' % (name, obj_id)
+    used.add(name)
+    return name
+
+
+def c_string(s):
+    return '"%s"' % s.replace('\\', '\\\\').replace('"', '\\"')
+
+
+def c_float(v):
+    if v is None or math.isnan(v):
+        return 'NAN'
+    return repr(float(v)) + 'f'
+
+
+def parse(path):
+    objects = []
+    section = None
+    pending_labels = []  # label lines waiting for the next ENUM object
+    last_enum = None     # ENUM object that collects the label lines following it
+
+    with open(path, encoding='utf-8', errors='replace') as f:
+        lines = [l.rstrip('\n') for l in f]
+
+    for line in lines:
+        stripped = line.strip()
+        if stripped == END_SECTION:
+            break
+        if stripped in SECTIONS:
+            section = SECTIONS[stripped]
+            pending_labels, last_enum = [], None
+            continue
+        if section is None:
+            continue
+
+        m = OBJECT_RE.match(line)
+        fmt = FORMAT_RE.search(line)
+        if m and fmt:
+            prefix, device, kind = section
+            level, obj_id, rest = m.group(1), int(m.group(2)), m.group(3)
+            if fmt.group(1) == 'Menu':
+                last_enum = None
+                continue
+            head = rest[: FORMAT_RE.search(rest).start()] if FORMAT_RE.search(rest) else rest
+            description, unit, numbers = split_description(head, kind)
+            obj = {
+                'id': obj_id,
+                'prefix': prefix,
+                'device': device,
+                'kind': kind,
+                'level': LEVELS.get(level[0].lower()) if level and kind == 'SCOM_PARAMETER_OBJECT_TYPE' else None,
+                'description': description,
+                'unit': unit,
+                'format': scom_format(fmt.group(1), kind),
+                'default': None,
+                'min': None,
+                'max': None,
+                'labels': [],
+            }
+            if obj['format'] in ('SCOM_FORMAT_FLOAT', 'SCOM_FORMAT_INT32') and len(numbers) == 3:
+                obj['default'], obj['min'], obj['max'] = numbers
+            if obj['format'] in ('SCOM_FORMAT_ENUM', 'SCOMX_FORMAT_LONG_ENUM', 'SCOM_FORMAT_BOOL'):
+                obj['labels'] = pending_labels + parse_labels(rest)
+                last_enum = obj
+            else:
+                last_enum = None
+            pending_labels = []
+            objects.append(obj)
+            continue
+
+        labels = parse_labels(line)
+        if labels:
+            # "SHORT"/"LONG" opens the cell of the next ENUM, other label lines continue the previous one
+            if last_enum is not None and not re.search(r'\b(SHORT|LONG)\b', line):
+                last_enum['labels'] += labels
+            else:
+                pending_labels += labels
+                last_enum = None
+
+    # drop duplicates of the label values (BOOL rows repeat the default)
+    for obj in objects:
+        seen, labels = set(), []
+        for value, label in obj['labels']:
+            if value not in seen:
+                seen.add(value)
+                labels.append((value, label))
+        obj['labels'] = sorted(labels)
+
+    # the same object appears in several tables (e.g. 1125 in the basic and the battery menu)
+    unique = {}
+    for obj in objects:
+        unique.setdefault((obj['prefix'], obj['id']), obj)
+    return sorted(unique.values(), key=lambda o: (o['kind'] != 'SCOM_USER_INFO_OBJECT_TYPE', o['id'], o['prefix']))
+
+
+def write_header(objects, path):
+    used = set()
+    with open(path, 'w') as f:
+        f.write('// Generated by tools/gen_object_catalog.py from doc/serial_protocol_complete.txt - do not edit\n\n')
+        f.write('#ifndef SCOMX_CATALOG_GEN_H\n#define SCOMX_CATALOG_GEN_H\n\n')
+        f.write('#define SCOMX_CATALOG_SIZE %d\n\n' % len(objects))
+        for obj in objects:
+            obj['name'] = c_name(obj['prefix'], obj['description'], used, obj['id'])
+            f.write('// %s %s %d: %s%s\n' % (obj['device'], 'info' if 'INFO' in obj['prefix'] else 'parameter', obj['id'], obj['description'],
+                                           ' [%s]' % obj['unit'] if obj['unit'] else ''))
+            f.write('#define %s %d\n' % (obj['name'], obj['id']))
+            f.write('#define %s_FORMAT %s\n' % (obj['name'], obj['format']))
+        f.write('\n// X(object type, id, format) of all objects, for compile-time lookups\n#define SCOMX_CATALOG_FORMATS(X) \\\n')
+        f.write(' \\\n'.join('    X(%s, %d, %s)' % (obj['kind'], obj['id'], obj['format']) for obj in objects))
+        f.write('\n\n#endif\n')
+
+
+def write_source(objects, path):
+    with open(path, 'w') as f:
+        f.write('// Generated by tools/gen_object_catalog.py from doc/serial_protocol_complete.txt - do not edit\n\n')
+        catalog_h = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'scomlib_extra', 'scomx_catalog.h')
+        f.write('#include "%s"\n\n#include <math.h>\n#include <stddef.h>\n\n' % os.path.relpath(catalog_h, os.path.dirname(os.path.abspath(path))))
+        for obj in objects:
+            if obj['labels']:
+                f.write('static const scomx_enum_label_t labels_%s_%d[] = {%s};\n' % (obj['prefix'].lower(), obj['id'], ', '.join(
+                    '{%d, %s}' % (v, c_string(l)) for v, l in obj['labels'])))
+        f.write('\nconst scomx_object_info_t scomx_catalog[SCOMX_CATALOG_SIZE] = {\n')
+        for obj in objects:
+            labels = 'labels_%s_%d' % (obj['prefix'].lower(), obj['id']) if obj['labels'] else 'NULL'
+            f.write('    {%d, %s, %s, %s, %s, %s, %s, %s, %s, %s, %s, %d},\n' % (
+                obj['id'], obj['kind'], c_string(obj['device']), c_string(obj['level']) if obj['level'] else 'NULL', c_string(obj['description']),
+                c_string(obj['unit']) if obj['unit'] else 'NULL', obj['format'], c_float(obj['default']), c_float(obj['min']), c_float(obj['max']),
+                labels, len(obj['labels'])))
+        f.write('};\n')
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.stderr.write('usage: %s <appendix.txt> <output directory>\n' % sys.argv[0])
+        return 1
+
+    objects = parse(sys.argv[1])
+    if not objects:
+        sys.stderr.write('%s: no objects found in %s\n' % (sys.argv[0], sys.argv[1]))
+        return 1
+
+    write_header(objects, os.path.join(sys.argv[2], 'scomx_catalog_gen.h'))
+    write_source(objects, os.path.join(sys.argv[2], 'scomx_catalog_gen.c'))
+    print('%s: %d objects' % (sys.argv[0], len(objects)))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
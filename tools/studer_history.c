@@ -0,0 +1,135 @@
+/**
+ * @file studer_history.c
+ * @brief Print the history kept by studer232-to-mqtt for one poll list entry
+ *
+ * Usage:
+ *   ./studer_history <name> [from [to]] [-t tier] [-d dir]
+ *
+ * from and to are unix times in seconds, or seconds before now when negative (default: the
+ * last hour). The tier is 0 for every sample, 1 for minute means and 2 for hour means; without
+ * it the finest tier reaching back to from is used.
+ *
+ * The daemon is asked through its history socket, which includes what it has not written to
+ * disk yet. When it is not running the files in dir are read directly.
+ *
+ * @license MIT License
+ * @author kolin
+ */
+
+#include "../src/history_file.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define HISTORY_SOCKET_PATH "/tmp/studer232-to-mqtt.history.sock"
+#define HISTORY_DIR "/var/lib/studer232-to-mqtt/history"
+
+static void print_sample(int64_t time_ms, float value, void *ctx __attribute__((unused)))
+{
+    char stamp[32];
+    time_t seconds = (time_t)(time_ms / 1000);
+    strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", localtime(&seconds));
+    printf("%s.%03d %12.3f\n", stamp, (int)(time_ms % 1000), value);
+}
+
+// ask the daemon; returns -1 if it is not running
+static int query_socket(const char *name, long long from, long long to, int tier)
+{
+    struct sockaddr_un addr;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", HISTORY_SOCKET_PATH);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    char request[128];
+    int length = tier >= 0 ? snprintf(request, sizeof(request), "%s %lld %lld %d\n", name, from, to, tier)
+                           : snprintf(request, sizeof(request), "%s %lld %lld\n", name, from, to);
+    if (write(fd, request, (size_t)length) != length) {
+        close(fd);
+        return -1;
+    }
+
+    FILE *in = fdopen(fd, "r");
+    char line[128];
+    int rc = 1;
+    while (in != NULL && fgets(line, sizeof(line), in) != NULL) {
+        int64_t time_ms;
+        float value;
+        if (strncmp(line, "end ", 4) == 0) {
+            rc = 0;
+            break;
+        }
+        if (strncmp(line, "error ", 6) == 0) {
+            fprintf(stderr, "%s", line + 6);
+            break;
+        }
+        if (sscanf(line, "%" SCNd64 " %f", &time_ms, &value) == 2) {
+            print_sample(time_ms, value, NULL);
+        }
+    }
+    if (in != NULL) {
+        fclose(in);
+    } else {
+        close(fd);
+    }
+    return rc;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *name = NULL;
+    const char *dir = HISTORY_DIR;
+    long long times[2] = {-3600, 0};
+    int num_times = 0;
+    int tier = -1;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            tier = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            dir = argv[++i];
+        } else if (name == NULL) {
+            name = argv[i];
+        } else if (num_times < 2) {
+            times[num_times++] = atoll(argv[i]);
+        }
+    }
+    if (name == NULL || tier >= HISTORY_TIERS) {
+        fprintf(stderr, "Usage: %s <name> [from [to]] [-t tier] [-d dir]\n", argv[0]);
+        return 2;
+    }
+
+    long long now = (long long)time(NULL);
+    long long from = times[0] <= 0 ? now + times[0] : times[0];
+    long long to = times[1] <= 0 ? now + times[1] : times[1];
+
+    int rc = query_socket(name, from, to, tier);
+    if (rc >= 0) {
+        return rc;
+    }
+
+    // daemon not running: read the file
+    history_file_t file;
+    if (history_file_open(&file, dir, name, 0) != 0) {
+        fprintf(stderr, "No history of %s in %s\n", name, dir);
+        return 1;
+    }
+    if (tier < 0) {
+        tier = history_file_pick_tier(&file, from * 1000);
+    }
+    history_file_query(&file, tier, from * 1000, to * 1000 + 999, print_sample, NULL);
+    history_file_close(&file);
+    return 0;
+}
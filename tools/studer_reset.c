@@ -5,6 +5,10 @@
  * Usage:
  *   ./studer_reset [serial_port] [option]
  * 
+ * When studer232-to-mqtt is running, the request is sent through the daemon's bus socket
+ * (see src/bus_api.h) so the serial port is never opened twice. Otherwise the tool opens
+ * the serial port directly.
+ *
  * Options:
  *   --system-reset       Reset all devices in the system (parameter 5121 at addr 501)
  *   --xtender-all        Reset all Xtenders to factory defaults (param 1287 at addr 100)
@@ -17,6 +21,7 @@
 
 #include "../scomlib_extra/scomlib_extra.h"
 #include "../src/serial.h"
+#include "../src/bus_api.h"
 #include <stdio.h>
 #include <string.h>
 #include <termios.h>
@@ -35,6 +40,33 @@
 #define ADDR_XTENDER_START      101
 #define ADDR_XTENDER_END        109
 
+// Connection to the studer232-to-mqtt daemon, -1 when using the serial port directly
+static int g_bus_fd = -1;
+
+// Send the reset through the daemon which owns the serial port
+static int send_reset_command_via_daemon(int addr, int parameter) {
+    bus_api_response_t response;
+    char value[4];
+
+    // For signal parameters, we write a dummy value (1) to trigger the signal
+    scom_write_le32(value, 1);
+
+    if (bus_client_write_property(g_bus_fd, addr, SCOM_PARAMETER_OBJECT_TYPE, parameter,
+                                  SCOMX_PROP_PARAMETER_VALUE_QSP, value, sizeof(value), &response) != 0) {
+        printf("ERROR: Lost connection to the studer232-to-mqtt daemon\n");
+        return -1;
+    }
+    printf("    Command sent via daemon\n");
+
+    if (response.error != SCOM_ERROR_NO_ERROR) {
+        printf("ERROR: Device returned error code %d (%s)\n", response.error, scomx_err2str(response.error));
+        return -1;
+    }
+
+    printf("    Response received: SUCCESS\n");
+    return 0;
+}
+
 // Function to send reset command
 int send_reset_command(int addr, int parameter) {
     scomx_enc_result_t encresult;
@@ -46,6 +78,10 @@ int send_reset_command(int addr, int parameter) {
     printf("\n==> Sending RESET command:\n");
     printf("    Address: %d\n", addr);
     printf("    Parameter: %d\n", parameter);
+
+    if (g_bus_fd >= 0) {
+        return send_reset_command_via_daemon(addr, parameter);
+    }
     
     // For signal parameters, we write a dummy value (1) to trigger the signal
     encresult = scomx_encode_write_parameter_value_u32(addr, parameter, 1);
@@ -116,7 +152,8 @@ void print_usage(const char *prog_name) {
     printf("  --xcom-defaults      Restore default access levels on Xcom-232i\n");
     printf("                       Uses parameter 5044 at address 501\n\n");
     printf("Default serial port: /dev/serial/by-path/platform-xhci-hcd.1.auto-usb-0:1.1.1:1.0-port0\n");
-    printf("Default baud rate: 115200, even parity, 1 stop bit\n\n");
+    printf("Default baud rate: 115200, even parity, 1 stop bit\n");
+    printf("If studer232-to-mqtt is running, requests go through its socket %s\n\n", BUS_API_SOCKET_PATH);
     printf("WARNING: These operations will reset devices to factory defaults!\n");
     printf("         All custom settings will be lost.\n");
 }
@@ -146,12 +183,18 @@ int main(int argc, char *argv[]) {
     printf("========================\n");
     printf("Serial port: %s\n", port);
     
-    // Initialize the serial port
-    if (serial_init(port, B115200, PARITY_EVEN, 1) != 0) {
-        printf("ERROR: Failed to initialize serial port\n");
-        return 1;
+    // Prefer the running daemon - opening the tty as well would corrupt its frames
+    g_bus_fd = bus_client_connect(BUS_API_SOCKET_PATH);
+    if (g_bus_fd >= 0) {
+        printf("Connected to studer232-to-mqtt daemon at %s\n", BUS_API_SOCKET_PATH);
+    } else {
+        // Initialize the serial port
+        if (serial_init(port, B115200, PARITY_EVEN, 1) != 0) {
+            printf("ERROR: Failed to initialize serial port\n");
+            return 1;
+        }
+        printf("Serial port initialized successfully\n");
     }
-    printf("Serial port initialized successfully\n");
     
     const char *option = argv[arg_offset];
     
@@ -212,6 +255,8 @@ int main(int argc, char *argv[]) {
         printf("\n✗ Reset command FAILED!\n");
         printf("  Check the serial connection and try again.\n");
     }
+
+    bus_client_close(g_bus_fd);
     
     return result;
 }
@@ -0,0 +1,106 @@
+/**
+ * @file studer_shm_read.c
+ * @brief Example reader of the shared-memory snapshot published by studer232-to-mqtt
+ *
+ * Usage:
+ *   ./studer_shm_read              Print all values once
+ *   ./studer_shm_read <name>       Print a single value (e.g. batt_voltage)
+ *   ./studer_shm_read -w <ms>      Print all values every <ms> milliseconds
+ *
+ * The daemon must be running. No MQTT broker is involved.
+ *
+ * @license MIT License
+ * @author kolin
+ */
+
+#include "../src/shm_snapshot.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+static void print_entry(const shm_snapshot_t *snap, uint32_t i, int64_t now_ns)
+{
+    const char *status;
+    switch (snap->status[i]) {
+    case SHM_STATUS_OK:
+        status = "ok";
+        break;
+    case SHM_STATUS_NO_DATA:
+        status = "no data";
+        break;
+    default:
+        status = "failed";
+        break;
+    }
+
+    double age = snap->timestamp_ns[i] ? (now_ns - snap->timestamp_ns[i]) / 1e9 : 0.0;
+    printf("%-32s %5u/%-3u %12.3f  %-8s age %.3f s\n", snap->name[i], snap->parameter[i], snap->address[i], snap->value[i], status, age);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *only = NULL;
+    int interval_ms = 0;
+
+    if (argc > 2 && strcmp(argv[1], "-w") == 0) {
+        interval_ms = atoi(argv[2]);
+    } else if (argc > 1) {
+        only = argv[1];
+    }
+
+    int fd = shm_open(SHM_SNAPSHOT_NAME, O_RDONLY, 0);
+    if (fd < 0) {
+        perror("shm_open " SHM_SNAPSHOT_NAME " (is studer232-to-mqtt running?)");
+        return 1;
+    }
+
+    const shm_snapshot_t *shm = mmap(NULL, sizeof(shm_snapshot_t), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shm == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+
+    // the snapshot is large - keep the copy off the stack
+    static shm_snapshot_t snap;
+
+    do {
+        struct timespec ts;
+        shm_snapshot_read(shm, &snap);
+        clock_gettime(CLOCK_REALTIME, &ts);
+        int64_t now_ns = (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+
+        // checked on the consistent copy: the daemon may be initializing the segment
+        if (snap.magic != SHM_SNAPSHOT_MAGIC || snap.version != SHM_SNAPSHOT_VERSION) {
+            fprintf(stderr, "Unexpected segment magic/version %08X/%u\n", snap.magic, snap.version);
+            return 1;
+        }
+
+        int found = 0;
+        for (uint32_t i = 0; i < snap.num_params && i < SHM_SNAPSHOT_MAX_PARAMS; i++) {
+            if (only == NULL || strcmp(snap.name[i], only) == 0) {
+                print_entry(&snap, i, now_ns);
+                found = 1;
+            }
+        }
+
+        if (!found && only != NULL) {
+            fprintf(stderr, "Parameter '%s' not found\n", only);
+            return 1;
+        }
+        if (!found) {
+            printf("snapshot is empty\n");
+        }
+
+        if (interval_ms > 0) {
+            printf("\n");
+            usleep(interval_ms * 1000);
+        }
+    } while (interval_ms > 0);
+
+    return 0;
+}
@@ -0,0 +1,9 @@
+#!/bin/bash
+
+# Hand the running studer232-to-mqtt service over to the freshly built binary (make) without
+# restarting it: the new process takes the open serial port over and the old one exits once the
+# new one has completed a poll cycle
+sudo systemctl kill -s USR2 --kill-who=main studer232-to-mqtt
+
+# Show output of studer232-to-mqtt service
+sudo journalctl -u studer232-to-mqtt -f